@@ -0,0 +1,78 @@
+/**
+ * Animation
+ *
+ * Renders the camera path of a scene file, its keyframe lines, to numbered PPM files.
+ * The scene is loaded and its BVHs are built once for all frames. The frames are pipelined:
+ * threads start on the next frame while the last tiles of a frame finish, and frames are
+ * written in the background. --sequential renders one frame at a time, to compare.
+ *   RaytracerAnimate file.scene [--frames n] [--size WxH] [--ns n] [--threads n] [--output prefix] [--sequential]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "../animation.h"
+#include "../raytracing.h"
+#include "../render.h"
+#include "../scene.h"
+
+/**
+ * Globals which are owned by main.cpp in the interactive application.
+ */
+Vec3Df MyCameraPosition;
+std::vector<Vec3Df> MyLightPositions;
+
+int main(int argc, char** argv)
+{
+	const char* sceneName = nullptr;
+	const char* output = "frame";
+	unsigned int width = 0, height = 0, ns = 0, frames = 0;
+	unsigned int threads = renderThreads();
+	bool pipelined = true;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--frames") && i + 1 < argc) frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc) sscanf_s(argv[++i], "%ux%u", &width, &height);
+		else if (!strcmp(argv[i], "--ns") && i + 1 < argc) ns = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc) output = argv[++i];
+		else if (!strcmp(argv[i], "--sequential")) pipelined = false;
+		else if (sceneName == nullptr && isSceneFile(argv[i])) sceneName = argv[i];
+		else {
+			sceneName = nullptr;
+			break;
+		}
+	}
+	if (sceneName == nullptr) {
+		printf("Usage: %s file.scene [--frames n] [--size WxH] [--ns n] [--threads n] [--output prefix] [--sequential]\n", argv[0]);
+		return 2;
+	}
+
+	SceneSettings settings;
+	if (!loadSceneFile(sceneName, settings))
+		return 2;
+	if (settings.keyframes.empty()) {
+		printf("%s has no keyframes\n", sceneName);
+		return 2;
+	}
+
+	CameraPath path(settings.keyframes);
+	if (frames == 0)
+		frames = settings.frames > 0 ? settings.frames : 1;
+	if (width == 0 || height == 0) {
+		width = settings.width > 0 ? settings.width : 800;
+		height = settings.height > 0 ? settings.height : 600;
+	}
+	if (ns == 0)
+		ns = settings.ns > 0 ? settings.ns : 1;
+
+	printf("Rendering %u frames of %s at %ux%u, %u samples per pixel, on %u threads\n", frames, sceneName, width, height, ns * ns, threads);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool ok = renderAnimation(path, frames, width, height, ns, output, threads, pipelined, true);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	printf("Rendered in %.2f s, %.3f s per frame\n", elapsed.count(), elapsed.count() / frames);
+	if (!ok)
+		printf("Not all frames could be written\n");
+	return ok ? 0 : 1;
+}
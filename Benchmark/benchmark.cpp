@@ -0,0 +1,359 @@
+/**
+ * Benchmark
+ *
+ * Renders the standard scenes headlessly and reports the median and variance of the
+ * wall time and the rays per second. Results can be saved as a baseline JSON file, and
+ * a later run compared against it to flag performance regressions.
+ *
+ * Run from the repository root, so the Cornell box and its textures are found:
+ *   RaytracerBenchmark [--runs n] [--scene name] [--json file]
+ *                      [--baseline file] [--tolerance fraction] [--virtual]
+ *                      [--mesh-storage full|compact|quantized] [--mesh-leaves scalar|soa]
+ *                      [--mesh-bvh binary|wide] [--mesh-builder sah|sbvh|lbvh] [--light-samples n]
+ *                      [--no-shadow-cache] [--irradiance accuracy] [--caustics photons]
+ *                      [--sampler grid|halton|sobol|bluenoise]
+ *
+ * --virtual traces the shape list through its virtual methods instead of the sorted shape arrays.
+ * --mesh-storage sets how the meshes of the scenes store their geometry, see MeshStorage.
+ * --mesh-leaves sets how the leaves of their BVHs store the triangles, see MeshLeaves.
+ * --mesh-bvh traces the meshes through their binary BVH or the 4-wide one.
+ * --mesh-builder builds their BVHs with object splits only, with spatial splits too, or along a Morton curve.
+ * --light-samples picks n lights per hit point from the light tree, instead of tracing every light.
+ * --no-shadow-cache traces every shadow ray through the BVHs, without first testing the last occluder.
+ * --irradiance adds indirect diffuse light from the irradiance cache, the number of records is reported.
+ * --caustics adds caustics from a photon map, the number of photons stored and the time to send them
+ * and build the map are reported; that time is part of the render time.
+ * --sampler sets the sequence of the pixel and area light samples, see sampler.h.
+ *
+ * The shadow line of a scene is the fraction of the shadow rays with a known occluder that it blocked,
+ * and the BVH nodes that saved: the hits times the nodes of an average traversal.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "scenes.h"
+#include "../raytracing.h"
+#include "../render.h"
+#include "../sampler.h"
+#include "../Shapes/shape.h"
+
+/**
+ * Globals which are owned by main.cpp in the interactive application.
+ */
+Vec3Df MyCameraPosition;
+std::vector<Vec3Df> MyLightPositions;
+
+/**
+ * The measurements of one scene.
+ */
+struct BenchmarkResult {
+	std::string name;
+	unsigned int width, height, ns, runs;
+	double median_ms;
+	double variance_ms2;
+	double rays_per_sec;
+	size_t mesh_bytes;
+	double build_ms;
+	double shadow_hit_rate;		// Of the shadow rays with a known occluder, the ones it blocked.
+	double shadow_saved_nodes;	// Estimated BVH nodes not visited thanks to the occluders, per run.
+	size_t irradiance_records;
+	size_t caustic_photons;
+	double caustic_build_ms;
+};
+
+/**
+ * Median of a list of values.
+ */
+static double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	size_t n = values.size();
+	return (n % 2) ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+/**
+ * Sample variance of a list of values.
+ */
+static double variance(const std::vector<double>& values)
+{
+	if (values.size() < 2)
+		return 0.0;
+
+	double mean = 0.0;
+	for (size_t i = 0; i < values.size(); i++)
+		mean += values[i];
+	mean /= values.size();
+
+	double sum = 0.0;
+	for (size_t i = 0; i < values.size(); i++)
+		sum += (values[i] - mean) * (values[i] - mean);
+	return sum / (values.size() - 1);
+}
+
+/**
+ * Memory used by the meshes of the scene and the time it took to build their BVHs,
+ * lazy meshes count once they are loaded.
+ */
+static void meshStatistics(size_t& bytes, double& buildTime)
+{
+	bytes = 0;
+	buildTime = 0.0;
+	for (size_t i = 0; i < shapes.size(); i++) {
+		MyMesh* mesh = dynamic_cast<MyMesh*>(shapes[i]);
+		if (LazyMesh* lazy = dynamic_cast<LazyMesh*>(shapes[i]))
+			mesh = lazy->isLoaded() ? lazy->mesh() : nullptr;
+		if (mesh != nullptr) {
+			bytes += mesh->memoryUsage();
+			buildTime += mesh->buildTime();
+		}
+	}
+}
+
+/**
+ * Render settings of the command line, 0 or unset when not given. Building a scene resets the render
+ * settings, so they are applied again to every scene.
+ */
+static unsigned int lightSamplesOption = 0;
+static float irradianceOption = 0.f;
+static unsigned int causticsOption = 0;
+static bool hasSamplerOption = false;
+static SampleSequence samplerOption = SAMPLES_GRID;
+
+/**
+ * Render one scene a number of times, after a warm-up render.
+ */
+static BenchmarkResult runScene(const BenchmarkScene& scene, unsigned int runs)
+{
+	clearScene();
+	scene.build();
+	if (lightSamplesOption > 0)
+		lightSamples = lightSamplesOption;
+	if (irradianceOption > 0.f)
+		irradianceAccuracy = irradianceOption;
+	if (causticsOption > 0)
+		causticPhotons = causticsOption;
+	if (hasSamplerOption)
+		sampleSequence = samplerOption;
+	updateShapeArrays();
+	updateLightTree();
+
+	Camera camera = Camera::lookAt(scene.eye, scene.target, Vec3Df(0.f, 1.f, 0.f), 50.f, scene.width, scene.height);
+	Image result(scene.width, scene.height);
+
+	// Warm-up, so the first measurement doesn't pay for cold caches.
+	renderRows(camera, result, scene.ns, 0, scene.height, false);
+
+	std::vector<double> times, rates;
+	for (unsigned int i = 0; i < runs; i++) {
+		// Every run gathers its own irradiance records and sends its own photons.
+		updateIrradianceCache();
+		updateCausticMap();
+		resetRayCount();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		renderRows(camera, result, scene.ns, 0, scene.height, false);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		times.push_back(elapsed.count());
+		rates.push_back(getRayCount() / (elapsed.count() / 1000.0));
+	}
+
+	std::string filename = std::string("benchmark_") + scene.name + ".ppm";
+	result.writeImage(filename.c_str());
+
+	BenchmarkResult r;
+	r.name = scene.name;
+	r.width = scene.width;
+	r.height = scene.height;
+	r.ns = scene.ns;
+	r.runs = runs;
+	r.median_ms = median(times);
+	r.variance_ms2 = variance(times);
+	r.rays_per_sec = median(rates);
+	meshStatistics(r.mesh_bytes, r.build_ms);
+
+	// Of the last run.
+	ShadowCacheStats shadow = getShadowCacheStats();
+	r.shadow_hit_rate = shadow.lookups > 0 ? double(shadow.hits) / shadow.lookups : 0.0;
+	r.shadow_saved_nodes = shadow.traversals > 0 ? double(shadow.hits) * shadow.nodes / shadow.traversals : 0.0;
+	r.irradiance_records = getIrradianceRecords();
+	r.caustic_photons = getCausticPhotons();
+	r.caustic_build_ms = getCausticBuildTime();
+	return r;
+}
+
+/**
+ * Write the results as JSON, the same format is read back as a baseline.
+ */
+static void writeJson(std::ostream& out, const std::vector<BenchmarkResult>& results)
+{
+	out << "{\n  \"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& r = results[i];
+		out << "    { \"name\": \"" << r.name << "\", \"width\": " << r.width << ", \"height\": " << r.height
+			<< ", \"samples\": " << r.ns * r.ns << ", \"runs\": " << r.runs
+			<< ", \"median_ms\": " << r.median_ms << ", \"variance_ms2\": " << r.variance_ms2
+			<< ", \"rays_per_sec\": " << r.rays_per_sec << ", \"mesh_bytes\": " << r.mesh_bytes << ", \"build_ms\": " << r.build_ms
+			<< ", \"shadow_hit_rate\": " << r.shadow_hit_rate << ", \"shadow_saved_nodes\": " << r.shadow_saved_nodes
+			<< ", \"irradiance_records\": " << r.irradiance_records
+			<< ", \"caustic_photons\": " << r.caustic_photons << ", \"caustic_build_ms\": " << r.caustic_build_ms << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+/**
+ * Find a numeric field of a flat JSON object.
+ */
+static bool jsonNumber(const std::string& object, const char* key, double& value)
+{
+	std::string quoted = std::string("\"") + key + "\"";
+	size_t pos = object.find(quoted);
+	if (pos == std::string::npos)
+		return false;
+	pos = object.find(':', pos + quoted.size());
+	if (pos == std::string::npos)
+		return false;
+	value = atof(object.c_str() + pos + 1);
+	return true;
+}
+
+/**
+ * Read a baseline file written by writeJson. Returns the median time per scene name.
+ */
+static bool readBaseline(const char* filename, std::vector<std::pair<std::string, double> >& baseline)
+{
+	std::ifstream in(filename);
+	if (!in) {
+		printf("Could not read baseline %s\n", filename);
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	std::string json = buffer.str();
+
+	// Each scene is one flat object between braces.
+	size_t open = json.find('{', json.find('['));
+	while (open != std::string::npos) {
+		size_t close = json.find('}', open);
+		if (close == std::string::npos)
+			break;
+		std::string object = json.substr(open, close - open);
+
+		size_t name = object.find("\"name\"");
+		double median_ms;
+		if (name != std::string::npos && jsonNumber(object, "median_ms", median_ms)) {
+			size_t first = object.find('"', object.find(':', name) + 1);
+			size_t last = object.find('"', first + 1);
+			baseline.push_back(std::make_pair(object.substr(first + 1, last - first - 1), median_ms));
+		}
+		open = json.find('{', close);
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int runs = 5;
+	const char* only = nullptr;
+	const char* jsonFile = nullptr;
+	const char* baselineFile = nullptr;
+	double tolerance = 0.10;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--runs") && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--scene") && i + 1 < argc) only = argv[++i];
+		else if (!strcmp(argv[i], "--json") && i + 1 < argc) jsonFile = argv[++i];
+		else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baselineFile = argv[++i];
+		else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) tolerance = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--virtual")) useShapeArrays = false;
+		else if (!strcmp(argv[i], "--mesh-storage") && i + 1 < argc && !strcmp(argv[i + 1], "full")) { meshOptions.storage = MESH_STORAGE_FULL; i++; }
+		else if (!strcmp(argv[i], "--mesh-storage") && i + 1 < argc && !strcmp(argv[i + 1], "compact")) { meshOptions.storage = MESH_STORAGE_COMPACT; i++; }
+		else if (!strcmp(argv[i], "--mesh-storage") && i + 1 < argc && !strcmp(argv[i + 1], "quantized")) { meshOptions.storage = MESH_STORAGE_QUANTIZED; i++; }
+		else if (!strcmp(argv[i], "--mesh-leaves") && i + 1 < argc && !strcmp(argv[i + 1], "scalar")) { meshOptions.leaves = MESH_LEAVES_SCALAR; i++; }
+		else if (!strcmp(argv[i], "--mesh-leaves") && i + 1 < argc && !strcmp(argv[i + 1], "soa")) { meshOptions.leaves = MESH_LEAVES_SOA; i++; }
+		else if (!strcmp(argv[i], "--mesh-bvh") && i + 1 < argc && !strcmp(argv[i + 1], "binary")) { meshOptions.wide = false; i++; }
+		else if (!strcmp(argv[i], "--mesh-bvh") && i + 1 < argc && !strcmp(argv[i + 1], "wide")) { meshOptions.wide = true; i++; }
+		else if (!strcmp(argv[i], "--mesh-builder") && i + 1 < argc && !strcmp(argv[i + 1], "sah")) { meshOptions.builder = BVH_BUILDER_SAH; i++; }
+		else if (!strcmp(argv[i], "--mesh-builder") && i + 1 < argc && !strcmp(argv[i + 1], "sbvh")) { meshOptions.builder = BVH_BUILDER_SBVH; i++; }
+		else if (!strcmp(argv[i], "--mesh-builder") && i + 1 < argc && !strcmp(argv[i + 1], "lbvh")) { meshOptions.builder = BVH_BUILDER_LBVH; i++; }
+		else if (!strcmp(argv[i], "--light-samples") && i + 1 < argc) lightSamplesOption = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--no-shadow-cache")) useShadowCache = false;
+		else if (!strcmp(argv[i], "--irradiance") && i + 1 < argc) irradianceOption = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--caustics") && i + 1 < argc) causticsOption = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--sampler") && i + 1 < argc && !strcmp(argv[i + 1], "grid")) { samplerOption = SAMPLES_GRID; hasSamplerOption = true; i++; }
+		else if (!strcmp(argv[i], "--sampler") && i + 1 < argc && !strcmp(argv[i + 1], "halton")) { samplerOption = SAMPLES_HALTON; hasSamplerOption = true; i++; }
+		else if (!strcmp(argv[i], "--sampler") && i + 1 < argc && !strcmp(argv[i + 1], "sobol")) { samplerOption = SAMPLES_SOBOL; hasSamplerOption = true; i++; }
+		else if (!strcmp(argv[i], "--sampler") && i + 1 < argc && !strcmp(argv[i + 1], "bluenoise")) { samplerOption = SAMPLES_BLUE_NOISE; hasSamplerOption = true; i++; }
+		else {
+			printf("Usage: %s [--runs n] [--scene name] [--json file] [--baseline file] [--tolerance fraction] [--virtual]\n"
+				"       [--mesh-storage full|compact|quantized] [--mesh-leaves scalar|soa] [--mesh-bvh binary|wide]\n"
+				"       [--mesh-builder sah|sbvh|lbvh] [--light-samples n] [--no-shadow-cache]\n"
+				"       [--irradiance accuracy] [--caustics photons] [--sampler grid|halton|sobol|bluenoise]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::vector<BenchmarkResult> results;
+	const std::vector<BenchmarkScene>& scenes = benchmarkScenes();
+	for (size_t i = 0; i < scenes.size(); i++) {
+		if (only && strcmp(only, scenes[i].name))
+			continue;
+
+		BenchmarkResult r = runScene(scenes[i], runs);
+		results.push_back(r);
+
+		std::cout << std::left << std::setw(14) << r.name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(5) << r.width << "x" << std::setw(4) << r.height << "  spp " << std::setw(2) << r.ns * r.ns
+			<< "  median " << std::setw(10) << r.median_ms << " ms"
+			<< "  variance " << std::setw(10) << r.variance_ms2 << " ms^2"
+			<< "  " << std::setw(12) << std::setprecision(0) << r.rays_per_sec << " rays/s";
+		if (r.mesh_bytes > 0)
+			std::cout << "  meshes " << std::setprecision(1) << r.mesh_bytes / 1024.0 << " KiB"
+				<< "  bvh " << std::setprecision(1) << r.build_ms << " ms";
+		if (r.shadow_saved_nodes > 0.0)
+			std::cout << "  shadow hits " << std::setprecision(1) << r.shadow_hit_rate * 100.0 << "%"
+				<< " saved " << std::setprecision(0) << r.shadow_saved_nodes << " nodes";
+		if (r.irradiance_records > 0)
+			std::cout << "  irradiance " << r.irradiance_records << " records";
+		if (r.caustic_photons > 0)
+			std::cout << "  caustics " << r.caustic_photons << " photons " << std::setprecision(1) << r.caustic_build_ms << " ms";
+		std::cout << std::endl;
+	}
+	clearScene();
+
+	if (jsonFile) {
+		std::ofstream out(jsonFile);
+		writeJson(out, results);
+		printf("Results written to %s\n", jsonFile);
+	}
+
+	// Compare against the baseline, a scene is a regression when its median is more than tolerance slower.
+	int status = 0;
+	if (baselineFile) {
+		std::vector<std::pair<std::string, double> > baseline;
+		if (!readBaseline(baselineFile, baseline))
+			return 2;
+
+		for (size_t i = 0; i < results.size(); i++) {
+			for (size_t j = 0; j < baseline.size(); j++) {
+				if (baseline[j].first != results[i].name)
+					continue;
+
+				double ratio = results[i].median_ms / baseline[j].second;
+				bool regression = ratio > 1.0 + tolerance;
+				printf("%-14s %8.2f ms vs baseline %8.2f ms (%+6.1f%%) %s\n", results[i].name.c_str(),
+					results[i].median_ms, baseline[j].second, (ratio - 1.0) * 100.0, regression ? "REGRESSION" : "ok");
+				if (regression)
+					status = 1;
+			}
+		}
+	}
+
+	return status;
+}
@@ -0,0 +1,280 @@
+/**
+ * Microbenchmarks
+ *
+ * Feeds large batches of randomized rays to the intersection kernels of the shape classes,
+ * in isolation from shading and recursion, and reports the nanoseconds per test and the hit rate.
+ * The fixtures are built from the real shape classes, so they always test the current code.
+ *
+ *   RaytracerMicrobench [--rays n] [--repeats n] [--kernel name]
+ *
+ * The mesh kernels trace a whole mesh through its BVH: binary or wide, with scalar or SoA leaves,
+ * built with object splits or with spatial splits (sbvh). The twisted kernels do the same on
+ * tubes of long diagonal triangles. Mesh kernels also report the build time of the BVH.
+ *
+ * The build kernels only build BVHs over a mesh of 1M triangles, with every builder and with
+ * the SAH build on one thread and on all cores, and report the time per million triangles
+ * and the SAH cost of the tree.
+ *
+ * The refit kernel moves 16384 spheres in a random walk for 64 frames, refits the BVH of the
+ * shape arrays every frame, and reports the time of a refit against a full build, how far the
+ * SAH cost drifted, how often it was rebuilt, and the rays per frame through the refitted tree.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "scenes.h"
+#include "../Shapes/shape.h"
+#include "../shapearrays.h"
+
+/**
+ * Globals which are owned by main.cpp in the interactive application.
+ */
+Vec3Df MyCameraPosition;
+std::vector<Vec3Df> MyLightPositions;
+
+/**
+ * A batch of rays, generated once and reused for every repeat.
+ */
+struct RayBatch {
+	std::vector<Vec3Df> origins;
+	std::vector<Vec3Df> directions;
+	// Only used by the triangle kernel, the triangle each ray is tested against.
+	std::vector<unsigned int> triangles;
+};
+
+/**
+ * The result of one kernel.
+ */
+struct KernelResult {
+	double ns_per_test;
+	double hit_rate;
+	// Sum of the hit points, printed so the compiler can't drop the work.
+	float checksum;
+};
+
+/**
+ * Random unit vector.
+ */
+static Vec3Df randomDirection(std::mt19937& rng)
+{
+	std::normal_distribution<float> normal(0.f, 1.f);
+	Vec3Df d(normal(rng), normal(rng), normal(rng));
+	d.normalize();
+	return d;
+}
+
+/**
+ * Rays that start on a sphere around the target and aim at a random point near it.
+ * The spread controls the hit rate, rays aim within spread times the size of the shape.
+ */
+static RayBatch makeRays(unsigned int count, const Vec3Df& target, float size, float spread, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> offset(-spread * size, spread * size);
+
+	RayBatch batch;
+	batch.origins.reserve(count);
+	batch.directions.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		Vec3Df origin = target + 4.f * size * randomDirection(rng);
+		Vec3Df aim = target + Vec3Df(offset(rng), offset(rng), offset(rng));
+		Vec3Df direction = aim - origin;
+		direction.normalize();
+		batch.origins.push_back(origin);
+		batch.directions.push_back(direction);
+	}
+	return batch;
+}
+
+/**
+ * Rays aimed at random triangles of a mesh, at barycentric coordinates slightly outside [0, 1]
+ * so part of them miss the triangle.
+ */
+static RayBatch makeTriangleRays(unsigned int count, const Mesh& mesh, const Vec3Df& meshOrigin, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<unsigned int> pick(0, (unsigned int)mesh.triangles.size() - 1);
+	std::uniform_real_distribution<float> bary(-0.2f, 1.f);
+
+	RayBatch batch;
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int t = pick(rng);
+		const Triangle& triangle = mesh.triangles[t];
+		float a = bary(rng), b = bary(rng);
+		Vec3Df aim = meshOrigin + (1 - a - b) * mesh.vertices[triangle.v[0]].p + a * mesh.vertices[triangle.v[1]].p + b * mesh.vertices[triangle.v[2]].p;
+		Vec3Df origin = aim + randomDirection(rng);
+		Vec3Df direction = aim - origin;
+		direction.normalize();
+		batch.origins.push_back(origin);
+		batch.directions.push_back(direction);
+		batch.triangles.push_back(t);
+	}
+	return batch;
+}
+
+/**
+ * Run a kernel over the batch a number of times, and keep the fastest repeat.
+ */
+template <typename Kernel>
+static KernelResult runKernel(const RayBatch& batch, unsigned int repeats, Kernel kernel)
+{
+	KernelResult result;
+	result.ns_per_test = 1e30;
+	result.checksum = 0.f;
+
+	for (unsigned int r = 0; r < repeats; r++) {
+		unsigned int hits = 0;
+		float checksum = 0.f;
+		Vec3Df new_origin, new_direction;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < batch.origins.size(); i++) {
+			if (kernel(i, new_origin, new_direction)) {
+				hits++;
+				checksum += new_origin[0] + new_direction[1];
+			}
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+		result.ns_per_test = std::min(result.ns_per_test, elapsed.count() / batch.origins.size());
+		result.hit_rate = double(hits) / batch.origins.size();
+		result.checksum = checksum;
+	}
+	return result;
+}
+
+static void printResult(const char* name, const KernelResult& r)
+{
+	printf("%-16s %8.2f ns/test   hit rate %5.1f%%   (checksum %g)\n", name, r.ns_per_test, r.hit_rate * 100.0, r.checksum);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int rays = 1 << 20;
+	unsigned int repeats = 5;
+	const char* only = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--rays") && i + 1 < argc) rays = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--repeats") && i + 1 < argc) repeats = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--kernel") && i + 1 < argc) only = argv[++i];
+		else {
+			printf("Usage: %s [--rays n] [--repeats n] [--kernel sphere|plane|triangle|mesh-binary|mesh-binary-soa|mesh-wide|mesh-wide-soa|refit|...]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	printf("%u rays per batch, best of %u repeats\n", rays, repeats);
+
+	Material material;
+	material.set_Kd(0.5f, 0.5f, 0.5f);
+
+	if (!only || !strcmp(only, "sphere")) {
+		Sphere sphere(material, Vec3Df(0.3f, -0.2f, 0.5f), 0.5f);
+		RayBatch batch = makeRays(rays, sphere._origin, sphere._radius, 1.f, 1);
+		printResult("sphere", runKernel(batch, repeats, [&](size_t i, Vec3Df& o, Vec3Df& d) {
+			return sphere.intersection(batch.origins[i], batch.directions[i], o, d);
+		}));
+	}
+
+	if (!only || !strcmp(only, "plane")) {
+		Plane plane(material, Vec3Df(0.f, -0.5f, 0.f), Vec3Df(0.f, 1.f, 0.f));
+		RayBatch batch = makeRays(rays, plane._origin, 1.f, 1.f, 2);
+		printResult("plane", runKernel(batch, repeats, [&](size_t i, Vec3Df& o, Vec3Df& d) {
+			return plane.intersection(batch.origins[i], batch.directions[i], o, d);
+		}));
+	}
+
+	if (!only || !strcmp(only, "triangle")) {
+		Mesh mesh = makeProceduralMesh(48, 1.2f, 27);
+		MyMesh myMesh(mesh, Vec3Df(0.1f, 0.2f, 0.3f));
+		RayBatch batch = makeTriangleRays(rays, myMesh._mesh, myMesh._origin, 3);
+		printResult("triangle", runKernel(batch, repeats, [&](size_t i, Vec3Df& o, Vec3Df& d) {
+			return myMesh.intersection(myMesh._mesh.triangles[batch.triangles[i]], batch.origins[i], batch.directions[i], o, d);
+		}));
+	}
+
+	const char* buildKernels[] = { "build-sah", "build-sah-mt", "build-lbvh", "build-lbvh-mt", "build-sbvh" };
+	Mesh buildMesh;
+	for (int k = 0; k < 5; k++) {
+		if (only && strcmp(only, buildKernels[k]))
+			continue;
+
+		if (buildMesh.triangles.empty())
+			buildMesh = makeProceduralMesh(512, 1.2f, 27);
+		MeshOptions options;
+		options.builder = k == 4 ? BVH_BUILDER_SBVH : k >= 2 ? BVH_BUILDER_LBVH : BVH_BUILDER_SAH;
+		options.buildThreads = (k == 1 || k == 3) ? 0 : 1;
+		options.wide = false;
+		MyMesh myMesh(buildMesh, Vec3Df(0.f, 0.f, 0.f), options);
+		double millions = myMesh.triangleCount() / 1e6;
+		printf("%-16s %8.2f ms/Mtri   SAH cost %6.2f   (%u triangles, %u nodes)\n", buildKernels[k], myMesh.buildTime() / millions,
+			myMesh._bvh.sahCost(), (unsigned int)myMesh.triangleCount(), (unsigned int)myMesh._bvh._nodes.size());
+	}
+
+	if (!only || !strcmp(only, "refit")) {
+		const unsigned int spheres = 16384, frames = 64;
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<float> position(-1.f, 1.f);
+		std::vector<Sphere> sphereShapes;
+		sphereShapes.reserve(spheres);
+		std::vector<Shape*> shapes;
+		for (unsigned int i = 0; i < spheres; i++) {
+			sphereShapes.push_back(Sphere(material, Vec3Df(position(rng), position(rng), position(rng)), 0.01f));
+			shapes.push_back(&sphereShapes.back());
+		}
+
+		ShapeArrays arrays;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		arrays.build(shapes);
+		std::chrono::duration<double, std::milli> build = std::chrono::steady_clock::now() - start;
+
+		RayBatch batch = makeRays(std::min(rays, 1u << 16), Vec3Df(0.f, 0.f, 0.f), 1.f, 1.f, 5);
+		double refit = 0.0, trace = 0.0;
+		float maxDrift = 1.f;
+		ShapeHit hit;
+		for (unsigned int f = 0; f < frames; f++) {
+			for (unsigned int i = 0; i < spheres; i++)
+				sphereShapes[i].setOrigin(sphereShapes[i]._origin + 0.02f * randomDirection(rng));
+
+			start = std::chrono::steady_clock::now();
+			arrays.refit();
+			std::chrono::steady_clock::time_point refitted = std::chrono::steady_clock::now();
+			maxDrift = std::max(maxDrift, arrays.drift());
+			for (size_t i = 0; i < batch.origins.size(); i++)
+				arrays.closestHit(batch.origins[i], batch.directions[i], hit);
+			refit += std::chrono::duration<double, std::milli>(refitted - start).count();
+			trace += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - refitted).count();
+		}
+		printf("%-16s %8.2f ms refit+rebuilds per frame   %8.2f ms build   %8.2f ns/ray   max drift %4.2f   %u rebuilds in %u frames\n", "refit",
+			refit / frames, build.count(), trace / (double(frames) * batch.origins.size()), maxDrift, arrays.rebuilds(), frames);
+	}
+
+	// A larger mesh, so the traversal dominates.
+	const char* meshKernels[] = { "mesh-binary", "mesh-binary-soa", "mesh-wide", "mesh-wide-soa", "mesh-sbvh", "mesh-sbvh-soa",
+		"twisted", "twisted-soa", "twisted-sbvh", "twisted-sbvh-soa", "mesh-lbvh", "mesh-lbvh-soa" };
+	for (int k = 0; k < 12; k++) {
+		if (only && strcmp(only, meshKernels[k]))
+			continue;
+
+		bool twisted = k >= 6 && k < 10;
+		Mesh mesh = twisted ? makeTwistedMesh(8192, 8, 0.6f) : makeProceduralMesh(192, 1.2f, 27);
+		MeshOptions options;
+		options.leaves = (k % 2) ? MESH_LEAVES_SOA : MESH_LEAVES_SCALAR;
+		options.wide = k >= 2;
+		options.builder = k >= 10 ? BVH_BUILDER_LBVH : (k == 4 || k == 5 || k >= 8) ? BVH_BUILDER_SBVH : BVH_BUILDER_SAH;
+		MyMesh myMesh(mesh, Vec3Df(0.1f, 0.2f, 0.3f), options);
+		RayBatch batch = makeTriangleRays(rays, myMesh._mesh, myMesh._origin, 4);
+		printResult(meshKernels[k], runKernel(batch, repeats, [&](size_t i, Vec3Df& o, Vec3Df& d) {
+			return myMesh.intersection(batch.origins[i], batch.directions[i], o, d);
+		}));
+		printf("%-16s %8.2f ms build  %u triangles  %u references\n", "", myMesh.buildTime(),
+			(unsigned int)myMesh.triangleCount(), (unsigned int)myMesh._bvh._indices.size());
+	}
+
+	return 0;
+}
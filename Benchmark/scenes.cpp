@@ -0,0 +1,260 @@
+#include "scenes.h"
+#include "../raytracing.h"
+#include "../Shapes/shape.h"
+#include <algorithm>
+#include <random>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Remove all shapes, materials and lights from the scene, and reset the render settings a scene file may have set.
+ */
+void clearScene()
+{
+	for (size_t i = 0; i < shapes.size(); i++)
+		delete shapes[i];
+	shapes.clear();
+	shapesChanged();
+	materials.clear();
+	MyLightPositions.clear();
+	areaLights.clear();
+	resetRenderSettings();
+	updateShapeArrays();
+	updateLightTree();
+}
+
+/**
+ * Build a displaced sphere mesh, so the triangle count can be scaled freely.
+ */
+Mesh makeProceduralMesh(unsigned int rings, float radius, unsigned int seed)
+{
+	Mesh mesh;
+	unsigned int segments = 2 * rings;
+
+	// A few random bumps, fixed by the seed so every run uses the same geometry.
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> phase(0.f, 2.f * float(M_PI));
+	float phaseU = phase(rng);
+	float phaseV = phase(rng);
+
+	for (unsigned int i = 0; i <= rings; i++) {
+		float theta = float(M_PI) * i / rings;
+		for (unsigned int j = 0; j < segments; j++) {
+			float phi = 2.f * float(M_PI) * j / segments;
+			float r = radius * (1.f + 0.08f * sinf(5.f * theta + phaseV) * sinf(7.f * phi + phaseU));
+			mesh.vertices.push_back(Vertex(Vec3Df(r * sinf(theta) * cosf(phi), r * cosf(theta), r * sinf(theta) * sinf(phi))));
+		}
+	}
+
+	for (unsigned int i = 0; i < rings; i++) {
+		for (unsigned int j = 0; j < segments; j++) {
+			unsigned int a = i * segments + j;
+			unsigned int b = i * segments + (j + 1) % segments;
+			unsigned int c = (i + 1) * segments + j;
+			unsigned int d = (i + 1) * segments + (j + 1) % segments;
+			mesh.triangles.push_back(Triangle(a, 0, b, 0, c, 0));
+			mesh.triangles.push_back(Triangle(b, 0, d, 0, c, 0));
+			mesh.triangleMaterials.push_back(0);
+			mesh.triangleMaterials.push_back(0);
+		}
+	}
+
+	Material mat;
+	mat.set_Kd(0.6f, 0.5f, 0.3f);
+	mat.set_Ks(0.1f, 0.1f, 0.1f);
+	mat.set_Ns(30.f);
+	mesh.materials.push_back(mat);
+
+	mesh.computeVertexNormals();
+	return mesh;
+}
+
+/**
+ * Build nested twisted tubes. Every triangle runs from the bottom to the top diagonally,
+ * so its box is large and overlaps those of many others: the worst case for object splits.
+ */
+Mesh makeTwistedMesh(unsigned int segments, unsigned int layers, float twist)
+{
+	Mesh mesh;
+	for (unsigned int layer = 0; layer < layers; layer++) {
+		float radius = 1.f - 0.5f * layer / std::max(1u, layers);
+		for (unsigned int ring = 0; ring < 2; ring++) {
+			for (unsigned int j = 0; j < segments; j++) {
+				float phi = 2.f * float(M_PI) * j / segments + ring * twist;
+				mesh.vertices.push_back(Vertex(Vec3Df(radius * cosf(phi), ring ? 1.f : -1.f, radius * sinf(phi))));
+			}
+		}
+
+		unsigned int first = 2 * segments * layer;
+		for (unsigned int j = 0; j < segments; j++) {
+			unsigned int a = first + j;
+			unsigned int b = first + (j + 1) % segments;
+			unsigned int c = first + segments + j;
+			unsigned int d = first + segments + (j + 1) % segments;
+			mesh.triangles.push_back(Triangle(a, 0, c, 0, b, 0));
+			mesh.triangles.push_back(Triangle(b, 0, c, 0, d, 0));
+			mesh.triangleMaterials.push_back(0);
+			mesh.triangleMaterials.push_back(0);
+		}
+	}
+
+	Material mat;
+	mat.set_Kd(0.3f, 0.5f, 0.6f);
+	mat.set_Ks(0.2f, 0.2f, 0.2f);
+	mat.set_Ns(40.f);
+	mesh.materials.push_back(mat);
+
+	mesh.computeVertexNormals();
+	return mesh;
+}
+
+/**
+ * The interactive scene: the bundled Cornell box with its spheres, as set up by init().
+ */
+static void buildCornellScene()
+{
+	// init() places the first light at the camera.
+	MyCameraPosition = Vec3Df(0.f, 0.f, 4.f);
+	init();
+}
+
+/**
+ * A grid of 10 x 10 spheres on a plane, lots of cheap primitives.
+ */
+static void buildSpheresScene()
+{
+	// Reserve first, shapes keep a reference to their material.
+	materials.reserve(3);
+
+	Material diffuse;
+	diffuse.set_Kd(0.2f, 0.4f, 0.8f);
+	materials.push_back(diffuse);
+
+	Material shiny;
+	shiny.set_Kd(0.8f, 0.3f, 0.2f);
+	shiny.set_Ks(0.3f, 0.3f, 0.3f);
+	shiny.set_Ns(50.f);
+	materials.push_back(shiny);
+
+	Material floor;
+	floor.set_Kd(0.5f, 0.5f, 0.5f);
+	materials.push_back(floor);
+
+	for (int i = 0; i < 10; i++) {
+		for (int j = 0; j < 10; j++) {
+			Vec3Df center(-1.8f + 0.4f * i, -0.8f, -1.8f + 0.4f * j);
+			shapes.push_back(new Sphere(materials[(i + j) % 2], center, 0.15f));
+		}
+	}
+	shapes.push_back(new Plane(materials[2], Vec3Df(0.f, -0.95f, 0.f), Vec3Df(0.f, 1.f, 0.f)));
+	shapesChanged();
+
+	MyLightPositions.push_back(Vec3Df(2.f, 3.f, 3.f));
+	MyLightPositions.push_back(Vec3Df(-2.f, 2.f, 1.f));
+}
+
+/**
+ * The spheres on a plane lit by a grid of 16 x 16 lights, for the shadow rays of many lights.
+ */
+static void buildLightsScene()
+{
+	buildSpheresScene();
+
+	MyLightPositions.clear();
+	for (int i = 0; i < 16; i++)
+		for (int j = 0; j < 16; j++)
+			MyLightPositions.push_back(Vec3Df(-3.f + 0.4f * i, 1.5f + 0.1f * ((i + j) % 4), -3.f + 0.4f * j));
+}
+
+/**
+ * The spheres on a plane lit by one rectangle light over the grid of the lights scene,
+ * for the soft shadows of an area light against as many point lights.
+ */
+static void buildAreaLightScene()
+{
+	buildSpheresScene();
+
+	MyLightPositions.clear();
+	areaLights.push_back(AreaLight(Vec3Df(-3.f, 1.6f, -3.f), Vec3Df(6.f, 0.f, 0.f), Vec3Df(0.f, 0.f, 6.f), 8));
+}
+
+/**
+ * A single large procedural mesh, for the triangle intersection path.
+ */
+static void buildMeshScene()
+{
+	shapes.push_back(new MyMesh(makeProceduralMesh(48, 1.2f, 26), Vec3Df(0.f, 0.f, 0.f), meshOptions));
+	shapesChanged();
+
+	MyLightPositions.push_back(Vec3Df(2.f, 3.f, 3.f));
+}
+
+/**
+ * Twisted tubes of long thin triangles, where spatial splits pay off.
+ */
+static void buildTwistedScene()
+{
+	shapes.push_back(new MyMesh(makeTwistedMesh(1024, 4, 0.6f), Vec3Df(0.f, 0.f, 0.f), meshOptions));
+	shapesChanged();
+
+	MyLightPositions.push_back(Vec3Df(2.f, 3.f, 3.f));
+}
+
+/**
+ * Glass and mirror spheres between two parallel mirrors, so nearly every ray recurses to the maximum depth.
+ */
+static void buildGlassMirrorScene()
+{
+	materials.reserve(3);
+
+	Material mirror;
+	mirror.set_Ka(0.f, 0.f, 0.f);
+	mirror.set_Kd(0.f, 0.f, 0.f);
+	mirror.set_Ks(0.9f, 0.9f, 0.9f);
+	materials.push_back(mirror);
+
+	Material glass;
+	glass.set_Ka(0.01f, 0.01f, 0.01f);
+	glass.set_Kd(0.01f, 0.01f, 0.01f);
+	glass.set_Ks(0.95f, 0.95f, 0.95f);
+	glass.set_Ni(1.5f);
+	glass.set_Ns(200.f);
+	glass.set_Tr(0.1f);
+	glass.set_Tf(0.9f, 0.95f, 0.9f);
+	materials.push_back(glass);
+
+	Material floor;
+	floor.set_Kd(0.6f, 0.6f, 0.6f);
+	floor.set_Ks(0.2f, 0.2f, 0.2f);
+	materials.push_back(floor);
+
+	shapes.push_back(new Plane(materials[0], Vec3Df(-1.5f, 0.f, 0.f), Vec3Df(1.f, 0.f, 0.f)));
+	shapes.push_back(new Plane(materials[0], Vec3Df(1.5f, 0.f, 0.f), Vec3Df(-1.f, 0.f, 0.f)));
+	shapes.push_back(new Plane(materials[2], Vec3Df(0.f, -1.f, 0.f), Vec3Df(0.f, 1.f, 0.f)));
+
+	shapes.push_back(new Sphere(materials[1], Vec3Df(-0.5f, -0.5f, 0.f), 0.45f));
+	shapes.push_back(new Sphere(materials[1], Vec3Df(0.5f, -0.5f, 0.5f), 0.45f));
+	shapes.push_back(new Sphere(materials[0], Vec3Df(0.f, 0.3f, -0.6f), 0.4f));
+	shapesChanged();
+
+	MyLightPositions.push_back(Vec3Df(0.f, 2.f, 2.f));
+}
+
+/**
+ * All standard benchmark scenes. Resolutions and sample counts are fixed, so results are comparable.
+ */
+const std::vector<BenchmarkScene>& benchmarkScenes()
+{
+	static const std::vector<BenchmarkScene> scenes = {
+		{ "cornell", buildCornellScene, Vec3Df(0.f, 0.f, 4.f), Vec3Df(0.f, 0.f, 0.f), 128, 128, 1 },
+		{ "spheres", buildSpheresScene, Vec3Df(0.f, 1.5f, 4.f), Vec3Df(0.f, -0.5f, 0.f), 128, 128, 2 },
+		{ "mesh", buildMeshScene, Vec3Df(0.f, 0.5f, 4.f), Vec3Df(0.f, 0.f, 0.f), 64, 64, 1 },
+		{ "glass_mirror", buildGlassMirrorScene, Vec3Df(0.f, 0.5f, 4.f), Vec3Df(0.f, -0.2f, 0.f), 96, 96, 1 },
+		{ "twisted", buildTwistedScene, Vec3Df(0.f, 1.5f, 4.f), Vec3Df(0.f, 0.f, 0.f), 64, 64, 1 },
+		{ "lights", buildLightsScene, Vec3Df(0.f, 1.5f, 4.f), Vec3Df(0.f, -0.5f, 0.f), 64, 64, 1 },
+		{ "arealight", buildAreaLightScene, Vec3Df(0.f, 1.5f, 4.f), Vec3Df(0.f, -0.5f, 0.f), 64, 64, 1 }
+	};
+	return scenes;
+}
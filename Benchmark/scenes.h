@@ -0,0 +1,36 @@
+#ifndef BENCHMARK_SCENES_H_fjkdlsjfieowjfklsdjf
+#define BENCHMARK_SCENES_H_fjkdlsjfieowjfklsdjf
+
+#include <vector>
+#include "../Vec3D.h"
+#include "../mesh.h"
+
+/**
+ * BenchmarkScene
+ *
+ * A scene that can be rendered headlessly at a fixed resolution and sample count.
+ * The build function fills the global shapes, materials and MyLightPositions.
+ */
+struct BenchmarkScene {
+	const char* name;
+	void (*build)();
+	Vec3Df eye;
+	Vec3Df target;
+	unsigned int width;
+	unsigned int height;
+	unsigned int ns;
+};
+
+// All standard benchmark scenes.
+const std::vector<BenchmarkScene>& benchmarkScenes();
+
+// Remove all shapes, materials and lights from the scene, and reset the render settings.
+void clearScene();
+
+// Build a displaced sphere mesh with 2 * rings * 2 * rings triangles, seeded so it is reproducible.
+Mesh makeProceduralMesh(unsigned int rings, float radius, unsigned int seed);
+
+// Build nested tubes whose top rings are twisted against their bottom rings, 2 * segments * layers long thin triangles.
+Mesh makeTwistedMesh(unsigned int segments, unsigned int layers, float twist);
+
+#endif // BENCHMARK_SCENES_H
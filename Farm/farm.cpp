@@ -0,0 +1,642 @@
+#include "farm.h"
+#include "../checkpoint.h"
+#include "../raytracing.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define closeSocket closesocket
+#define SEND_FLAGS 0
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define INVALID_SOCKET -1
+#define closeSocket close
+#define SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+// Time local workers get to exit after the render, before they are ended.
+static const std::chrono::seconds WORKER_EXIT_TIME(10);
+
+/**
+ * Message types. Every message is a header { type, payload size } followed by the payload.
+ */
+enum FarmMessage {
+	FARM_JOB = 1,		// Coordinator -> worker: job number and FarmJob.
+	FARM_READY,			// Worker -> coordinator: job number and render threads, the scene is loaded and matches the hash.
+	FARM_REJECT,		// Worker -> coordinator: job number, the scene is unknown or has another hash.
+	FARM_TILE,			// Coordinator -> worker: Tile to render.
+	FARM_PIXELS,		// Worker -> coordinator: job number, tile index and its pixels.
+	FARM_QUIT			// Coordinator -> worker: no more work.
+};
+
+/**
+ * Start the socket library, only needed on Windows.
+ */
+static void startSockets()
+{
+#ifdef _WIN32
+	static bool started = false;
+	if (!started) {
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+		started = true;
+	}
+#else
+	// A worker that disconnects must not kill the coordinator while it is sending.
+	signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+/**
+ * Send or receive exactly size bytes, return false when the connection is gone.
+ */
+static bool sendAll(FarmSocket socket, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0) {
+		int sent = send((int)socket, bytes, (int)size, SEND_FLAGS);
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(FarmSocket socket, void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0) {
+		int received = recv((int)socket, bytes, (int)size, 0);
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+/**
+ * Payload of a message, written and read in order.
+ */
+class FarmBuffer {
+	public:
+		FarmBuffer() : _read(0) {}
+
+		void put(const void* data, size_t size) { _data.insert(_data.end(), (const char*)data, (const char*)data + size); }
+		void put(uint32_t value) { put(&value, sizeof(value)); }
+		void put(const Vec3Df& value) { put(value.p, sizeof(value.p)); }
+
+		bool get(void* data, size_t size) {
+			if (_read + size > _data.size())
+				return false;
+			memcpy(data, &_data[_read], size);
+			_read += size;
+			return true;
+		}
+		bool get(uint32_t& value) { return get(&value, sizeof(value)); }
+		bool get(Vec3Df& value) { return get(value.p, sizeof(value.p)); }
+
+		std::vector<char> _data;
+		size_t _read;
+};
+
+static bool sendMessage(FarmSocket socket, uint32_t type, const FarmBuffer& payload)
+{
+	uint32_t header[2] = { type, (uint32_t)payload._data.size() };
+	return sendAll(socket, header, sizeof(header)) &&
+		(payload._data.empty() || sendAll(socket, &payload._data[0], payload._data.size()));
+}
+
+static bool receiveMessage(FarmSocket socket, uint32_t& type, FarmBuffer& payload)
+{
+	uint32_t header[2];
+	if (!receiveAll(socket, header, sizeof(header)))
+		return false;
+	type = header[0];
+	payload._data.resize(header[1]);
+	payload._read = 0;
+	return header[1] == 0 || receiveAll(socket, &payload._data[0], header[1]);
+}
+
+/**
+ * Write and read a job. Replies carry the job number, so late replies to an earlier job are ignored.
+ */
+static void putJob(FarmBuffer& buffer, uint32_t number, const FarmJob& job)
+{
+	buffer.put(number);
+	buffer.put((uint32_t)job.scene.size());
+	buffer.put(job.scene.data(), job.scene.size());
+
+	const Camera& camera = job.camera;
+	buffer.put(camera._width);
+	buffer.put(camera._height);
+	buffer.put(camera._origin00); buffer.put(camera._dest00);
+	buffer.put(camera._origin01); buffer.put(camera._dest01);
+	buffer.put(camera._origin10); buffer.put(camera._dest10);
+	buffer.put(camera._origin11); buffer.put(camera._dest11);
+	buffer.put(job.ns);
+
+	buffer.put((uint32_t)job.lights.size());
+	for (size_t i = 0; i < job.lights.size(); i++)
+		buffer.put(job.lights[i]);
+	buffer.put(&job.hash, sizeof(job.hash));
+}
+
+static bool getJob(FarmBuffer& buffer, uint32_t& number, FarmJob& job)
+{
+	uint32_t size;
+	if (!buffer.get(number) || !buffer.get(size) || size > buffer._data.size())
+		return false;
+	job.scene.resize(size);
+	if (size > 0 && !buffer.get(&job.scene[0], size))
+		return false;
+
+	Camera& camera = job.camera;
+	uint32_t count;
+	bool ok = buffer.get(camera._width) && buffer.get(camera._height) &&
+		buffer.get(camera._origin00) && buffer.get(camera._dest00) &&
+		buffer.get(camera._origin01) && buffer.get(camera._dest01) &&
+		buffer.get(camera._origin10) && buffer.get(camera._dest10) &&
+		buffer.get(camera._origin11) && buffer.get(camera._dest11) &&
+		buffer.get(job.ns) && buffer.get(count) && count <= buffer._data.size();
+	if (!ok)
+		return false;
+
+	job.lights.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+		if (!buffer.get(job.lights[i]))
+			return false;
+	return buffer.get(&job.hash, sizeof(job.hash));
+}
+
+/**
+ * Constructor, call listen() before rendering.
+ */
+FarmCoordinator::FarmCoordinator() : _listen(INVALID_SOCKET), _port(0), _job(0) {
+	startSockets();
+}
+
+FarmCoordinator::~FarmCoordinator() {
+	shutdown();
+	if (_listen != INVALID_SOCKET)
+		closeSocket((int)_listen);
+}
+
+/**
+ * Open the port workers connect to.
+ */
+bool FarmCoordinator::listen(unsigned short port) {
+	_listen = socket(AF_INET, SOCK_STREAM, 0);
+	if (_listen == INVALID_SOCKET)
+		return false;
+
+	int reuse = 1;
+	setsockopt((int)_listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+#ifndef _WIN32
+	// Local workers must not inherit the port.
+	fcntl((int)_listen, F_SETFD, FD_CLOEXEC);
+#endif
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	socklen_t length = sizeof(address);
+	if (bind((int)_listen, (sockaddr*)&address, sizeof(address)) != 0 || ::listen((int)_listen, 64) != 0 ||
+		getsockname((int)_listen, (sockaddr*)&address, &length) != 0) {
+		closeSocket((int)_listen);
+		_listen = INVALID_SOCKET;
+		return false;
+	}
+
+	_port = ntohs(address.sin_port);
+	return true;
+}
+
+unsigned short FarmCoordinator::port() const {
+	return _port;
+}
+
+/**
+ * Accept a new worker and send it the job.
+ */
+void FarmCoordinator::accept(const FarmJob& job) {
+	sockaddr_in address;
+	socklen_t length = sizeof(address);
+	FarmSocket socket = ::accept((int)_listen, (sockaddr*)&address, &length);
+	if (socket == INVALID_SOCKET)
+		return;
+
+	// Tiles are small messages, don't let them wait for more data.
+	int noDelay = 1;
+	setsockopt((int)socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+	Worker worker;
+	worker.socket = socket;
+	worker.address = std::string(inet_ntoa(address.sin_addr)) + ":" + std::to_string(ntohs(address.sin_port));
+	worker.ready = false;
+	worker.timedOut = false;
+	worker.threads = 1;
+
+	FarmBuffer payload;
+	putJob(payload, _job, job);
+	if (!sendMessage(socket, FARM_JOB, payload)) {
+		closeSocket((int)socket);
+		return;
+	}
+	_workers.push_back(worker);
+}
+
+/**
+ * Disconnect a worker. Its unfinished tiles are handed out again.
+ */
+void FarmCoordinator::drop(size_t worker, std::vector<unsigned int>& issued, std::vector<bool>& done) {
+	takeBack(_workers[worker], issued, done);
+	closeSocket((int)_workers[worker].socket);
+	_workers.erase(_workers.begin() + worker);
+}
+
+/**
+ * Take the tiles of a worker back, so they are handed out again. Pixels it still sends for them are ignored.
+ */
+void FarmCoordinator::takeBack(Worker& worker, std::vector<unsigned int>& issued, std::vector<bool>& done) {
+	for (size_t i = 0; i < worker.tiles.size(); i++)
+		if (!done[worker.tiles[i]])
+			issued[worker.tiles[i]]--;
+	worker.tiles.clear();
+}
+
+/**
+ * Render the image with the workers. A tile is issued again when no worker has it anymore,
+ * and when the queue is empty an idle worker also gets a copy of a tile another worker is
+ * still busy with, so a slow worker doesn't hold up the end of the image. A worker that spends
+ * longer than the timeout on a tile loses all its tiles, so a hung worker doesn't hold up the
+ * render either; it stays connected, and gets tiles again once it answers.
+ */
+void FarmCoordinator::render(const FarmJob& job, Image& result, unsigned int tilesAhead, unsigned int tileTimeout) {
+	std::vector<Tile> tiles = makeTiles(job.camera._width, job.camera._height);
+	std::vector<unsigned int> issued(tiles.size(), 0);
+	std::vector<bool> done(tiles.size(), false);
+	unsigned int remaining = (unsigned int)tiles.size();
+	_job++;
+
+	// Workers that are still connected from a previous image get the new job.
+	for (size_t i = 0; i < _workers.size(); i++) {
+		FarmBuffer payload;
+		putJob(payload, _job, job);
+		_workers[i].ready = false;
+		_workers[i].timedOut = false;
+		_workers[i].tiles.clear();
+		if (!sendMessage(_workers[i].socket, FARM_JOB, payload)) {
+			closeSocket((int)_workers[i].socket);
+			_workers.erase(_workers.begin() + i--);
+		}
+	}
+
+	std::vector<float> pixels;
+	bool waiting = false;
+	while (remaining > 0) {
+		// Take the tiles back from workers that are stuck on one.
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < _workers.size() && tileTimeout > 0; i++) {
+			Worker& worker = _workers[i];
+			if (worker.tiles.empty() || now - worker.started < std::chrono::seconds(tileTimeout))
+				continue;
+			std::cout << std::endl << "Worker " << worker.address << " took more than " << tileTimeout << " s for tile "
+				<< worker.tiles[0] << ", " << worker.tiles.size() << " tiles are issued again" << std::endl;
+			takeBack(worker, issued, done);
+			worker.timedOut = true;
+		}
+
+		// Hand out tiles: first the ones nobody has, then copies of tiles in progress.
+		for (size_t i = 0; i < _workers.size(); i++) {
+			Worker& worker = _workers[i];
+			if (!worker.ready || worker.timedOut)
+				continue;
+
+			size_t ahead = tilesAhead * worker.threads;
+			for (unsigned int copies = 0; copies < 2 && worker.tiles.size() < ahead; copies++) {
+				for (size_t t = 0; t < tiles.size() && worker.tiles.size() < ahead; t++) {
+					if (done[t] || issued[t] != copies || (copies > 0 && !worker.tiles.empty()))
+						continue;
+
+					FarmBuffer payload;
+					payload.put(&tiles[t], sizeof(Tile));
+					if (!sendMessage(worker.socket, FARM_TILE, payload))
+						break;
+					if (worker.tiles.empty())
+						worker.started = std::chrono::steady_clock::now();
+					worker.tiles.push_back((unsigned int)t);
+					issued[t]++;
+				}
+			}
+		}
+
+		// Wait for a new worker or a message.
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET((int)_listen, &readable);
+		int maxSocket = (int)_listen;
+		for (size_t i = 0; i < _workers.size(); i++) {
+			FD_SET((int)_workers[i].socket, &readable);
+			maxSocket = std::max(maxSocket, (int)_workers[i].socket);
+		}
+		timeval timeout = { 1, 0 };
+		if (select(maxSocket + 1, &readable, NULL, NULL, &timeout) <= 0) {
+			if (_workers.empty() && !waiting) {
+				std::cout << std::endl << "Waiting for workers on port " << _port << std::endl;
+				waiting = true;
+			}
+			continue;
+		}
+
+		if (FD_ISSET((int)_listen, &readable)) {
+			accept(job);
+			waiting = false;
+		}
+
+		for (size_t i = 0; i < _workers.size(); i++) {
+			Worker& worker = _workers[i];
+			if (!FD_ISSET((int)worker.socket, &readable))
+				continue;
+
+			uint32_t type, number;
+			FarmBuffer payload;
+			if (!receiveMessage(worker.socket, type, payload)) {
+				std::cout << std::endl << "Lost worker " << worker.address << ", " << worker.tiles.size() << " tiles are issued again" << std::endl;
+				drop(i--, issued, done);
+				continue;
+			}
+			if (!payload.get(number) || number != _job)
+				continue;
+			worker.timedOut = false;
+
+			if (type == FARM_READY) {
+				uint32_t threads;
+				worker.ready = true;
+				worker.threads = payload.get(threads) && threads > 0 ? threads : 1;
+			}
+			else if (type == FARM_REJECT) {
+				std::cout << std::endl << "Worker " << worker.address << " has another scene, it is not used" << std::endl;
+				drop(i--, issued, done);
+			}
+			else if (type == FARM_PIXELS) {
+				uint32_t index;
+				if (!payload.get(index) || index >= tiles.size())
+					continue;
+				const Tile& tile = tiles[index];
+				pixels.resize(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+				std::vector<unsigned int>::iterator issuedTile = std::find(worker.tiles.begin(), worker.tiles.end(), index);
+				if (issuedTile == worker.tiles.end() || !payload.get(&pixels[0], pixels.size() * sizeof(float)))
+					continue;
+
+				// The thread goes on with the next tile. Only the oldest tile restarts the timeout,
+				// so a thread that hangs is noticed while the other threads keep finishing tiles.
+				if (issuedTile == worker.tiles.begin())
+					worker.started = std::chrono::steady_clock::now();
+				worker.tiles.erase(issuedTile);
+				if (!done[index]) {
+					done[index] = true;
+					remaining--;
+					storeTile(result, tile, pixels);
+					loadbar((unsigned int)tiles.size() - remaining, (unsigned int)tiles.size(), 50);
+				}
+			}
+		}
+	}
+
+	// Copies of finished tiles may still be in progress, forget them.
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i].tiles.clear();
+	std::cout << std::endl << std::endl;
+}
+
+/**
+ * Tell the workers to quit, and disconnect them.
+ */
+void FarmCoordinator::shutdown() {
+	for (size_t i = 0; i < _workers.size(); i++) {
+		sendMessage(_workers[i].socket, FARM_QUIT, FarmBuffer());
+		closeSocket((int)_workers[i].socket);
+	}
+	_workers.clear();
+}
+
+/**
+ * Worker: load the scene of each job, and render tiles on a number of threads until the coordinator says quit.
+ */
+bool runFarmWorker(const std::string& host, unsigned short port, unsigned int threads, bool (*loadScene)(const std::string&)) {
+	startSockets();
+
+	addrinfo hints, *addresses;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+		std::cerr << "Unknown coordinator " << host << std::endl;
+		return false;
+	}
+
+	FarmSocket socket = ::socket(AF_INET, SOCK_STREAM, 0);
+	bool connected = socket != INVALID_SOCKET && connect((int)socket, addresses->ai_addr, (int)addresses->ai_addrlen) == 0;
+	freeaddrinfo(addresses);
+	if (!connected) {
+		std::cerr << "Cannot connect to " << host << ":" << port << std::endl;
+		return false;
+	}
+
+	int noDelay = 1;
+	setsockopt((int)socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+	// The render threads take the tiles from the queue, and send their pixels themselves.
+	FarmJob job;
+	uint32_t number = 0;
+	std::deque<Tile> queue;
+	unsigned int busy = 0;
+	bool quit = false;
+	std::mutex queueMutex, sendMutex;
+	std::condition_variable queueChanged;
+
+	auto renderer = [&]() {
+		std::vector<float> pixels;
+		std::unique_lock<std::mutex> lock(queueMutex);
+		while (true) {
+			while (!quit && queue.empty())
+				queueChanged.wait(lock);
+			if (quit)
+				return;
+
+			Tile tile = queue.front();
+			queue.pop_front();
+			FarmBuffer reply;
+			reply.put(number);
+			busy++;
+			lock.unlock();
+
+			renderTile(job.camera, job.ns, tile, pixels);
+			reply.put(tile.index);
+			reply.put(&pixels[0], pixels.size() * sizeof(float));
+			{
+				// A lost connection is noticed by the receiving thread.
+				std::lock_guard<std::mutex> sending(sendMutex);
+				sendMessage(socket, FARM_PIXELS, reply);
+			}
+
+			lock.lock();
+			busy--;
+			queueChanged.notify_all();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 0; i < threads; i++)
+		pool.push_back(std::thread(renderer));
+
+	std::string loadedScene;
+	bool ready = false;
+	bool finished = false;
+	uint32_t type;
+	FarmBuffer payload;
+	while (receiveMessage(socket, type, payload)) {
+		if (type == FARM_QUIT) {
+			finished = true;
+			break;
+		}
+
+		if (type == FARM_JOB) {
+			// The tiles of the old job are not needed anymore, and the scene must not change under a render thread.
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queue.clear();
+				while (busy > 0)
+					queueChanged.wait(lock);
+			}
+
+			ready = getJob(payload, number, job);
+
+			// The scene is built once, later jobs only change the camera and lights.
+			if (ready && job.scene != loadedScene) {
+				ready = loadScene(job.scene);
+				loadedScene = ready ? job.scene : std::string();
+			}
+			if (ready) {
+				MyLightPositions = job.lights;
+				updateLightTree();
+				ready = Checkpoint::hashRender(job.camera, job.ns) == job.hash;
+			}
+			// Every worker gathers the same records, so their tiles match.
+			if (ready)
+				prefillIrradianceCache(job.camera);
+			FarmBuffer reply;
+			reply.put(number);
+			reply.put(threads);
+			std::lock_guard<std::mutex> sending(sendMutex);
+			if (!sendMessage(socket, ready ? FARM_READY : FARM_REJECT, reply))
+				break;
+		}
+		else if (type == FARM_TILE && ready) {
+			Tile tile;
+			if (!payload.get(&tile, sizeof(tile)))
+				break;
+			std::lock_guard<std::mutex> lock(queueMutex);
+			queue.push_back(tile);
+			queueChanged.notify_one();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		quit = true;
+		queueChanged.notify_all();
+	}
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+
+	closeSocket((int)socket);
+	return finished;
+}
+
+#ifndef _WIN32
+static std::vector<pid_t> localWorkers;
+#else
+static std::vector<HANDLE> localWorkers;
+#endif
+
+/**
+ * Start a worker process on this machine.
+ */
+bool spawnLocalWorker(const char* executable, unsigned short port, unsigned int threads) {
+	std::string address = "127.0.0.1:" + std::to_string(port);
+	std::string threadCount = std::to_string(threads);
+#ifdef _WIN32
+	std::string command = std::string("\"") + executable + "\" --threads " + threadCount + " --worker " + address;
+	STARTUPINFOA startup;
+	PROCESS_INFORMATION process;
+	memset(&startup, 0, sizeof(startup));
+	startup.cb = sizeof(startup);
+	if (!CreateProcessA(NULL, &command[0], NULL, NULL, FALSE, 0, NULL, NULL, &startup, &process))
+		return false;
+	CloseHandle(process.hThread);
+	localWorkers.push_back(process.hProcess);
+#else
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0) {
+		// Search the PATH like the shell did, the coordinator may have been started by name.
+		const char* arguments[] = { executable, "--threads", threadCount.c_str(), "--worker", address.c_str(), NULL };
+		execvp(executable, (char* const*)arguments);
+		_exit(127);
+	}
+	localWorkers.push_back(pid);
+#endif
+	return true;
+}
+
+/**
+ * Wait for the local worker processes to exit, and end the ones that don't in time.
+ */
+void waitLocalWorkers() {
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + WORKER_EXIT_TIME;
+	for (size_t i = 0; i < localWorkers.size(); i++) {
+#ifdef _WIN32
+		long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (WaitForSingleObject(localWorkers[i], (DWORD)std::max(0ll, left)) != WAIT_OBJECT_0) {
+			TerminateProcess(localWorkers[i], 1);
+			WaitForSingleObject(localWorkers[i], INFINITE);
+		}
+		CloseHandle(localWorkers[i]);
+#else
+		while (waitpid(localWorkers[i], NULL, WNOHANG) == 0) {
+			if (std::chrono::steady_clock::now() >= deadline) {
+				kill(localWorkers[i], SIGKILL);
+				waitpid(localWorkers[i], NULL, 0);
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+#endif
+	}
+	localWorkers.clear();
+}
@@ -0,0 +1,128 @@
+#ifndef FARM_H_qpwoeirutyalskdjfhgz
+#define FARM_H_qpwoeirutyalskdjfhgz
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../camera.h"
+#include "../image.h"
+#include "../render.h"
+
+/**
+ * Render farm
+ *
+ * A coordinator splits the image in tiles, like the 'r' render does, and hands them to
+ * worker processes over TCP. Every worker builds the scene itself; the coordinator sends
+ * the scene name, camera, samples and lights, and a hash of the render so a worker with
+ * other scene files is turned away. Workers pull tiles one by one, so fast workers get
+ * more of them, and the tiles of a worker that disconnects, or takes too long for a tile, are
+ * handed out again. A worker renders as many tiles at once as it has threads, each tile on
+ * one thread, so a tile is the same whichever worker or thread renders it.
+ */
+
+// A socket handle, a SOCKET on Windows and a file descriptor elsewhere.
+typedef intptr_t FarmSocket;
+
+/**
+ * Everything a worker needs to render tiles of the same image as the coordinator.
+ */
+struct FarmJob {
+	std::string scene;
+	Camera camera;
+	unsigned int ns;
+	std::vector<Vec3Df> lights;
+	uint64_t hash;
+};
+
+/**
+ * FarmCoordinator class
+ *
+ * Listens for workers and renders images with them.
+ */
+class FarmCoordinator {
+	public:
+		// Constructor
+		FarmCoordinator();
+		~FarmCoordinator();
+
+		/**
+		 * Start listening for workers.
+		 * 1st param:	TCP port, 0 picks a free one.
+		 * Return:		Whether the port could be opened.
+		 */
+		bool listen(unsigned short port);
+
+		// The port workers connect to.
+		unsigned short port() const;
+
+		/**
+		 * Render an image with the connected workers, and the ones that connect while rendering.
+		 * 1st param:	The job, the scene must be loaded in this process to compute its hash.
+		 * 2nd param:	The image to store the result in, must be as big as the camera.
+		 * 3rd param:	Number of tiles a worker gets ahead per thread, so it doesn't wait for the network.
+		 * 4th param:	Seconds a worker may spend on one tile before its tiles are handed out
+		 *				to the others, 0 to wait as long as it stays connected.
+		 */
+		void render(const FarmJob& job, Image& result, unsigned int tilesAhead, unsigned int tileTimeout);
+
+		// Tell all workers there is no more work.
+		void shutdown();
+
+	private:
+		// A connected worker and the tiles it is rendering.
+		struct Worker {
+			FarmSocket socket;
+			std::string address;
+			bool ready;
+			std::vector<unsigned int> tiles;
+
+			// Number of tiles it renders at once, sent when it is ready.
+			unsigned int threads;
+
+			// When the worker started on its oldest tile.
+			std::chrono::steady_clock::time_point started;
+
+			// Its tiles took too long and were taken back; it gets no new ones until it answers again.
+			bool timedOut;
+		};
+
+		void accept(const FarmJob& job);
+		void drop(size_t worker, std::vector<unsigned int>& issued, std::vector<bool>& done);
+		void takeBack(Worker& worker, std::vector<unsigned int>& issued, std::vector<bool>& done);
+
+		FarmSocket _listen;
+		unsigned short _port;
+
+		// Number of the current job.
+		uint32_t _job;
+
+		std::vector<Worker> _workers;
+};
+
+/**
+ * Worker loop: connect to a coordinator and render the tiles it sends, until it is done.
+ * 1st param:	Host name or address of the coordinator.
+ * 2nd param:	Port of the coordinator.
+ * 3rd param:	Number of tiles to render at once, each on its own thread.
+ * 4th param:	Builds a scene by name, returns false for an unknown scene.
+ * Return:		Whether the worker finished without errors.
+ */
+bool runFarmWorker(const std::string& host, unsigned short port, unsigned int threads, bool (*loadScene)(const std::string&));
+
+/**
+ * Start a worker process on this machine that connects to a local coordinator.
+ * 1st param:	Path of the executable, started with "--threads n --worker 127.0.0.1:port".
+ * 2nd param:	Port of the coordinator.
+ * 3rd param:	Number of render threads of the worker.
+ * Return:		Whether the process could be started.
+ */
+bool spawnLocalWorker(const char* executable, unsigned short port, unsigned int threads);
+
+/**
+ * Wait for the local worker processes to exit. A worker that hung doesn't see the quit message,
+ * those that still run after a few seconds are ended.
+ */
+void waitLocalWorkers();
+
+#endif // FARM_H
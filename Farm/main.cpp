@@ -0,0 +1,152 @@
+/**
+ * Render farm
+ *
+ * Renders one image of a standard scene or a scene file with worker processes, see farm.h.
+ * The coordinator starts a number of local workers, and any other machine can join with
+ * --worker. Run from the repository root, so the Cornell box and its textures are found.
+ * The scene is a benchmark scene name, or a .scene file which workers must find at the same path:
+ *   RaytracerFarm [--scene name] [--size WxH] [--ns n] [--local n] [--threads n] [--port p] [--tile-timeout s] [--output file]
+ *   RaytracerFarm [--threads n] --worker host:port
+ * A worker keeps --threads tiles in flight, each rendered on its own thread, one per core by
+ * default. Splitting a tile over threads would change its irradiance records, so tiles would
+ * depend on the worker that rendered them. The local workers share the cores by default.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "farm.h"
+#include "../Benchmark/scenes.h"
+#include "../checkpoint.h"
+#include "../raytracing.h"
+#include "../scene.h"
+
+/**
+ * Globals which are owned by main.cpp in the interactive application.
+ */
+Vec3Df MyCameraPosition;
+std::vector<Vec3Df> MyLightPositions;
+
+/**
+ * Find a standard scene by name.
+ */
+static const BenchmarkScene* findScene(const std::string& name)
+{
+	const std::vector<BenchmarkScene>& scenes = benchmarkScenes();
+	for (size_t i = 0; i < scenes.size(); i++)
+		if (name == scenes[i].name)
+			return &scenes[i];
+	return nullptr;
+}
+
+/**
+ * Build a standard scene or load a scene file, used by the workers.
+ */
+static bool loadScene(const std::string& name)
+{
+	if (isSceneFile(name.c_str())) {
+		SceneSettings settings;
+		clearScene();
+		return loadSceneFile(name.c_str(), settings);
+	}
+
+	const BenchmarkScene* scene = findScene(name);
+	if (scene == nullptr)
+		return false;
+
+	clearScene();
+	scene->build();
+	updateShapeArrays();
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const char* sceneName = "cornell";
+	const char* output = "farm.ppm";
+	unsigned int width = 0, height = 0, ns = 0;
+	unsigned int local = 4;
+	unsigned int threads = 0;
+	unsigned int port = 5123;
+	unsigned int tileTimeout = 120;
+	const char* worker = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--worker") && i + 1 < argc) worker = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--scene") && i + 1 < argc) sceneName = argv[++i];
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc) sscanf_s(argv[++i], "%ux%u", &width, &height);
+		else if (!strcmp(argv[i], "--ns") && i + 1 < argc) ns = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--local") && i + 1 < argc) local = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--port") && i + 1 < argc) port = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--tile-timeout") && i + 1 < argc) tileTimeout = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc) output = argv[++i];
+		else {
+			printf("Usage: %s [--scene name] [--size WxH] [--ns n] [--local n] [--threads n] [--port p] [--tile-timeout s] [--output file]\n"
+				"       %s [--threads n] --worker host:port\n", argv[0], argv[0]);
+			return 2;
+		}
+	}
+
+	if (worker != nullptr) {
+		// Worker mode, host:port of the coordinator.
+		std::string address = worker;
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos) {
+			printf("Usage: %s [--threads n] --worker host:port\n", argv[0]);
+			return 2;
+		}
+		return runFarmWorker(address.substr(0, colon), (unsigned short)atoi(address.c_str() + colon + 1),
+			threads > 0 ? threads : renderThreads(), loadScene) ? 0 : 1;
+	}
+
+	// The coordinator loads the scene too, for the hash the workers must match.
+	FarmJob job;
+	job.scene = sceneName;
+	if (isSceneFile(sceneName)) {
+		SceneSettings settings;
+		if (!loadSceneFile(sceneName, settings))
+			return 2;
+		job.camera = Camera::lookAt(settings.eye, settings.target, settings.up, settings.fov,
+			width > 0 ? width : (settings.width > 0 ? settings.width : 800), height > 0 ? height : (settings.height > 0 ? settings.height : 600));
+		job.ns = ns > 0 ? ns : (settings.ns > 0 ? settings.ns : 1);
+	}
+	else {
+		const BenchmarkScene* scene = findScene(sceneName);
+		if (scene == nullptr) {
+			printf("Unknown scene %s\n", sceneName);
+			return 2;
+		}
+		loadScene(sceneName);
+		job.camera = Camera::lookAt(scene->eye, scene->target, Vec3Df(0.f, 1.f, 0.f), 50.f,
+			width > 0 ? width : scene->width, height > 0 ? height : scene->height);
+		job.ns = ns > 0 ? ns : scene->ns;
+	}
+	job.lights = MyLightPositions;
+	job.hash = Checkpoint::hashRender(job.camera, job.ns);
+
+	FarmCoordinator coordinator;
+	if (!coordinator.listen((unsigned short)port)) {
+		printf("Cannot listen on port %u\n", port);
+		return 1;
+	}
+
+	printf("Rendering %s at %ux%u, %u samples per pixel, workers connect to port %u\n",
+		sceneName, job.camera._width, job.camera._height, job.ns * job.ns, coordinator.port());
+	for (unsigned int i = 0; i < local; i++)
+		if (!spawnLocalWorker(argv[0], coordinator.port(), threads > 0 ? threads : std::max(1u, renderThreads() / local)))
+			printf("Cannot start a local worker\n");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Image result(job.camera._width, job.camera._height);
+	coordinator.render(job, result, 2, tileTimeout);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	printf("Rendered in %.2f s\n", elapsed.count());
+
+	coordinator.shutdown();
+	waitLocalWorkers();
+	return result.writeImage(output) ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include "shape.h"
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+/**
+ * SHAPE: LazyMesh
+ *
+ * Material of the shape itself, every triangle of the loaded mesh has its own.
+ */
+static Material lazyMeshMaterial;
+
+/**
+ * Constructor, without bounds.
+ */
+LazyMesh::LazyMesh(const std::string& filename, Vec3Df origin, const MeshOptions& options) : Shape(lazyMeshMaterial, origin),
+	_filename(filename), _hasBounds(false), _options(options), _mesh(nullptr) {}
+
+/**
+ * Constructor, with world space bounds the mesh is known to fit in.
+ */
+LazyMesh::LazyMesh(const std::string& filename, Vec3Df origin, Vec3Df boundsMin, Vec3Df boundsMax, const MeshOptions& options) :
+	Shape(lazyMeshMaterial, origin), _filename(filename), _hasBounds(true), _boundsMin(boundsMin), _boundsMax(boundsMax), _options(options),
+	_mesh(nullptr) {}
+
+LazyMesh::~LazyMesh() {
+	if (_loading.valid())
+		_loading.wait();
+	delete _mesh.load();
+}
+
+/**
+ * Load the OBJ file, and build the mesh shape.
+ */
+MyMesh* LazyMesh::load() {
+	FILE* file;
+	if (fopen_s(&file, _filename.c_str(), "r") != 0) {
+		std::cout << "Mesh " << _filename << " not found" << std::endl;
+		return nullptr;
+	}
+	fclose(file);
+
+	Mesh mesh;
+	mesh.loadMesh(_filename.c_str(), true);
+	if (mesh.triangles.empty()) {
+		std::cout << "Mesh " << _filename << " has no triangles" << std::endl;
+		return nullptr;
+	}
+	if (mesh.materials.empty()) {
+		Material material;
+		material.set_Kd(0.5f, 0.5f, 0.5f);
+		mesh.materials.push_back(material);
+		mesh.triangleMaterials.assign(mesh.triangles.size(), 0);
+	}
+	mesh.computeVertexNormals();
+
+	// Publish the mesh right away, so draw() shows a prefetched mesh no ray asked for yet.
+	MyMesh* loaded = new MyMesh(std::move(mesh), _origin, _options);
+	_mesh.store(loaded, std::memory_order_release);
+	return loaded;
+}
+
+/**
+ * Start loading in the background, if that didn't happen yet.
+ */
+void LazyMesh::prefetch() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_loading.valid())
+		_loading = std::async(std::launch::async, &LazyMesh::load, this).share();
+}
+
+/**
+ * The loaded mesh. The first caller starts the load, the others wait for the same load.
+ */
+MyMesh* LazyMesh::mesh() {
+	MyMesh* mesh = _mesh.load(std::memory_order_acquire);
+	if (mesh != nullptr)
+		return mesh;
+
+	std::shared_future<MyMesh*> loading;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_loading.valid())
+			_loading = std::async(std::launch::async, &LazyMesh::load, this).share();
+		loading = _loading;
+	}
+
+	return loading.get();
+}
+
+/**
+ * Move the mesh. A load that is still running may use either origin, so don't move a mesh while it loads.
+ */
+void LazyMesh::setOrigin(const Vec3Df& origin) {
+	Vec3Df offset = origin - _origin;
+	_boundsMin += offset;
+	_boundsMax += offset;
+	_origin = origin;
+
+	MyMesh* loaded = _mesh.load(std::memory_order_acquire);
+	if (loaded != nullptr)
+		loaded->setOrigin(origin);
+}
+
+/**
+ * Intersection method. A ray that misses the bounds doesn't load the mesh.
+ */
+bool LazyMesh::intersection(const Vec3Df& origin, const Vec3Df& direction, Vec3Df& new_origin, Vec3Df& new_direction) {
+	if (_hasBounds) {
+		// Slab test, the ray enters the box at tNear and leaves it at tFar.
+		float tNear = 0.f, tFar = FLT_MAX;
+		for (int i = 0; i < 3; i++) {
+			if (direction[i] > -EPSILON && direction[i] < EPSILON) {
+				if (origin[i] < _boundsMin[i] || origin[i] > _boundsMax[i])
+					return false;
+				continue;
+			}
+			float t0 = (_boundsMin[i] - origin[i]) / direction[i];
+			float t1 = (_boundsMax[i] - origin[i]) / direction[i];
+			if (t0 > t1)
+				std::swap(t0, t1);
+			tNear = std::max(tNear, t0);
+			tFar = std::min(tFar, t1);
+			if (tNear > tFar)
+				return false;
+		}
+	}
+
+	MyMesh* loaded = mesh();
+	return loaded != nullptr && loaded->intersection(origin, direction, new_origin, new_direction);
+}
+
+/**
+ * Shading and refraction are done by the intersected triangle, these are not used.
+ */
+Vec3Df LazyMesh::shade(const Vec3Df& camPos, const Vec3Df& intersect, const Vec3Df& lightPos, const Vec3Df& normal) {
+	return Shape::shade(camPos, intersect, lightPos, normal);
+}
+
+Vec3Df LazyMesh::refract(const Vec3Df& normal, const Vec3Df& direction, const float& ni, float& fresnel) {
+	return Shape::refract(normal, direction, ni, fresnel);
+}
+
+/**
+ * Draw the mesh once it is loaded, drawing doesn't start a load.
+ */
+void LazyMesh::draw() {
+	MyMesh* loaded = _mesh.load(std::memory_order_acquire);
+	if (loaded != nullptr)
+		loaded->draw();
+}
@@ -1,49 +1,432 @@
 #include "shape.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <utility>
 #include <GL/glut.h>
 
+MeshOptions::MeshOptions() : storage(MESH_STORAGE_FULL), leaves(MESH_LEAVES_SCALAR), wide(true), builder(BVH_BUILDER_SAH),
+	spatialBudget(0.3f), buildThreads(0) {}
+
+MeshOptions meshOptions;
+
 /**
  * SHAPE: Mesh
  *
- * Each instance of this class is one plane. It is constructed via an origin and a coefficient.
- *
- *
- * Constructor
+ * Material of the shape itself, every triangle has its own.
+ */
+static Material meshMaterial;
+
+/**
+ * Constructor, copies the mesh. Compact meshes only copy the materials.
+ */
+MyMesh::MyMesh(const Mesh& mesh, Vec3Df origin, const MeshOptions& options) : Shape(meshMaterial, origin),
+	_options(options), _buildTime(0.0), _padding(0.f), _extent(0.f) {
+	if (_options.storage == MESH_STORAGE_FULL)
+		_mesh = mesh;
+	else {
+		_compact.build(mesh, _options.storage == MESH_STORAGE_QUANTIZED);
+		_mesh.materials = mesh.materials;
+	}
+	createShapes();
+}
+
+/**
+ * Constructor, takes the mesh over. Compact meshes release its geometry before the BVH is built.
+ */
+MyMesh::MyMesh(Mesh&& mesh, Vec3Df origin, const MeshOptions& options) : Shape(meshMaterial, origin),
+	_options(options), _buildTime(0.0), _padding(0.f), _extent(0.f) {
+	if (_options.storage == MESH_STORAGE_FULL)
+		_mesh = std::move(mesh);
+	else {
+		_compact.build(mesh, _options.storage == MESH_STORAGE_QUANTIZED);
+		_mesh.materials = std::move(mesh.materials);
+		mesh = Mesh();
+	}
+	createShapes();
+}
+
+/**
+ * Compile the materials, create the triangle shapes and build the BVH.
+ */
+void MyMesh::createShapes() {
+	// Compile every material once, instead of once per triangle.
+	std::vector<unsigned int> materialIds(_mesh.materials.size());
+	for (size_t i = 0; i < _mesh.materials.size(); i++)
+		materialIds[i] = compileMaterial(_mesh.materials[i]);
+	_record = &materialRecord(materialIds[0]);
+
+	if (_options.storage != MESH_STORAGE_FULL) {
+		// The triangles of a material share one shape.
+		_triangleShapes.reserve(_mesh.materials.size());
+		for (size_t i = 0; i < _mesh.materials.size(); i++)
+			_triangleShapes.push_back(TriangleShape(_mesh.materials[i], materialIds[i]));
+	}
+	else {
+		_triangleShapes.reserve(_mesh.triangles.size());
+		for (size_t i = 0; i < _mesh.triangles.size(); i++)
+			_triangleShapes.push_back(TriangleShape(_mesh.materials[_mesh.triangleMaterials[i]], _mesh.triangles[i], materialIds[_mesh.triangleMaterials[i]]));
+	}
+
+	buildBVH();
+}
+
+thread_local TriangleShape* MyMesh::_lastIntersectedTriangle = nullptr;
+
+/**
+ * Move the mesh.
+ */
+void MyMesh::setOrigin(const Vec3Df& origin) {
+	Shape::setOrigin(origin);
+
+	// The padding of buildBVH() grows with the coordinates in world space.
+	float largest = std::max(std::max(std::max(fabsf(_origin[0]), fabsf(_origin[1])), fabsf(_origin[2])), _extent);
+	if (1e-5f * (1.f + largest) > _padding)
+		buildBVH();
+}
+
+/**
+ * Number of triangles, in either storage.
+ */
+size_t MyMesh::triangleCount() const {
+	return _options.storage == MESH_STORAGE_FULL ? _mesh.triangles.size() : _compact.size();
+}
+
+/**
+ * The vertex indices of a triangle.
+ */
+const unsigned int* MyMesh::triangleVertices(unsigned int triangle) const {
+	return _options.storage == MESH_STORAGE_FULL ? _mesh.triangles[triangle].v : _compact._triangles[triangle].v;
+}
+
+/**
+ * Position of a vertex, without the origin of the mesh.
+ */
+Vec3Df MyMesh::vertexPosition(unsigned int vertex) const {
+	return _options.storage == MESH_STORAGE_FULL ? _mesh.vertices[vertex].p : _compact.position(vertex);
+}
+
+/**
+ * Normal of a vertex.
+ */
+Vec3Df MyMesh::vertexNormal(unsigned int vertex) const {
+	return _options.storage == MESH_STORAGE_FULL ? _mesh.vertices[vertex].n : _compact.normal(vertex);
+}
+
+/**
+ * The shape that shades a triangle.
+ */
+TriangleShape* MyMesh::triangleShape(unsigned int triangle) {
+	return _options.storage == MESH_STORAGE_FULL ? &_triangleShapes[triangle] : &_triangleShapes[_compact._triangleMaterials[triangle]];
+}
+
+/**
+ * Build the BVH over the triangles in mesh space, its wide version and the triangle blocks of its leaves.
+ */
+void MyMesh::buildBVH() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t count = triangleCount();
+
+	// Rays are tested against the boxes in mesh space and against the triangles in world space,
+	// the boxes are padded so the difference in rounding never makes a ray miss a box.
+	_extent = 0.f;
+	std::vector<Vec3Df> boundsMin(count), boundsMax(count);
+	for (size_t i = 0; i < count; i++) {
+		const unsigned int* v = triangleVertices((unsigned int)i);
+		Vec3Df p0 = vertexPosition(v[0]), p1 = vertexPosition(v[1]), p2 = vertexPosition(v[2]);
+		for (int axis = 0; axis < 3; axis++) {
+			boundsMin[i][axis] = std::min(std::min(p0[axis], p1[axis]), p2[axis]);
+			boundsMax[i][axis] = std::max(std::max(p0[axis], p1[axis]), p2[axis]);
+			_extent = std::max(_extent, std::max(fabsf(boundsMin[i][axis]), fabsf(boundsMax[i][axis])));
+		}
+	}
+	float largest = std::max(std::max(std::max(fabsf(_origin[0]), fabsf(_origin[1])), fabsf(_origin[2])), _extent);
+	Vec3Df padding(1.f, 1.f, 1.f);
+	padding *= 1e-5f * (1.f + largest);
+	_padding = padding[0];
+	for (size_t i = 0; i < count; i++) {
+		boundsMin[i] -= padding;
+		boundsMax[i] += padding;
+	}
+
+	unsigned int leafSize = _options.leaves == MESH_LEAVES_SOA ? TRIANGLE_BLOCK_SIZE : 4;
+	unsigned int blockSize = _options.leaves == MESH_LEAVES_SOA ? TRIANGLE_BLOCK_SIZE : 1;
+	if (_options.builder == BVH_BUILDER_SBVH) {
+		// Clipping needs the triangles themselves, it pads the clipped boxes.
+		std::vector<Vec3Df> vertices(3 * count);
+		for (size_t i = 0; i < count; i++) {
+			const unsigned int* v = triangleVertices((unsigned int)i);
+			for (int j = 0; j < 3; j++)
+				vertices[3 * i + j] = vertexPosition(v[j]);
+		}
+		_bvh.buildSpatial(vertices, padding[0], leafSize, blockSize, _options.spatialBudget);
+	}
+	else {
+		unsigned int threads = _options.buildThreads > 0 ? _options.buildThreads : std::max(1u, std::thread::hardware_concurrency());
+		if (_options.builder == BVH_BUILDER_LBVH)
+			_bvh.buildMorton(boundsMin, boundsMax, leafSize, threads);
+		else
+			_bvh.build(boundsMin, boundsMax, leafSize, blockSize, threads);
+	}
+
+	_wide.clear();
+	if (_options.wide)
+		_wide.build(_bvh);
+
+	std::vector<TriangleBlock>().swap(_blocks);
+	std::vector<unsigned int>().swap(_leafBlocks);
+	if (_options.leaves == MESH_LEAVES_SOA) {
+		// The triangles of every leaf, in blocks that start at _leafBlocks of the leaf.
+		_leafBlocks.assign(_bvh._nodes.size(), 0);
+		for (size_t n = 0; n < _bvh._nodes.size(); n++) {
+			const BVHNode& node = _bvh._nodes[n];
+			if (!node.isLeaf())
+				continue;
+
+			_leafBlocks[n] = (unsigned int)_blocks.size();
+			for (unsigned int i = 0; i < node.count; i++) {
+				if (i % TRIANGLE_BLOCK_SIZE == 0)
+					_blocks.push_back(TriangleBlock());
+				unsigned int triangle = _bvh._indices[node.first + i];
+				const unsigned int* v = triangleVertices(triangle);
+				_blocks.back().set(i % TRIANGLE_BLOCK_SIZE, vertexPosition(v[0]), vertexPosition(v[1]), vertexPosition(v[2]), triangle);
+			}
+		}
+	}
+
+	_buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Intersection of a triangle, exactly as intersection() of a single triangle computes it.
+ * Gets the distance along the ray, the intersection point and its barycentric coordinates.
+ */
+bool MyMesh::hitTriangle(unsigned int triangle, const Vec3Df& origin, const Vec3Df& direction, float& t, Vec3Df& p, float& a, float& b) const {
+	const unsigned int* vertices = triangleVertices(triangle);
+	Vec3Df p0 = vertexPosition(vertices[0]) + _origin;
+	Vec3Df u = (vertexPosition(vertices[1]) + _origin) - p0;
+	Vec3Df v = (vertexPosition(vertices[2]) + _origin) - p0;
+
+	// The plane of the triangle.
+	Vec3Df planeNormal = Vec3Df::crossProduct(u, v);
+	float denom = Vec3Df::dotProduct(direction, planeNormal);
+	if (denom > -EPSILON && denom < EPSILON)
+		return false;
+
+	t = Vec3Df::dotProduct(p0 - origin, planeNormal) / denom;
+	if (t < EPSILON)
+		return false;
+
+	p = origin + t * direction;
+
+	// Barycentric coordinates, as barycentric().
+	float d00 = Vec3Df::dotProduct(u, u);
+	float d01 = Vec3Df::dotProduct(u, v);
+	float d11 = Vec3Df::dotProduct(v, v);
+	float d20 = Vec3Df::dotProduct(p - p0, u);
+	float d21 = Vec3Df::dotProduct(p - p0, v);
+	float invDenom = 1.f / (d00 * d11 - d01 * d01);
+	a = (d11 * d20 - d01 * d21) * invDenom;
+	b = (d00 * d21 - d01 * d20) * invDenom;
+	return !(a < -EPSILON || b < -EPSILON || a + b > 1);
+}
+
+/**
+ * Test the triangles of a leaf, and keep the closest hit.
+ * Scalar leaves keep the closest triangle by the distance of its intersection point, and of
+ * equally close ones the first, exactly like testing every triangle in order.
  */
-MyMesh::MyMesh(Mesh mesh, Vec3Df origin) : Shape(mesh.materials[0], origin), _mesh(mesh) {}
+void MyMesh::intersectLeaf(unsigned int leaf, const Vec3Df& origin, const Vec3Df& localOrigin, const Vec3Df& direction, Hit& hit) const {
+	const BVHNode& node = _bvh._nodes[leaf];
+
+	if (_options.leaves == MESH_LEAVES_SOA) {
+		const TriangleBlock* block = &_blocks[_leafBlocks[leaf]];
+		for (unsigned int i = 0; i < node.count; i += TRIANGLE_BLOCK_SIZE, block++) {
+			// Of equally close triangles the first wins, whatever order the leaves are visited in.
+			float t = hit.t, a, b;
+			int lane = intersectTriangleBlock(*block, localOrigin, direction, t, a, b);
+			if (lane >= 0 && (t < hit.t || block->triangle[lane] < hit.triangle)) {
+				hit.t = t;
+				hit.triangle = block->triangle[lane];
+				hit.a = a;
+				hit.b = b;
+				hit.found = true;
+			}
+		}
+		return;
+	}
+
+	for (unsigned int i = 0; i < node.count; i++) {
+		unsigned int triangle = _bvh._indices[node.first + i];
+		float t, a, b;
+		Vec3Df p;
+		if (!hitTriangle(triangle, origin, direction, t, p, a, b))
+			continue;
+
+		float depth = (p - origin).getLength();
+		if (depth < hit.depth || (depth == hit.depth && triangle < hit.triangle)) {
+			hit.depth = depth;
+			hit.t = t;
+			hit.point = p;
+			hit.triangle = triangle;
+			hit.a = a;
+			hit.b = b;
+			hit.found = true;
+		}
+	}
+}
+
+bool MyMesh::occludedBy(unsigned int leaf, const Vec3Df& origin, const Vec3Df& direction, float distance) const {
+	// The leaf may be of a BVH that setOrigin() built again since, inner nodes have no triangles.
+	if (leaf >= _bvh._nodes.size())
+		return false;
+	const BVHNode& node = _bvh._nodes[leaf];
+	for (unsigned int i = 0; i < node.count; i++) {
+		float t, a, b;
+		Vec3Df p;
+		if (hitTriangle(_bvh._indices[node.first + i], origin, direction, t, p, a, b) && (p - origin).getLength() < distance)
+			return true;
+	}
+	return false;
+}
 
 /**
- * Intersection method for the whole mesh.
+ * Any hit closer than a distance. Any triangle closer than the distance means the closest one is,
+ * so this answers the same as intersection() followed by a distance check.
+ */
+bool MyMesh::occluded(const Vec3Df& origin, const Vec3Df& direction, float distance, unsigned int& leaf, unsigned int& nodes) const {
+	if (_bvh.empty())
+		return false;
+
+	BVHRay ray(origin - _origin, direction);
+
+	// A little beyond the distance, the boxes and the triangles round differently.
+	const float tMax = distance / direction.getLength() * 1.0001f + EPSILON;
+	unsigned int stack[BVH::MAX_DEPTH + 1];
+	unsigned int size = 0;
+	float tNear;
+	if (intersectBox(_bvh._nodes[0], ray, tMax, tNear))
+		stack[size++] = 0;
+
+	while (size > 0) {
+		const unsigned int index = stack[--size];
+		const BVHNode& node = _bvh._nodes[index];
+		nodes++;
+		if (node.isLeaf()) {
+			if (occludedBy(index, origin, direction, distance)) {
+				leaf = index;
+				return true;
+			}
+			continue;
+		}
+
+		for (unsigned int child = node.first; child < node.first + 2; child++)
+			if (intersectBox(_bvh._nodes[child], ray, tMax, tNear))
+				stack[size++] = child;
+	}
+	return false;
+}
+
+/**
+ * Intersection method for the whole mesh, through the binary or the wide BVH.
+ * The normal is only interpolated for the closest triangle.
  */
 bool MyMesh::intersection(const Vec3Df& origin, const Vec3Df& direction, Vec3Df& new_origin, Vec3Df& new_direction){
-	//
-	// See this for explanation: https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-	//
+	if (_bvh.empty())
+		return false;
 
-	// Closest triangle
-	float ClosestTriangle = FLT_MAX;
+	BVHRay ray(origin - _origin, direction);
+	const Vec3Df localOrigin = origin - _origin;
 
-	// Tmp values
-	Vec3Df tmp_new_origin, tmp_new_direction;
+	Hit hit;
+	hit.t = hit.depth = FLT_MAX;
+	hit.triangle = 0;
+	hit.a = hit.b = 0.f;
+	hit.found = false;
 
-	// Has intersected
-	bool hasIntersected = false;
+	if (_options.wide) {
+		// Every node pushes at most three more children than it pops.
+		unsigned int stack[3 * BVH::MAX_DEPTH + 1];
+		unsigned int size = 0;
+		stack[size++] = 0;
 
-	for (size_t i = 0; i < _mesh.triangles.size(); i++) {
-		if (intersection(_mesh.triangles[i], origin, direction, tmp_new_origin, tmp_new_direction)) {
-			if ((tmp_new_origin - origin).getLength() < ClosestTriangle) {
-				ClosestTriangle = (tmp_new_origin - origin).getLength();
-				new_origin = tmp_new_origin;
-				new_direction = tmp_new_direction;
-				hasIntersected = true;
+		while (size > 0) {
+			unsigned int child = stack[--size];
+			if (child & WIDE_BVH_LEAF) {
+				intersectLeaf(child & ~WIDE_BVH_LEAF, origin, localOrigin, direction, hit);
+				continue;
+			}
 
-				TriangleShape* triangleShape = new TriangleShape(_mesh.materials[_mesh.triangleMaterials[i]], _mesh.triangles[i]);
-				// New last intersected triangle.
-				_lastIntersectedTriangle = triangleShape;
+			// A little beyond the closest hit, the boxes and the triangles round differently.
+			const WideBVHNode& node = _wide._nodes[child];
+			float tLimit = hit.found ? hit.t * 1.0001f + EPSILON : FLT_MAX;
+			float tNear[WIDE_BVH_WIDTH];
+			unsigned int hits = intersectChildren(node, ray, tLimit, tNear);
+
+			// The hit children sorted from far to near, so the nearest is popped first.
+			unsigned int order[WIDE_BVH_WIDTH];
+			unsigned int count = 0;
+			for (unsigned int i = 0; i < node.childCount; i++) {
+				if (!(hits & (1u << i)))
+					continue;
+				unsigned int j = count++;
+				for (; j > 0 && tNear[order[j - 1]] < tNear[i]; j--)
+					order[j] = order[j - 1];
+				order[j] = i;
 			}
+			for (unsigned int i = 0; i < count; i++)
+				stack[size++] = node.child[order[i]];
 		}
 	}
+	else {
+		unsigned int stack[BVH::MAX_DEPTH + 1];
+		unsigned int size = 0;
+		float tNear, tFar;
+		if (intersectBox(_bvh._nodes[0], ray, FLT_MAX, tNear))
+			stack[size++] = 0;
 
-	return hasIntersected;
+		while (size > 0) {
+			unsigned int index = stack[--size];
+			const BVHNode& node = _bvh._nodes[index];
+			if (node.isLeaf()) {
+				intersectLeaf(index, origin, localOrigin, direction, hit);
+				continue;
+			}
+
+			float tLimit = hit.found ? hit.t * 1.0001f + EPSILON : FLT_MAX;
+			bool hitNear = intersectBox(_bvh._nodes[node.first], ray, tLimit, tNear);
+			bool hitFar = intersectBox(_bvh._nodes[node.first + 1], ray, tLimit, tFar);
+			unsigned int nearChild = node.first, farChild = node.first + 1;
+			if (hitNear && hitFar && tFar < tNear) {
+				std::swap(nearChild, farChild);
+			}
+			else if (!hitNear) {
+				nearChild = farChild;
+				hitNear = hitFar;
+				hitFar = false;
+			}
+			// The near child is visited first, so it goes on the stack last.
+			if (hitFar)
+				stack[size++] = farChild;
+			if (hitNear)
+				stack[size++] = nearChild;
+		}
+	}
+
+	if (!hit.found)
+		return false;
+
+	new_origin = _options.leaves == MESH_LEAVES_SOA ? origin + hit.t * direction : hit.point;
+
+	const unsigned int* vertices = triangleVertices(hit.triangle);
+	new_direction = (1 - hit.a - hit.b) * (vertexNormal(vertices[0]) + _origin) +
+		hit.a * (vertexNormal(vertices[1]) + _origin) +
+		hit.b * (vertexNormal(vertices[2]) + _origin);
+	new_direction.normalize();
+
+	// New last intersected triangle.
+	_lastIntersectedTriangle = triangleShape(hit.triangle);
+	return true;
 }
 
 /**
@@ -112,6 +495,19 @@ void MyMesh::barycentric(const Triangle &triangle, const Vec3Df &p, float &a, fl
 	b = (d00 * d21 - d01 * d20) * invDenom;
 }
 
+/**
+ * Memory of the geometry, the texture coordinates, the triangle shapes and the BVH.
+ */
+size_t MyMesh::memoryUsage() const {
+	size_t bytes = _triangleShapes.capacity() * sizeof(TriangleShape) + _bvh.memoryUsage() + _wide.memoryUsage()
+		+ _blocks.capacity() * sizeof(TriangleBlock) + _leafBlocks.capacity() * sizeof(unsigned int);
+	if (_options.storage != MESH_STORAGE_FULL)
+		return bytes + _compact.memoryUsage();
+
+	return bytes + _mesh.vertices.capacity() * sizeof(Vertex) + _mesh.texcoords.capacity() * sizeof(Vec3Df)
+		+ _mesh.triangles.capacity() * sizeof(Triangle) + _mesh.triangleMaterials.capacity() * sizeof(unsigned int);
+}
+
 /**
  * Shading method specific for MyMesh.
  */
@@ -130,5 +526,26 @@ Vec3Df MyMesh::refract(const Vec3Df &normal, const Vec3Df &direction, const floa
  * Draw function to view the plane in the viewport.
  */
 void MyMesh::draw() {
-	_mesh.draw(_origin);
+	if (_options.storage == MESH_STORAGE_FULL) {
+		_mesh.draw(_origin);
+		return;
+	}
+
+	// As Mesh::draw, from the compact geometry.
+	glBegin(GL_TRIANGLES);
+	for (size_t i = 0; i < _compact.size(); i++) {
+		const CompactTriangle& triangle = _compact._triangles[i];
+		Vec3Df col = _mesh.materials[_compact._triangleMaterials[i]].Kd();
+		glColor3fv(col.pointer());
+
+		Vec3Df p[3];
+		for (int v = 0; v < 3; v++)
+			p[v] = _compact.position(triangle.v[v]) + _origin;
+		Vec3Df n = Vec3Df::crossProduct(p[1] - p[0], p[2] - p[0]);
+		n.normalize();
+		glNormal3f(n[0], n[1], n[2]);
+		for (int v = 0; v < 3; v++)
+			glVertex3f(p[v][0], p[v][1], p[v][2]);
+	}
+	glEnd();
 }
\ No newline at end of file
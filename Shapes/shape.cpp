@@ -1,56 +1,93 @@
 #include "shape.h"
 
-Shape::Shape(Material& material, Vec3Df origin) : _material(material), _origin(origin) {}
+Shape::Shape(Material& material, Vec3Df origin) : _origin(origin), _material(material), _record(&materialRecord(compileMaterial(material))),
+	textureMapSet(false), _textureMap(nullptr), normalMapSet(false), _normalMap(nullptr) {}
 
+/**
+ * Constructor, with a material that was compiled already.
+ */
+Shape::Shape(Material& material, Vec3Df origin, unsigned int materialId) : _origin(origin), _material(material), _record(&materialRecord(materialId)),
+	textureMapSet(false), _textureMap(nullptr), normalMapSet(false), _normalMap(nullptr) {}
 
 /**
- * Basic shading method using Phong.
+ * Set the texture, its handle goes in the material record of this shape.
  */
-Vec3Df Shape::shade(const Vec3Df& camPos, const Vec3Df& intersection, const Vec3Df& lightPos, const Vec3Df& normal) {
-	Vec3Df ambient(0.f, 0.f, 0.f);
-	Vec3Df diffuse(0.f, 0.f, 0.f);
-	Vec3Df specular(0.f, 0.f, 0.f);
+void Shape::setTexture(Texture* textureMap) {
+	textureMapSet = true;
+	_textureMap = textureMap;
+	_record = &materialRecord(compileMaterial(_material, textureMap));
+}
 
+/**
+ * Phong shading kernel.
+ *
+ * Terms of parameters the material doesn't have are left out at compile time, so the
+ * diffuse only kernel has no branches. All kernels do the same operations as testing
+ * the parameters one by one.
+ */
+template <unsigned int FEATURES>
+static Vec3Df phongKernel(const MaterialRecord& material, const Vec3Df& camPos, const Vec3Df& intersection, const Vec3Df& lightPos, const Vec3Df& normal, const Vec3Df& diffuseColor) {
 	Vec3Df lightVec = lightPos - intersection;
 	lightVec.normalize();
 
-	if (this->_material.has_Ka()) ambient = _material.Ka();
-	if (this->_material.has_Kd()) {
-		float dot = Vec3Df::dotProduct(normal, lightVec);
-		if (dot < 0)
-			dot = Vec3Df::dotProduct(-normal, lightVec);
-		diffuse = dot * _material.Kd();
-	}
-	if (this->_material.has_Ks()){
+	// A light behind the surface lights it as if it were in front.
+	float dot = std::abs(Vec3Df::dotProduct(normal, lightVec));
+	Vec3Df color = (FEATURES & MATERIAL_KD) ? dot * diffuseColor : Vec3Df(0.f, 0.f, 0.f);
+	if (FEATURES & MATERIAL_KA)
+		color = material.Ka + color;
+
+	if (FEATURES & MATERIAL_KS) {
 		Vec3Df reflect = 2 * Vec3Df::dotProduct(lightVec, normal) * normal - lightVec;
 		Vec3Df view = camPos - intersection;
 		view.normalize();
 
-		if (Vec3Df::dotProduct(view, reflect) < 0) {
-			specular = Vec3Df(0, 0, 0);
-		}
-		else {
-			float shininess;
-			if (this->_material.has_Ns()) shininess = _material.Ns();
-			else shininess = 21;
-			specular = pow(Vec3Df::dotProduct(reflect, view), shininess) * _material.Ks();
+		if (Vec3Df::dotProduct(view, reflect) >= 0) {
+			float shininess = (FEATURES & MATERIAL_NS) ? material.Ns : 21;
+			color += pow(Vec3Df::dotProduct(reflect, view), shininess) * material.Ks;
 		}
 	}
-	return ambient + diffuse + specular;
+	return color;
+}
+
+// One kernel for every combination of the Kd, Ka, Ks and Ns bits.
+static const PhongKernel phongKernels[16] = {
+	phongKernel<0>, phongKernel<1>, phongKernel<2>, phongKernel<3>,
+	phongKernel<4>, phongKernel<5>, phongKernel<6>, phongKernel<7>,
+	phongKernel<8>, phongKernel<9>, phongKernel<10>, phongKernel<11>,
+	phongKernel<12>, phongKernel<13>, phongKernel<14>, phongKernel<15>
+};
+
+PhongKernel phongKernel(unsigned int features) {
+	return phongKernels[features & (MATERIAL_KD | MATERIAL_KA | MATERIAL_KS | MATERIAL_NS)];
+}
+
+/**
+ * Basic shading method using Phong.
+ */
+Vec3Df Shape::shade(const Vec3Df& camPos, const Vec3Df& intersection, const Vec3Df& lightPos, const Vec3Df& normal) {
+	// Without a diffuse color the kernel leaves out the diffuse term.
+	return phongKernel(_record->features)(*_record, camPos, intersection, lightPos, normal, _record->Kd);
+}
+
+/**
+ * Phong shading with an explicit diffuse color.
+ */
+Vec3Df Shape::phong(const Vec3Df& camPos, const Vec3Df& intersection, const Vec3Df& lightPos, const Vec3Df& normal, const Vec3Df& diffuseColor) {
+	return phongKernel(_record->features | MATERIAL_KD)(*_record, camPos, intersection, lightPos, normal, diffuseColor);
 }
 
 /**
 * Basic refraction method.
 */
 Vec3Df Shape::refract(const Vec3Df &normal, const Vec3Df &direction, const float &ni, float &fresnel) {
-	if (this->_material.has_Ni()) {
+	if (_record->features & MATERIAL_NI) {
 		float dot = Vec3Df::dotProduct(normal, direction);
 		float ni1, ni2;
 		Vec3Df realNormal = normal;
 
 		// If dot(N,D) > 0, then we're exiting the medium
 		if (dot > 0) {
-			ni1 = this->_material.Ni();
+			ni1 = _record->Ni;
 			ni2 = ni;
 			realNormal = -normal;
 
@@ -63,7 +100,7 @@ Vec3Df Shape::refract(const Vec3Df &normal, const Vec3Df &direction, const float
 		else {
 			// FIXME: fresnel here too?
 			ni1 = ni;
-			ni2 = this->_material.Ni();
+			ni2 = _record->Ni;
 			dot = Vec3Df::dotProduct(-normal, direction);
 
 
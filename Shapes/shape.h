@@ -1,8 +1,16 @@
 #ifndef SHAPES_header
 #define SHAPES_header
 
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
 #include "../Vec3D.h"
 #include "../mesh.h"
+#include "../compactmesh.h"
+#include "../bvh.h"
+#include "../triangleblock.h"
+#include "../widebvh.h"
 #include "../material.h"
 #include "../texture.h"
 #include "../image.h"
@@ -10,6 +18,15 @@
 // EPSILON -> Used for rounding errors. (Margin)
 static const float EPSILON = 1e-4f;
 
+/**
+ * A Phong shading kernel, compiled for one combination of the Kd, Ka, Ks and Ns features.
+ * Params as Shape::phong, with the material record first.
+ */
+typedef Vec3Df (*PhongKernel)(const MaterialRecord&, const Vec3Df&, const Vec3Df&, const Vec3Df&, const Vec3Df&, const Vec3Df&);
+
+// The kernel for the features of a material, see MaterialFeature.
+PhongKernel phongKernel(unsigned int features);
+
 /**
  * Shape class. All shapes inherit from this class.
  */
@@ -17,6 +34,8 @@ class Shape {
 	public:
 		// Constructor
 		Shape(Material& material, Vec3Df origin);
+		Shape(Material& material, Vec3Df origin, unsigned int materialId);
+		virtual ~Shape() {}
 
 		/**
 		 * Method to check if a ray intersects with this shape.
@@ -38,6 +57,12 @@ class Shape {
 		*/
 		virtual Vec3Df shade(const Vec3Df&, const Vec3Df&, const Vec3Df&, const Vec3Df&) = 0;
 
+		/**
+		* Phong shading with an explicit diffuse color, so textures don't have to change the material.
+		* Params as shade(), the 5th param is the diffuse color to use instead of Kd.
+		*/
+		Vec3Df phong(const Vec3Df&, const Vec3Df&, const Vec3Df&, const Vec3Df&, const Vec3Df&);
+
 		/**
 		* Calculate the refraction vector. For simplicity, all vectors must be normalized.
 		* 1st param:	The normal at the point of intersection.
@@ -59,16 +84,26 @@ class Shape {
 		virtual bool hasMaterial() { return true; }
 		virtual Material& getMaterial() { return _material; }
 		bool hasTexture() { return textureMapSet; }
-		void setTexture(Texture* textureMap) { textureMapSet = true; _textureMap = textureMap; }
+		void setTexture(Texture* textureMap);
 		void setNormalMap(Texture* normalMap) { normalMapSet = true; _normalMap = normalMap; }
 
 		// Draw function
 		// Used so we can see our shape in the viewport. -> Not used for raytracing
 		virtual void draw() = 0;
 
+		/**
+		 * Move the shape, between frames only: rays must not be traced while it moves.
+		 * Call refitShapeArrays() after moving shapes.
+		 */
+		virtual void setOrigin(const Vec3Df& origin) { _origin = origin; }
+
 		// Variables
-		const Vec3Df _origin;
+		Vec3Df _origin;
 		Material &_material;
+
+		// The compiled material, see MaterialRecord. Ray tracing and shading only read this.
+		const MaterialRecord* _record;
+
 		bool textureMapSet;
 		Texture* _textureMap;
 		bool normalMapSet;
@@ -126,6 +161,8 @@ class TriangleShape : public Shape {
 	public:
 		// Constructor
 		TriangleShape(Material& material, Triangle &triangle);
+		TriangleShape(Material& material, Triangle &triangle, unsigned int materialId);
+		TriangleShape(Material& material, unsigned int materialId);
 
 		// Inherited methods.
 		virtual bool intersection(const Vec3Df&, const Vec3Df&, Vec3Df&, Vec3Df&);
@@ -137,17 +174,35 @@ class TriangleShape : public Shape {
 		// Draw method
 		virtual void draw();
 
-		// Triangle
-		Triangle &_triangle;
+		// Triangle, nullptr when the shape is shared by the triangles of one material of a compact mesh.
+		const Triangle* _triangle;
 };
 
+/**
+ * How a MyMesh stores its triangles and builds its BVH.
+ */
+struct MeshOptions {
+	MeshOptions();
+
+	MeshStorage storage;
+	MeshLeaves leaves;
+	bool wide;		// Trace through a 4-wide BVH collapsed from the binary one.
+	BVHBuilder builder;
+	float spatialBudget;	// SBVH only: references beyond one per triangle, as a fraction of the triangles.
+	unsigned int buildThreads;	// Threads the SAH and LBVH builds use, 0 for one per core.
+};
+
+// Options of the meshes made from now on, set by the benchmark. Scene files start from them.
+extern MeshOptions meshOptions;
+
 /**
  * Mesh
  */
 class MyMesh : public Shape {
 public:
-	// Contructor
-	MyMesh(Mesh mesh, Vec3Df origin);
+	// Contructor, the first copies the mesh and the second takes it over.
+	MyMesh(const Mesh& mesh, Vec3Df origin, const MeshOptions& options = MeshOptions());
+	MyMesh(Mesh&& mesh, Vec3Df origin, const MeshOptions& options = MeshOptions());
 
 	// Inherited methods.
 	virtual bool intersection(const Vec3Df&, const Vec3Df&, Vec3Df&, Vec3Df&);
@@ -157,19 +212,153 @@ public:
 
 	virtual Shape* getIntersectedShape() { return  _lastIntersectedTriangle; }
 
+	// The BVH stays in mesh space, it is only built again when the mesh moves so far that its padding is too small.
+	virtual void setOrigin(const Vec3Df& origin);
+
 	// Methods special to this class
 	void barycentric(const Triangle &triangle, const Vec3Df &p, float &a, float &b);
 
+	/**
+	 * Whether any triangle is closer than a distance along a ray, for shadow rays. Stops at the
+	 * first such triangle instead of finding the closest, through the binary BVH.
+	 * 1st param:	Origin of the ray.
+	 * 2nd param:	Direction of the ray.
+	 * 3rd param:	Distance from the origin.
+	 * 4th param:	Gets the BVH leaf of the triangle.
+	 * 5th param:	Is increased by the number of BVH nodes visited.
+	 */
+	bool occluded(const Vec3Df& origin, const Vec3Df& direction, float distance, unsigned int& leaf, unsigned int& nodes) const;
+
+	// Whether a triangle of a BVH leaf is closer than a distance along a ray.
+	bool occludedBy(unsigned int leaf, const Vec3Df& origin, const Vec3Df& direction, float distance) const;
+
+	// Number of bytes used by the geometry, the triangle shapes and the BVH.
+	size_t memoryUsage() const;
+
+	// Number of triangles.
+	size_t triangleCount() const;
+
+	// Milliseconds it took to build the BVH.
+	double buildTime() const { return _buildTime; }
+
 	// Draw method
 	virtual void draw();
 
 	// Variables
 
-	// Last intersected triangle
-	TriangleShape *_lastIntersectedTriangle;
+	// Last intersected triangle, per thread so several threads can trace the same mesh.
+	static thread_local TriangleShape *_lastIntersectedTriangle;
 	
 	// Pointer to the mesh.
 	Mesh _mesh;
+
+	// One shape per triangle, so an intersection doesn't have to allocate one.
+	// Compact meshes have one shape per material instead.
+	std::vector<TriangleShape> _triangleShapes;
+
+	// How the triangles are stored and traced.
+	MeshOptions _options;
+
+	// Compact geometry, compact meshes only keep the materials in _mesh.
+	CompactMesh _compact;
+
+	// BVH over the triangles in mesh space, and its wide version. SoA leaves keep their
+	// triangles in _blocks, starting at _leafBlocks of the leaf node.
+	BVH _bvh;
+	WideBVH _wide;
+	std::vector<TriangleBlock> _blocks;
+	std::vector<unsigned int> _leafBlocks;
+	double _buildTime;
+
+	// Margin of the boxes of the BVH, and the largest coordinate of the mesh in mesh space.
+	float _padding;
+	float _extent;
+
+private:
+	// The closest hit during a traversal.
+	struct Hit {
+		float t;			// Distance along the ray.
+		float depth;		// Distance to the origin of the ray, for scalar leaves.
+		unsigned int triangle;
+		float a, b;			// Barycentric coordinates.
+		Vec3Df point;
+		bool found;
+	};
+
+	// Test the triangles of a leaf of _bvh.
+	void intersectLeaf(unsigned int leaf, const Vec3Df& origin, const Vec3Df& localOrigin, const Vec3Df& direction, Hit& hit) const;
+
+	// Triangle and vertex data, in either storage.
+	const unsigned int* triangleVertices(unsigned int triangle) const;
+	Vec3Df vertexPosition(unsigned int vertex) const;
+	Vec3Df vertexNormal(unsigned int vertex) const;
+	TriangleShape* triangleShape(unsigned int triangle);
+
+	// Build _bvh and the triangle blocks.
+	void buildBVH();
+
+	// Compile the materials, create the triangle shapes and build the BVH.
+	void createShapes();
+
+	// Intersection of one triangle, without the normal.
+	bool hitTriangle(unsigned int triangle, const Vec3Df& origin, const Vec3Df& direction, float& t, Vec3Df& p, float& a, float& b) const;
+};
+
+/**
+ * LazyMesh
+ *
+ * A mesh that is referenced by its OBJ file, and only loaded when it is needed.
+ * With bounds, the file is loaded when the first ray enters them, so meshes the camera
+ * never sees are never loaded. Without bounds, prefetch() loads it in the background.
+ * Loads of different meshes run in parallel; a ray that needs a mesh that is still
+ * loading waits for it.
+ */
+class LazyMesh : public Shape {
+public:
+	// Constructor
+	LazyMesh(const std::string& filename, Vec3Df origin, const MeshOptions& options);
+	LazyMesh(const std::string& filename, Vec3Df origin, Vec3Df boundsMin, Vec3Df boundsMax, const MeshOptions& options);
+	virtual ~LazyMesh();
+
+	// Inherited methods, forwarded to the loaded mesh.
+	virtual bool intersection(const Vec3Df&, const Vec3Df&, Vec3Df&, Vec3Df&);
+	virtual Vec3Df shade(const Vec3Df&, const Vec3Df&, const Vec3Df&, const Vec3Df&);
+	virtual Vec3Df refract(const Vec3Df&, const Vec3Df&, const float&, float&);
+
+	virtual Shape* getIntersectedShape() { return MyMesh::_lastIntersectedTriangle; }
+
+	// Draw method, draws nothing until the mesh is loaded.
+	virtual void draw();
+
+	// Moves the bounds and the loaded mesh along.
+	virtual void setOrigin(const Vec3Df& origin);
+
+	// Methods special to this class
+
+	// Start loading the mesh in the background.
+	void prefetch();
+
+	// The loaded mesh, loads it first if needed. Null when the file can't be loaded.
+	MyMesh* mesh();
+
+	// Whether the mesh is loaded.
+	bool isLoaded() const { return _mesh != nullptr; }
+
+	// Variables
+	const std::string _filename;
+	const bool _hasBounds;
+	Vec3Df _boundsMin;
+	Vec3Df _boundsMax;
+
+	// Options the mesh is built with once it is loaded.
+	const MeshOptions _options;
+
+private:
+	MyMesh* load();
+
+	std::atomic<MyMesh*> _mesh;
+	std::mutex _mutex;
+	std::shared_future<MyMesh*> _loading;
 };
 
 #endif // SHAPES_header
\ No newline at end of file
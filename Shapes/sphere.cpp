@@ -51,7 +51,7 @@ bool Sphere::intersection(const Vec3Df& origin, const Vec3Df& direction, Vec3Df&
  * Shading method specific for sphere.
  */
 Vec3Df Sphere::shade(const Vec3Df& camPos, const Vec3Df& intersect, const Vec3Df& lightPos, const Vec3Df& normal){
-	if (!_material.has_tex())
+	if (!(_record->features & MATERIAL_TEX))
 		return Shape::shade(camPos, intersect, lightPos, normal);
 	float u, v;
 	Vec3Df mid = this->_origin;
@@ -66,9 +66,8 @@ Vec3Df Sphere::shade(const Vec3Df& camPos, const Vec3Df& intersect, const Vec3Df
 	if (v < 0)
 		v = 0;
 			
-	Vec3Df diffuse = this->_textureMap->getColor(u, v);
-	this->_material.set_Kd(diffuse[0], diffuse[1], diffuse[2]);
-	return Shape::shade(camPos, intersect, lightPos, normal);
+	Vec3Df diffuse = materialTexture(_record->texture)->getColor(u, v);
+	return Shape::phong(camPos, intersect, lightPos, normal, diffuse);
 }
 
 /**
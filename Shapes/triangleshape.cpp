@@ -8,7 +8,17 @@
 *
 * Constructor
 */
-TriangleShape::TriangleShape(Material &material, Triangle &triangle) : Shape(material, Vec3Df(0,0,0)), _triangle(triangle) {}
+TriangleShape::TriangleShape(Material &material, Triangle &triangle) : Shape(material, Vec3Df(0,0,0)), _triangle(&triangle) {}
+
+/**
+* Constructor, with a material that was compiled already.
+*/
+TriangleShape::TriangleShape(Material &material, Triangle &triangle, unsigned int materialId) : Shape(material, Vec3Df(0,0,0), materialId), _triangle(&triangle) {}
+
+/**
+* Constructor for the shape of all triangles of one material, used by compact meshes.
+*/
+TriangleShape::TriangleShape(Material &material, unsigned int materialId) : Shape(material, Vec3Df(0,0,0), materialId), _triangle(nullptr) {}
 
 /**
 * Intersection method, returns if collided, and which color.
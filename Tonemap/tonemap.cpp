@@ -0,0 +1,56 @@
+/**
+ * Tonemap
+ *
+ * Turns the linear PFM file of a render into a PPM file with another exposure, so a render
+ * doesn't have to be repeated for every exposure tweak. With the defaults (exposure 0, clamp,
+ * gamma 1) the output is the same as the result.ppm written by the render.
+ *   RaytracerTonemap input.pfm output.ppm [--exposure stops] [--reinhard] [--gamma g]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../image.h"
+
+int main(int argc, char** argv)
+{
+	const char* input = nullptr;
+	const char* output = nullptr;
+	float exposure = 0.f;
+	float gamma = 1.f;
+	bool reinhard = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--exposure") && i + 1 < argc) exposure = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--gamma") && i + 1 < argc) gamma = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--reinhard")) reinhard = true;
+		else if (argv[i][0] != '-' && input == nullptr) input = argv[i];
+		else if (argv[i][0] != '-' && output == nullptr) output = argv[i];
+		else {
+			input = nullptr;
+			break;
+		}
+	}
+	if (input == nullptr || output == nullptr || gamma <= 0.f) {
+		printf("Usage: %s input.pfm output.ppm [--exposure stops] [--reinhard] [--gamma g]\n", argv[0]);
+		return 2;
+	}
+
+	Image image(input);
+	if (image._image.empty())
+		return 1;
+
+	// Scale by 2^exposure, compress with x / (1 + x) if asked, then gamma.
+	// writeImage clamps what is left outside [0, 1].
+	float scale = powf(2.f, exposure);
+	for (size_t i = 0; i < image._image.size(); i++) {
+		float value = image._image[i] * scale;
+		if (reinhard)
+			value = value / (1.f + value);
+		if (gamma != 1.f && value > 0.f)
+			value = powf(value, 1.f / gamma);
+		image._image[i] = value;
+	}
+
+	return image.writeImage(output) ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+#include "animation.h"
+#include "image.h"
+#include "render.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+CameraPath::CameraPath() {}
+
+CameraPath::CameraPath(const std::vector<CameraKeyframe>& keyframes) : _keyframes(keyframes)
+{
+	std::stable_sort(_keyframes.begin(), _keyframes.end(), [](const CameraKeyframe& a, const CameraKeyframe& b) {
+		return a.time < b.time;
+	});
+}
+
+/**
+ * Tangent of the spline at keyframe i, per unit of time: the slope between its neighbours,
+ * or to its only neighbour at the ends.
+ */
+static Vec3Df tangent(const std::vector<CameraKeyframe>& keyframes, size_t i, Vec3Df CameraKeyframe::*point)
+{
+	size_t before = i > 0 ? i - 1 : i;
+	size_t after = i + 1 < keyframes.size() ? i + 1 : i;
+	float time = keyframes[after].time - keyframes[before].time;
+	if (time <= 0.f)
+		return Vec3Df(0.f, 0.f, 0.f);
+	return (keyframes[after].*point - keyframes[before].*point) / time;
+}
+
+/**
+ * Cubic Hermite interpolation of a point between keyframes i and i + 1, s in [0, 1].
+ */
+static Vec3Df hermite(const std::vector<CameraKeyframe>& keyframes, size_t i, float s, Vec3Df CameraKeyframe::*point)
+{
+	float duration = keyframes[i + 1].time - keyframes[i].time;
+	float s2 = s * s, s3 = s2 * s;
+	return (2.f * s3 - 3.f * s2 + 1.f) * (keyframes[i].*point)
+		+ ((s3 - 2.f * s2 + s) * duration) * tangent(keyframes, i, point)
+		+ (-2.f * s3 + 3.f * s2) * (keyframes[i + 1].*point)
+		+ ((s3 - s2) * duration) * tangent(keyframes, i + 1, point);
+}
+
+CameraKeyframe CameraPath::evaluate(float time) const
+{
+	if (time <= _keyframes.front().time)
+		return _keyframes.front();
+	if (time >= _keyframes.back().time)
+		return _keyframes.back();
+
+	// The segment [i, i + 1] which contains the time, keyframes at the same time are a jump.
+	size_t i = 0;
+	while (_keyframes[i + 1].time <= time)
+		i++;
+	const CameraKeyframe& from = _keyframes[i];
+	const CameraKeyframe& to = _keyframes[i + 1];
+	float s = (time - from.time) / (to.time - from.time);
+
+	CameraKeyframe result;
+	result.time = time;
+	result.eye = hermite(_keyframes, i, s, &CameraKeyframe::eye);
+	result.target = hermite(_keyframes, i, s, &CameraKeyframe::target);
+	result.up = (1.f - s) * from.up + s * to.up;
+	result.fov = (1.f - s) * from.fov + s * to.fov;
+	return result;
+}
+
+Camera CameraPath::frameCamera(unsigned int frame, unsigned int frames, unsigned int width, unsigned int height) const
+{
+	float time = startTime();
+	if (frames > 1)
+		time += (endTime() - startTime()) * frame / float(frames - 1);
+	CameraKeyframe camera = evaluate(time);
+	return Camera::lookAt(camera.eye, camera.target, camera.up, camera.fov, width, height);
+}
+
+std::string frameFilename(const std::string& prefix, unsigned int frame)
+{
+	std::string number = std::to_string(frame);
+	if (number.size() < 4)
+		number.insert(0, 4 - number.size(), '0');
+	return prefix + number + ".ppm";
+}
+
+/**
+ * A frame being rendered: its camera and image are made by the first thread that needs them,
+ * the image is written and freed once its last tile is done.
+ */
+struct AnimationFrame {
+	AnimationFrame() : image(nullptr), remaining(0), ready(false) {}
+
+	Camera camera;
+	Image* image;
+	unsigned int remaining;
+	bool ready;
+};
+
+/**
+ * Writes finished frames on its own thread, so rendering continues while a frame is written.
+ */
+class FrameWriter {
+	public:
+		FrameWriter(const std::string& prefix) : _prefix(prefix), _done(false), _ok(true) {
+			_thread = std::thread(&FrameWriter::run, this);
+		}
+
+		// Queue a frame, the image is deleted once it is written.
+		void write(unsigned int frame, Image* image) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_queue.push_back(std::make_pair(frame, image));
+			_condition.notify_one();
+		}
+
+		// Write the remaining frames, and return whether all were written.
+		bool finish() {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_done = true;
+				_condition.notify_one();
+			}
+			_thread.join();
+			return _ok;
+		}
+
+	private:
+		void run() {
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true) {
+				while (_queue.empty() && !_done)
+					_condition.wait(lock);
+				if (_queue.empty())
+					return;
+
+				std::pair<unsigned int, Image*> frame = _queue.front();
+				_queue.erase(_queue.begin());
+				lock.unlock();
+				bool ok = frame.second->writeImage(frameFilename(_prefix, frame.first).c_str());
+				delete frame.second;
+				lock.lock();
+				_ok = _ok && ok;
+			}
+		}
+
+		std::string _prefix;
+		std::thread _thread;
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		std::vector<std::pair<unsigned int, Image*> > _queue;
+		bool _done;
+		bool _ok;
+};
+
+bool renderAnimation(const CameraPath& path, unsigned int frames, unsigned int width, unsigned int height, unsigned int ns,
+	const std::string& prefix, unsigned int threads, bool pipelined, bool showProgress)
+{
+	const std::vector<Tile> frameTiles = makeTiles(width, height);
+	const unsigned int tilesPerFrame = (unsigned int)frameTiles.size();
+
+	if (!pipelined) {
+		bool ok = true;
+		for (unsigned int f = 0; f < frames; f++) {
+			Camera camera = path.frameCamera(f, frames, width, height);
+			Image image(width, height);
+			renderTiles(frameTiles, threads, [&camera, ns](const Tile& tile, std::vector<float>& pixels) {
+				renderTile(camera, ns, tile, pixels);
+			}, [&image](const Tile& tile, std::vector<float>& pixels) {
+				storeTile(image, tile, pixels);
+			}, showProgress);
+			ok = image.writeImage(frameFilename(prefix, f).c_str()) && ok;
+		}
+		return ok;
+	}
+
+	// One queue with the tiles of every frame, tile i belongs to frame i / tilesPerFrame.
+	std::vector<Tile> tiles;
+	tiles.reserve(size_t(tilesPerFrame) * frames);
+	for (unsigned int f = 0; f < frames; f++) {
+		for (unsigned int t = 0; t < tilesPerFrame; t++) {
+			Tile tile = frameTiles[t];
+			tile.index = (unsigned int)tiles.size();
+			tiles.push_back(tile);
+		}
+	}
+
+	std::vector<AnimationFrame> animationFrames(frames);
+	std::mutex setupMutex;
+	FrameWriter writer(prefix);
+
+	// The first thread to reach a frame sets it up, while the others still render the frame before.
+	auto setup = [&](unsigned int f) -> AnimationFrame& {
+		AnimationFrame& frame = animationFrames[f];
+		std::lock_guard<std::mutex> lock(setupMutex);
+		if (!frame.ready) {
+			frame.camera = path.frameCamera(f, frames, width, height);
+			frame.image = new Image(width, height);
+			frame.remaining = tilesPerFrame;
+			frame.ready = true;
+		}
+		return frame;
+	};
+
+	renderTiles(tiles, threads, [&](const Tile& tile, std::vector<float>& pixels) {
+		renderTile(setup(tile.index / tilesPerFrame).camera, ns, tile, pixels);
+	}, [&](const Tile& tile, std::vector<float>& pixels) {
+		unsigned int f = tile.index / tilesPerFrame;
+		AnimationFrame& frame = animationFrames[f];
+		storeTile(*frame.image, tile, pixels);
+		if (--frame.remaining == 0) {
+			writer.write(f, frame.image);
+			frame.image = nullptr;
+		}
+	}, showProgress);
+
+	return writer.finish();
+}
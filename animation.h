@@ -0,0 +1,77 @@
+#ifndef ANIMATION_H_wpqoeirutyalskdjfhgz
+#define ANIMATION_H_wpqoeirutyalskdjfhgz
+
+#include <string>
+#include <vector>
+#include "camera.h"
+
+/**
+ * A camera at a moment of the animation, the keyframe lines of a scene file.
+ */
+struct CameraKeyframe {
+	float time;
+	Vec3Df eye;
+	Vec3Df target;
+	Vec3Df up;
+	float fov;
+};
+
+/**
+ * CameraPath class
+ *
+ * A camera moving through keyframes. The eye and target follow a Catmull-Rom spline through
+ * the keyframes, with the tangents scaled to the time between them so the speed doesn't jump
+ * at uneven keyframes. The up vector and field of view are interpolated linearly.
+ * Before the first and after the last keyframe the camera stands still.
+ */
+class CameraPath {
+	public:
+		// Constructors
+		CameraPath();
+		explicit CameraPath(const std::vector<CameraKeyframe>& keyframes);
+
+		// Methods
+		bool empty() const { return _keyframes.empty(); }
+		float startTime() const { return _keyframes.front().time; }
+		float endTime() const { return _keyframes.back().time; }
+
+		// The interpolated camera at a time, in the fields of a keyframe.
+		CameraKeyframe evaluate(float time) const;
+
+		// The camera of a frame, frames are spread evenly from the first to the last keyframe.
+		Camera frameCamera(unsigned int frame, unsigned int frames, unsigned int width, unsigned int height) const;
+
+		// Variables
+
+		// Sorted by time.
+		std::vector<CameraKeyframe> _keyframes;
+};
+
+/**
+ * The file name of a frame: the prefix, the frame number in 4 digits and .ppm.
+ */
+std::string frameFilename(const std::string& prefix, unsigned int frame);
+
+/**
+ * Render the frames of a camera path, and write each to a numbered PPM file as soon as it is done.
+ * The scene and its BVHs are shared by all frames, only the camera changes.
+ *
+ * Pipelined, the tiles of all frames are one queue: a thread that finds no more tiles of a frame
+ * sets up the next one and starts on its tiles while the others finish the last tiles of the frame,
+ * and finished frames are written by a separate thread. Otherwise every frame is rendered,
+ * and written, before the next one is started, so threads idle on the slowest tile of each frame.
+ * 1st param:	The camera path.
+ * 2nd param:	Number of frames.
+ * 3rd param:	Image width.
+ * 4th param:	Image height.
+ * 5th param:	Number of samples per pixel in each direction.
+ * 6th param:	Prefix of the file names, see frameFilename.
+ * 7th param:	Number of render threads.
+ * 8th param:	Whether to overlap the frames.
+ * 9th param:	Whether to print the loadbar while rendering.
+ * Return:		Whether all frames were written.
+ */
+bool renderAnimation(const CameraPath& path, unsigned int frames, unsigned int width, unsigned int height, unsigned int ns,
+	const std::string& prefix, unsigned int threads, bool pipelined, bool showProgress);
+
+#endif // ANIMATION_H
@@ -0,0 +1,72 @@
+#include "arealight.h"
+#include <algorithm>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+AreaLight::AreaLight(const Vec3Df& corner, const Vec3Df& edgeU, const Vec3Df& edgeV, unsigned int samples) :
+	_type(RECT), _position(corner), _edgeU(edgeU), _edgeV(edgeV), _radius(0.f), _samples(samples > 0 ? samples : 1) {}
+
+AreaLight::AreaLight(const Vec3Df& center, float radius, unsigned int samples) :
+	_type(SPHERE), _position(center), _edgeU(0.f, 0.f, 0.f), _edgeV(0.f, 0.f, 0.f), _radius(radius), _samples(samples > 0 ? samples : 1) {}
+
+Vec3Df AreaLight::center() const
+{
+	if (_type == RECT)
+		return _position + 0.5f * (_edgeU + _edgeV);
+	return _position;
+}
+
+Vec3Df AreaLight::samplePoint(const Vec3Df& from, float u, float v) const
+{
+	if (_type == RECT)
+		return _position + u * _edgeU + v * _edgeV;
+
+	// Uniform over the area of the half sphere facing the point: the height is uniform.
+	Vec3Df w = from - _position;
+	if (w.normalize() == 0.f)
+		return _position;
+	Vec3Df a = fabsf(w[0]) > 0.9f ? Vec3Df(0.f, 1.f, 0.f) : Vec3Df(1.f, 0.f, 0.f);
+	a = Vec3Df::crossProduct(w, a);
+	a.normalize();
+	Vec3Df b = Vec3Df::crossProduct(w, a);
+
+	float z = u;
+	float r = sqrtf(std::max(0.f, 1.f - z * z));
+	float phi = 2.f * float(M_PI) * v;
+	return _position + _radius * (r * cosf(phi) * a + r * sinf(phi) * b + z * w);
+}
+
+void AreaLight::probe(unsigned int k, unsigned int& i, unsigned int& j) const
+{
+	// The middle cells of the four quadrants of the grid.
+	const unsigned int n = _samples;
+	i = (k & 1) ? (3 * n) / 4 : n / 4;
+	j = (k & 2) ? (3 * n) / 4 : n / 4;
+}
+
+void AreaLight::cell(unsigned int k, unsigned int& i, unsigned int& j) const
+{
+	const unsigned int n = _samples;
+	if (n == 1) {
+		i = j = 0;
+		return;
+	}
+	if (k < PROBES) {
+		probe(k, i, j);
+		return;
+	}
+
+	// The other cells row by row, skipping the probes, which are in increasing order.
+	unsigned int index = k - PROBES;
+	for (unsigned int p = 0; p < PROBES; p++) {
+		unsigned int pi, pj;
+		probe(p, pi, pj);
+		if (pj * n + pi <= index)
+			index++;
+	}
+	i = index % n;
+	j = index / n;
+}
@@ -0,0 +1,78 @@
+#ifndef AREALIGHT_H_qpwoeirulaksjdhfzmxn
+#define AREALIGHT_H_qpwoeirulaksjdhfzmxn
+
+#include "Vec3D.h"
+
+/**
+ * AreaLight class
+ *
+ * A light with a size, a rectangle or a sphere, which casts soft shadows. Its light at a point
+ * is the average of samples x samples point lights spread over it, one in each cell of a grid
+ * over the light, at a random place in the cell.
+ *
+ * Most points see all or none of the light, only those in the penumbra need every sample.
+ * One sample in the middle of each quadrant of the grid is traced first: when these probes
+ * agree the point is taken to be fully lit or fully shadowed, and they are all that is traced.
+ *
+ * With a sampleSequence other than the grid, the samples are the first points of that sequence
+ * instead, and the first four of them are the probes.
+ */
+class AreaLight {
+	public:
+		enum Type { RECT, SPHERE };
+
+		// Samples traced before the others to find the penumbra.
+		static const unsigned int PROBES = 4;
+
+		// Constructors
+
+		/**
+		 * A rectangle.
+		 * 1st param:	A corner.
+		 * 2nd param:	The edge from that corner along one side.
+		 * 3rd param:	The edge from that corner along the other side.
+		 * 4th param:	Samples in each direction, at most samples * samples shadow rays per point.
+		 */
+		AreaLight(const Vec3Df& corner, const Vec3Df& edgeU, const Vec3Df& edgeV, unsigned int samples);
+
+		/**
+		 * A sphere, only the half facing the lit point is sampled.
+		 * 1st param:	The center.
+		 * 2nd param:	The radius.
+		 * 3rd param:	Samples in each direction, at most samples * samples shadow rays per point.
+		 */
+		AreaLight(const Vec3Df& center, float radius, unsigned int samples);
+
+		// Methods
+
+		// The middle of the light.
+		Vec3Df center() const;
+
+		/**
+		 * A point on the light, u and v in [0, 1) spread over it evenly.
+		 * 1st param:	The lit point, which the sampled half of a sphere faces.
+		 * 2nd param:	Position along the first edge, or height on the half sphere.
+		 * 3rd param:	Position along the second edge, or angle around the half sphere.
+		 */
+		Vec3Df samplePoint(const Vec3Df& from, float u, float v) const;
+
+		/**
+		 * The cell of the k-th sample in the samples x samples grid: the probes first,
+		 * then the others row by row.
+		 */
+		void cell(unsigned int k, unsigned int& i, unsigned int& j) const;
+
+		// Variables
+		Type _type;
+		Vec3Df _position;		// The corner of a rectangle, the center of a sphere.
+		Vec3Df _edgeU;
+		Vec3Df _edgeV;
+		float _radius;
+		unsigned int _samples;
+
+	private:
+		// The cell of probe k.
+		void probe(unsigned int k, unsigned int& i, unsigned int& j) const;
+};
+
+#endif // AREALIGHT_H
@@ -0,0 +1,815 @@
+#include "bvh.h"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <stdint.h>
+#include <thread>
+
+// Number of bins per axis of the SAH sweep.
+static const int SAH_BINS = 16;
+
+// Cost of visiting a node, relative to the cost of a primitive test.
+static const float TRAVERSAL_COST = 1.f;
+
+// Cost of testing a block of primitives at once, see TriangleBlock.
+static const float BLOCK_COST = 2.f;
+
+// Smallest subtree a parallel build leaves to a task, smaller nodes aren't worth binning on several threads.
+static const unsigned int MIN_TASK_PRIMITIVES = 4096;
+
+BVHRay::BVHRay(const Vec3Df& origin, const Vec3Df& direction)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		float d = direction[axis];
+		if (d > -1e-20f && d < 1e-20f)
+			d = d < 0.f ? -1e-20f : 1e-20f;
+		this->origin[axis] = origin[axis];
+		inverse[axis] = 1.f / d;
+	}
+}
+
+/**
+ * An axis aligned box during the build.
+ */
+struct BuildBox {
+	BuildBox() : min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+
+	void grow(const Vec3Df& p) {
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = std::min(min[axis], p[axis]);
+			max[axis] = std::max(max[axis], p[axis]);
+		}
+	}
+
+	// An empty box, such as an empty bin, leaves the box as it is.
+	void grow(const BuildBox& box) {
+		if (box.min[0] > box.max[0])
+			return;
+		grow(box.min);
+		grow(box.max);
+	}
+
+	float area() const {
+		if (min[0] > max[0])
+			return 0.f;
+		Vec3Df e = max - min;
+		return 2.f * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+	}
+
+	Vec3Df min, max;
+};
+
+/**
+ * The part of a triangle in a box, during a spatial split build.
+ */
+struct BVHReference {
+	unsigned int primitive;
+	BuildBox box;
+};
+
+/**
+ * The intersection of two boxes, empty when they don't overlap.
+ */
+static BuildBox intersect(const BuildBox& a, const BuildBox& b)
+{
+	BuildBox box;
+	for (int axis = 0; axis < 3; axis++) {
+		box.min[axis] = std::max(a.min[axis], b.min[axis]);
+		box.max[axis] = std::min(a.max[axis], b.max[axis]);
+	}
+	return box;
+}
+
+static bool isEmpty(const BuildBox& box)
+{
+	return box.min[0] > box.max[0] || box.min[1] > box.max[1] || box.min[2] > box.max[2];
+}
+
+/**
+ * Bounds of the part of a triangle between two planes along an axis: its vertices between
+ * the planes, and the points where its edges cross them.
+ */
+static BuildBox clipTriangle(const Vec3Df* v, int axis, float lower, float upper)
+{
+	BuildBox box;
+	for (int i = 0; i < 3; i++) {
+		const Vec3Df& a = v[i];
+		const Vec3Df& b = v[(i + 1) % 3];
+		if (a[axis] >= lower && a[axis] <= upper)
+			box.grow(a);
+
+		const float planes[2] = { lower, upper };
+		for (int j = 0; j < 2; j++) {
+			float plane = planes[j];
+			if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+				Vec3Df p = a + ((plane - a[axis]) / (b[axis] - a[axis])) * (b - a);
+				p[axis] = plane;
+				box.grow(p);
+			}
+		}
+	}
+	return box;
+}
+
+/**
+ * A subtree that one thread builds into its own nodes, during a parallel build.
+ */
+struct BVHBuildTask {
+	unsigned int node;		// The node of BVH::_nodes whose subtree this is.
+	unsigned int begin, end, depth;
+	std::vector<BVHNode> nodes;
+};
+
+/**
+ * The primitives of a node, for the bounding and binning below.
+ */
+struct BuildInput {
+	const unsigned int* indices;
+	const Vec3Df* boundsMin;
+	const Vec3Df* boundsMax;
+	const Vec3Df* centroids;
+};
+
+/**
+ * Bounds and number of the primitives in every bin, along every axis.
+ */
+struct BuildBins {
+	BuildBins() {
+		for (int axis = 0; axis < 3; axis++)
+			for (int b = 0; b < SAH_BINS; b++)
+				counts[axis][b] = 0;
+	}
+
+	void add(const BuildBins& bins) {
+		for (int axis = 0; axis < 3; axis++) {
+			for (int b = 0; b < SAH_BINS; b++) {
+				bounds[axis][b].grow(bins.bounds[axis][b]);
+				counts[axis][b] += bins.counts[axis][b];
+			}
+		}
+	}
+
+	BuildBox bounds[3][SAH_BINS];
+	unsigned int counts[3][SAH_BINS];
+};
+
+/**
+ * Run a function on a number of threads, the calling thread is one of them.
+ * The function gets the index of its thread.
+ */
+template <typename Function>
+static void runThreads(unsigned int threads, Function function)
+{
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.push_back(std::thread(function, i));
+	function(0);
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+}
+
+/**
+ * Grow the bounds of the boxes and of the centroids by input.indices[begin, end).
+ */
+static void boundRange(const BuildInput& input, unsigned int begin, unsigned int end, BuildBox& bounds, BuildBox& centroidBounds)
+{
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int primitive = input.indices[i];
+		bounds.grow(input.boundsMin[primitive]);
+		bounds.grow(input.boundsMax[primitive]);
+		centroidBounds.grow(input.centroids[primitive]);
+	}
+}
+
+/**
+ * Add input.indices[begin, end) to the bins of every axis.
+ */
+static void binRange(const BuildInput& input, unsigned int begin, unsigned int end, const BuildBox& centroidBounds, BuildBins& bins)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if (extent <= 0.f)
+			continue;
+
+		float scale = SAH_BINS / extent;
+		for (unsigned int i = begin; i < end; i++) {
+			unsigned int primitive = input.indices[i];
+			int bin = std::min(SAH_BINS - 1, int((input.centroids[primitive][axis] - centroidBounds.min[axis]) * scale));
+			bins.counts[axis][bin]++;
+			bins.bounds[axis][bin].grow(input.boundsMin[primitive]);
+			bins.bounds[axis][bin].grow(input.boundsMax[primitive]);
+		}
+	}
+}
+
+/**
+ * Part of a range of a number of threads.
+ */
+static unsigned int rangeSplit(unsigned int begin, unsigned int end, unsigned int part, unsigned int parts)
+{
+	return begin + (unsigned int)(uint64_t(end - begin) * part / parts);
+}
+
+/**
+ * boundRange, split over a number of threads.
+ */
+static void boundPrimitives(const BuildInput& input, unsigned int begin, unsigned int end, unsigned int threads, BuildBox& bounds, BuildBox& centroidBounds)
+{
+	if (threads == 1) {
+		boundRange(input, begin, end, bounds, centroidBounds);
+		return;
+	}
+
+	std::vector<BuildBox> partBounds(threads), partCentroids(threads);
+	runThreads(threads, [&](unsigned int thread) {
+		boundRange(input, rangeSplit(begin, end, thread, threads), rangeSplit(begin, end, thread + 1, threads), partBounds[thread], partCentroids[thread]);
+	});
+	for (unsigned int i = 0; i < threads; i++) {
+		bounds.grow(partBounds[i]);
+		centroidBounds.grow(partCentroids[i]);
+	}
+}
+
+/**
+ * binRange, split over a number of threads.
+ */
+static void binPrimitives(const BuildInput& input, unsigned int begin, unsigned int end, unsigned int threads, const BuildBox& centroidBounds, BuildBins& bins)
+{
+	if (threads == 1) {
+		binRange(input, begin, end, centroidBounds, bins);
+		return;
+	}
+
+	std::vector<BuildBins> parts(threads);
+	runThreads(threads, [&](unsigned int thread) {
+		binRange(input, rangeSplit(begin, end, thread, threads), rangeSplit(begin, end, thread + 1, threads), centroidBounds, parts[thread]);
+	});
+	for (unsigned int i = 0; i < threads; i++)
+		bins.add(parts[i]);
+}
+
+BVH::BVH() : _boundsMin(nullptr), _boundsMax(nullptr), _maxLeafSize(4), _blockSize(1), _threads(1), _taskSize(0), _vertices(nullptr),
+	_padding(0.f), _spareReferences(0), _minOverlap(0.f) {}
+
+void BVH::build(const std::vector<Vec3Df>& boundsMin, const std::vector<Vec3Df>& boundsMax, unsigned int maxLeafSize, unsigned int blockSize,
+	unsigned int threads)
+{
+	clear();
+	if (boundsMin.empty())
+		return;
+
+	_boundsMin = &boundsMin;
+	_boundsMax = &boundsMax;
+	_maxLeafSize = std::max(1u, maxLeafSize);
+	_blockSize = std::max(1u, blockSize);
+	_threads = std::max(1u, threads);
+
+	unsigned int count = (unsigned int)boundsMin.size();
+	_centroids.resize(count);
+	_indices.resize(count);
+	for (unsigned int i = 0; i < count; i++) {
+		_centroids[i] = 0.5f * (boundsMin[i] + boundsMax[i]);
+		_indices[i] = i;
+	}
+
+	buildTree();
+
+	std::vector<Vec3Df>().swap(_centroids);
+	_boundsMin = _boundsMax = nullptr;
+}
+
+/**
+ * Spread the lower 10 bits of a value over every third bit, for a Morton code.
+ */
+static unsigned int expandBits(unsigned int v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+void BVH::buildMorton(const std::vector<Vec3Df>& boundsMin, const std::vector<Vec3Df>& boundsMax, unsigned int maxLeafSize, unsigned int threads)
+{
+	clear();
+	if (boundsMin.empty())
+		return;
+
+	_boundsMin = &boundsMin;
+	_boundsMax = &boundsMax;
+	_maxLeafSize = std::max(1u, maxLeafSize);
+	_blockSize = 1;
+	_threads = std::max(1u, threads);
+
+	unsigned int count = (unsigned int)boundsMin.size();
+	_centroids.resize(count);
+	BuildBox centroidBounds;
+	for (unsigned int i = 0; i < count; i++) {
+		_centroids[i] = 0.5f * (boundsMin[i] + boundsMax[i]);
+		centroidBounds.grow(_centroids[i]);
+	}
+
+	// 10 bits per axis over the centroid bounds.
+	std::vector<unsigned int> codes(count), indices(count);
+	runThreads(_threads, [&](unsigned int thread) {
+		unsigned int end = rangeSplit(0, count, thread + 1, _threads);
+		for (unsigned int i = rangeSplit(0, count, thread, _threads); i < end; i++) {
+			unsigned int q[3];
+			for (int axis = 0; axis < 3; axis++) {
+				float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				float x = extent > 0.f ? (_centroids[i][axis] - centroidBounds.min[axis]) / extent : 0.f;
+				q[axis] = (unsigned int)std::min(1023.f, std::max(0.f, x * 1024.f));
+			}
+			codes[i] = (expandBits(q[0]) << 2) | (expandBits(q[1]) << 1) | expandBits(q[2]);
+			indices[i] = i;
+		}
+	});
+
+	// Radix sort on the codes, 10 bits per pass. It is stable, so equal codes keep their order.
+	std::vector<unsigned int> sortedCodes(count), sortedIndices(count);
+	for (int shift = 0; shift < 30; shift += 10) {
+		std::vector<unsigned int> offsets(1024, 0);
+		for (unsigned int i = 0; i < count; i++)
+			offsets[(codes[i] >> shift) & 1023]++;
+		unsigned int sum = 0;
+		for (int b = 0; b < 1024; b++) {
+			unsigned int n = offsets[b];
+			offsets[b] = sum;
+			sum += n;
+		}
+		for (unsigned int i = 0; i < count; i++) {
+			unsigned int j = offsets[(codes[i] >> shift) & 1023]++;
+			sortedCodes[j] = codes[i];
+			sortedIndices[j] = indices[i];
+		}
+		codes.swap(sortedCodes);
+		indices.swap(sortedIndices);
+	}
+	_indices.swap(indices);
+	_mortonCodes.swap(codes);
+
+	buildTree();
+
+	std::vector<unsigned int>().swap(_mortonCodes);
+	std::vector<Vec3Df>().swap(_centroids);
+	_boundsMin = _boundsMax = nullptr;
+}
+
+void BVH::buildTree()
+{
+	unsigned int count = (unsigned int)_indices.size();
+
+	// A binary tree over n primitives has at most 2n - 1 nodes.
+	_nodes.reserve(2 * count - 1);
+	_nodes.push_back(BVHNode());
+	if (_threads == 1 || count < 2 * MIN_TASK_PRIMITIVES) {
+		buildNode(_nodes, 0, 0, count, 0, nullptr);
+		return;
+	}
+
+	// The top levels, binned on all threads, down to a few subtrees per thread.
+	_taskSize = std::max(MIN_TASK_PRIMITIVES, count / (8 * _threads));
+	std::vector<BVHBuildTask> tasks;
+	buildNode(_nodes, 0, 0, count, 0, &tasks);
+
+	// The largest subtrees first, so the threads finish at about the same time.
+	std::vector<unsigned int> order(tasks.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		return tasks[a].end - tasks[a].begin > tasks[b].end - tasks[b].begin;
+	});
+
+	std::atomic<unsigned int> next(0);
+	runThreads(_threads, [&](unsigned int) {
+		for (unsigned int i = next++; i < order.size(); i = next++) {
+			BVHBuildTask& task = tasks[order[i]];
+			task.nodes.reserve(2 * (task.end - task.begin) - 1);
+			task.nodes.push_back(BVHNode());
+			buildNode(task.nodes, 0, task.begin, task.end, task.depth, nullptr);
+		}
+	});
+
+	// Append the subtrees in the order they were found, the root of each takes the place of its task node.
+	for (size_t t = 0; t < tasks.size(); t++) {
+		unsigned int offset = (unsigned int)_nodes.size() - 1;
+		for (size_t i = 0; i < tasks[t].nodes.size(); i++) {
+			BVHNode node = tasks[t].nodes[i];
+			if (!node.isLeaf())
+				node.first += offset;
+			if (i == 0)
+				_nodes[tasks[t].node] = node;
+			else
+				_nodes.push_back(node);
+		}
+		std::vector<BVHNode>().swap(tasks[t].nodes);
+	}
+}
+
+void BVH::buildNode(std::vector<BVHNode>& nodes, unsigned int node, unsigned int begin, unsigned int end, unsigned int depth,
+	std::vector<BVHBuildTask>* tasks)
+{
+	unsigned int count = end - begin;
+	if (tasks && count <= _taskSize) {
+		tasks->push_back(BVHBuildTask());
+		tasks->back().node = node;
+		tasks->back().begin = begin;
+		tasks->back().end = end;
+		tasks->back().depth = depth;
+		return;
+	}
+
+	// Above the tasks the primitives of a node are bounded and binned on all threads.
+	unsigned int threads = tasks ? _threads : 1;
+	const BuildInput input = { &_indices[0], &(*_boundsMin)[0], &(*_boundsMax)[0], &_centroids[0] };
+
+	BuildBox bounds, centroidBounds;
+	boundPrimitives(input, begin, end, threads, bounds, centroidBounds);
+	for (int axis = 0; axis < 3; axis++) {
+		nodes[node].boundsMin[axis] = bounds.min[axis];
+		nodes[node].boundsMax[axis] = bounds.max[axis];
+	}
+
+	nodes[node].first = begin;
+	nodes[node].count = count;
+	if (count == 1 || depth + 1 >= MAX_DEPTH)
+		return;
+
+	unsigned int middle;
+	if (!_mortonCodes.empty()) {
+		if (count <= _maxLeafSize)
+			return;
+		middle = mortonSplit(begin, end);
+	}
+	else {
+		BuildBins bins;
+		binPrimitives(input, begin, end, threads, centroidBounds, bins);
+
+		// Sweep the bins of every axis for the cheapest split.
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestBin = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			if (centroidBounds.max[axis] - centroidBounds.min[axis] <= 0.f)
+				continue;
+
+			// Areas and counts left of every split, then the right side while sweeping back.
+			float leftArea[SAH_BINS - 1];
+			unsigned int leftCount[SAH_BINS - 1];
+			BuildBox left;
+			unsigned int n = 0;
+			for (int b = 0; b < SAH_BINS - 1; b++) {
+				left.grow(bins.bounds[axis][b]);
+				n += bins.counts[axis][b];
+				leftArea[b] = left.area();
+				leftCount[b] = n;
+			}
+			BuildBox right;
+			n = 0;
+			for (int b = SAH_BINS - 1; b > 0; b--) {
+				right.grow(bins.bounds[axis][b]);
+				n += bins.counts[axis][b];
+				if (leftCount[b - 1] == 0 || n == 0)
+					continue;
+				float cost = leftArea[b - 1] * leafCost(leftCount[b - 1]) + right.area() * leafCost(n);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		// Stay a leaf when splitting costs more than testing every primitive.
+		float area = bounds.area();
+		float splitCost = area > 0.f ? TRAVERSAL_COST + bestCost / area : FLT_MAX;
+		if (count <= _maxLeafSize && (bestAxis < 0 || splitCost >= leafCost(count)))
+			return;
+
+		if (bestAxis >= 0) {
+			float scale = SAH_BINS / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+			float lower = centroidBounds.min[bestAxis];
+			unsigned int* split = std::partition(&_indices[0] + begin, &_indices[0] + end, [&](unsigned int primitive) {
+				return std::min(SAH_BINS - 1, int((_centroids[primitive][bestAxis] - lower) * scale)) < bestBin;
+			});
+			middle = (unsigned int)(split - &_indices[0]);
+		}
+		else {
+			// All centroids coincide, split the list in half.
+			middle = begin + count / 2;
+		}
+	}
+
+	unsigned int left = (unsigned int)nodes.size();
+	nodes.push_back(BVHNode());
+	nodes.push_back(BVHNode());
+	nodes[node].first = left;
+	nodes[node].count = 0;
+	buildNode(nodes, left, begin, middle, depth + 1, tasks);
+	buildNode(nodes, left + 1, middle, end, depth + 1, tasks);
+}
+
+unsigned int BVH::mortonSplit(unsigned int begin, unsigned int end) const
+{
+	unsigned int first = _mortonCodes[begin], last = _mortonCodes[end - 1];
+	if (first == last)
+		return begin + (end - begin) / 2;
+
+	// The codes are sorted, so they all agree above the highest bit in which the first and last differ.
+	int bit = 31;
+	while (!(((first ^ last) >> bit) & 1))
+		bit--;
+	const unsigned int* codes = &_mortonCodes[0];
+	const unsigned int* split = std::partition_point(codes + begin, codes + end, [&](unsigned int code) {
+		return !((code >> bit) & 1);
+	});
+	return (unsigned int)(split - codes);
+}
+
+void BVH::buildSpatial(const std::vector<Vec3Df>& vertices, float padding, unsigned int maxLeafSize, unsigned int blockSize, float budget)
+{
+	clear();
+	unsigned int count = (unsigned int)(vertices.size() / 3);
+	if (count == 0)
+		return;
+
+	_vertices = &vertices;
+	_padding = padding;
+	_maxLeafSize = std::max(1u, maxLeafSize);
+	_blockSize = std::max(1u, blockSize);
+	_spareReferences = size_t(std::max(0.f, budget) * count);
+
+	std::vector<BVHReference> references(count);
+	BuildBox bounds;
+	for (unsigned int i = 0; i < count; i++) {
+		references[i].primitive = i;
+		for (int v = 0; v < 3; v++)
+			references[i].box.grow(vertices[3 * i + v]);
+		bounds.grow(references[i].box);
+	}
+
+	// Spatial splits are only tried where the object split children overlap noticeably.
+	_minOverlap = 1e-5f * bounds.area();
+
+	_indices.reserve(count + _spareReferences);
+	_nodes.push_back(BVHNode());
+	buildSpatialNode(0, references, 0);
+	_vertices = nullptr;
+}
+
+void BVH::buildSpatialNode(unsigned int node, std::vector<BVHReference>& references, unsigned int depth)
+{
+	BuildBox bounds, centroidBounds;
+	for (size_t i = 0; i < references.size(); i++) {
+		bounds.grow(references[i].box);
+		centroidBounds.grow(0.5f * (references[i].box.min + references[i].box.max));
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		_nodes[node].boundsMin[axis] = bounds.min[axis] - _padding;
+		_nodes[node].boundsMax[axis] = bounds.max[axis] + _padding;
+	}
+
+	unsigned int count = (unsigned int)references.size();
+	_nodes[node].first = (unsigned int)_indices.size();
+	_nodes[node].count = count;
+
+	// The best object split, as in buildNode, over the centroids of the reference boxes.
+	float objectCost = FLT_MAX;
+	int objectAxis = -1, objectBin = 0;
+	BuildBox objectLeft, objectRight;
+	for (int axis = 0; axis < 3 && count > 1; axis++) {
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if (extent <= 0.f)
+			continue;
+
+		BuildBox binBounds[SAH_BINS];
+		unsigned int binCounts[SAH_BINS] = {};
+		float scale = SAH_BINS / extent;
+		for (size_t i = 0; i < references.size(); i++) {
+			float centroid = 0.5f * (references[i].box.min[axis] + references[i].box.max[axis]);
+			int bin = std::min(SAH_BINS - 1, int((centroid - centroidBounds.min[axis]) * scale));
+			binCounts[bin]++;
+			binBounds[bin].grow(references[i].box);
+		}
+
+		BuildBox leftBounds[SAH_BINS - 1];
+		unsigned int leftCount[SAH_BINS - 1];
+		BuildBox left;
+		unsigned int n = 0;
+		for (int b = 0; b < SAH_BINS - 1; b++) {
+			left.grow(binBounds[b]);
+			n += binCounts[b];
+			leftBounds[b] = left;
+			leftCount[b] = n;
+		}
+		BuildBox right;
+		n = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--) {
+			right.grow(binBounds[b]);
+			n += binCounts[b];
+			if (leftCount[b - 1] == 0 || n == 0)
+				continue;
+			float cost = leftBounds[b - 1].area() * leafCost(leftCount[b - 1]) + right.area() * leafCost(n);
+			if (cost < objectCost) {
+				objectCost = cost;
+				objectAxis = axis;
+				objectBin = b;
+				objectLeft = leftBounds[b - 1];
+				objectRight = right;
+			}
+		}
+	}
+
+	// The best spatial split, when the object split children overlap and the budget allows.
+	float spatialCost = FLT_MAX;
+	int spatialAxis = -1, spatialBin = 0;
+	BuildBox overlap = intersect(objectLeft, objectRight);
+	bool trySpatial = count > 1 && _spareReferences > 0 && (objectAxis < 0 || (!isEmpty(overlap) && overlap.area() > _minOverlap));
+	for (int axis = 0; axis < 3 && trySpatial; axis++) {
+		float extent = bounds.max[axis] - bounds.min[axis];
+		if (extent <= 0.f)
+			continue;
+
+		BuildBox binBounds[SAH_BINS];
+		unsigned int entries[SAH_BINS] = {}, exits[SAH_BINS] = {};
+		float width = extent / SAH_BINS;
+		for (size_t i = 0; i < references.size(); i++) {
+			const BVHReference& reference = references[i];
+			int first = std::min(SAH_BINS - 1, std::max(0, int((reference.box.min[axis] - bounds.min[axis]) / width)));
+			int last = std::min(SAH_BINS - 1, std::max(first, int((reference.box.max[axis] - bounds.min[axis]) / width)));
+			entries[first]++;
+			exits[last]++;
+			if (first == last) {
+				binBounds[first].grow(reference.box);
+				continue;
+			}
+			const Vec3Df* v = &(*_vertices)[3 * reference.primitive];
+			for (int b = first; b <= last; b++) {
+				BuildBox part = intersect(clipTriangle(v, axis, bounds.min[axis] + b * width, bounds.min[axis] + (b + 1) * width), reference.box);
+				if (!isEmpty(part))
+					binBounds[b].grow(part);
+			}
+		}
+
+		BuildBox leftBounds[SAH_BINS - 1];
+		unsigned int leftCount[SAH_BINS - 1];
+		BuildBox left;
+		unsigned int n = 0;
+		for (int b = 0; b < SAH_BINS - 1; b++) {
+			left.grow(binBounds[b]);
+			n += entries[b];
+			leftBounds[b] = left;
+			leftCount[b] = n;
+		}
+		BuildBox right;
+		n = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--) {
+			right.grow(binBounds[b]);
+			n += exits[b];
+			unsigned int nLeft = leftCount[b - 1];
+			if (nLeft == 0 || n == 0 || nLeft + n - count > _spareReferences || (nLeft == count && n == count))
+				continue;
+			float cost = leftBounds[b - 1].area() * leafCost(nLeft) + right.area() * leafCost(n);
+			if (cost < spatialCost) {
+				spatialCost = cost;
+				spatialAxis = axis;
+				spatialBin = b;
+			}
+		}
+	}
+
+	// Stay a leaf when splitting costs more than testing every primitive.
+	float area = bounds.area();
+	float bestCost = std::min(objectCost, spatialCost);
+	float splitCost = area > 0.f && bestCost < FLT_MAX ? TRAVERSAL_COST + bestCost / area : FLT_MAX;
+	bool leaf = count == 1 || depth + 1 >= MAX_DEPTH || (count <= _maxLeafSize && splitCost >= leafCost(count));
+
+	std::vector<BVHReference> left, right;
+	if (!leaf && spatialCost < objectCost) {
+		float width = (bounds.max[spatialAxis] - bounds.min[spatialAxis]) / SAH_BINS;
+		float plane = bounds.min[spatialAxis] + spatialBin * width;
+		for (size_t i = 0; i < references.size(); i++) {
+			const BVHReference& reference = references[i];
+			int first = std::min(SAH_BINS - 1, std::max(0, int((reference.box.min[spatialAxis] - bounds.min[spatialAxis]) / width)));
+			int last = std::min(SAH_BINS - 1, std::max(first, int((reference.box.max[spatialAxis] - bounds.min[spatialAxis]) / width)));
+			if (last < spatialBin) {
+				left.push_back(reference);
+			}
+			else if (first >= spatialBin) {
+				right.push_back(reference);
+			}
+			else {
+				// Straddles the plane: clip it into both children.
+				const Vec3Df* v = &(*_vertices)[3 * reference.primitive];
+				BVHReference part = reference;
+				part.box = intersect(clipTriangle(v, spatialAxis, -FLT_MAX, plane), reference.box);
+				if (!isEmpty(part.box))
+					left.push_back(part);
+				part.box = intersect(clipTriangle(v, spatialAxis, plane, FLT_MAX), reference.box);
+				if (!isEmpty(part.box))
+					right.push_back(part);
+			}
+		}
+	}
+	else if (!leaf && objectAxis >= 0) {
+		float scale = SAH_BINS / (centroidBounds.max[objectAxis] - centroidBounds.min[objectAxis]);
+		for (size_t i = 0; i < references.size(); i++) {
+			float centroid = 0.5f * (references[i].box.min[objectAxis] + references[i].box.max[objectAxis]);
+			int bin = std::min(SAH_BINS - 1, int((centroid - centroidBounds.min[objectAxis]) * scale));
+			(bin < objectBin ? left : right).push_back(references[i]);
+		}
+	}
+	else if (!leaf) {
+		// All centroids coincide, split the list in half.
+		left.assign(references.begin(), references.begin() + count / 2);
+		right.assign(references.begin() + count / 2, references.end());
+	}
+
+	// Clipping can leave a side empty, then this node stays a leaf after all.
+	if (leaf || left.empty() || right.empty()) {
+		for (size_t i = 0; i < references.size(); i++)
+			_indices.push_back(references[i].primitive);
+		return;
+	}
+
+	size_t added = left.size() + right.size() - count;
+	_spareReferences -= std::min(_spareReferences, added);
+	std::vector<BVHReference>().swap(references);
+
+	unsigned int child = (unsigned int)_nodes.size();
+	_nodes.push_back(BVHNode());
+	_nodes.push_back(BVHNode());
+	_nodes[node].first = child;
+	_nodes[node].count = 0;
+	buildSpatialNode(child, left, depth + 1);
+	std::vector<BVHReference>().swap(left);
+	buildSpatialNode(child + 1, right, depth + 1);
+}
+
+void BVH::refit(const std::vector<Vec3Df>& boundsMin, const std::vector<Vec3Df>& boundsMax)
+{
+	// Children are stored after their parent, so going backwards visits them first.
+	for (size_t n = _nodes.size(); n-- > 0;) {
+		BVHNode& node = _nodes[n];
+		BuildBox box;
+		if (node.isLeaf()) {
+			for (unsigned int i = 0; i < node.count; i++) {
+				box.grow(boundsMin[_indices[node.first + i]]);
+				box.grow(boundsMax[_indices[node.first + i]]);
+			}
+		}
+		else {
+			for (unsigned int c = 0; c < 2; c++) {
+				const BVHNode& child = _nodes[node.first + c];
+				box.grow(Vec3Df(child.boundsMin[0], child.boundsMin[1], child.boundsMin[2]));
+				box.grow(Vec3Df(child.boundsMax[0], child.boundsMax[1], child.boundsMax[2]));
+			}
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			node.boundsMin[axis] = box.min[axis];
+			node.boundsMax[axis] = box.max[axis];
+		}
+	}
+}
+
+float BVH::leafCost(unsigned int count) const
+{
+	if (_blockSize == 1)
+		return float(count);
+	return BLOCK_COST * ((count + _blockSize - 1) / _blockSize);
+}
+
+void BVH::clear()
+{
+	std::vector<BVHNode>().swap(_nodes);
+	std::vector<unsigned int>().swap(_indices);
+}
+
+size_t BVH::memoryUsage() const
+{
+	return _nodes.capacity() * sizeof(BVHNode) + _indices.capacity() * sizeof(unsigned int);
+}
+
+/**
+ * Surface area of the box of a node.
+ */
+static float nodeArea(const BVHNode& node)
+{
+	float x = node.boundsMax[0] - node.boundsMin[0];
+	float y = node.boundsMax[1] - node.boundsMin[1];
+	float z = node.boundsMax[2] - node.boundsMin[2];
+	return 2.f * (x * y + y * z + z * x);
+}
+
+float BVH::sahCost() const
+{
+	if (_nodes.empty())
+		return 0.f;
+
+	// A ray that hits the root hits a node with the chance of their areas.
+	float cost = 0.f;
+	for (size_t i = 0; i < _nodes.size(); i++)
+		cost += nodeArea(_nodes[i]) * (_nodes[i].isLeaf() ? leafCost(_nodes[i].count) : TRAVERSAL_COST);
+	float rootArea = nodeArea(_nodes[0]);
+	return rootArea > 0.f ? cost / rootArea : cost;
+}
@@ -0,0 +1,192 @@
+#ifndef BVH_H_lkajsdhfgpoqiwueyrtz
+#define BVH_H_lkajsdhfgpoqiwueyrtz
+
+#include <vector>
+#include "Vec3D.h"
+
+/**
+ * How a BVH is built.
+ */
+enum BVHBuilder {
+	BVH_BUILDER_SAH,	// Binned SAH over the primitive boxes, every primitive is in one leaf.
+	BVH_BUILDER_SBVH,	// Binned SAH with spatial splits, which clip triangles into several leaves.
+	BVH_BUILDER_LBVH	// Primitives sorted along a Morton curve and split at its bits, fast but lower quality.
+};
+
+// A primitive, or the part of a triangle in a box, during a spatial split build.
+struct BVHReference;
+
+// A subtree that one thread builds during a parallel build.
+struct BVHBuildTask;
+
+/**
+ * A node of a BVH, 32 bytes so two fit in a cache line.
+ */
+struct BVHNode {
+	float boundsMin[3];
+	unsigned int first;		// Leaf: first entry of BVH::_indices. Inner node: left child, the right child is first + 1.
+	float boundsMax[3];
+	unsigned int count;		// Leaf: number of primitives. Inner node: 0.
+
+	bool isLeaf() const { return count > 0; }
+};
+
+/**
+ * A ray prepared for box tests.
+ */
+struct BVHRay {
+	BVHRay(const Vec3Df& origin, const Vec3Df& direction);
+
+	float origin[3];
+	float inverse[3];	// 1 / direction, very small components are clamped so it stays finite.
+};
+
+/**
+ * Slab test of a ray against the box of a node.
+ * 1st param:	The node.
+ * 2nd param:	The ray.
+ * 3rd param:	Only hits before this distance count.
+ * 4th param:	Gets the distance where the ray enters the box, 0 when it starts inside.
+ * Return:		Whether the ray hits the box before tMax.
+ */
+inline bool intersectBox(const BVHNode& node, const BVHRay& ray, float tMax, float& tNear)
+{
+	float t0 = 0.f, t1 = tMax;
+	for (int axis = 0; axis < 3; axis++) {
+		float tA = (node.boundsMin[axis] - ray.origin[axis]) * ray.inverse[axis];
+		float tB = (node.boundsMax[axis] - ray.origin[axis]) * ray.inverse[axis];
+		t0 = tA < tB ? (tA > t0 ? tA : t0) : (tB > t0 ? tB : t0);
+		t1 = tA < tB ? (tB < t1 ? tB : t1) : (tA < t1 ? tA : t1);
+	}
+	tNear = t0;
+	return t0 <= t1;
+}
+
+/**
+ * BVH class
+ *
+ * A binary bounding volume hierarchy over primitives given by their bounding boxes,
+ * built top-down with the surface area heuristic over binned centroids.
+ *
+ * buildSpatial() builds the tree over triangles with spatial splits as well (SBVH): where the
+ * children of the best object split overlap, splitting space at a plane and clipping the
+ * triangles that straddle it into both children can be cheaper. Long, thin and diagonal
+ * triangles then no longer make boxes that overlap their neighbours. A triangle can be in
+ * several leaves, up to a budget of extra references.
+ *
+ * buildMorton() builds an LBVH: the primitives are sorted by the Morton code of their centroid
+ * and every node splits at the highest bit in which the codes of its primitives differ.
+ * It takes a fraction of the time of the SAH build, for previews.
+ *
+ * build() and buildMorton() can use several threads. The top levels are built first, binning
+ * the primitives of each node on all threads, until the subtrees are small enough to be built
+ * by one thread each. The tree is the same for any number of threads.
+ *
+ * refit() updates the boxes to primitives that moved, keeping the tree as it is. Its quality drops
+ * as the primitives move further, sahCost() measures how much.
+ *
+ * The two children of a node are stored next to each other, the nodes of a subtree together,
+ * and children always after their parent.
+ * A leaf refers to a range of _indices, the indices of its primitives.
+ */
+class BVH {
+	public:
+		// Largest depth of a tree, traversal stacks of this size never overflow.
+		static const unsigned int MAX_DEPTH = 64;
+
+		// Constructor
+		BVH();
+
+		/**
+		 * Build the tree.
+		 * 1st param:	Lower corner of the bounding box of every primitive.
+		 * 2nd param:	Upper corner of the bounding box of every primitive.
+		 * 3rd param:	Leaves with more primitives than this are always split.
+		 * 4th param:	Number of primitives a leaf tests at once, the SAH counts the cost of a leaf
+		 *				in blocks of this size so SIMD leaves are filled.
+		 * 5th param:	Number of threads to build on.
+		 */
+		void build(const std::vector<Vec3Df>& boundsMin, const std::vector<Vec3Df>& boundsMax, unsigned int maxLeafSize, unsigned int blockSize = 1,
+			unsigned int threads = 1);
+
+		/**
+		 * Build the tree along a Morton curve (LBVH).
+		 * 1st param:	Lower corner of the bounding box of every primitive.
+		 * 2nd param:	Upper corner of the bounding box of every primitive.
+		 * 3rd param:	Leaves have at most this many primitives.
+		 * 4th param:	Number of threads to build on.
+		 */
+		void buildMorton(const std::vector<Vec3Df>& boundsMin, const std::vector<Vec3Df>& boundsMax, unsigned int maxLeafSize, unsigned int threads = 1);
+
+		/**
+		 * Build the tree over triangles, with spatial splits.
+		 * 1st param:	The three vertices of every triangle.
+		 * 2nd param:	Margin added around every box.
+		 * 3rd param:	Leaves with more primitives than this are always split.
+		 * 4th param:	Number of primitives a leaf tests at once, see build().
+		 * 5th param:	References beyond one per triangle, as a fraction of the number of triangles.
+		 */
+		void buildSpatial(const std::vector<Vec3Df>& vertices, float padding, unsigned int maxLeafSize, unsigned int blockSize, float budget);
+
+		/**
+		 * Update the boxes of all nodes bottom-up to new primitive boxes, without changing the tree.
+		 * A tree built by buildSpatial() gets the whole boxes of its triangles, not the clipped ones.
+		 * 1st param:	Lower corner of the bounding box of every primitive.
+		 * 2nd param:	Upper corner of the bounding box of every primitive.
+		 */
+		void refit(const std::vector<Vec3Df>& boundsMin, const std::vector<Vec3Df>& boundsMax);
+
+		// Remove the tree.
+		void clear();
+
+		// Whether the tree has no nodes.
+		bool empty() const { return _nodes.empty(); }
+
+		// Number of bytes used by the nodes and indices.
+		size_t memoryUsage() const;
+
+		// SAH cost of the tree: the expected cost of tracing a ray that hits the root, in primitive tests.
+		float sahCost() const;
+
+		// Variables
+		std::vector<BVHNode> _nodes;
+		std::vector<unsigned int> _indices;
+
+	private:
+		// Build the tree over _indices, on _threads threads.
+		void buildTree();
+
+		// Build the subtree of a node over _indices[begin, end) into nodes. At the top levels of a
+		// parallel build, subtrees of up to _taskSize primitives are left to tasks.
+		void buildNode(std::vector<BVHNode>& nodes, unsigned int node, unsigned int begin, unsigned int end, unsigned int depth,
+			std::vector<BVHBuildTask>* tasks);
+
+		// Split position of _indices[begin, end) in a Morton build.
+		unsigned int mortonSplit(unsigned int begin, unsigned int end) const;
+
+		// Build the subtree of a node over references to triangles, it takes the references.
+		void buildSpatialNode(unsigned int node, std::vector<BVHReference>& references, unsigned int depth);
+
+		// SAH cost of testing a number of primitives in a leaf.
+		float leafCost(unsigned int count) const;
+
+		// Primitive bounds and centroids during the build.
+		const std::vector<Vec3Df>* _boundsMin;
+		const std::vector<Vec3Df>* _boundsMax;
+		std::vector<Vec3Df> _centroids;
+		unsigned int _maxLeafSize;
+		unsigned int _blockSize;
+		unsigned int _threads;
+		unsigned int _taskSize;
+
+		// Morton code of the primitive at every position of _indices, during a Morton build.
+		std::vector<unsigned int> _mortonCodes;
+
+		// Triangles, padding and the references left in the budget during a spatial split build.
+		const std::vector<Vec3Df>* _vertices;
+		float _padding;
+		size_t _spareReferences;
+		float _minOverlap;
+};
+
+#endif // BVH_H
@@ -0,0 +1,69 @@
+#include "camera.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Near and far plane, as set in reshape() with gluPerspective.
+static const float NEAR_PLANE = 0.01f;
+static const float FAR_PLANE = 10.f;
+
+/**
+ * Default constructor, an empty camera.
+ */
+Camera::Camera() : _width(0), _height(0) {}
+
+/**
+ * Constructor which stores the four corner rays.
+ */
+Camera::Camera(unsigned int width, unsigned int height,
+	const Vec3Df& origin00, const Vec3Df& dest00,
+	const Vec3Df& origin01, const Vec3Df& dest01,
+	const Vec3Df& origin10, const Vec3Df& dest10,
+	const Vec3Df& origin11, const Vec3Df& dest11) :
+	_width(width), _height(height),
+	_origin00(origin00), _dest00(dest00),
+	_origin01(origin01), _dest01(dest01),
+	_origin10(origin10), _dest10(dest10),
+	_origin11(origin11), _dest11(dest11) {}
+
+/**
+ * Build a camera from an eye position, target and field of view.
+ */
+Camera Camera::lookAt(const Vec3Df& eye, const Vec3Df& target, const Vec3Df& up, float fovy, unsigned int width, unsigned int height) {
+	Vec3Df forward = target - eye;
+	forward.normalize();
+	Vec3Df right = Vec3Df::crossProduct(forward, up);
+	right.normalize();
+	Vec3Df trueUp = Vec3Df::crossProduct(right, forward);
+
+	float tanY = tanf(0.5f * fovy * float(M_PI) / 180.f);
+	float tanX = tanY * float(width) / float(height);
+
+	// Same mapping as gluUnProject: window x = 0 is the left edge, y_I = 0 is the top edge.
+	Vec3Df origins[4], dests[4];
+	const unsigned int px[4] = { 0, 0, width - 1, width - 1 };
+	const unsigned int py[4] = { 0, height - 1, 0, height - 1 };
+	for (int i = 0; i < 4; i++) {
+		float ndcX = 2.f * px[i] / width - 1.f;
+		float ndcY = 2.f * (height - py[i]) / height - 1.f;
+		Vec3Df dir = forward + ndcX * tanX * right + ndcY * tanY * trueUp;
+		origins[i] = eye + NEAR_PLANE * dir;
+		dests[i] = eye + FAR_PLANE * dir;
+	}
+
+	return Camera(width, height, origins[0], dests[0], origins[1], dests[1], origins[2], dests[2], origins[3], dests[3]);
+}
+
+/**
+ * Produce the ray for a (sub)pixel position by interpolating the four corner rays.
+ */
+void Camera::getRay(float x, float y, Vec3Df& origin, Vec3Df& dest) const {
+	float xscale = 1.0f - x / (_width - 1);
+	float yscale = 1.0f - y / (_height - 1);
+
+	origin = yscale*(xscale*_origin00 + (1 - xscale)*_origin10) +
+		(1 - yscale)*(xscale*_origin01 + (1 - xscale)*_origin11);
+	dest = yscale*(xscale*_dest00 + (1 - xscale)*_dest10) +
+		(1 - yscale)*(xscale*_dest01 + (1 - xscale)*_dest11);
+}
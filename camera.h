@@ -0,0 +1,53 @@
+#ifndef CAMERA_H_kdjfslkdjfoiwejfsldkfj
+#define CAMERA_H_kdjfslkdjfoiwejfsldkfj
+
+#include "Vec3D.h"
+
+/**
+ * Camera class
+ *
+ * Stores the rays through the four corners of the frustum of a image.
+ * Every other ray is found by interpolating these four corner rays, which is
+ * exactly what the 'r' and 's' keys did inline before.
+ *
+ * Corner naming follows produceRay(): 00 is pixel (0, 0), 01 is (0, height - 1),
+ * 10 is (width - 1, 0) and 11 is (width - 1, height - 1).
+ */
+class Camera {
+	public:
+		// Constructors
+		Camera();
+		Camera(unsigned int width, unsigned int height,
+			const Vec3Df& origin00, const Vec3Df& dest00,
+			const Vec3Df& origin01, const Vec3Df& dest01,
+			const Vec3Df& origin10, const Vec3Df& dest10,
+			const Vec3Df& origin11, const Vec3Df& dest11);
+
+		/**
+		 * Build a camera without OpenGL, the same way gluPerspective and gluUnProject would.
+		 * Used by the headless tools (benchmarks), as produceRay needs a GL context.
+		 * 1st param:	Position of the eye.
+		 * 2nd param:	Point the camera looks at.
+		 * 3rd param:	Up vector.
+		 * 4th param:	Vertical field of view in degrees.
+		 * 5th param:	Image width.
+		 * 6th param:	Image height.
+		 */
+		static Camera lookAt(const Vec3Df& eye, const Vec3Df& target, const Vec3Df& up, float fovy, unsigned int width, unsigned int height);
+
+		/**
+		 * Produce the ray for a (sub)pixel position by interpolating the four corner rays.
+		 * x and y are in pixels, so (x + 0.5, y + 0.5) is the center of pixel (x, y).
+		 */
+		void getRay(float x, float y, Vec3Df& origin, Vec3Df& dest) const;
+
+		// Variables
+		unsigned int _width;
+		unsigned int _height;
+		Vec3Df _origin00, _dest00;
+		Vec3Df _origin01, _dest01;
+		Vec3Df _origin10, _dest10;
+		Vec3Df _origin11, _dest11;
+};
+
+#endif // CAMERA_H
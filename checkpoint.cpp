@@ -0,0 +1,498 @@
+#include "checkpoint.h"
+#include "raytracing.h"
+#include "sampler.h"
+#include <cstring>
+#include <iostream>
+
+// First bytes of a checkpoint file, the last two are the version of the format.
+static const char CHECKPOINT_MAGIC[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+
+// First bytes of a progressive checkpoint file.
+static const char PROGRESSIVE_MAGIC[8] = { 'R', 'T', 'P', 'R', 'O', 'G', '0', '1' };
+
+// First word of every tile record.
+static const uint32_t RECORD_MAGIC = 0x454c4954; // "TILE"
+
+/**
+ * Header of a checkpoint file.
+ */
+struct CheckpointHeader {
+	char magic[8];
+	uint64_t hash;
+	uint32_t tileCount;
+	uint32_t tileSize;
+};
+
+/**
+ * Header of a progressive checkpoint file, followed by the passes, the sums and a checksum of both.
+ */
+struct ProgressiveHeader {
+	char magic[8];
+	uint64_t hash;
+	uint32_t passCount;
+	uint32_t floatCount;
+};
+
+/**
+ * 64 bit FNV-1a hash, used to recognize the render a checkpoint belongs to.
+ */
+class Hash64 {
+	public:
+		Hash64() : _value(14695981039346656037ull) {}
+
+		void add(const void* data, size_t size) {
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t i = 0; i < size; i++) {
+				_value ^= bytes[i];
+				_value *= 1099511628211ull;
+			}
+		}
+		void add(unsigned int value) { add(&value, sizeof(value)); }
+		void add(float value) { add(&value, sizeof(value)); }
+		void add(const Vec3Df& value) { add(value[0]); add(value[1]); add(value[2]); }
+		void add(const std::string& value) { add((unsigned int)value.size()); add(value.data(), value.size()); }
+
+		uint64_t _value;
+};
+
+/**
+ * Add the shading parameters of a material to a hash.
+ * Parameters that are not set are left out, their values are not initialized.
+ */
+static void hashMaterial(Hash64& hash, Material& material)
+{
+	hash.add((unsigned int)(material.has_Kd() | material.has_Ka() << 1 | material.has_Ks() << 2 | material.has_Ns() << 3 |
+		material.has_Ni() << 4 | material.has_Tr() << 5 | material.has_Tf() << 6 | material.has_illum() << 7));
+	if (material.has_Kd()) hash.add(material.Kd());
+	if (material.has_Ka()) hash.add(material.Ka());
+	if (material.has_Ks()) hash.add(material.Ks());
+	if (material.has_Ns()) hash.add(material.Ns());
+	if (material.has_Ni()) hash.add(material.Ni());
+	if (material.has_Tr()) hash.add(material.Tr());
+	if (material.has_Tf()) hash.add(material.Tf());
+	if (material.has_illum()) hash.add((unsigned int)material.illum());
+	hash.add(material.textureName());
+}
+
+/**
+ * Add the options a mesh is stored and traced with to a hash.
+ * The leaves and the BVH builder decide which of two equally near triangles is hit.
+ */
+static void hashMeshOptions(Hash64& hash, const MeshOptions& options)
+{
+	hash.add((unsigned int)options.storage);
+	hash.add((unsigned int)options.leaves);
+	hash.add((unsigned int)options.wide);
+	hash.add((unsigned int)options.builder);
+}
+
+/**
+ * Continue a 32 bit FNV-1a checksum over some bytes.
+ */
+static uint32_t addChecksum(uint32_t value, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+		value = (value ^ bytes[i]) * 16777619u;
+	return value;
+}
+
+/**
+ * 32 bit FNV-1a checksum of a tile record, to find records that were cut off.
+ */
+static uint32_t recordChecksum(uint32_t index, uint32_t count, const float* pixels)
+{
+	const uint32_t words[2] = { index, count };
+	return addChecksum(addChecksum(2166136261u, words, sizeof(words)), pixels, count * sizeof(float));
+}
+
+/**
+ * Seek to a 64 bit file offset, the checkpoints of huge images are larger than 2 GB.
+ */
+static bool seekFile(FILE* file, long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/**
+ * Write one tile record, return whether it succeeded.
+ */
+static bool writeRecord(FILE* file, uint32_t index, const std::vector<float>& pixels)
+{
+	uint32_t header[3] = { RECORD_MAGIC, index, (uint32_t)pixels.size() };
+	uint32_t checksum = recordChecksum(index, header[2], pixels.data());
+	return fwrite(header, sizeof(header), 1, file) == 1 &&
+		fwrite(pixels.data(), sizeof(float), pixels.size(), file) == pixels.size() &&
+		fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+}
+
+/**
+ * Constructor, no file is open until open() is called.
+ */
+Checkpoint::Checkpoint() : _file(NULL), _reader(NULL), _closing(false) {}
+
+Checkpoint::~Checkpoint() {
+	close(false);
+}
+
+/**
+ * Open the checkpoint file and start the writer thread. The valid records are copied to a new
+ * file one at a time, and only their places are kept; read() takes them from there.
+ */
+unsigned int Checkpoint::open(const char* filename, uint64_t hash, const std::vector<Tile>& tiles) {
+	close(false);
+	_filename = filename;
+	_offsets.assign(tiles.size(), -1);
+
+	// Write the valid part to a new file, so new records don't follow a damaged one.
+	std::string temporary = _filename + ".tmp";
+	FILE* file;
+	if (fopen_s(&file, temporary.c_str(), "wb") != 0) {
+		std::cerr << "Cannot write checkpoint " << temporary << std::endl;
+		return 0;
+	}
+
+	CheckpointHeader header;
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.hash = hash;
+	header.tileCount = (uint32_t)tiles.size();
+	header.tileSize = TILE_SIZE;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	long long offset = sizeof(header);
+
+	// Copy the tiles of a previous run of the same render.
+	unsigned int count = 0;
+	FILE* previous;
+	if (written && fopen_s(&previous, filename, "rb") == 0) {
+		CheckpointHeader old;
+		if (fread(&old, sizeof(old), 1, previous) == 1 &&
+			memcmp(old.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+			old.hash == hash && old.tileCount == tiles.size() && old.tileSize == TILE_SIZE) {
+
+			// Stop at the first record that is incomplete or damaged.
+			uint32_t record[3];
+			std::vector<float> pixels;
+			while (written && fread(record, sizeof(record), 1, previous) == 1 && record[0] == RECORD_MAGIC && record[1] < tiles.size()) {
+				const Tile& tile = tiles[record[1]];
+				if (record[2] != 3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0))
+					break;
+
+				uint32_t checksum;
+				pixels.resize(record[2]);
+				if (fread(pixels.data(), sizeof(float), pixels.size(), previous) != pixels.size() ||
+					fread(&checksum, sizeof(checksum), 1, previous) != 1 ||
+					checksum != recordChecksum(record[1], record[2], pixels.data()))
+					break;
+
+				written = writeRecord(file, record[1], pixels);
+				if (_offsets[record[1]] < 0)
+					count++;
+				_offsets[record[1]] = offset + sizeof(record);
+				offset += sizeof(record) + pixels.size() * sizeof(float) + sizeof(checksum);
+			}
+		}
+		fclose(previous);
+	}
+	written = fclose(file) == 0 && written;
+
+	std::remove(_filename.c_str());
+	if (!written || std::rename(temporary.c_str(), _filename.c_str()) != 0 || fopen_s(&_file, _filename.c_str(), "ab") != 0) {
+		std::cerr << "Cannot write checkpoint " << _filename << std::endl;
+		_file = NULL;
+		_offsets.assign(tiles.size(), -1);
+		return 0;
+	}
+	if (count > 0 && fopen_s(&_reader, _filename.c_str(), "rb") != 0) {
+		_reader = NULL;
+		_offsets.assign(tiles.size(), -1);
+		count = 0;
+	}
+
+	_closing = false;
+	_thread = std::thread(&Checkpoint::writer, this);
+	return count;
+}
+
+/**
+ * Whether the checkpoint holds a tile.
+ */
+bool Checkpoint::has(const Tile& tile) const {
+	return tile.index < _offsets.size() && _offsets[tile.index] >= 0;
+}
+
+/**
+ * Read the pixels of a restored tile from the file.
+ */
+bool Checkpoint::read(const Tile& tile, std::vector<float>& pixels) {
+	if (!has(tile))
+		return false;
+
+	pixels.resize(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+	std::lock_guard<std::mutex> lock(_readMutex);
+	return seekFile(_reader, _offsets[tile.index]) &&
+		fread(pixels.data(), sizeof(float), pixels.size(), _reader) == pixels.size();
+}
+
+/**
+ * Queue a finished tile for the writer thread.
+ */
+void Checkpoint::append(const Tile& tile, const std::vector<float>& pixels) {
+	if (_file == NULL)
+		return;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_queue.push_back(std::make_pair(tile.index, pixels));
+	_condition.notify_one();
+}
+
+/**
+ * Writer thread. Takes all queued tiles at once, and flushes the file after writing them,
+ * so the file is at most the tiles of one batch behind the render.
+ */
+void Checkpoint::writer() {
+	std::deque<std::pair<unsigned int, std::vector<float> > > batch;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (_queue.empty() && !_closing)
+				_condition.wait(lock);
+			if (_queue.empty())
+				return;
+			batch.swap(_queue);
+		}
+
+		for (size_t i = 0; i < batch.size(); i++)
+			writeRecord(_file, batch[i].first, batch[i].second);
+		fflush(_file);
+		batch.clear();
+	}
+}
+
+/**
+ * Write the queued tiles and close the file, remove it when the render is complete.
+ */
+void Checkpoint::close(bool complete) {
+	if (_file == NULL)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closing = true;
+		_condition.notify_one();
+	}
+	_thread.join();
+
+	fclose(_file);
+	_file = NULL;
+	if (_reader != NULL)
+		fclose(_reader);
+	_reader = NULL;
+	_offsets.clear();
+	if (complete)
+		std::remove(_filename.c_str());
+}
+
+/**
+ * Hash the camera, render settings, lights, shapes and materials.
+ */
+uint64_t Checkpoint::hashRender(const Camera& camera, unsigned int ns) {
+	Hash64 hash;
+
+	// Camera and render settings.
+	hash.add(camera._width);
+	hash.add(camera._height);
+	hash.add(camera._origin00); hash.add(camera._dest00);
+	hash.add(camera._origin01); hash.add(camera._dest01);
+	hash.add(camera._origin10); hash.add(camera._dest10);
+	hash.add(camera._origin11); hash.add(camera._dest11);
+	hash.add(ns);
+	hash.add((unsigned int)sampleSequence);
+	hash.add(maxRayDepth);
+	hash.add(TILE_SIZE);
+
+	// Lights.
+	hash.add((unsigned int)MyLightPositions.size());
+	for (size_t i = 0; i < MyLightPositions.size(); i++)
+		hash.add(MyLightPositions[i]);
+	hash.add(lightSamples);
+	hash.add(irradianceAccuracy);
+	hash.add(irradianceRays);
+	hash.add(causticPhotons);
+	hash.add(causticGather);
+	hash.add((unsigned int)areaLights.size());
+	for (size_t i = 0; i < areaLights.size(); i++) {
+		const AreaLight& light = areaLights[i];
+		hash.add((unsigned int)light._type);
+		hash.add(light._position);
+		hash.add(light._edgeU);
+		hash.add(light._edgeV);
+		hash.add(light._radius);
+		hash.add(light._samples);
+	}
+
+	// Shapes and their materials.
+	hash.add((unsigned int)shapes.size());
+	for (size_t i = 0; i < shapes.size(); i++) {
+		Shape* shape = shapes[i];
+		hash.add(shape->_origin);
+		hash.add((unsigned int)shape->textureMapSet);
+
+		// The material of a mesh is the one of each triangle, hashed below.
+		if (dynamic_cast<MyMesh*>(shape) == NULL && dynamic_cast<LazyMesh*>(shape) == NULL)
+			hashMaterial(hash, shape->_material);
+
+		if (Sphere* sphere = dynamic_cast<Sphere*>(shape)) {
+			hash.add(1u);
+			hash.add(sphere->_radius);
+		}
+		else if (Plane* plane = dynamic_cast<Plane*>(shape)) {
+			hash.add(2u);
+			hash.add(plane->_coefficient);
+		}
+		else if (MyMesh* mesh = dynamic_cast<MyMesh*>(shape)) {
+			hash.add(3u);
+			hashMeshOptions(hash, mesh->_options);
+			if (mesh->_options.storage != MESH_STORAGE_FULL) {
+				// Compact meshes keep only their encoded geometry.
+				const CompactMesh& c = mesh->_compact;
+				hash.add(c._boundsMin);
+				hash.add(c._step);
+				hash.add(c._positions.data(), c._positions.size() * sizeof(float));
+				hash.add(c._quantizedPositions.data(), c._quantizedPositions.size() * sizeof(unsigned short));
+				hash.add(c._normals.data(), c._normals.size() * sizeof(unsigned int));
+				hash.add(c._triangles.data(), c._triangles.size() * sizeof(CompactTriangle));
+				hash.add(c._triangleMaterials.data(), c._triangleMaterials.size() * sizeof(unsigned short));
+			}
+			const Mesh& m = mesh->_mesh;
+			hash.add((unsigned int)m.vertices.size());
+			for (size_t v = 0; v < m.vertices.size(); v++) {
+				hash.add(m.vertices[v].p);
+				hash.add(m.vertices[v].n);
+			}
+			hash.add((unsigned int)m.triangles.size());
+			for (size_t t = 0; t < m.triangles.size(); t++)
+				hash.add(m.triangles[t].v, sizeof(m.triangles[t].v));
+			hash.add(m.triangleMaterials.data(), m.triangleMaterials.size() * sizeof(unsigned int));
+			for (size_t j = 0; j < mesh->_mesh.materials.size(); j++)
+				hashMaterial(hash, mesh->_mesh.materials[j]);
+		}
+		else if (LazyMesh* lazy = dynamic_cast<LazyMesh*>(shape)) {
+			// Hashing the triangles would load the mesh, its file stands for them.
+			hash.add(4u);
+			hash.add(lazy->_filename);
+			hashMeshOptions(hash, lazy->_options);
+			hash.add((unsigned int)lazy->_hasBounds);
+			if (lazy->_hasBounds) {
+				hash.add(lazy->_boundsMin);
+				hash.add(lazy->_boundsMax);
+			}
+		}
+	}
+
+	return hash._value;
+}
+
+/**
+ * Render the image tile by tile, restoring and recording the finished tiles in a checkpoint file.
+ * Restored tiles are read back when their turn comes and passed on in tile order with the rendered
+ * ones, so they obey the window too, and a resumed render holds no more tiles in memory than a new one.
+ */
+unsigned int renderCheckpointed(const Camera& camera, unsigned int ns, const char* filename, const TileFunction& render, const TileFunction& done, unsigned int window) {
+	std::vector<Tile> tiles = makeTiles(camera._width, camera._height);
+
+	Checkpoint checkpoint;
+	unsigned int count = checkpoint.open(filename, Checkpoint::hashRender(camera, ns), tiles);
+
+	// Not a vector<bool>, the render threads set the tiles that can't be read back at the same time.
+	std::vector<unsigned char> isRestored(tiles.size());
+	for (size_t i = 0; i < tiles.size(); i++)
+		isRestored[i] = checkpoint.has(tiles[i]) ? 1 : 0;
+
+	if (count > 0)
+		std::cout << "Resuming from " << filename << ", " << count << " of " << tiles.size() << " tiles done" << std::endl;
+
+	// Restored tiles were rendered with the same records as the rest will be.
+	if (count < tiles.size())
+		prefillIrradianceCache(camera);
+
+	// Only render the tiles the checkpoint doesn't have.
+	renderTiles(tiles, renderThreads(), [&](const Tile& tile, std::vector<float>& pixels) {
+		if (isRestored[tile.index] && checkpoint.read(tile, pixels))
+			return;
+		isRestored[tile.index] = 0;
+		render(tile, pixels);
+	}, [&](const Tile& tile, std::vector<float>& pixels) {
+		done(tile, pixels);
+		if (!isRestored[tile.index])
+			checkpoint.append(tile, pixels);
+	}, true, window);
+
+	checkpoint.close(true);
+	return count;
+}
+
+/**
+ * Write the passes and sums of a progressive render to a new file, and replace the old one with it.
+ */
+bool saveProgressive(const char* filename, uint64_t hash, const std::vector<unsigned char>& passes, const std::vector<float>& accumulation) {
+	std::string temporary = std::string(filename) + ".tmp";
+	FILE* file;
+	if (fopen_s(&file, temporary.c_str(), "wb") != 0)
+		return false;
+
+	ProgressiveHeader header;
+	memcpy(header.magic, PROGRESSIVE_MAGIC, sizeof(PROGRESSIVE_MAGIC));
+	header.hash = hash;
+	header.passCount = (uint32_t)passes.size();
+	header.floatCount = (uint32_t)accumulation.size();
+	uint32_t checksum = addChecksum(addChecksum(2166136261u, passes.data(), passes.size()),
+		accumulation.data(), accumulation.size() * sizeof(float));
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(passes.data(), 1, passes.size(), file) == passes.size() &&
+		fwrite(accumulation.data(), sizeof(float), accumulation.size(), file) == accumulation.size() &&
+		fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+	written = fclose(file) == 0 && written;
+
+	std::remove(filename);
+	if (!written || std::rename(temporary.c_str(), filename) != 0) {
+		std::cerr << "Cannot write checkpoint " << filename << std::endl;
+		std::remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Read the passes and sums of a progressive render, if the file belongs to it and is complete.
+ */
+bool loadProgressive(const char* filename, uint64_t hash, std::vector<unsigned char>& passes, std::vector<float>& accumulation) {
+	FILE* file;
+	if (fopen_s(&file, filename, "rb") != 0)
+		return false;
+
+	ProgressiveHeader header;
+	std::vector<unsigned char> readPasses(passes.size());
+	std::vector<float> readAccumulation(accumulation.size());
+	uint32_t checksum;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+		memcmp(header.magic, PROGRESSIVE_MAGIC, sizeof(PROGRESSIVE_MAGIC)) == 0 &&
+		header.hash == hash && header.passCount == passes.size() && header.floatCount == accumulation.size() &&
+		fread(readPasses.data(), 1, readPasses.size(), file) == readPasses.size() &&
+		fread(readAccumulation.data(), sizeof(float), readAccumulation.size(), file) == readAccumulation.size() &&
+		fread(&checksum, sizeof(checksum), 1, file) == 1 &&
+		checksum == addChecksum(addChecksum(2166136261u, readPasses.data(), readPasses.size()),
+			readAccumulation.data(), readAccumulation.size() * sizeof(float));
+	fclose(file);
+
+	if (!valid)
+		return false;
+	passes.swap(readPasses);
+	accumulation.swap(readAccumulation);
+	return true;
+}
@@ -0,0 +1,119 @@
+#ifndef CHECKPOINT_H_vnmxcoiwuerlkjsdfoiu
+#define CHECKPOINT_H_vnmxcoiwuerlkjsdfoiu
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "camera.h"
+#include "render.h"
+
+/**
+ * Checkpoint class
+ *
+ * Keeps the finished tiles of a long render in a file, so a render that was interrupted
+ * continues with the missing tiles when it is started again for the same scene and camera.
+ *
+ * The file starts with a header holding a hash of the scene, camera and render settings,
+ * followed by one record per finished tile. Records are only ever appended, by a background
+ * thread, so the render threads never wait for the disk. A record that was cut off when the
+ * program stopped fails its checksum and is dropped when the file is opened again.
+ */
+class Checkpoint {
+	public:
+		// Constructor
+		Checkpoint();
+		~Checkpoint();
+
+		/**
+		 * Open the checkpoint file of a render, and find the tiles it already holds.
+		 * A file of another scene, camera or setting is discarded.
+		 * 1st param:	Name of the checkpoint file.
+		 * 2nd param:	Hash of the render, see hashRender().
+		 * 3rd param:	The tiles of the render.
+		 * Return:		The number of restored tiles.
+		 */
+		unsigned int open(const char* filename, uint64_t hash, const std::vector<Tile>& tiles);
+
+		// Whether a tile was restored from the file.
+		bool has(const Tile& tile) const;
+
+		/**
+		 * Read the pixels of a restored tile back from the file, safe to call from several threads.
+		 * Return:		Whether the tile could be read.
+		 */
+		bool read(const Tile& tile, std::vector<float>& pixels);
+
+		// Queue a finished tile to be appended to the file, this doesn't block on the disk.
+		void append(const Tile& tile, const std::vector<float>& pixels);
+
+		/**
+		 * Write the queued tiles and close the file.
+		 * When the render is complete the file is removed, as it is not needed anymore.
+		 */
+		void close(bool complete);
+
+		/**
+		 * Hash everything the image depends on: the camera, the samples per pixel,
+		 * the ray depth, the tiles, the lights, and the shapes with their materials.
+		 */
+		static uint64_t hashRender(const Camera& camera, unsigned int ns);
+
+	private:
+		// Writer thread, appends the queued tiles.
+		void writer();
+
+		std::string _filename;
+		FILE* _file;
+
+		// Restored tiles are read back through their own handle, at the offset of their pixels, -1 when missing.
+		FILE* _reader;
+		std::vector<long long> _offsets;
+		std::mutex _readMutex;
+
+		// Tiles waiting to be written.
+		std::deque<std::pair<unsigned int, std::vector<float> > > _queue;
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		bool _closing;
+		std::thread _thread;
+};
+
+/**
+ * Render an image tile by tile on all cores, with a checkpoint file.
+ * Tiles found in the checkpoint file are not rendered again.
+ * 1st param:	The camera to produce the rays with.
+ * 2nd param:	Number of samples per pixel in each direction.
+ * 3rd param:	Name of the checkpoint file, it is removed when the render completes.
+ * 4th param:	Renders one tile, called from the render threads.
+ * 5th param:	Stores a finished or restored tile, calls are serialized.
+ * 6th param:	Window of renderTiles, 0 to start tiles as soon as a thread is free.
+ * Return:		The number of tiles that were restored from the checkpoint.
+ */
+unsigned int renderCheckpointed(const Camera& camera, unsigned int ns, const char* filename, const TileFunction& render, const TileFunction& done, unsigned int window);
+
+/**
+ * Write the state of a progressive render to a checkpoint file: which passes every row has
+ * done, and the sums of their samples. The file is written next to the old one and then put in
+ * its place, so an interruption while writing leaves the previous state.
+ * 1st param:	Name of the checkpoint file.
+ * 2nd param:	Hash of the render, see Checkpoint::hashRender().
+ * 3rd param:	One byte per row and pass, not 0 when the pass of the row is accumulated.
+ * 4th param:	The sums of the samples, 3 floats per pixel.
+ * Return:		Whether the file was written.
+ */
+bool saveProgressive(const char* filename, uint64_t hash, const std::vector<unsigned char>& passes, const std::vector<float>& accumulation);
+
+/**
+ * Read the state of a progressive render written by saveProgressive().
+ * The sizes of passes and accumulation must already be those of the render; a file of another
+ * render, or one that was damaged, is ignored and leaves them as they are.
+ * Return:		Whether the state was restored.
+ */
+bool loadProgressive(const char* filename, uint64_t hash, std::vector<unsigned char>& passes, std::vector<float>& accumulation);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,122 @@
+#include "compactmesh.h"
+#include <algorithm>
+#include <math.h>
+
+// Largest value of a quantized coordinate.
+static const float QUANTIZE_MAX = 65535.f;
+
+// Largest value of a signed 16-bit octahedral coordinate.
+static const float OCTAHEDRAL_MAX = 32767.f;
+
+CompactMesh::CompactMesh() : _quantized(false) {}
+
+/**
+ * Sign of a value, with 0 counted as positive as the octahedral folding needs.
+ */
+static inline float signNotZero(float value)
+{
+	return value < 0.f ? -1.f : 1.f;
+}
+
+unsigned int CompactMesh::encodeNormal(const Vec3Df& normal)
+{
+	float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	float x = 0.f, y = 0.f;
+	if (length > 0.f) {
+		x = normal[0] / length;
+		y = normal[1] / length;
+		if (normal[2] < 0.f) {
+			float foldedX = (1.f - fabsf(y)) * signNotZero(x);
+			float foldedY = (1.f - fabsf(x)) * signNotZero(y);
+			x = foldedX;
+			y = foldedY;
+		}
+	}
+
+	short encodedX = short(floorf(std::min(std::max(x, -1.f), 1.f) * OCTAHEDRAL_MAX + 0.5f));
+	short encodedY = short(floorf(std::min(std::max(y, -1.f), 1.f) * OCTAHEDRAL_MAX + 0.5f));
+	return (unsigned int)(unsigned short)encodedX | ((unsigned int)(unsigned short)encodedY << 16);
+}
+
+Vec3Df CompactMesh::decodeNormal(unsigned int encoded)
+{
+	float x = short(encoded & 0xffff) / OCTAHEDRAL_MAX;
+	float y = short(encoded >> 16) / OCTAHEDRAL_MAX;
+	float z = 1.f - fabsf(x) - fabsf(y);
+	if (z < 0.f) {
+		float unfoldedX = (1.f - fabsf(y)) * signNotZero(x);
+		float unfoldedY = (1.f - fabsf(x)) * signNotZero(y);
+		x = unfoldedX;
+		y = unfoldedY;
+	}
+
+	Vec3Df normal(x, y, z);
+	normal.normalize();
+	return normal;
+}
+
+void CompactMesh::build(const Mesh& mesh, bool quantize)
+{
+	clear();
+	_quantized = quantize;
+
+	const size_t vertices = mesh.vertices.size();
+	_normals.resize(vertices);
+	for (size_t i = 0; i < vertices; i++)
+		_normals[i] = encodeNormal(mesh.vertices[i].n);
+
+	if (quantize && vertices > 0) {
+		Vec3Df boundsMax = mesh.vertices[0].p;
+		_boundsMin = mesh.vertices[0].p;
+		for (size_t i = 1; i < vertices; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				_boundsMin[axis] = std::min(_boundsMin[axis], mesh.vertices[i].p[axis]);
+				boundsMax[axis] = std::max(boundsMax[axis], mesh.vertices[i].p[axis]);
+			}
+		}
+		for (int axis = 0; axis < 3; axis++)
+			_step[axis] = (boundsMax[axis] - _boundsMin[axis]) / QUANTIZE_MAX;
+
+		_quantizedPositions.resize(3 * vertices);
+		for (size_t i = 0; i < vertices; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				float q = _step[axis] > 0.f ? (mesh.vertices[i].p[axis] - _boundsMin[axis]) / _step[axis] : 0.f;
+				_quantizedPositions[3 * i + axis] = (unsigned short)std::min(floorf(q + 0.5f), QUANTIZE_MAX);
+			}
+		}
+	}
+	else {
+		_positions.resize(3 * vertices);
+		for (size_t i = 0; i < vertices; i++)
+			for (int axis = 0; axis < 3; axis++)
+				_positions[3 * i + axis] = mesh.vertices[i].p[axis];
+	}
+
+	// Meshes have far fewer than 65536 materials, the OBJ loader makes one per usemtl.
+	_triangles.resize(mesh.triangles.size());
+	_triangleMaterials.resize(mesh.triangles.size());
+	for (size_t i = 0; i < mesh.triangles.size(); i++) {
+		for (int v = 0; v < 3; v++)
+			_triangles[i].v[v] = mesh.triangles[i].v[v];
+		_triangleMaterials[i] = (unsigned short)mesh.triangleMaterials[i];
+	}
+}
+
+void CompactMesh::clear()
+{
+	_quantized = false;
+	_boundsMin = Vec3Df();
+	_step = Vec3Df();
+	std::vector<float>().swap(_positions);
+	std::vector<unsigned short>().swap(_quantizedPositions);
+	std::vector<unsigned int>().swap(_normals);
+	std::vector<CompactTriangle>().swap(_triangles);
+	std::vector<unsigned short>().swap(_triangleMaterials);
+}
+
+size_t CompactMesh::memoryUsage() const
+{
+	return _positions.capacity() * sizeof(float) + _quantizedPositions.capacity() * sizeof(unsigned short)
+		+ _normals.capacity() * sizeof(unsigned int) + _triangles.capacity() * sizeof(CompactTriangle)
+		+ _triangleMaterials.capacity() * sizeof(unsigned short);
+}
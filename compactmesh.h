@@ -0,0 +1,103 @@
+#ifndef COMPACTMESH_H_qmvnxbzlweirutpoas
+#define COMPACTMESH_H_qmvnxbzlweirutpoas
+
+#include <vector>
+#include "mesh.h"
+#include "Vec3D.h"
+
+/**
+ * How MyMesh stores its geometry.
+ */
+enum MeshStorage {
+	MESH_STORAGE_FULL,		// The Mesh as loaded: Vertex and Triangle objects, and one shape per triangle.
+	MESH_STORAGE_COMPACT,	// Float positions, octahedral normals and plain index triangles.
+	MESH_STORAGE_QUANTIZED	// As compact, with 16-bit positions relative to the bounds of the mesh.
+};
+
+/**
+ * The three vertex indices of a triangle, without the texture coordinates.
+ */
+struct CompactTriangle {
+	unsigned int v[3];
+};
+
+/**
+ * CompactMesh class
+ *
+ * The geometry of a mesh in as little memory as the intersection needs. A vertex is its
+ * position, 12 bytes as floats or 6 bytes quantized to 16 bits per axis over the bounds,
+ * and its normal in 4 bytes: the octahedral encoding with 16 bits per coordinate.
+ * A triangle is three indices and a 16-bit material index.
+ *
+ * Compared to the 32 bytes of a Vertex and the 32 bytes of a Triangle plus its TriangleShape,
+ * a mesh takes about a third of the memory, or a quarter when quantized.
+ */
+class CompactMesh {
+	public:
+		// Constructor
+		CompactMesh();
+
+		/**
+		 * Encode the geometry of a mesh.
+		 * 1st param:	The mesh, its normals must be computed.
+		 * 2nd param:	Whether to quantize the positions to 16 bits.
+		 */
+		void build(const Mesh& mesh, bool quantize);
+
+		// Remove the geometry.
+		void clear();
+
+		// Number of triangles.
+		size_t size() const { return _triangles.size(); }
+
+		// Number of bytes used by the geometry.
+		size_t memoryUsage() const;
+
+		/**
+		 * Position of a vertex, in mesh space.
+		 */
+		inline Vec3Df position(unsigned int vertex) const {
+			if (_quantized) {
+				const unsigned short* q = &_quantizedPositions[3 * vertex];
+				return Vec3Df(_boundsMin[0] + q[0] * _step[0], _boundsMin[1] + q[1] * _step[1], _boundsMin[2] + q[2] * _step[2]);
+			}
+			const float* p = &_positions[3 * vertex];
+			return Vec3Df(p[0], p[1], p[2]);
+		}
+
+		/**
+		 * Normal of a vertex, normalized.
+		 */
+		inline Vec3Df normal(unsigned int vertex) const {
+			return decodeNormal(_normals[vertex]);
+		}
+
+		/**
+		 * Octahedral encoding of a normal: the normal is projected on the octahedron |x|+|y|+|z| = 1,
+		 * the lower half is folded over the upper half, and x and y are stored as 16-bit integers.
+		 */
+		static unsigned int encodeNormal(const Vec3Df& normal);
+		static Vec3Df decodeNormal(unsigned int encoded);
+
+		// Variables
+
+		// Whether the positions are quantized.
+		bool _quantized;
+
+		// Quantized positions are _boundsMin + q * _step.
+		Vec3Df _boundsMin;
+		Vec3Df _step;
+
+		// Three coordinates per vertex, only one of both is used.
+		std::vector<float> _positions;
+		std::vector<unsigned short> _quantizedPositions;
+
+		// Encoded normal per vertex.
+		std::vector<unsigned int> _normals;
+
+		// Triangles, and the material index of each.
+		std::vector<CompactTriangle> _triangles;
+		std::vector<unsigned short> _triangleMaterials;
+};
+
+#endif // COMPACTMESH_H
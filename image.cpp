@@ -1,11 +1,33 @@
 // Includes
 #include "image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/**
+ * Whether a file name ends in .pfm, those are written as linear floats.
+ */
+static bool isPFM(const char * filename) {
+	size_t length = strlen(filename);
+	return length >= 4 && (strcmp(filename + length - 4, ".pfm") == 0 || strcmp(filename + length - 4, ".PFM") == 0);
+}
+
+/**
+ * Seek to a 64 bit file offset, PFM files of huge images are larger than 2 GB.
+ */
+static bool seekFile(FILE * file, long long offset) {
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
 
 /**
 * Image class
 *
 * This class can be used to read or write an image.
-* It reads and writes it in a PPM format.
+* It reads and writes it in a PPM format, or as linear floats in a PFM file.
 */
 
 /**
@@ -31,6 +53,15 @@ void Image::setPixel(int i, int j, const RGBValue & rgb) {
 	_image[3 * (_width*j + i) + 2] = rgb[2];
 }
 
+/**
+ * setPixelHDR; Sets the desired pixel without clamping, for the PFM file.
+ */
+void Image::setPixelHDR(int i, int j, float r, float g, float b) {
+	_image[3 * (_width*j + i)] = r;
+	_image[3 * (_width*j + i) + 1] = g;
+	_image[3 * (_width*j + i) + 2] = b;
+}
+
 /**
  * writeImage; Writes the stored image to the given file name.
  */
@@ -44,24 +75,170 @@ bool Image::writeImage(const char * filename) {
 
 	fprintf(file, "P6\n%i %i\n255\n", _width, _height);
 
+	// Convert one row at a time, so no second copy of the image is needed.
+	std::vector<unsigned char> imageC(3 * _width);
+
+	for (int y = 0; y < _height; ++y) {
+		const float* row = &_image[3 * _width * y];
+		for (int i = 0; i < 3 * _width; ++i)
+			imageC[i] = (unsigned char)((row[i] > 1.f ? 1.f : (row[i] < 0.f ? 0.f : row[i])) * 255.0f);
 
-	std::vector<unsigned char> imageC(_image.size());
+		int t = fwrite(&(imageC[0]), _width * 3, 1, file);
+		if (t != 1) {
+			printf("Dump file problem... fwrite\n");
+			fclose(file);
+			return false;
+		}
+	}
 
-	for (unsigned int i = 0; i<_image.size(); ++i)
-		imageC[i] = (unsigned char)(_image[i] * 255.0f);
+	std::cout << "Image succesfully written to: " << filename << std::endl;
 
-	int t = fwrite(&(imageC[0]), _width * _height * 3, 1, file);
-	if (t != 1) {
-		printf("Dump file problem... fwrite\n");
+	fclose(file);
+	return true;
+}
+
+/**
+ * writePFM; Writes the stored image as linear floats, without clamping.
+ * PFM stores the rows from bottom to top; the negative scale means little endian.
+ */
+bool Image::writePFM(const char * filename) {
+	FILE* file;
+	if (fopen_s(&file, filename, "wb") != 0 || !file) {
+		printf("Dump file problem... file\n");
 		return false;
 	}
 
+	fprintf(file, "PF\n%i %i\n-1.0\n", _width, _height);
+
+	for (int y = _height - 1; y >= 0; --y) {
+		int t = fwrite(&_image[3 * _width * y], sizeof(float) * 3 * _width, 1, file);
+		if (t != 1) {
+			printf("Dump file problem... fwrite\n");
+			fclose(file);
+			return false;
+		}
+	}
+
 	std::cout << "Image succesfully written to: " << filename << std::endl;
 
 	fclose(file);
 	return true;
 }
 
+/**
+ * Constructor, nothing is written until open() is called.
+ */
+ImageWriter::ImageWriter() : _file(NULL), _pfm(false), _headerSize(0), _pixelsWritten(0), _width(0), _height(0), _nextRow(0), _ok(false), _peakRows(0) {}
+
+ImageWriter::~ImageWriter() {
+	close();
+}
+
+/**
+ * open; Creates the file and writes the header.
+ */
+bool ImageWriter::open(const char * filename, int width, int height) {
+	close();
+
+	if (fopen_s(&_file, filename, "wb") != 0 || !_file) {
+		_file = NULL;
+		printf("Dump file problem... file\n");
+		return false;
+	}
+
+	_pfm = isPFM(filename);
+	if (_pfm)
+		fprintf(_file, "PF\n%i %i\n-1.0\n", width, height);
+	else
+		fprintf(_file, "P6\n%i %i\n255\n", width, height);
+	_headerSize = ftell(_file);
+	_pixelsWritten = 0;
+	_filename = filename;
+	_width = width;
+	_height = height;
+	_nextRow = 0;
+	_ok = true;
+	_peakRows = 0;
+	return true;
+}
+
+/**
+ * writeBlock; Copies a block of pixels into the waiting rows, and writes the rows that are complete.
+ */
+void ImageWriter::writeBlock(int x0, int y0, int x1, int y1, const float * pixels) {
+	if (!_file)
+		return;
+
+	// Floats go straight to their place in the file, rows from bottom to top.
+	if (_pfm) {
+		for (int y = y0; y < y1; ++y) {
+			long long offset = _headerSize + 3 * sizeof(float) * ((long long)(_height - 1 - y) * _width + x0);
+			if (!seekFile(_file, offset) || fwrite(pixels, 3 * sizeof(float) * (x1 - x0), 1, _file) != 1)
+				_ok = false;
+			pixels += 3 * (x1 - x0);
+		}
+		_pixelsWritten += (long long)(x1 - x0) * (y1 - y0);
+		return;
+	}
+
+	for (int y = y0; y < y1; ++y) {
+		Row& row = _rows[y];
+		if (row.bytes.empty()) {
+			row.bytes.resize(3 * _width);
+			row.pixels = 0;
+		}
+
+		unsigned char* bytes = &row.bytes[3 * x0];
+		for (int i = 0; i < 3 * (x1 - x0); ++i) {
+			float value = *pixels++;
+			*bytes++ = (unsigned char)((value > 1.f ? 1.f : (value < 0.f ? 0.f : value)) * 255.0f);
+		}
+		row.pixels += x1 - x0;
+	}
+
+	if (_rows.size() > _peakRows)
+		_peakRows = _rows.size();
+	flushRows();
+}
+
+/**
+ * flushRows; Writes the complete rows that are next in the file.
+ */
+void ImageWriter::flushRows() {
+	std::map<int, Row>::iterator row = _rows.begin();
+	while (row != _rows.end() && row->first == _nextRow && row->second.pixels >= _width) {
+		if (fwrite(&row->second.bytes[0], 3 * _width, 1, _file) != 1)
+			_ok = false;
+		_rows.erase(row++);
+		_nextRow++;
+	}
+}
+
+/**
+ * close; Closes the file, and reports whether the image is complete.
+ */
+bool ImageWriter::close() {
+	if (!_file)
+		return false;
+
+	bool complete = _ok && (_pfm ? _pixelsWritten == (long long)_width * _height : _nextRow == _height);
+	if (fclose(_file) != 0)
+		complete = false;
+	_file = NULL;
+	_rows.clear();
+	if (!complete) {
+		printf("Dump file problem... %s is incomplete\n", _filename.c_str());
+		return false;
+	}
+
+	std::cout << "Image succesfully written to: " << _filename << std::endl;
+	return true;
+}
+
+size_t ImageWriter::peakRows() const {
+	return _peakRows;
+}
+
 /**
  * readImage; Reads the image from the given file name.
  */
@@ -73,6 +250,10 @@ bool Image::readImage(const char * filename) {
 		return false;
 	}
 
+	// Linear float images.
+	if (isPFM(filename))
+		return readPFM(file, filename);
+
 	int width, height;
 	fscanf_s(file, "%*s\n");
 	char buf[256];
@@ -93,6 +274,53 @@ bool Image::readImage(const char * filename) {
 	return true;
 }
 
+/**
+ * readPFM; Reads a color PFM file, bottom row first, in the byte order given by the sign of the scale.
+ * The pixels are multiplied by the magnitude of the scale.
+ */
+bool Image::readPFM(FILE * file, const char * filename) {
+	int width, height;
+	float scale;
+	if (fgetc(file) != 'P' || fgetc(file) != 'F' ||
+		fscanf_s(file, "%i %i %f", &width, &height, &scale) != 3 || fgetc(file) == EOF ||
+		width <= 0 || height <= 0 || scale == 0.f) {
+		printf("ERROR: %s is not a color PFM file!\n", filename);
+		fclose(file);
+		return false;
+	}
+
+	std::vector<float> image(3 * (size_t)width * height);
+	for (int y = height - 1; y >= 0; --y) {
+		if (fread(&image[3 * (size_t)width * y], sizeof(float) * 3 * width, 1, file) != 1) {
+			printf("ERROR: %s is truncated!\n", filename);
+			fclose(file);
+			return false;
+		}
+	}
+	fclose(file);
+
+	// Swap the bytes of big endian files.
+	if (scale > 0.f) {
+		for (size_t i = 0; i < image.size(); i++) {
+			unsigned char* bytes = (unsigned char*)&image[i];
+			std::swap(bytes[0], bytes[3]);
+			std::swap(bytes[1], bytes[2]);
+		}
+	}
+
+	float magnitude = std::fabs(scale);
+	if (magnitude != 1.f) {
+		for (size_t i = 0; i < image.size(); i++)
+			image[i] *= magnitude;
+	}
+
+	this->_width = width;
+	this->_height = height;
+	_image.swap(image);
+	printf("Loaded image %s\n", filename);
+	return true;
+}
+
 /**
  * RGBValue class. Stores RGB Values per pixel.
  */
@@ -1,5 +1,8 @@
 #ifndef IMAGE_JFDJKDFSLJFDFKSDFDJFDFJSDKSFJSDLF
 #define IMAGE_JFDJKDFSLJFDFKSDFDJFDFJSDKSFJSDLF
+#include <cstdio>
+#include <map>
+#include <string>
 #include <vector>
 #include <iostream>
 
@@ -23,7 +26,9 @@ public:
  * Image class
  *
  * This class can be used to read or write an image.
- * It reads and writes it in a PPM format.
+ * It reads and writes it in a PPM format, or as linear floats in a PFM file.
+ * The pixels are stored as floats, setPixelHDR keeps values outside [0, 1] so
+ * the PFM file can be tone mapped later; the PPM file is clamped.
  */
 class Image
 {
@@ -34,7 +39,9 @@ public:
 
 	// Methods
 	void setPixel(int i, int j, const RGBValue & rgb);
+	void setPixelHDR(int i, int j, float r, float g, float b);
 	bool writeImage(const char * filename);
+	bool writePFM(const char * filename);
 
 	// Variabless
 	std::vector<float> _image;
@@ -44,6 +51,71 @@ public:
 private:
 	// Private methods
 	bool readImage(const char * filename);
+	bool readPFM(FILE * file, const char * filename);
+};
+
+/**
+ * ImageWriter class
+ *
+ * Writes a PPM file while the image is rendered, so the whole image never has to be in memory.
+ * Blocks of pixels may arrive in any order; a row is written as soon as all its pixels are
+ * there and all rows above it are written. Only the rows that are not written yet are kept,
+ * so the memory used depends on how far ahead of the first unfinished row the blocks arrive.
+ *
+ * A file name ending in .pfm writes linear floats instead. Those are not clamped, and every
+ * block is written to its place in the file right away, so no rows are kept at all.
+ */
+class ImageWriter
+{
+public:
+	// Constructors
+	ImageWriter();
+	~ImageWriter();
+
+	// Methods
+
+	/**
+	 * Create the file and write the PPM header.
+	 * Return:		Whether the file could be created.
+	 */
+	bool open(const char * filename, int width, int height);
+
+	/**
+	 * Add the pixels of the block [x0, x1) x [y0, y1), 3 floats per pixel, row by row.
+	 * For a PPM file the values are clamped to [0, 1], like RGBValue does.
+	 */
+	void writeBlock(int x0, int y0, int x1, int y1, const float * pixels);
+
+	/**
+	 * Close the file.
+	 * Return:		Whether every row was written.
+	 */
+	bool close();
+
+	// The largest number of rows that waited in memory at the same time.
+	size_t peakRows() const;
+
+private:
+	// A row that is not complete yet, or waits for the rows above it.
+	struct Row {
+		std::vector<unsigned char> bytes;
+		int pixels;
+	};
+
+	// Write the complete rows at the front.
+	void flushRows();
+
+	std::string _filename;
+	FILE * _file;
+	bool _pfm;
+	long long _headerSize;
+	long long _pixelsWritten;
+	int _width;
+	int _height;
+	int _nextRow;
+	bool _ok;
+	std::map<int, Row> _rows;
+	size_t _peakRows;
 };
 
 #endif
\ No newline at end of file
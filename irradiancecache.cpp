@@ -0,0 +1,260 @@
+#include "irradiancecache.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Depth of the octree, below this the nodes are smaller than any useful record.
+static const unsigned int MAX_DEPTH = 16;
+
+// Range of the record radii, relative to the diagonal of the scene.
+static const float MIN_RADIUS = 0.005f;
+static const float MAX_RADIUS = 0.2f;
+
+// How far a record may lie in front of a point, relative to its radius, and still light it.
+static const float MAX_IN_FRONT = 0.05f;
+
+IrradianceCache::Node::Node()
+{
+	for (int i = 0; i < 8; i++)
+		children[i].store(nullptr, std::memory_order_relaxed);
+	records.store(nullptr, std::memory_order_relaxed);
+}
+
+IrradianceCache::IrradianceCache() : _accuracy(0.f), _frozen(false), _minRadius(0.f), _maxRadius(0.f), _min(-1.f, -1.f, -1.f), _max(1.f, 1.f, 1.f),
+	_root(nullptr), _size(0)
+{
+	reset(_min, _max, 0.f);
+}
+
+void IrradianceCache::reset(const Vec3Df& min, const Vec3Df& max, float accuracy)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_links.clear();
+	_nodes.clear();
+	_nodes.emplace_back();
+	_root = &_nodes.back();
+	_size = 0;
+	_accuracy = accuracy;
+	_frozen = false;
+
+	// A cube around the scene with some room, so nodes stay cubes.
+	Vec3Df center(0.f, 0.f, 0.f);
+	float half = 1.f;
+	if (min[0] <= max[0] && min[1] <= max[1] && min[2] <= max[2]) {
+		center = 0.5f * (min + max);
+		half = 0.75f * std::max(max[0] - min[0], std::max(max[1] - min[1], max[2] - min[2])) + 1e-3f;
+	}
+	_min = center - Vec3Df(half, half, half);
+	_max = center + Vec3Df(half, half, half);
+
+	float diagonal = (max - min).getLength();
+	if (!(diagonal > 0.f))
+		diagonal = 2.f * half;
+	_minRadius = MIN_RADIUS * diagonal;
+	_maxRadius = MAX_RADIUS * diagonal;
+}
+
+bool IrradianceCache::lookup(const Vec3Df& point, const Vec3Df& normal, Vec3Df& irradiance) const
+{
+	Vec3Df sum(0.f, 0.f, 0.f);
+	float weights = 0.f;
+
+	const bool inside = point[0] >= _min[0] && point[1] >= _min[1] && point[2] >= _min[2]
+		&& point[0] <= _max[0] && point[1] <= _max[1] && point[2] <= _max[2];
+	Vec3Df nodeMin = _min, nodeMax = _max;
+	const Node* node = _root;
+	while (node != nullptr) {
+		for (const Link* link = node->records.load(std::memory_order_acquire); link != nullptr; link = link->next) {
+			const IrradianceRecord& record = link->record;
+			Vec3Df offset = point - record.position;
+			float error = offset.getLength() / record.radius
+				+ sqrtf(std::max(0.f, 1.f - Vec3Df::dotProduct(normal, record.normal)));
+			if (error >= _accuracy)
+				continue;
+
+			// A record in front of the point sees light the point doesn't.
+			if (0.5f * Vec3Df::dotProduct(offset, normal + record.normal) < -MAX_IN_FRONT * record.radius)
+				continue;
+
+			Vec3Df turn = Vec3Df::crossProduct(record.normal, normal);
+			Vec3Df extrapolated;
+			for (int c = 0; c < 3; c++)
+				extrapolated[c] = std::max(0.f, record.irradiance[c] + Vec3Df::dotProduct(turn, record.rotation[c])
+					+ Vec3Df::dotProduct(offset, record.translation[c]));
+
+			float weight = 1.f / std::max(error, 1e-6f);
+			sum += weight * extrapolated;
+			weights += weight;
+		}
+
+		if (!inside)
+			break;
+
+		// Down to the child with the point.
+		Vec3Df middle = 0.5f * (nodeMin + nodeMax);
+		unsigned int child = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			if (point[axis] >= middle[axis]) {
+				child |= 1 << axis;
+				nodeMin[axis] = middle[axis];
+			}
+			else {
+				nodeMax[axis] = middle[axis];
+			}
+		}
+		node = node->children[child].load(std::memory_order_acquire);
+	}
+
+	if (weights <= 0.f)
+		return false;
+	irradiance = sum / weights;
+	return true;
+}
+
+void IrradianceCache::strata(unsigned int rays, unsigned int& rows, unsigned int& columns)
+{
+	rows = std::max(1u, (unsigned int)(sqrtf(rays / float(M_PI)) + 0.5f));
+	columns = std::max(3u, (rays + rows / 2) / rows);
+}
+
+void IrradianceCache::makeFrame(const Vec3Df& normal, Vec3Df& u, Vec3Df& v)
+{
+	u = fabsf(normal[0]) > 0.9f ? Vec3Df(0.f, 1.f, 0.f) : Vec3Df(1.f, 0.f, 0.f);
+	u = Vec3Df::crossProduct(normal, u);
+	u.normalize();
+	v = Vec3Df::crossProduct(normal, u);
+}
+
+Vec3Df IrradianceCache::direction(const Vec3Df& normal, unsigned int row, unsigned int column, unsigned int rows, unsigned int columns, float s, float t)
+{
+	Vec3Df u, v;
+	makeFrame(normal, u, v);
+	float sinTheta = sqrtf((row + s) / rows);
+	float cosTheta = sqrtf(std::max(0.f, 1.f - sinTheta * sinTheta));
+	float phi = 2.f * float(M_PI) * (column + t) / columns;
+	return sinTheta * cosf(phi) * u + sinTheta * sinf(phi) * v + cosTheta * normal;
+}
+
+/**
+ * The irradiance is the average of the cosine distributed rays times pi. The gradients are those of
+ * Ward and Heckbert, "Irradiance Gradients": turning the normal tilts every row towards the horizon
+ * by its tangent; moving the point moves the borders between the strata, by how much depends on the
+ * distance to what the rays on either side of the border hit.
+ */
+Vec3Df IrradianceCache::add(const Vec3Df& point, const Vec3Df& normal, unsigned int rows, unsigned int columns, const Vec3Df* radiance, const float* distance)
+{
+	const unsigned int M = rows, N = columns;
+	const float pi = float(M_PI);
+	Vec3Df u, v;
+	makeFrame(normal, u, v);
+
+	IrradianceRecord record;
+	record.position = point;
+	record.normal = normal;
+	record.irradiance = Vec3Df(0.f, 0.f, 0.f);
+	float inverseDistances = 0.f;
+	for (unsigned int i = 0; i < M * N; i++) {
+		record.irradiance += radiance[i];
+		inverseDistances += 1.f / distance[i];
+	}
+	record.irradiance *= pi / (M * N);
+	if (_frozen)
+		return record.irradiance;
+
+	for (int c = 0; c < 3; c++) {
+		record.rotation[c] = Vec3Df(0.f, 0.f, 0.f);
+		record.translation[c] = Vec3Df(0.f, 0.f, 0.f);
+	}
+
+	for (unsigned int k = 0; k < N; k++) {
+		float phi = 2.f * pi * (k + 0.5f) / N;
+		float phiBorder = 2.f * pi * k / N;
+		Vec3Df uk = cosf(phi) * u + sinf(phi) * v;
+		Vec3Df vk = -sinf(phi) * u + cosf(phi) * v;
+		Vec3Df vBorder = -sinf(phiBorder) * u + cosf(phiBorder) * v;
+		unsigned int previous = (k + N - 1) % N;
+
+		Vec3Df rotation(0.f, 0.f, 0.f), rowBorders(0.f, 0.f, 0.f), columnBorder(0.f, 0.f, 0.f);
+		for (unsigned int j = 0; j < M; j++) {
+			const Vec3Df& L = radiance[j * N + k];
+			float sinTheta = sqrtf((j + 0.5f) / M);
+			float tanTheta = sinTheta / sqrtf(std::max(1e-6f, 1.f - sinTheta * sinTheta));
+			rotation -= tanTheta * L;
+
+			float sinLow = sqrtf(float(j) / M), sinHigh = sqrtf(float(j + 1) / M);
+			if (j > 0) {
+				float cos2Low = 1.f - sinLow * sinLow;
+				float nearest = std::min(distance[j * N + k], distance[(j - 1) * N + k]);
+				rowBorders += (sinLow * cos2Low / nearest) * (L - radiance[(j - 1) * N + k]);
+			}
+			float nearest = std::min(distance[j * N + k], distance[j * N + previous]);
+			columnBorder += ((sinHigh - sinLow) / nearest) * (L - radiance[j * N + previous]);
+		}
+
+		for (int c = 0; c < 3; c++) {
+			record.rotation[c] += rotation[c] * vk;
+			record.translation[c] += (2.f * pi / N * rowBorders[c]) * uk + columnBorder[c] * vBorder;
+		}
+	}
+	for (int c = 0; c < 3; c++)
+		record.rotation[c] *= pi / (M * N);
+
+	// The harmonic mean distance, cut down where the irradiance changes faster than that.
+	float radius = inverseDistances > 0.f ? (M * N) / inverseDistances : _maxRadius;
+	radius = std::min(std::max(radius, _minRadius), _maxRadius);
+	float brightness = (record.irradiance[0] + record.irradiance[1] + record.irradiance[2]) / 3.f;
+	float gradient = ((record.translation[0] + record.translation[1] + record.translation[2]) / 3.f).getLength();
+	if (gradient > 0.f)
+		radius = std::max(std::min(radius, brightness / gradient), _minRadius);
+	record.radius = radius;
+
+	// Every node on the path of a point in the sphere where the record is used gets it.
+	float reach = _accuracy * radius;
+	Vec3Df min = point - Vec3Df(reach, reach, reach);
+	Vec3Df max = point + Vec3Df(reach, reach, reach);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		insert(_root, _min, _max, 0, record, min, max);
+		_size++;
+	}
+	return record.irradiance;
+}
+
+void IrradianceCache::insert(Node* node, const Vec3Df& nodeMin, const Vec3Df& nodeMax, unsigned int depth, const IrradianceRecord& record, const Vec3Df& min, const Vec3Df& max)
+{
+	// The root keeps the records that don't fit in the octree, a point outside it only looks there.
+	bool outside = depth == 0 && (min[0] < nodeMin[0] || min[1] < nodeMin[1] || min[2] < nodeMin[2]
+		|| max[0] > nodeMax[0] || max[1] > nodeMax[1] || max[2] > nodeMax[2]);
+	if (outside || depth == MAX_DEPTH || (nodeMax - nodeMin).getSquaredLength() < (max - min).getSquaredLength()) {
+		Link link = { record, node->records.load(std::memory_order_relaxed) };
+		_links.push_back(link);
+		node->records.store(&_links.back(), std::memory_order_release);
+		return;
+	}
+
+	Vec3Df middle = 0.5f * (nodeMin + nodeMax);
+	for (unsigned int child = 0; child < 8; child++) {
+		Vec3Df childMin, childMax;
+		bool overlaps = true;
+		for (int axis = 0; axis < 3; axis++) {
+			bool upper = (child >> axis) & 1;
+			childMin[axis] = upper ? middle[axis] : nodeMin[axis];
+			childMax[axis] = upper ? nodeMax[axis] : middle[axis];
+			overlaps = overlaps && min[axis] <= childMax[axis] && max[axis] >= childMin[axis];
+		}
+		if (!overlaps)
+			continue;
+
+		Node* next = node->children[child].load(std::memory_order_relaxed);
+		if (next == nullptr) {
+			_nodes.emplace_back();
+			next = &_nodes.back();
+			node->children[child].store(next, std::memory_order_release);
+		}
+		insert(next, childMin, childMax, depth + 1, record, min, max);
+	}
+}
@@ -0,0 +1,139 @@
+#ifndef IRRADIANCECACHE_H_mznxbcvlaksjdhfgpqow
+#define IRRADIANCECACHE_H_mznxbcvlaksjdhfgpqow
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include "Vec3D.h"
+
+/**
+ * The indirect irradiance at a point, gathered from a hemisphere of rays, with its gradients
+ * for moving the point and turning its normal.
+ */
+struct IrradianceRecord {
+	Vec3Df position;
+	Vec3Df normal;
+	Vec3Df irradiance;
+	float radius;				// Harmonic mean distance to the surfaces around it, clamped.
+	Vec3Df rotation[3];			// Gradient of each color channel for turning the normal.
+	Vec3Df translation[3];		// Gradient of each color channel for moving the point.
+};
+
+/**
+ * IrradianceCache class
+ *
+ * Irradiance caching after Ward: the indirect diffuse light changes slowly over a surface, so it
+ * is only gathered at sparse points and interpolated in between. A record is used for the points
+ * where its error estimate,
+ *
+ *   |p - position| / radius + sqrt(1 - dot(n, normal)),
+ *
+ * is below the accuracy: close to the record and facing the same way, further away the more open
+ * the space around it. Records are extrapolated with their gradients before they are averaged,
+ * and the radius is cut down where the translation gradient says the irradiance changes fast.
+ *
+ * The records are kept in an octree, in the nodes about the size of the sphere where they are
+ * used. Lookups don't lock: nodes and records are published with atomic pointers and never
+ * change after that, so any number of threads can look up while one adds. The cache keeps its
+ * records until it is reset, so the frames of an animation of a static scene share them.
+ *
+ * Which records a point finds depends on the points gathered before it, so the image depends on
+ * the order the pixels are rendered in. A frozen cache doesn't, see freeze().
+ */
+class IrradianceCache {
+	public:
+		// Constructor
+		IrradianceCache();
+
+		/**
+		 * Remove all records, and set the space the octree covers. Records outside of it are
+		 * kept in the root. Not safe while other threads use the cache.
+		 * 1st param:	Minimum corner of the scene.
+		 * 2nd param:	Maximum corner of the scene.
+		 * 3rd param:	Largest error estimate of the records used, 0 disables the cache.
+		 */
+		void reset(const Vec3Df& min, const Vec3Df& max, float accuracy);
+
+		// Whether records are used, the accuracy is above 0.
+		bool enabled() const { return _accuracy > 0.f; }
+
+		/**
+		 * Stop adding records: add() still makes the record and returns its irradiance, but leaves
+		 * it out, so lookups no longer depend on which points were gathered first. reset() ends it.
+		 */
+		void freeze() { _frozen = true; }
+
+		// Whether the records are frozen.
+		bool frozen() const { return _frozen; }
+
+		// Number of records.
+		size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+		/**
+		 * Interpolate the irradiance at a point from the records around it.
+		 * 1st param:	The point.
+		 * 2nd param:	The normal at the point, normalized.
+		 * 3rd param:	Gets the irradiance.
+		 * Return:		Whether there were records close enough, otherwise a new record is needed.
+		 */
+		bool lookup(const Vec3Df& point, const Vec3Df& normal, Vec3Df& irradiance) const;
+
+		/**
+		 * The number of strata of a hemisphere gather of about the given number of rays: rows
+		 * of equal solid angle times cosine, and about pi times as many columns around the normal.
+		 */
+		static void strata(unsigned int rays, unsigned int& rows, unsigned int& columns);
+
+		/**
+		 * The direction of a gather ray of stratum (row, column), cosine distributed.
+		 * 1st param:	The normal.
+		 * 2nd-3rd:	Row and column.
+		 * 4th-5th:	Number of rows and columns.
+		 * 6th-7th:	Place in the stratum, in [0, 1).
+		 */
+		static Vec3Df direction(const Vec3Df& normal, unsigned int row, unsigned int column, unsigned int rows, unsigned int columns, float s, float t);
+
+		/**
+		 * Make a record from the gather rays of a point, and add it.
+		 * 1st param:	The point.
+		 * 2nd param:	The normal, the one the directions were made with.
+		 * 3rd-4th:	Number of rows and columns.
+		 * 5th param:	Light arriving along each gather ray, row by row.
+		 * 6th param:	Distance to the hit of each gather ray, FLT_MAX for misses.
+		 * Return:		The irradiance of the record.
+		 */
+		Vec3Df add(const Vec3Df& point, const Vec3Df& normal, unsigned int rows, unsigned int columns, const Vec3Df* radiance, const float* distance);
+
+	private:
+		// A record in the list of an octree node.
+		struct Link {
+			IrradianceRecord record;
+			const Link* next;
+		};
+
+		struct Node {
+			Node();
+
+			std::atomic<Node*> children[8];
+			std::atomic<const Link*> records;
+		};
+
+		// Methods
+		void insert(Node* node, const Vec3Df& nodeMin, const Vec3Df& nodeMax, unsigned int depth, const IrradianceRecord& record, const Vec3Df& min, const Vec3Df& max);
+		static void makeFrame(const Vec3Df& normal, Vec3Df& u, Vec3Df& v);
+
+		// Variables
+		float _accuracy;
+		bool _frozen;
+		float _minRadius, _maxRadius;
+		Vec3Df _min, _max;
+		Node* _root;
+		std::atomic<size_t> _size;
+
+		// Nodes and records don't move, they are only freed by reset.
+		std::deque<Node> _nodes;
+		std::deque<Link> _links;
+		std::mutex _mutex;
+};
+
+#endif // IRRADIANCECACHE_H
@@ -0,0 +1,142 @@
+#include "lighttree.h"
+#include <algorithm>
+#include <math.h>
+
+// Part of the importance that doesn't depend on the direction of the light, for the ambient
+// and specular light of lights that graze the surface.
+static const float MIN_COSINE = 0.05f;
+
+
+LightTree::LightTree() : _lightCount(0) {}
+
+void LightTree::build(const std::vector<Vec3Df>& lights)
+{
+	clear();
+	if (lights.empty())
+		return;
+
+	std::vector<unsigned int> indices(lights.size());
+	for (unsigned int i = 0; i < indices.size(); i++)
+		indices[i] = i;
+
+	// A binary tree with one light per leaf has 2n - 1 nodes, children are made in pairs.
+	_nodes.reserve(2 * lights.size() - 1);
+	_nodes.push_back(LightNode());
+	buildNode(lights, indices, 0, 0, (unsigned int)lights.size());
+	_lightCount = lights.size();
+}
+
+void LightTree::buildNode(const std::vector<Vec3Df>& lights, std::vector<unsigned int>& indices, unsigned int node, unsigned int begin, unsigned int end)
+{
+	Vec3Df boundsMin = lights[indices[begin]], boundsMax = lights[indices[begin]];
+	for (unsigned int i = begin + 1; i < end; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			boundsMin[axis] = std::min(boundsMin[axis], lights[indices[i]][axis]);
+			boundsMax[axis] = std::max(boundsMax[axis], lights[indices[i]][axis]);
+		}
+	}
+
+	LightNode result;
+	result.center = 0.5f * (boundsMin + boundsMax);
+	result.radius2 = (0.5f * (boundsMax - boundsMin)).getSquaredLength();
+	result.count = end - begin;
+
+	if (result.count == 1) {
+		result.first = indices[begin];
+		_nodes[node] = result;
+		return;
+	}
+
+	int axis = 0;
+	for (int a = 1; a < 3; a++)
+		if (boundsMax[a] - boundsMin[a] > boundsMax[axis] - boundsMin[axis])
+			axis = a;
+
+	unsigned int middle = begin + (end - begin) / 2;
+	std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](unsigned int a, unsigned int b) {
+		return lights[a][axis] < lights[b][axis];
+	});
+
+	result.first = (unsigned int)_nodes.size();
+	_nodes[node] = result;
+	_nodes.push_back(LightNode());
+	_nodes.push_back(LightNode());
+	buildNode(lights, indices, result.first, begin, middle);
+	buildNode(lights, indices, result.first + 1, middle, end);
+}
+
+void LightTree::clear()
+{
+	std::vector<LightNode>().swap(_nodes);
+	_lightCount = 0;
+}
+
+/**
+ * Importance of the lights of a node: their number times the largest |cos| between the normal and
+ * a direction into the sphere around their box, as the Phong shading lights both sides of a surface.
+ */
+float LightTree::importance(const LightNode& node, const Vec3Df& point, const Vec3Df& normal)
+{
+	Vec3Df toCenter = node.center - point;
+	float distance2 = toCenter.getSquaredLength();
+	float radius2 = node.radius2;
+	float cosine = 1.f;
+	if (distance2 > radius2) {
+		// |cos| to the center is the sine of the angle a to the plane of the surface, which the sphere
+		// widens by an angle b: sin(a + b), or 1 once a + b passes 90 degrees.
+		float sinA = std::min(fabsf(Vec3Df::dotProduct(normal, toCenter)) / sqrtf(distance2), 1.f);
+		float cosA = sqrtf(1.f - sinA * sinA);
+		float sinB = sqrtf(radius2 / distance2);
+		float cosB = sqrtf(1.f - radius2 / distance2);
+		if (cosA * cosB > sinA * sinB)
+			cosine = sinA * cosB + cosA * sinB;
+	}
+	return node.count * (MIN_COSINE + cosine);
+}
+
+void LightTree::sample(const Vec3Df& point, const Vec3Df& normal, float* u, unsigned int count, unsigned int* lights, float* probabilities) const
+{
+	// The samples [begin, end) that reach a node, and the probability of reaching it.
+	struct Visit {
+		unsigned int node;
+		unsigned int begin, end;
+		float probability;
+	};
+
+	// The tree is balanced, each level below the root adds at most one visit to the stack.
+	Visit stack[64];
+	unsigned int size = 0;
+	Visit root = { 0, 0, count, 1.f };
+	stack[size++] = root;
+	while (size > 0) {
+		const Visit visit = stack[--size];
+		const LightNode& node = _nodes[visit.node];
+		if (node.isLeaf()) {
+			for (unsigned int i = visit.begin; i < visit.end; i++) {
+				lights[i] = node.first;
+				probabilities[i] = visit.probability;
+			}
+			continue;
+		}
+
+		float left = importance(_nodes[node.first], point, normal);
+		float right = importance(_nodes[node.first + 1], point, normal);
+		float pLeft = left / (left + right);
+
+		// The numbers of each child are scaled back to [0, 1), for the choices below it.
+		unsigned int split = visit.begin;
+		for (; split < visit.end && u[split] < pLeft; split++)
+			u[split] = std::min(u[split] / pLeft, 0.99999994f);
+		for (unsigned int i = split; i < visit.end; i++)
+			u[i] = std::min((u[i] - pLeft) / (1.f - pLeft), 0.99999994f);
+
+		if (split < visit.end) {
+			Visit child = { node.first + 1, split, visit.end, visit.probability * (1.f - pLeft) };
+			stack[size++] = child;
+		}
+		if (visit.begin < split) {
+			Visit child = { node.first, visit.begin, split, visit.probability * pLeft };
+			stack[size++] = child;
+		}
+	}
+}
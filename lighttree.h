@@ -0,0 +1,77 @@
+#ifndef LIGHTTREE_H_vbnmqwoeirutalskdjfz
+#define LIGHTTREE_H_vbnmqwoeirutalskdjfz
+
+#include <vector>
+#include "Vec3D.h"
+
+/**
+ * A node of the light tree, the sphere around the box of its lights. Nodes with one light are leaves,
+ * where first is the index of the light in MyLightPositions; otherwise first is the index of the
+ * first of two child nodes.
+ */
+struct LightNode {
+	Vec3Df center;
+	float radius2;			// Squared radius.
+	unsigned int count;		// Number of lights below the node.
+	unsigned int first;
+
+	bool isLeaf() const { return count == 1; }
+};
+
+/**
+ * LightTree class
+ *
+ * A binary tree over point lights, for picking a few of many lights per hit point instead of
+ * tracing a shadow ray to each. The lights are split at the median of the longest axis of
+ * their bounds, so the tree is balanced and a sample visits log2(lights) nodes.
+ *
+ * A sample walks down from the root, and picks each child with a probability proportional to
+ * its importance for the hit point: the number of lights times a bound on the cosine between
+ * the normal and the directions to its lights. The shading has no distance falloff, so distance
+ * doesn't count. Dividing the light of the picked light by its probability keeps the estimate
+ * of the sum over all lights unbiased.
+ *
+ * The samples of a hit point walk down together: the ones below the probability of the left
+ * child go left, so each node is visited once however many samples pass it.
+ */
+class LightTree {
+	public:
+		// Constructor
+		LightTree();
+
+		/**
+		 * Build the tree over the positions of the lights.
+		 */
+		void build(const std::vector<Vec3Df>& lights);
+
+		// Remove the tree.
+		void clear();
+
+		// Number of lights in the tree.
+		size_t size() const { return _lightCount; }
+
+		/**
+		 * Pick lights for a hit point.
+		 * 1st param:	The hit point.
+		 * 2nd param:	The normal at the hit point, normalized.
+		 * 3rd param:	Random numbers in [0, 1) in increasing order, one per light. Close numbers pick
+		 *				lights close together, so evenly spread numbers stratify the lights. Overwritten.
+		 * 4th param:	Number of lights to pick.
+		 * 5th param:	Gets the index of each light.
+		 * 6th param:	Gets the probability each light was picked with.
+		 */
+		void sample(const Vec3Df& point, const Vec3Df& normal, float* u, unsigned int count, unsigned int* lights, float* probabilities) const;
+
+		// Variables
+		std::vector<LightNode> _nodes;
+
+	private:
+		// Methods
+		void buildNode(const std::vector<Vec3Df>& lights, std::vector<unsigned int>& indices, unsigned int node, unsigned int begin, unsigned int end);
+		static float importance(const LightNode& node, const Vec3Df& point, const Vec3Df& normal);
+
+		// Variables
+		size_t _lightCount;
+};
+
+#endif // LIGHTTREE_H
@@ -3,9 +3,14 @@
 #endif
 #include "main.h"
 #include "traqueboule.h"
+#include "render.h"
+#include "progressive.h"
+#include "relight.h"
+#include "checkpoint.h"
+#include "scene.h"
 #include <GL/glut.h>
-#include <iomanip>
 #include <ostream>
+#include <thread>
 
 /**
  * VARIABLE DEFINITION
@@ -24,9 +29,20 @@ unsigned int WindowSize_Y = 2000;
 unsigned int ImageSize_X = WindowSize_X;
 unsigned int ImageSize_Y = WindowSize_Y;
 
+// Vertical field of view of the window in degrees.
+float FieldOfView = 50.f;
+
 // Number of samples.
 unsigned int ns = 4;
 
+// Progressive rendering, started with 'p'.
+ProgressiveRenderer progressive;
+bool showProgressive = false;
+GLuint progressiveTexture = 0;
+
+// Hits of the last 'r' render, to relight it when only the lights moved.
+RelightCache relightCache;
+
 /**
  * Main function, which is drawing an image (frame) on the screen.
  *
@@ -34,7 +50,98 @@ unsigned int ns = 4;
  */
 void drawFrame()
 {
-	yourDebugDraw();
+	if (showProgressive)
+		drawProgressive();
+	else
+		yourDebugDraw();
+}
+
+/**
+ * Draw the current progressive render over the whole window.
+ *
+ * The accumulated image is uploaded as a texture at most a few times per second,
+ * converting a 2000x2000 float buffer every frame would slow down the render threads.
+ */
+void drawProgressive()
+{
+	static std::vector<unsigned char> preview;
+	static int lastUpload = -1000;
+	static unsigned int lastPasses = 0;
+	static bool wasRunning = false;
+
+	bool running = progressive.isRunning();
+	int now = glutGet(GLUT_ELAPSED_TIME);
+
+	if (progressiveTexture == 0) {
+		glGenTextures(1, &progressiveTexture);
+		glBindTexture(GL_TEXTURE_2D, progressiveTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	glBindTexture(GL_TEXTURE_2D, progressiveTexture);
+
+	if ((now - lastUpload > 250 || !running) && progressive.getPreview(preview)) {
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, progressive._camera._width, progressive._camera._height, 0, GL_RGB, GL_UNSIGNED_BYTE, &preview[0]);
+		lastUpload = now;
+
+		unsigned int passes = progressive.completedPasses();
+		if (passes != lastPasses || running != wasRunning)
+			loadbar(passes, progressive.totalPasses(), 50);
+		lastPasses = passes;
+	}
+
+	// The render finished all passes, store it.
+	if (wasRunning && !running) {
+		cout << endl << endl;
+		progressive.writeImage("result.ppm", "result.pfm");
+	}
+	wasRunning = running;
+
+	// Full window quad, row 0 of the image is the top of the window.
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, 1, 0, 1, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+	glColor3f(1, 1, 1);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0, 1); glVertex2f(0, 0);
+	glTexCoord2f(1, 1); glVertex2f(1, 0);
+	glTexCoord2f(1, 0); glVertex2f(1, 1);
+	glTexCoord2f(0, 0); glVertex2f(0, 1);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+
+	// The first pass starts once the irradiance records are gathered.
+	if (progressive.isPreparing()) {
+		const char* text = "Preparing...";
+		glRasterPos2f(0.02f, 0.02f);
+		for (const char* c = text; *c; c++)
+			glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+	}
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+
+/**
+ * Start a progressive render from the current viewpoint on all cores.
+ * A stopped or interrupted render of the same view continues from result.progressive.
+ */
+void startProgressive(const Camera& camera)
+{
+	cout << "Progressive raytracing, press p to stop" << endl;
+	progressive.start(camera, ns, std::thread::hardware_concurrency(), "result.progressive");
+	showProgressive = true;
 }
 
 /**
@@ -53,6 +160,20 @@ int main(int argc, char** argv)
 {
     glutInit(&argc, argv);
 
+	// A scene file given on the command line is loaded before the window is made in its size.
+	SceneSettings scene;
+	if (argc > 1) {
+		if (!loadSceneFile(argv[1], scene))
+			return 1;
+		if (scene.width > 0) {
+			WindowSize_X = ImageSize_X = scene.width;
+			WindowSize_Y = ImageSize_Y = scene.height;
+		}
+		if (scene.ns > 0)
+			ns = scene.ns;
+		FieldOfView = scene.fov;
+	}
+
     // Framebuffer setup
     glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH );
 
@@ -64,7 +185,10 @@ int main(int argc, char** argv)
     // Initialize viewpoint
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    glTranslatef(0,0,-4);
+	if (scene.hasCamera)
+		gluLookAt(scene.eye[0], scene.eye[1], scene.eye[2], scene.target[0], scene.target[1], scene.target[2], scene.up[0], scene.up[1], scene.up[2]);
+	else
+		glTranslatef(0,0,-4);
     tbInitTransform();     // This is for the trackball, please ignore
     tbHelp();             // idem
 	MyCameraPosition=getCameraPosition();
@@ -103,7 +227,9 @@ int main(int argc, char** argv)
     glutIdleFunc( animate);
 
 
-	init();
+	// Without a scene file, the default scene.
+	if (argc <= 1)
+		init();
 
     
 	// Main loop for glut... this just runs your application
@@ -140,7 +266,7 @@ void reshape(int w, int h)
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     //glOrtho (-1.1, 1.1, -1.1,1.1, -1000.0, 1000.0);
-    gluPerspective (50, (float)w/h, 0.01, 10);
+    gluPerspective (FieldOfView, (float)w/h, 0.01, 10);
     glMatrixMode(GL_MODELVIEW);
 }
 
@@ -167,6 +293,23 @@ void produceRay(int x_I, int y_I, Vec3Df * origin, Vec3Df * dest)
 		dest->p[2]=float(z);
 }
 
+// Produce the camera for the current viewpoint, by computing
+// the rays for the corners of the frustum.
+Camera getViewportCamera()
+{
+	Vec3Df origin00, dest00;
+	Vec3Df origin01, dest01;
+	Vec3Df origin10, dest10;
+	Vec3Df origin11, dest11;
+
+	produceRay(0, 0, &origin00, &dest00);
+	produceRay(0, ImageSize_Y - 1, &origin01, &dest01);
+	produceRay(ImageSize_X - 1, 0, &origin10, &dest10);
+	produceRay(ImageSize_X - 1, ImageSize_Y - 1, &origin11, &dest11);
+
+	return Camera(ImageSize_X, ImageSize_Y, origin00, dest00, origin01, dest01, origin10, dest10, origin11, dest11);
+}
+
 // React to keyboard input
 void keyboard(unsigned char key, int x, int y)
 {
@@ -175,137 +318,113 @@ void keyboard(unsigned char key, int x, int y)
 	switch (key)
 	{
 		// Add a light based on the camera position.
+		// A running progressive render is restarted, its samples used the old lights.
 		case 'L':
-			MyLightPositions.push_back(getCameraPosition());
+		case 'l':
+		{
+			bool restart = progressive.isRunning();
+			progressive.stop();
+
+			if (key == 'L')
+				MyLightPositions.push_back(getCameraPosition());
+			// Update a light based on the camera position.
+			else
+				MyLightPositions[MyLightPositions.size() - 1] = getCameraPosition();
+			updateLightTree();
+
+			if (restart)
+				startProgressive(progressive._camera);
 			break;
+		}
 
-		// Update a light based on the camera position.
-		case 'l':
-			MyLightPositions[MyLightPositions.size() - 1] = getCameraPosition();
+		// Pressing p starts progressive raytracing in the background, pressing it again stops it.
+		case 'p':
+		{
+			// Stopping is picked up by drawProgressive(), which writes the image.
+			if (progressive.isRunning()) {
+				progressive.stop();
+			}
+			else if (showProgressive) {
+				// Back to the viewport.
+				showProgressive = false;
+			}
+			else {
+				startProgressive(getViewportCamera());
+			}
 			break;
+		}
 
 		// Pressing r will launch the raytracing.
+		// A running progressive render is stopped meanwhile, it writes the same files.
 		case 'r':
 		{
+			bool restart = progressive.isRunning();
+			progressive.stop();
 			cout << "Raytracing" << endl;
 
 			// Setup an image with the size of the current image.
 			Image result(ImageSize_X, ImageSize_Y);
 
-			// Produce the rays for each pixel, by first computing
-			// the rays for the corners of the frustum.
-			Vec3Df origin00, dest00;
-			Vec3Df origin01, dest01;
-			Vec3Df origin10, dest10;
-			Vec3Df origin11, dest11;
-			Vec3Df origin, dest;
-
-			produceRay(0, 0, &origin00, &dest00);
-			produceRay(0, ImageSize_Y - 1, &origin01, &dest01);
-			produceRay(ImageSize_X - 1, 0, &origin10, &dest10);
-			produceRay(ImageSize_X - 1, ImageSize_Y - 1, &origin11, &dest11);
-
-			for (unsigned int y = 0; y < ImageSize_Y; ++y) {
-				for (unsigned int x = 0; x < ImageSize_X; ++x)
-				{
-					// Produce the rays for each pixel, by interpolating 
-					// the four rays of the frustum corners.
-					float xscale = 1.0f - float(x) / (ImageSize_X - 1);
-					float yscale = 1.0f - float(y) / (ImageSize_Y - 1);
-
-					origin = yscale*(xscale*origin00 + (1 - xscale)*origin10) +
-						(1 - yscale)*(xscale*origin01 + (1 - xscale)*origin11);
-					dest = yscale*(xscale*dest00 + (1 - xscale)*dest10) +
-						(1 - yscale)*(xscale*dest01 + (1 - xscale)*dest11);
-
-					// Launch raytracing for the given ray.
-					Vec3Df rgb = performRayTracing(origin, dest);
-					// Store the result in an image 
-					result.setPixel(x, y, RGBValue(rgb[0], rgb[1], rgb[2]));
-				}
-
-				loadbar(y, ImageSize_Y, 50);
+			// Same view as the last render, only the lights can have changed.
+			Camera camera = getViewportCamera();
+			if (relightCache.matches(camera)) {
+				cout << "Relighting the cached hits" << endl;
+				relightCache.relight(result);
+			}
+			else {
+				// Interrupted renders continue from result.checkpoint.
+				relightCache.begin(camera);
+				renderCheckpointed(camera, 1, "result.checkpoint", [](const Tile& tile, std::vector<float>& pixels) {
+					relightCache.renderTile(tile, pixels);
+				}, [&result](const Tile& tile, std::vector<float>& pixels) {
+					storeTile(result, tile, pixels);
+				}, 0);
 			}
-
-			loadbar(ImageSize_Y, ImageSize_Y, 50);
-			cout << endl;
-			cout << endl;
 
 			result.writeImage("result.ppm");
+			result.writePFM("result.pfm");
 
 			cout << endl;
+			if (restart)
+				startProgressive(progressive._camera);
 			break;
 		}
 
 		// Pressing s will launch the raytracing with sampling.
+		// A running progressive render is stopped meanwhile, like for r.
 		case 's':
 		{
+			bool restart = progressive.isRunning();
+			progressive.stop();
 			cout << "Raytracing with sampling" << endl;
 
-			// Setup an image with the size of the current image.
-			Image result(ImageSize_X, ImageSize_Y);
-
-			// Produce the rays for each pixel, by first computing
-			// the rays for the corners of the frustum.
-			Vec3Df origin00, dest00;
-			Vec3Df origin01, dest01;
-			Vec3Df origin10, dest10;
-			Vec3Df origin11, dest11;
-			Vec3Df origin, dest;
-
-			produceRay(0, 0, &origin00, &dest00);
-			produceRay(0, ImageSize_Y - 1, &origin01, &dest01);
-			produceRay(ImageSize_X - 1, 0, &origin10, &dest10);
-			produceRay(ImageSize_X - 1, ImageSize_Y - 1, &origin11, &dest11);
-			
-			Vec3Df rgb;
-
-			unsigned int fromY = 0;
-			unsigned int toY = 100;
-
-			for (unsigned int y = fromY; y < toY; ++y) {
-				for (unsigned int x = 0; x < ImageSize_X; ++x)
-				{
-					// Produce the rays for each pixel, by interpolating 
-					// the four rays of the frustum corners.
-					float xscale; // = 1.0f - float(x) / (ImageSize_X - 1);
-					float yscale; // = 1.0f - float(y) / (ImageSize_Y - 1);
-
-					for (unsigned int sx = 0; sx < ns; sx++) {
-						for (unsigned int sy = 0; sy < ns; sy++) {
-							xscale = 1.0f - (x + (sx + 0.5f) / ns) / (ImageSize_X - 1);
-							yscale = 1.0f - (y + (sy + 0.5f) / ns) / (ImageSize_Y - 1);
-
-							origin = yscale*(xscale*origin00 + (1 - xscale)*origin10) + (1 - yscale)*(xscale*origin01 + (1 - xscale)*origin11);
-							dest = yscale*(xscale*dest00 + (1 - xscale)*dest10) + (1 - yscale)*(xscale*dest01 + (1 - xscale)*dest11);
-
-							// Launch raytracing for the given ray.
-							rgb += performRayTracing(origin, dest);
-						}
-					}
-					
-					rgb /= float(ns*ns);
-
-					// Store the result in an image 
-					result.setPixel(x, y, RGBValue(rgb[0], rgb[1], rgb[2]));
-				}
-
-				loadbar(y-fromY, toY-fromY, 50);
+			// The rows are written to result.ppm and result.pfm as soon as they are done,
+			// so the whole image is never in memory.
+			ImageWriter result, hdrResult;
+			if (result.open("result.ppm", ImageSize_X, ImageSize_Y) && hdrResult.open("result.pfm", ImageSize_X, ImageSize_Y)) {
+				// Interrupted renders continue from result.checkpoint.
+				Camera camera = getViewportCamera();
+				renderCheckpointed(camera, ns, "result.checkpoint", [&camera](const Tile& tile, std::vector<float>& pixels) {
+					renderTile(camera, ns, tile, pixels);
+				}, [&result, &hdrResult](const Tile& tile, std::vector<float>& pixels) {
+					result.writeBlock(tile.x0, tile.y0, tile.x1, tile.y1, &pixels[0]);
+					hdrResult.writeBlock(tile.x0, tile.y0, tile.x1, tile.y1, &pixels[0]);
+				}, streamingWindow(camera._width, renderThreads()));
+
+				result.close();
+				hdrResult.close();
 			}
 
-			loadbar(toY - fromY, toY - fromY, 50);
-			cout << endl;
-			cout << endl;
-
-			result.writeImage("result.ppm");
-
 			cout << endl;
+			if (restart)
+				startProgressive(progressive._camera);
 			break;
 		}
 
 		// ESC pressed
 		case 27:
 		{
+			progressive.stop();
 			exit(0);
 		}
 
@@ -322,15 +441,3 @@ void keyboard(unsigned char key, int x, int y)
 		}
 	}
 }
-
-static inline void loadbar(unsigned int x, unsigned int n, unsigned int w = 50) {
-	if ((x != n) && (x % (n / 100 + 1) != 0)) return;
-
-	float ratio = x / (float)n;
-	unsigned int c = unsigned int(ratio * w);
-
-	cout << std::setw(3) << (int)(ratio * 100) << "% [";
-	for (unsigned int x = 0; x < c; x++) cout << "=";
-	for (unsigned int x = c; x < w; x++) cout << " ";
-	cout << "]\r" << std::flush;
-}
\ No newline at end of file
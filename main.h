@@ -10,6 +10,7 @@
 #include "raytracing.h"
 #include "mesh.h"
 #include "image.h"
+#include "camera.h"
 
 /////////////////
 // MAIN HEADER //
@@ -33,8 +34,8 @@ extern unsigned int WindowSize_Y;
 extern unsigned int ImageSize_X;
 extern unsigned int ImageSize_Y;
 
-// Loadbar
-static inline void loadbar(unsigned int, unsigned int, unsigned int);
+// Vertical field of view of the window in degrees.
+extern float FieldOfView;
 
 /**
  * Function declarations
@@ -43,9 +44,12 @@ void display(void);
 void reshape(int w, int h);
 void keyboard(unsigned char key, int x, int y);
 void produceRay(int x_I, int y_I, Vec3Df * origin, Vec3Df * dest);
+Camera getViewportCamera();
 void reshape(int w, int h);
 void display(void);
 void animate();
 void drawFrame();
+void drawProgressive();
+void startProgressive(const Camera& camera);
 
 #endif // MAIN_header
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "material.h"
+#include <map>
+#include <mutex>
+#include <stdexcept>
 
 Material::Material() {
 	cleanup();
@@ -89,6 +92,12 @@ bool Material::has_tex() const {
 	return tex_is_set;
 }
 
+unsigned int Material::features() const {
+	return (Kd_is_set_ ? MATERIAL_KD : 0) | (Ka_is_set_ ? MATERIAL_KA : 0) | (Ks_is_set_ ? MATERIAL_KS : 0) |
+		(Ns_is_set_ ? MATERIAL_NS : 0) | (Ni_is_set_ ? MATERIAL_NI : 0) | (Tr_is_set_ ? MATERIAL_TR : 0) |
+		(Tf_is_set_ ? MATERIAL_TF : 0) | (tex_is_set ? MATERIAL_TEX : 0);
+}
+
 void Material::set_Kd(float r, float g, float b) {
 	Kd_ = Vec3Df(r, g, b); Kd_is_set_ = true;
 }
@@ -182,4 +191,92 @@ const std::string & Material::normal_mapName() {
 
 const std::string & Material::name() {
 	return name_;
-}
\ No newline at end of file
+}
+
+/**
+ * MATERIAL TABLE
+ *
+ * The records live in chunks that are allocated once and never moved, so threads can
+ * read records while another thread adds the materials of a mesh it loads.
+ */
+static const unsigned int MATERIAL_CHUNK_BITS = 8;
+static const unsigned int MATERIAL_CHUNK = 1 << MATERIAL_CHUNK_BITS;
+static const unsigned int MATERIAL_CHUNKS = 256;
+static const unsigned int MAX_TEXTURES = 4096;
+
+static_assert(sizeof(MaterialRecord) == 64, "A material record should fill one cache line");
+
+static MaterialRecord* materialChunks[MATERIAL_CHUNKS];
+static Texture* textureHandles[MAX_TEXTURES];
+
+/**
+ * The state to add records, only used under its mutex.
+ */
+struct MaterialTable {
+	std::mutex mutex;
+	unsigned int records;
+	unsigned short textures;
+	std::map<std::string, unsigned int> ids;
+	std::map<Texture*, unsigned short> textureIds;
+
+	MaterialTable() : records(0), textures(1) {}
+};
+
+static MaterialTable& materialTable()
+{
+	static MaterialTable table;
+	return table;
+}
+
+unsigned int compileMaterial(const Material& material, Texture* texture) {
+	MaterialTable& table = materialTable();
+	std::lock_guard<std::mutex> lock(table.mutex);
+
+	unsigned int features = material.features();
+	MaterialRecord record;
+	record.Kd = (features & MATERIAL_KD) ? material.Kd() : Vec3Df(0.f, 0.f, 0.f);
+	record.Ka = (features & MATERIAL_KA) ? material.Ka() : Vec3Df(0.f, 0.f, 0.f);
+	record.Ks = (features & MATERIAL_KS) ? material.Ks() : Vec3Df(0.f, 0.f, 0.f);
+	record.Tf = (features & MATERIAL_TF) ? material.Tf() : Vec3Df(0.f, 0.f, 0.f);
+	record.Ns = (features & MATERIAL_NS) ? material.Ns() : 0.f;
+	record.Ni = (features & MATERIAL_NI) ? material.Ni() : 0.f;
+	record.Tr = (features & MATERIAL_TR) ? material.Tr() : 0.f;
+	record.features = (unsigned short)features;
+	record.texture = 0;
+
+	if (texture != nullptr) {
+		std::map<Texture*, unsigned short>::iterator handle = table.textureIds.find(texture);
+		if (handle == table.textureIds.end()) {
+			if (table.textures == MAX_TEXTURES)
+				throw std::length_error("Too many textures");
+			textureHandles[table.textures] = texture;
+			handle = table.textureIds.insert(std::make_pair(texture, table.textures++)).first;
+		}
+		record.texture = handle->second;
+	}
+
+	// Every byte of the record is set, so equal materials have equal bytes.
+	std::string key((const char*)&record, sizeof(record));
+	std::map<std::string, unsigned int>::iterator id = table.ids.find(key);
+	if (id != table.ids.end())
+		return id->second;
+
+	unsigned int index = table.records;
+	if (index == MATERIAL_CHUNK * MATERIAL_CHUNKS)
+		throw std::length_error("Too many materials");
+	if (materialChunks[index >> MATERIAL_CHUNK_BITS] == nullptr)
+		materialChunks[index >> MATERIAL_CHUNK_BITS] = new MaterialRecord[MATERIAL_CHUNK];
+	materialChunks[index >> MATERIAL_CHUNK_BITS][index & (MATERIAL_CHUNK - 1)] = record;
+
+	table.records++;
+	table.ids[key] = index;
+	return index;
+}
+
+const MaterialRecord& materialRecord(unsigned int id) {
+	return materialChunks[id >> MATERIAL_CHUNK_BITS][id & (MATERIAL_CHUNK - 1)];
+}
+
+Texture* materialTexture(unsigned short texture) {
+	return textureHandles[texture];
+}
@@ -5,6 +5,20 @@
 #include<string>
 #include"Vec3D.h"
 
+/**
+ * Bits of Material::features(), one for every parameter that is set.
+ */
+enum MaterialFeature {
+	MATERIAL_KD = 1 << 0,
+	MATERIAL_KA = 1 << 1,
+	MATERIAL_KS = 1 << 2,
+	MATERIAL_NS = 1 << 3,
+	MATERIAL_NI = 1 << 4,
+	MATERIAL_TR = 1 << 5,
+	MATERIAL_TF = 1 << 6,
+	MATERIAL_TEX = 1 << 7
+};
+
 /**
  * Material class;
  */
@@ -30,6 +44,9 @@ class Material {
 		bool has_Tf();
 		bool has_tex() const;
 
+		// All has methods at once, as MaterialFeature bits.
+		unsigned int features() const;
+
 		// Set methods
 		void set_Kd(float r, float g, float b);
 		void set_Ka(float r, float g, float b);
@@ -83,4 +100,40 @@ class Material {
 		bool normal_is_set;
 };
 
-#endif
\ No newline at end of file
+/**
+ * MaterialRecord
+ *
+ * The parameters of a material the ray tracer needs, packed in 64 bytes: one cache line
+ * instead of the strings and flags of Material, which is only used to load scenes.
+ * Parameters that are not set are 0, their feature bit tells whether they are set.
+ */
+struct MaterialRecord {
+	Vec3Df Kd;					// Color diffuse
+	Vec3Df Ka;					// Color ambient
+	Vec3Df Ks;					// Color specular
+	Vec3Df Tf;					// Transmission filter
+	float Ns;					// Shininess
+	float Ni;					// Index of refraction
+	float Tr;					// Transparency
+	unsigned short features;	// MaterialFeature bits
+	unsigned short texture;		// Texture handle, 0 without texture
+};
+
+class Texture;
+
+/**
+ * Compile a material into the table of material records. Equal materials share one record.
+ * Records are never moved, so this may be called while other threads render.
+ * 1st param:	The material.
+ * 2nd param:	Texture of the shapes with this material, or null.
+ * Return:		The material id, the index of the record in the table.
+ */
+unsigned int compileMaterial(const Material& material, Texture* texture = nullptr);
+
+// The record of a material id.
+const MaterialRecord& materialRecord(unsigned int id);
+
+// The texture of a texture handle of a record.
+Texture* materialTexture(unsigned short texture);
+
+#endif
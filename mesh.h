@@ -37,7 +37,7 @@ public:
         t[1] = t1;
         t[2] = t2;
     }
-    inline virtual ~Triangle () {}
+    inline ~Triangle () {}
     inline Triangle & operator= (const Triangle & t2) {
         v[0] = t2.v[0];
         v[1] = t2.v[1];
@@ -0,0 +1,150 @@
+#include "photonmap.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <thread>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Ranges smaller than this are not worth a thread.
+static const size_t PARALLEL_MIN = 16384;
+
+// Slope of the cone filter: a photon at the edge of the disc still weighs 1 - 1 / CONE.
+static const float CONE = 1.1f;
+
+// Largest number of photons gathered at once.
+static const unsigned int MAX_GATHER = 256;
+
+PhotonMap::PhotonMap() {}
+
+void PhotonMap::build(std::vector<Photon>& photons, unsigned int threads)
+{
+	_photons.clear();
+	_photons.swap(photons);
+	if (!_photons.empty())
+		balance(&_photons[0], &_photons[0] + _photons.size(), std::max(1u, threads));
+}
+
+void PhotonMap::clear()
+{
+	_photons.clear();
+}
+
+/**
+ * Split a range at the median of the longest axis of its box, and the two halves after it.
+ */
+void PhotonMap::balance(Photon* begin, Photon* end, unsigned int threads)
+{
+	size_t count = end - begin;
+	if (count == 0)
+		return;
+
+	float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (const Photon* photon = begin; photon != end; photon++) {
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = std::min(min[axis], photon->position[axis]);
+			max[axis] = std::max(max[axis], photon->position[axis]);
+		}
+	}
+	unsigned char axis = 0;
+	for (unsigned char a = 1; a < 3; a++)
+		if (max[a] - min[a] > max[axis] - min[axis])
+			axis = a;
+
+	Photon* middle = begin + count / 2;
+	std::nth_element(begin, middle, end, [axis](const Photon& a, const Photon& b) {
+		return a.position[axis] < b.position[axis];
+	});
+	middle->axis = axis;
+
+	if (threads > 1 && count >= PARALLEL_MIN) {
+		std::thread left(&PhotonMap::balance, begin, middle, threads / 2);
+		balance(middle + 1, end, threads - threads / 2);
+		left.join();
+	}
+	else {
+		balance(begin, middle, 1);
+		balance(middle + 1, end, 1);
+	}
+}
+
+Vec3Df PhotonMap::irradiance(const Vec3Df& point, const Vec3Df& normal, unsigned int count, float maxDistance) const
+{
+	Vec3Df result(0.f, 0.f, 0.f);
+	if (_photons.empty() || count == 0)
+		return result;
+	count = std::min(count, MAX_GATHER);
+
+	// The nearest photons in a max-heap on the squared distance, the farthest on top.
+	std::pair<float, unsigned int> heap[MAX_GATHER];
+	unsigned int found = 0;
+	float max2 = maxDistance * maxDistance;
+
+	// Ranges still to visit, with the squared distance to their splitting plane.
+	struct Range {
+		unsigned int begin, end;
+		float plane2;
+	};
+	Range stack[128];
+	unsigned int size = 0;
+	stack[size++] = { 0, (unsigned int)_photons.size(), 0.f };
+
+	while (size > 0) {
+		Range range = stack[--size];
+		if (range.begin >= range.end || range.plane2 >= max2)
+			continue;
+
+		unsigned int middle = range.begin + (range.end - range.begin) / 2;
+		const Photon& photon = _photons[middle];
+		float offset[3] = { point[0] - photon.position[0], point[1] - photon.position[1], point[2] - photon.position[2] };
+		float distance2 = offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2];
+		if (distance2 < max2) {
+			if (found < count) {
+				heap[found++] = std::make_pair(distance2, middle);
+				std::push_heap(heap, heap + found);
+				if (found == count)
+					max2 = heap[0].first;
+			}
+			else {
+				std::pop_heap(heap, heap + found);
+				heap[found - 1] = std::make_pair(distance2, middle);
+				std::push_heap(heap, heap + found);
+				max2 = heap[0].first;
+			}
+		}
+
+		// The far side after the near side, unless its plane is out of reach by then.
+		float plane = offset[photon.axis];
+		Range low = { range.begin, middle, plane * plane };
+		Range high = { middle + 1, range.end, plane * plane };
+		if (plane < 0.f) {
+			stack[size++] = high;
+			low.plane2 = 0.f;
+			stack[size++] = low;
+		}
+		else {
+			stack[size++] = low;
+			high.plane2 = 0.f;
+			stack[size++] = high;
+		}
+	}
+
+	if (found == 0)
+		return result;
+
+	float radius2 = found == count ? heap[0].first : maxDistance * maxDistance;
+	float radius = sqrtf(radius2);
+	if (radius <= 0.f)
+		return result;
+	for (unsigned int i = 0; i < found; i++) {
+		const Photon& photon = _photons[heap[i].second];
+		float dot = normal[0] * photon.direction[0] + normal[1] * photon.direction[1] + normal[2] * photon.direction[2];
+		if (dot >= 0.f)
+			continue;
+		float weight = 1.f - sqrtf(heap[i].first) / (CONE * radius);
+		result += weight * Vec3Df(photon.power[0], photon.power[1], photon.power[2]);
+	}
+	return result / ((1.f - 2.f / (3.f * CONE)) * float(M_PI) * radius2);
+}
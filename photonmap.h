@@ -0,0 +1,62 @@
+#ifndef PHOTONMAP_H_alskdjfhgqpwoeiruzmxn
+#define PHOTONMAP_H_alskdjfhgqpwoeiruzmxn
+
+#include <vector>
+#include "Vec3D.h"
+
+/**
+ * A photon on a diffuse surface: where it landed, the power it carries, and the direction it
+ * came from, packed in 28 bytes.
+ */
+struct Photon {
+	float position[3];
+	float power[3];
+	signed char direction[3];	// Direction of travel, times 127.
+	unsigned char axis;			// Split axis of its node in the kd-tree.
+};
+
+/**
+ * PhotonMap class
+ *
+ * Photons in a balanced kd-tree without pointers: the photons of a subtree are a range of the
+ * array, with the photon that splits it in the middle and the two subtrees on either side. A
+ * lookup only touches the array, and the subtrees near the top are built on their own threads.
+ */
+class PhotonMap {
+	public:
+		// Constructor
+		PhotonMap();
+
+		/**
+		 * Build the tree from photons, which are taken over.
+		 * 1st param:	The photons, left empty.
+		 * 2nd param:	Number of threads to build with.
+		 */
+		void build(std::vector<Photon>& photons, unsigned int threads);
+
+		// Remove all photons.
+		void clear();
+
+		// Number of photons.
+		size_t size() const { return _photons.size(); }
+
+		/**
+		 * Estimate the irradiance at a point from its nearest photons: their power over the area
+		 * of the disc they are found in, weighted by a cone filter so caustics stay sharp. Only
+		 * photons arriving at the side of the normal count.
+		 * 1st param:	The point.
+		 * 2nd param:	The normal on the side to estimate, normalized.
+		 * 3rd param:	Number of photons to gather.
+		 * 4th param:	Largest distance to gather from.
+		 */
+		Vec3Df irradiance(const Vec3Df& point, const Vec3Df& normal, unsigned int count, float maxDistance) const;
+
+		// Variables
+		std::vector<Photon> _photons;
+
+	private:
+		// Methods
+		static void balance(Photon* begin, Photon* end, unsigned int threads);
+};
+
+#endif // PHOTONMAP_H
@@ -0,0 +1,258 @@
+#include "progressive.h"
+#include "checkpoint.h"
+#include "raytracing.h"
+#include "image.h"
+#include "sampler.h"
+#include <cstdio>
+#include <iostream>
+
+// Time between two checkpoints of a running render.
+static const std::chrono::seconds CHECKPOINT_INTERVAL(30);
+
+/**
+ * Hash three integers to a float in [0, 1), used to jitter the samples within their stratum.
+ */
+static float hashFloat(unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int h = (a * 73856093u) ^ (b * 19349663u) ^ (c * 83492791u);
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return (h & 0xffffff) / 16777216.f;
+}
+
+/**
+ * Constructor, nothing is rendered until start() is called.
+ */
+ProgressiveRenderer::ProgressiveRenderer() : _hash(0), _version(0), _previewVersion(0), _running(false), _activeThreads(0), _prepared(false), _nextJob(0), _ns(1) {}
+
+ProgressiveRenderer::~ProgressiveRenderer() {
+	stop();
+}
+
+/**
+ * Start rendering in the background, any previous render is discarded.
+ * The passes found in the checkpoint file are not rendered again.
+ */
+void ProgressiveRenderer::start(const Camera& camera, unsigned int ns, unsigned int threads, const char* checkpoint) {
+	stop();
+
+	_camera = camera;
+	_ns = ns > 0 ? ns : 1;
+	_accumulation.assign(3 * _camera._width * _camera._height, 0.f);
+	_rowSamples.assign(_camera._height, 0);
+	_passes.assign(totalPasses() * _camera._height, 0);
+	_checkpoint = checkpoint != nullptr ? checkpoint : "";
+	if (!_checkpoint.empty()) {
+		_hash = Checkpoint::hashRender(_camera, _ns);
+		if (loadProgressive(_checkpoint.c_str(), _hash, _passes, _accumulation)) {
+			for (unsigned int pass = 0; pass < totalPasses(); pass++)
+				for (unsigned int y = 0; y < _camera._height; y++)
+					if (_passes[pass * _camera._height + y])
+						_rowSamples[y]++;
+			std::cout << "Resuming from " << _checkpoint << ", " << completedPasses() << " of " << totalPasses() << " passes done" << std::endl;
+		}
+	}
+
+	_lastSave = std::chrono::steady_clock::now();
+	_version = 0;
+	_previewVersion = 0;
+	_nextJob = 0;
+	_prepared = false;
+	_running = true;
+
+	if (threads == 0)
+		threads = 1;
+	_activeThreads = threads;
+	for (unsigned int i = 0; i < threads; i++)
+		_threads.push_back(std::thread(&ProgressiveRenderer::worker, this));
+}
+
+/**
+ * Stop rendering, the samples accumulated so far are kept, and saved when the render is not done.
+ */
+void ProgressiveRenderer::stop() {
+	_running = false;
+	bool wasStarted = !_threads.empty();
+	for (size_t i = 0; i < _threads.size(); i++)
+		_threads[i].join();
+	_threads.clear();
+
+	if (wasStarted && !_checkpoint.empty() && completedPasses() < totalPasses())
+		saveCheckpoint();
+}
+
+/**
+ * Whether the render threads are still working.
+ */
+bool ProgressiveRenderer::isRunning() const {
+	return _activeThreads > 0;
+}
+
+/**
+ * Whether the render threads are still gathering the irradiance records, before the first pass.
+ */
+bool ProgressiveRenderer::isPreparing() const {
+	return _activeThreads > 0 && !_prepared;
+}
+
+/**
+ * Whether there is an image to show.
+ */
+bool ProgressiveRenderer::hasImage() const {
+	return !_accumulation.empty();
+}
+
+/**
+ * The number of passes that completed for every row.
+ */
+unsigned int ProgressiveRenderer::completedPasses() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	unsigned int passes = totalPasses();
+	for (size_t i = 0; i < _rowSamples.size(); i++)
+		if (_rowSamples[i] < passes)
+			passes = _rowSamples[i];
+	return passes;
+}
+
+unsigned int ProgressiveRenderer::totalPasses() const {
+	return _ns * _ns;
+}
+
+/**
+ * Render thread. Each job is one row of one pass; later passes of a row may start
+ * before the previous pass of other rows is done, as every row counts its own samples.
+ */
+void ProgressiveRenderer::worker() {
+	unsigned int width = _camera._width;
+	unsigned int height = _camera._height;
+	std::vector<float> row(3 * width);
+	Vec3Df origin, dest;
+
+	// The first thread gathers the irradiance records, the others wait for them. The passes
+	// of a resumed render were rendered with the same records as the rest will be.
+	{
+		std::lock_guard<std::mutex> lock(_prepareMutex);
+		if (!_prepared && _running) {
+			prefillIrradianceCache(_camera);
+			_prepared = true;
+		}
+	}
+
+	while (_running) {
+		unsigned int job = _nextJob++;
+		unsigned int pass = job / height;
+		unsigned int y = job % height;
+		if (pass >= totalPasses())
+			break;
+
+		// Restored from the checkpoint.
+		if (_passes[pass * height + y])
+			continue;
+
+		// The stratum of this pass, jittered per pixel, for the grid.
+		unsigned int stratum = pass % (_ns * _ns);
+		float sx = float(stratum % _ns);
+		float sy = float(stratum / _ns);
+
+		beginIrradianceRegion();
+		for (unsigned int x = 0; x < width; x++) {
+			unsigned int pixel = y * width + x;
+			setSamplePixel(x, y);
+			float jx, jy;
+			if (sampleSequence == SAMPLES_GRID) {
+				jx = (sx + hashFloat(pixel, pass, 0)) / _ns;
+				jy = (sy + hashFloat(pixel, pass, 1)) / _ns;
+			}
+			else {
+				// Every first few samples of a low discrepancy sequence are spread evenly.
+				sample2D(sampleSequence, pass, totalPasses(), 0, pixelScramble(x, y), jx, jy);
+			}
+			_camera.getRay(x + jx, y + jy, origin, dest);
+
+			Vec3Df rgb = performRayTracing(origin, dest);
+			row[3 * x] = rgb[0];
+			row[3 * x + 1] = rgb[1];
+			row[3 * x + 2] = rgb[2];
+		}
+
+		bool save;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			float* accumulation = &_accumulation[3 * y * width];
+			for (unsigned int i = 0; i < 3 * width; i++)
+				accumulation[i] += row[i];
+			_rowSamples[y]++;
+			_passes[pass * height + y] = 1;
+			_version++;
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			save = !_checkpoint.empty() && now - _lastSave >= CHECKPOINT_INTERVAL;
+			if (save)
+				_lastSave = now;
+		}
+		if (save)
+			saveCheckpoint();
+	}
+
+	// The last thread of a finished render removes the checkpoint, it is not needed anymore.
+	if (--_activeThreads == 0 && !_checkpoint.empty() && completedPasses() == totalPasses())
+		std::remove(_checkpoint.c_str());
+}
+
+/**
+ * Copy the accumulated passes, and write them while the other threads go on.
+ */
+void ProgressiveRenderer::saveCheckpoint() {
+	std::vector<unsigned char> passes;
+	std::vector<float> accumulation;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		passes = _passes;
+		accumulation = _accumulation;
+	}
+	saveProgressive(_checkpoint.c_str(), _hash, passes, accumulation);
+}
+
+/**
+ * Copy the current average into an 8 bit RGB buffer for display.
+ */
+bool ProgressiveRenderer::getPreview(std::vector<unsigned char>& rgb) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_version == _previewVersion && rgb.size() == _accumulation.size())
+		return false;
+	_previewVersion = _version;
+
+	unsigned int width = _camera._width;
+	rgb.resize(_accumulation.size());
+	for (unsigned int y = 0; y < _camera._height; y++) {
+		float scale = _rowSamples[y] > 0 ? 255.f / _rowSamples[y] : 0.f;
+		for (unsigned int i = 3 * y * width; i < 3 * (y + 1) * width; i++) {
+			float value = _accumulation[i] * scale;
+			rgb[i] = (unsigned char)(value > 255.f ? 255.f : (value < 0.f ? 0.f : value));
+		}
+	}
+	return true;
+}
+
+/**
+ * Write the current average to a PPM file, and optionally the linear floats to a PFM file.
+ */
+bool ProgressiveRenderer::writeImage(const char* filename, const char* hdrFilename) {
+	Image result(_camera._width, _camera._height);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (unsigned int y = 0; y < _camera._height; y++) {
+			float scale = _rowSamples[y] > 0 ? 1.f / _rowSamples[y] : 0.f;
+			for (unsigned int x = 0; x < _camera._width; x++) {
+				const float* pixel = &_accumulation[3 * (y * _camera._width + x)];
+				result.setPixelHDR(x, y, pixel[0] * scale, pixel[1] * scale, pixel[2] * scale);
+			}
+		}
+	}
+	if (hdrFilename != nullptr && !result.writePFM(hdrFilename))
+		return false;
+	return result.writeImage(filename);
+}
@@ -0,0 +1,108 @@
+#ifndef PROGRESSIVE_H_fjdkslfjeiowfjlskdfj
+#define PROGRESSIVE_H_fjdkslfjeiowfjlskdfj
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "camera.h"
+
+/**
+ * ProgressiveRenderer class
+ *
+ * Renders on background threads, one sample per pixel per pass, and accumulates the
+ * samples in a float framebuffer. The current average can be shown while rendering,
+ * so a render can be stopped as soon as it looks converged.
+ *
+ * With the grid sequence the samples of pass p are stratified over an ns x ns grid within
+ * the pixel, so after ns * ns passes the image has the same samples as the 's' key would trace.
+ * With the other sequences pass p takes sample p of the sequence of the pixel, so the samples
+ * are spread evenly after any number of passes.
+ *
+ * With a checkpoint file the accumulated samples are saved every few seconds and when the render
+ * is stopped, with the passes every row has done. A render started again for the same scene and
+ * camera continues from there, and only traces the passes that are missing. The file is removed
+ * when all passes are done.
+ */
+class ProgressiveRenderer {
+	public:
+		// Constructor
+		ProgressiveRenderer();
+		~ProgressiveRenderer();
+
+		/**
+		 * Start rendering in the background.
+		 * 1st param:	The camera to produce the rays with.
+		 * 2nd param:	Number of samples per pixel in each direction, ns * ns passes are rendered.
+		 * 3rd param:	Number of render threads.
+		 * 4th param:	Name of the checkpoint file, or nullptr to render without one.
+		 */
+		void start(const Camera& camera, unsigned int ns, unsigned int threads, const char* checkpoint = nullptr);
+
+		// Stop rendering, waits for the render threads to finish their current row and saves the checkpoint.
+		void stop();
+
+		// Methods
+		bool isRunning() const;
+		bool isPreparing() const;
+		bool hasImage() const;
+		unsigned int completedPasses();
+		unsigned int totalPasses() const;
+
+		/**
+		 * Copy the current average into an 8 bit RGB buffer for display.
+		 * Return:		Whether new samples were added since the last call.
+		 */
+		bool getPreview(std::vector<unsigned char>& rgb);
+
+		// Write the current average to a PPM file, and to a linear PFM file when hdrFilename is given.
+		bool writeImage(const char* filename, const char* hdrFilename = nullptr);
+
+		// Variables
+		Camera _camera;
+
+	private:
+		// Render thread, takes rows until all passes are done or the renderer is stopped.
+		void worker();
+
+		// Write the accumulated passes to the checkpoint file.
+		void saveCheckpoint();
+
+		// Sum of all samples per pixel, 3 floats per pixel.
+		std::vector<float> _accumulation;
+
+		// Number of samples accumulated in each row.
+		std::vector<unsigned int> _rowSamples;
+
+		// One byte per row and pass, pass p of row y is at p * height + y; set when it is accumulated.
+		std::vector<unsigned char> _passes;
+
+		// Protects _accumulation, _rowSamples, _passes and _lastSave.
+		std::mutex _mutex;
+
+		// Checkpoint file, empty without one, and the hash of the render it belongs to.
+		std::string _checkpoint;
+		uint64_t _hash;
+		std::chrono::steady_clock::time_point _lastSave;
+
+		// Increases with every row added, so the preview knows when to update.
+		unsigned int _version;
+		unsigned int _previewVersion;
+
+		std::vector<std::thread> _threads;
+		std::atomic<bool> _running;
+		std::atomic<unsigned int> _activeThreads;
+
+		// Set once the irradiance cache is filled for the camera, _prepareMutex is held while filling it.
+		std::atomic<bool> _prepared;
+		std::mutex _prepareMutex;
+
+		// Next job; job j renders row j % height for pass j / height.
+		std::atomic<unsigned int> _nextJob;
+		unsigned int _ns;
+};
+
+#endif // PROGRESSIVE_H
@@ -7,6 +7,21 @@
 #include "main.h"
 #include "Shapes\shape.h"
 #include "image.h"
+#include "scene.h"
+#include "shapearrays.h"
+#include "lighttree.h"
+#include "arealight.h"
+#include "irradiancecache.h"
+#include "photonmap.h"
+#include "render.h"
+#include "sampler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string.h>
+#include <thread>
 
 /**
  * VARIABLES
@@ -18,92 +33,233 @@ std::vector<Material> materials;
 Vec3Df testRayOrigin;
 Vec3Df testRayDestination;
 
-Mesh testMesh;
+// Defaults of the render settings a scene file can give, see resetRenderSettings.
+static const unsigned int DEFAULT_RAY_DEPTH = 10;
+static const unsigned int DEFAULT_IRRADIANCE_RAYS = 128;
+static const unsigned int DEFAULT_CAUSTIC_GATHER = 64;
+
+// Maximum number of reflections and refractions of a camera ray.
+unsigned int maxRayDepth = DEFAULT_RAY_DEPTH;
+
+// The shapes sorted by type, for ray queries without virtual calls.
+static ShapeArrays shapeArrays;
+bool useShapeArrays = true;
+
+// Whether the shapes changed since they were sorted, the arrays may point to deleted shapes then.
+static bool shapeArraysStale = true;
+
+// The lights in a tree, for sampling a few of them per hit point.
+static LightTree lightTree;
+unsigned int lightSamples = 0;
+
+std::vector<AreaLight> areaLights;
+
+// Indirect diffuse light, gathered at sparse points and interpolated in between.
+static IrradianceCache irradianceCache;
+float irradianceAccuracy = 0.f;
+unsigned int irradianceRays = DEFAULT_IRRADIANCE_RAYS;
+
+// Pixels between the camera rays of prefillIrradianceCache.
+static const unsigned int PREFILL_STEP = 8;
+
+// While the cache is frozen, the records gathered for the current region of this thread.
+static thread_local IrradianceCache regionCache;
+
+// Caustics: photons sent from the lights through the shapes that reflect or refract light, on
+// the diffuse surfaces they reach. Built on first use after updateCausticMap.
+static PhotonMap causticMap;
+static std::mutex causticMutex;
+static std::atomic<bool> causticReady(false);
+static float causticRadius = 0.f;
+static double causticBuildTime = 0.0;
+unsigned int causticPhotons = 0;
+unsigned int causticGather = DEFAULT_CAUSTIC_GATHER;
+
+// Photons emitted per chunk, each chunk has its own random numbers so the map doesn't depend on the threads.
+static const unsigned int PHOTON_CHUNK = 4096;
+
+// Largest gather radius of the caustics, relative to the diagonal of the scene.
+static const float CAUSTIC_RADIUS = 0.02f;
+
+// Whether this thread is tracing the rays of a new irradiance record, which don't gather again.
+static thread_local bool gathering = false;
+static thread_local std::vector<Vec3Df> gatherRadiance;
+static thread_local std::vector<float> gatherDistance;
+
+// Number of lights picked from the light tree at once.
+static const unsigned int LIGHT_SAMPLE_BLOCK = 64;
+
+// Rays traced by all threads, and by this thread during the current camera ray.
+static std::atomic<unsigned long long> rayCount(0);
+static thread_local unsigned long long localRayCount = 0;
+
+// The last occluder of each light and ray depth per thread, tested first by the next shadow ray
+// to that light from a hit at that depth: reflections and refractions hit other parts of the scene.
+bool useShadowCache = true;
+static thread_local std::vector<ShadowOccluder> shadowOccluders;
+
+// Use of the occluders by all threads, and by this thread during the current camera ray.
+static std::atomic<unsigned long long> shadowLookups(0), shadowHits(0), shadowTraversals(0), shadowNodes(0);
+static thread_local ShadowCacheStats localShadowStats;
+
+static Vec3Df traceRay(const Vec3Df & origin, const Vec3Df & direction, unsigned char level, unsigned char max, const Vec3Df & weight, std::vector<HitRecord> * hits, float * distance = nullptr);
 
 /**
  * INIT
  *
  * Initialize the scene here.
- * 
- * - Load meshes/triangles/cubes/spheres or whatever.
- * - Load lightsources
- * - 
+ *
+ * The default scene is described by Scenes/cornell.scene, see scene.h for the format.
+ * Its meshes and textures are loaded on first use.
  */
 void init()
 {
-	//load the mesh file
-	//please realize that not all OBJ files will successfully load.
-	//Nonetheless, if they come from Blender, they should, if they 
-	//are exported as WavefrontOBJ.
-	//PLEASE ADAPT THE LINE BELOW TO THE FULL PATH OF THE dodgeColorTest.obj
-	//model, e.g., "C:/temp/myData/GraphicsIsFun/dodgeColorTest.obj", 
-	//otherwise the application will not load properly
-	
-	testMesh.loadMesh("Meshes/cornellBox/cornellBoxMirrorTriangulated.obj", true);
-	testMesh.computeVertexNormals();
-
-	Shape* cube = new MyMesh(testMesh, Vec3Df(0.f, -1.f, 1.f));
-	shapes.push_back(cube);
-
-	/**
-	 * Materials
-	 */
-	Material earthmat;
-	earthmat.set_Kd(0.2f, 0.f, 0.f);		// Diffuse
-	earthmat.set_Ks(0.2f, 0.2f, 0.2f);		// Specular
-	//earthmat.set_Ni(1.3f);					// Index of refraction
-	//earthmat.set_Tr(0.5f);					// 
-	earthmat.set_textureName("Meshes/Textures/moon.ppm");
-	Image earth_img("Meshes/Textures/moon.ppm");
-	Texture* earth_tex = new Texture(earth_img);
-	materials.push_back(earthmat);
-
-	Material plane_mat;
-	plane_mat.set_Ka(0.0f,0.0f,0.0f);
-	plane_mat.set_Kd(0.f, 0.f, 0.f);
-	plane_mat.set_Ks(1.f, 1.f, 1.f);
-	materials.push_back(plane_mat);
-
-	// Glass material
-	//Material glass;
-	//glass.set_Ka(0.01f, 0.01f, 0.01f);
-	//glass.set_Kd(0.01f, 0.01f, 0.01f);
-	//glass.set_Ks(0.95f, 0.95f, 0.95f);
-	//glass.set_illum(7);
-	//glass.set_Ni(2.5f);
-	//glass.set_Ns(200.f);
-	//glass.set_Tf(0.1f, 0.1f, 0.1f);
-	//glass.set_Tr(0.f);
-	//materials.push_back(glass);
-
-
-	/**
-	 * Shapes
-	 */
-	Shape* earth = new Sphere(materials[0], Vec3Df(0.35f, -0.15f, 1.35f), .25f);
-	//Shape* earth = new Sphere(materials[0], Vec3Df(0.f, 0.f, 0.f), .5f);
-	earth->setTexture(earth_tex);
-	shapes.push_back(earth);
-
-	//Shape* glassSphere = new Sphere(materials[0], Vec3Df(0.35f, -0.15f, 1.35f), .25f);
-	//shapes.push_back(glassSphere);
-
-	Shape* mirrorSphere = new Sphere(materials[1], Vec3Df(-0.3f, 0.45f, 0.7f), .25f);
-	shapes.push_back(mirrorSphere);
-
-	Shape* mirrorSphere1 = new Sphere(materials[1], Vec3Df(-0.5f, -.75f, 1.4f), .25f);
-	shapes.push_back(mirrorSphere1);
-
-
-	//shapes.push_back(new Plane(materials[1], Vec3Df(0.f, -.5f, 0.f), Vec3Df(0.f, 1.f, 0.f)));
-
-
-	/**
-	 * Lights
-	 */
-	// One light at the starting camera position.
-	MyLightPositions.push_back(MyCameraPosition);
-	MyLightPositions.push_back(Vec3Df(0.f, .90f, .9f));
+	SceneSettings settings;
+	loadSceneFile("Scenes/cornell.scene", settings);
+}
+
+/**
+ * Sort the shapes into the arrays used for ray queries.
+ * Until this is called after the shapes change, rays test the shape list itself.
+ */
+void updateShapeArrays()
+{
+	shapeArrays.build(shapes);
+	shapeArraysStale = false;
+	updateIrradianceCache();
+	updateCausticMap();
+}
+
+/**
+ * Stop using the arrays until they are sorted again.
+ */
+void shapesChanged()
+{
+	shapeArraysStale = true;
+}
+
+/**
+ * Update the arrays after shapes moved, without changing which shapes there are.
+ * The BVH is rebuilt when refitting has made it too slow.
+ */
+void refitShapeArrays()
+{
+	if (!shapeArraysStale)
+		shapeArrays.refit();
+	updateIrradianceCache();
+	updateCausticMap();
+}
+
+/**
+ * Set the render settings back to their defaults, so the settings of one scene don't carry over to the next.
+ */
+void resetRenderSettings()
+{
+	maxRayDepth = DEFAULT_RAY_DEPTH;
+	lightSamples = 0;
+	irradianceAccuracy = 0.f;
+	irradianceRays = DEFAULT_IRRADIANCE_RAYS;
+	causticPhotons = 0;
+	causticGather = DEFAULT_CAUSTIC_GATHER;
+	sampleSequence = SAMPLES_GRID;
+}
+
+/**
+ * Build the light tree over MyLightPositions.
+ * Until this is called after the lights change, every light is traced.
+ */
+void updateLightTree()
+{
+	lightTree.build(MyLightPositions);
+	updateIrradianceCache();
+	updateCausticMap();
+}
+
+/**
+ * Remove the irradiance records, which are only valid for the shapes and lights they were
+ * gathered with, and size the octree to the scene.
+ */
+void updateIrradianceCache()
+{
+	Vec3Df min(1.f, 1.f, 1.f), max(-1.f, -1.f, -1.f);
+	shapeArrays.bounds(min, max);
+	irradianceCache.reset(min, max, irradianceAccuracy);
+}
+
+size_t getIrradianceRecords()
+{
+	return irradianceCache.size();
+}
+
+/**
+ * Empty the cache, and gather the records of a camera ray every PREFILL_STEP pixels, in a fixed order.
+ */
+void prefillIrradianceCache(const Camera& camera)
+{
+	updateIrradianceCache();
+	if (!irradianceCache.enabled())
+		return;
+
+	Vec3Df origin, dest;
+	for (unsigned int y = PREFILL_STEP / 2; y < camera._height; y += PREFILL_STEP) {
+		for (unsigned int x = PREFILL_STEP / 2; x < camera._width; x += PREFILL_STEP) {
+			setSamplePixel(x, y);
+			camera.getRay(x + 0.5f, y + 0.5f, origin, dest);
+			performRayTracing(origin, dest);
+		}
+	}
+	irradianceCache.freeze();
+}
+
+void beginIrradianceRegion()
+{
+	if (!irradianceCache.frozen())
+		return;
+	Vec3Df min(1.f, 1.f, 1.f), max(-1.f, -1.f, -1.f);
+	shapeArrays.bounds(min, max);
+	regionCache.reset(min, max, irradianceAccuracy);
+}
+
+/**
+ * A hash of the bits of a point, so the lights and area light samples picked for a hit point
+ * are the same on every run, thread and farm worker.
+ */
+static unsigned int hashPointBits(const Vec3Df& point)
+{
+	unsigned int hash = 2166136261u;
+	for (int axis = 0; axis < 3; axis++) {
+		float value = point[axis];
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		hash = (hash ^ bits) * 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+// The hash of a point as a number in [0, 1).
+static float hashPoint(const Vec3Df& point)
+{
+	return (hashPointBits(point) >> 8) * (1.f / 16777216.f);
+}
+
+/**
+ * The next of a sequence of numbers in [0, 1) from a hash, for the samples of a hit point.
+ */
+static float randomFloat(unsigned int& state)
+{
+	state += 0x9e3779b9u;
+	unsigned int hash = state;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return (hash >> 8) * (1.f / 16777216.f);
 }
 
 /**
@@ -114,6 +270,17 @@ void init()
 * It will return a ray tracing function which uses origin and direction.
 */
 Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & destination)
+{
+	return performRayTracing(origin, destination, nullptr);
+}
+
+/**
+ * Ray Tracing
+ *
+ * Same as above, but records the hits of the camera ray and all its reflected and refracted rays
+ * when hits is set.
+ */
+Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & destination, std::vector<HitRecord> * hits)
 {
 	// Perform ray tracing with a origin and a direction instead of a origin and a destination.
 	// Usefull when we're going to do refraction and reflection.
@@ -123,8 +290,20 @@ Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & destination)
 	direction.normalize();
 
 	// Return the ray tracing function which uses origin and direction.
-	// Level start at 0, max 5.
-	return performRayTracing(origin, direction, 0, 10);
+	// Level start at 0, max maxRayDepth.
+	localRayCount = 0;
+	Vec3Df color = traceRay(origin, direction, 0, (unsigned char)maxRayDepth, Vec3Df(1.f, 1.f, 1.f), hits);
+
+	// Publish the rays of this camera ray at once, instead of per ray.
+	rayCount += localRayCount;
+	if (localShadowStats.lookups > 0 || localShadowStats.traversals > 0) {
+		shadowLookups += localShadowStats.lookups;
+		shadowHits += localShadowStats.hits;
+		shadowTraversals += localShadowStats.traversals;
+		shadowNodes += localShadowStats.nodes;
+		localShadowStats = ShadowCacheStats();
+	}
+	return color;
 }
 
 /**
@@ -136,26 +315,191 @@ Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & destination)
  */
 Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & direction, unsigned char level, unsigned char max)
 {
-	// If we are out of bounces, return black.
-	if (level == max)
-		return Vec3Df(0, 0, 0);
+	return traceRay(origin, direction, level, max, Vec3Df(1.f, 1.f, 1.f), nullptr);
+}
 
-	// The maximum depth.
-	float current_depth = FLT_MAX;
+/**
+ * Direct light
+ *
+ * The light of all light sources arriving at a hit point, with (transparent) shadows.
+ * Independent of the reflected and refracted rays, so it is all that changes when a light moves.
+ * With lightSamples set and more lights than that, only that many lights are picked from the
+ * light tree, and their light is weighted by their probability.
+ * Area lights count as one light each, see AreaLight for their samples.
+ * The level is the depth of the ray in the ray tree, which picks the occluders tested first.
+ */
+Vec3Df computeDirectLight(const Vec3Df & origin, const Vec3Df & new_origin, const Vec3Df & new_direction, Shape * intersectedShape, unsigned char level)
+{
+	// The color of the intersected object for all lightsources.
+	Vec3Df directColor = Vec3Df(0.f, 0.f, 0.f);
+	Shape* shadowInt = nullptr;
+	const size_t lights = MyLightPositions.size();
+
+	// The occluders of the point lights, followed by one for each area light.
+	const size_t allLights = lights + areaLights.size();
+	if (shadowOccluders.size() != (maxRayDepth + 1) * allLights)
+		shadowOccluders.assign((maxRayDepth + 1) * allLights, ShadowOccluder());
+	ShadowOccluder* occluders = useShadowCache ? &shadowOccluders[std::min<size_t>(level, maxRayDepth) * allLights] : nullptr;
+
+	// Calculate shadows. Transparant shadows. Adds the light of a light at a position to a color,
+	// and returns whether anything was in the way.
+	auto addLight = [&](const Vec3Df& lightPosition, size_t occluder, Vec3Df& color) -> bool {
+		Vec3Df lightDir = lightPosition - new_origin;
+		float lightDist = lightDir.getLength();
+		bool intersection = false;
+		localRayCount++;
 
-	// True if a collision occured.
-	bool hasIntersected = false;
+		// Without transparent shapes in the way, the arrays answer whether the light is blocked.
+		ShapeArrays::Shadow shadow = ShapeArrays::SHADOW_TRANSPARENT;
+		if (useShapeArrays && !shapeArraysStale)
+			shadow = shapeArrays.shadow(new_origin, lightDir, lightDist, occluders ? occluders + occluder : nullptr, &localShadowStats);
+		if (shadow == ShapeArrays::SHADOW_BLOCKED)
+			intersection = true;
 
-	// The new origin at the intersected point
-	Vec3Df new_origin;
+		for (unsigned int i = 0; i < shapes.size() && shadow == ShapeArrays::SHADOW_TRANSPARENT; i++) {
+			Vec3Df hit, stub2;
+			// Check whether there's an intersection between the hit point and the light source
+			if (shapes[i]->intersection(new_origin, lightDir, hit, stub2) && (hit - new_origin).getLength() < lightDist) {
+				intersection = true;
+				shadowInt = shapes[i]->getIntersectedShape();
+
+				const MaterialRecord& shadowMaterial = *shadowInt->_record;
+				// With caustics, the light through refracting shapes arrives as photons instead.
+				bool refracts = causticPhotons > 0 && (shadowMaterial.features & MATERIAL_NI);
+				if (!(shadowMaterial.features & MATERIAL_TR) || shadowMaterial.Tr == 1.0 || refracts) {
+					// Intersected with an opaque object.
+					break;
+				}
+				else {
+					// Material is transparent, for meshes the material of the intersected triangle.
+					color += (1 - shadowMaterial.Tr) * intersectedShape->shade(origin, new_origin, lightPosition, new_direction);
+					// If it has an ambient color, it should let that color pass through.
+					if ((shadowMaterial.features & MATERIAL_KA) && shadowMaterial.Ka != Vec3Df(0.f, 0.f, 0.f)) {
+						color *= shadowMaterial.Ka;
+					}
+				}
+			}
+		}
+		if (!intersection) {
+			// There was no intersection.
+			color += intersectedShape->shade(origin, new_origin, lightPosition, new_direction);
+		}
+		return intersection;
+	};
+
+	if (lightSamples > 0 && lightSamples < lights && lightTree.size() == lights) {
+		// Stratified over the lights: the samples start at one random offset and are spread evenly.
+		float offset = hashPoint(new_origin);
+		float u[LIGHT_SAMPLE_BLOCK], probabilities[LIGHT_SAMPLE_BLOCK];
+		unsigned int picked[LIGHT_SAMPLE_BLOCK];
+		for (unsigned int start = 0; start < lightSamples; start += LIGHT_SAMPLE_BLOCK) {
+			unsigned int count = std::min(LIGHT_SAMPLE_BLOCK, lightSamples - start);
+			for (unsigned int k = 0; k < count; k++)
+				u[k] = std::min((start + k + offset) / lightSamples, 0.99999994f);
+			lightTree.sample(new_origin, new_direction, u, count, picked, probabilities);
+
+			for (unsigned int k = 0; k < count; k++) {
+				Vec3Df lightColor = Vec3Df(0.f, 0.f, 0.f);
+				addLight(MyLightPositions[picked[k]], picked[k], lightColor);
+				directColor += lightColor / (lightSamples * probabilities[k]);
+			}
+		}
+	}
+	else {
+		for (unsigned int j = 0; j < lights; j++)
+			addLight(MyLightPositions[j], j, directColor);
+	}
 
-	// The normal at the intersected point
-	Vec3Df new_direction;
+	// Area lights: the probes first, the other samples only when they don't agree.
+	// Each area light has its own dimension of the sample sequence.
+	if (!areaLights.empty()) {
+		unsigned int random = hashPointBits(new_origin);
+		for (size_t a = 0; a < areaLights.size(); a++) {
+			const AreaLight& light = areaLights[a];
+			const unsigned int n = light._samples;
+			const unsigned int count = n * n;
+			unsigned int probes = std::min(AreaLight::PROBES, count), traced = 0, blocked = 0;
+			Vec3Df lightColor = Vec3Df(0.f, 0.f, 0.f);
+			for (unsigned int k = 0; k < count; k++) {
+				if (k == probes && (blocked == 0 || blocked == probes))
+					break;
+				float u, v;
+				if (sampleSequence == SAMPLES_GRID) {
+					unsigned int i, j;
+					light.cell(k, i, j);
+					u = (i + randomFloat(random)) / n;
+					v = (j + randomFloat(random)) / n;
+				}
+				else {
+					// The first points of a sequence are spread over the light like the probes.
+					sample2D(sampleSequence, k, count, (unsigned int)a + 1, random, u, v);
+				}
+				blocked += addLight(light.samplePoint(new_origin, u, v), lights + a, lightColor) ? 1 : 0;
+				traced++;
+			}
+			directColor += lightColor / float(traced);
+		}
+	}
+	directColor /= float(allLights);
 
-	// The object which is intersected.
-	Shape* intersectedShape = nullptr;
+	return directColor;
+}
+
+/**
+ * Indirect light
+ *
+ * The diffuse light of the other surfaces arriving at a hit point, one bounce, from the
+ * irradiance cache. Where the cache has no records close enough a hemisphere of rays is
+ * traced from the point, and their light becomes a new record; of the region cache when
+ * the irradiance cache is frozen.
+ */
+Vec3Df computeIndirectLight(const Vec3Df & origin, const Vec3Df & point, const Vec3Df & normal, Shape * shape, unsigned char level)
+{
+	const MaterialRecord& material = *shape->_record;
+	if (!irradianceCache.enabled() || gathering || !(material.features & MATERIAL_KD) || level + 1u >= maxRayDepth)
+		return Vec3Df(0.f, 0.f, 0.f);
 
-	// Loop over all objects in the scene.
+	// The side of the surface the ray came from.
+	Vec3Df facing = Vec3Df::dotProduct(normal, origin - point) < 0.f ? -normal : normal;
+
+	Vec3Df irradiance;
+	bool frozen = irradianceCache.frozen();
+	if (!irradianceCache.lookup(point, facing, irradiance) && !(frozen && regionCache.lookup(point, facing, irradiance))) {
+		unsigned int rows, columns;
+		IrradianceCache::strata(irradianceRays, rows, columns);
+		gatherRadiance.resize(rows * columns);
+		gatherDistance.resize(rows * columns);
+
+		unsigned int random = hashPointBits(point);
+		gathering = true;
+		for (unsigned int j = 0; j < rows; j++) {
+			for (unsigned int k = 0; k < columns; k++) {
+				float s = randomFloat(random);
+				float t = randomFloat(random);
+				Vec3Df direction = IrradianceCache::direction(facing, j, k, rows, columns, s, t);
+				gatherRadiance[j * columns + k] = traceRay(point, direction, level + 1, (unsigned char)maxRayDepth,
+					Vec3Df(1.f, 1.f, 1.f), nullptr, &gatherDistance[j * columns + k]);
+			}
+		}
+		gathering = false;
+		irradiance = (frozen ? regionCache : irradianceCache).add(point, facing, rows, columns, &gatherRadiance[0], &gatherDistance[0]);
+	}
+
+	// Lambertian: the diffuse color over pi of the irradiance.
+	return material.Kd * irradiance / float(M_PI);
+}
+
+/**
+ * The closest hit of a ray, through the arrays when they are up to date.
+ */
+static bool findHit(const Vec3Df & origin, const Vec3Df & direction, ShapeHit & hit)
+{
+	if (useShapeArrays && !shapeArraysStale)
+		return shapeArrays.closestHit(origin, direction, hit);
+
+	// The maximum depth.
+	float current_depth = FLT_MAX;
+	bool hasIntersected = false;
 	for (size_t i = 0; i < shapes.size(); i++) {
 
 		// Temp variables for the intersected function.
@@ -170,16 +514,301 @@ Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & direction, unsign
 				// We have intersected and are closer to the origin. This is the new next object to raytrace.
 				hasIntersected = true;
 				current_depth = depth;
-				new_origin = tmp_origin;
-				new_direction = tmp_direction;
-				intersectedShape = shapes[i]->getIntersectedShape();
+				hit.point = tmp_origin;
+				hit.normal = tmp_direction;
+				hit.shape = shapes[i]->getIntersectedShape();
 			}
 		}
 	}
+	return hasIntersected;
+}
+
+/**
+ * Caustics
+ *
+ * Whether a material can focus light: it reflects, or it refracts and lets light through.
+ */
+static bool isSpecular(const MaterialRecord& material)
+{
+	bool reflects = (material.features & MATERIAL_KS) && material.Ks != Vec3Df(0.f, 0.f, 0.f);
+	bool refracts = (material.features & MATERIAL_NI) && (material.features & MATERIAL_TR) && material.Tr < 1.f;
+	return reflects || refracts;
+}
+
+// A sphere around a shape the photons are sent at.
+struct PhotonTarget {
+	Vec3Df center;
+	float radius;
+};
+
+/**
+ * The spheres and meshes with a material that can focus light. Planes are endless, light only
+ * reaches them through the caustics of the others. Lazy meshes are loaded to find their materials.
+ */
+static void findPhotonTargets(std::vector<PhotonTarget>& targets)
+{
+	for (size_t i = 0; i < shapes.size(); i++) {
+		if (Sphere* sphere = dynamic_cast<Sphere*>(shapes[i])) {
+			if (isSpecular(*sphere->_record)) {
+				PhotonTarget target = { sphere->_origin, sphere->_radius };
+				targets.push_back(target);
+			}
+			continue;
+		}
+
+		MyMesh* mesh = dynamic_cast<MyMesh*>(shapes[i]);
+		if (LazyMesh* lazy = dynamic_cast<LazyMesh*>(shapes[i]))
+			mesh = lazy->mesh();
+		if (mesh == nullptr || mesh->_bvh.empty())
+			continue;
+		bool specular = false;
+		for (size_t j = 0; j < mesh->_triangleShapes.size() && !specular; j++)
+			specular = isSpecular(*mesh->_triangleShapes[j]._record);
+		if (specular) {
+			const BVHNode& root = mesh->_bvh._nodes[0];
+			Vec3Df min = Vec3Df(root.boundsMin[0], root.boundsMin[1], root.boundsMin[2]) + mesh->_origin;
+			Vec3Df max = Vec3Df(root.boundsMax[0], root.boundsMax[1], root.boundsMax[2]) + mesh->_origin;
+			PhotonTarget target = { 0.5f * (min + max), 0.5f * (max - min).getLength() };
+			targets.push_back(target);
+		}
+	}
+}
+
+/**
+ * Follow a photon through reflections and refractions, and keep it where it lands on a diffuse
+ * surface after at least one of them. At each surface Russian roulette picks refraction or
+ * reflection with the probability of their average weight in traceRay, or ends the photon, and
+ * divides the power by that probability.
+ * The power starts as the solid angle the photon stands for times the squared distance to its
+ * first hit: the lights don't fall off, so the photons of a light give a surface facing it the
+ * irradiance its direct light would.
+ */
+static void tracePhoton(Vec3Df origin, Vec3Df direction, float solidAngle, std::mt19937& random, std::vector<Photon>& photons)
+{
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	Vec3Df power(solidAngle, solidAngle, solidAngle);
+	for (unsigned int bounce = 0; bounce < maxRayDepth; bounce++) {
+		ShapeHit hit;
+		if (!findHit(origin, direction, hit))
+			return;
+		if (bounce == 0)
+			power *= (hit.point - origin).getSquaredLength();
+
+		const MaterialRecord& material = *hit.shape->_record;
+		if (bounce > 0 && (material.features & MATERIAL_KD) && material.Kd != Vec3Df(0.f, 0.f, 0.f)) {
+			Photon photon;
+			for (int c = 0; c < 3; c++) {
+				photon.position[c] = hit.point[c];
+				photon.power[c] = power[c];
+				photon.direction[c] = (signed char)(std::max(-1.f, std::min(1.f, direction[c])) * 127.f);
+			}
+			photon.axis = 0;
+			photons.push_back(photon);
+		}
+
+		float reflection = 1.f;
+		Vec3Df refract, refractWeight(0.f, 0.f, 0.f), reflectWeight(0.f, 0.f, 0.f);
+		if (material.features & MATERIAL_NI) {
+			float fresnel = 0.f;
+			refract = hit.shape->refract(hit.normal, direction, 1.0f, fresnel);
+			reflection = fresnel;
+			if ((material.features & MATERIAL_TR) && material.Tr < 1.f) {
+				Vec3Df filter = (material.features & MATERIAL_TF) ? material.Tf : Vec3Df(1.f, 1.f, 1.f);
+				refractWeight = (1 - fresnel) * (1 - material.Tr) * filter;
+			}
+		}
+		if (material.features & MATERIAL_KS)
+			reflectWeight = reflection * material.Ks;
+
+		float refractChance = (refractWeight[0] + refractWeight[1] + refractWeight[2]) / 3.f;
+		float reflectChance = (reflectWeight[0] + reflectWeight[1] + reflectWeight[2]) / 3.f;
+		float total = refractChance + reflectChance;
+		if (total > 1.f) {
+			refractChance /= total;
+			reflectChance /= total;
+		}
+
+		float u = uniform(random);
+		if (u < refractChance) {
+			power *= refractWeight / refractChance;
+			origin = hit.point + refract * EPSILON;
+			direction = refract;
+		}
+		else if (u < refractChance + reflectChance) {
+			power *= reflectWeight / reflectChance;
+			origin = hit.point;
+			direction = direction - 2.f * Vec3Df::dotProduct(direction, hit.normal) * hit.normal;
+		}
+		else {
+			return;
+		}
+	}
+}
+
+/**
+ * Send the photons and build the map. Every light sends an equal share of causticPhotons at
+ * every target, spread evenly over the cone of directions towards its bounding sphere, so no
+ * photons are spent on the diffuse surfaces the shadow rays already light. Area lights send
+ * them from random points. The photons are sent in chunks by all threads.
+ */
+static void buildCausticMap()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<PhotonTarget> targets;
+	findPhotonTargets(targets);
+	const size_t pointLights = MyLightPositions.size();
+	const size_t pairs = (pointLights + areaLights.size()) * targets.size();
+
+	std::vector<Photon> photons;
+	if (causticPhotons > 0 && pairs > 0) {
+		const size_t perPair = std::max<size_t>(1, causticPhotons / pairs);
+		const size_t total = perPair * pairs;
+		const size_t chunks = (total + PHOTON_CHUNK - 1) / PHOTON_CHUNK;
+		std::vector<std::vector<Photon> > chunkPhotons(chunks);
+		std::atomic<size_t> next(0);
+
+		auto emit = [&]() {
+			for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+				std::mt19937 random((unsigned int)chunk);
+				std::uniform_real_distribution<float> uniform(0.f, 1.f);
+				size_t end = std::min(total, (chunk + 1) * PHOTON_CHUNK);
+				for (size_t e = chunk * PHOTON_CHUNK; e < end; e++) {
+					size_t pair = e / perPair;
+					size_t light = pair / targets.size();
+					const PhotonTarget& target = targets[pair % targets.size()];
+					Vec3Df position;
+					if (light < pointLights) {
+						position = MyLightPositions[light];
+					}
+					else {
+						float u = uniform(random);
+						position = areaLights[light - pointLights].samplePoint(target.center, u, uniform(random));
+					}
+
+					// Uniform over the cone, or over all directions from inside the sphere.
+					Vec3Df axis = target.center - position;
+					float distance = axis.getLength();
+					float cosMax = -1.f;
+					if (distance > target.radius) {
+						float ratio = target.radius / distance;
+						cosMax = sqrtf(1.f - ratio * ratio);
+					}
+					axis = distance > 0.f ? axis / distance : Vec3Df(0.f, 1.f, 0.f);
+					Vec3Df u = fabsf(axis[0]) > 0.9f ? Vec3Df(0.f, 1.f, 0.f) : Vec3Df(1.f, 0.f, 0.f);
+					u = Vec3Df::crossProduct(axis, u);
+					u.normalize();
+					Vec3Df v = Vec3Df::crossProduct(axis, u);
+
+					float cosTheta = 1.f - uniform(random) * (1.f - cosMax);
+					float sinTheta = sqrtf(std::max(0.f, 1.f - cosTheta * cosTheta));
+					float phi = 2.f * float(M_PI) * uniform(random);
+					Vec3Df direction = sinTheta * cosf(phi) * u + sinTheta * sinf(phi) * v + cosTheta * axis;
+					float solidAngle = 2.f * float(M_PI) * (1.f - cosMax);
+					tracePhoton(position, direction, solidAngle / perPair, random, chunkPhotons[chunk]);
+				}
+			}
+		};
+
+		unsigned int threads = (unsigned int)std::min<size_t>(renderThreads(), chunks);
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < threads; i++)
+			workers.push_back(std::thread(emit));
+		emit();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+
+		size_t count = 0;
+		for (size_t chunk = 0; chunk < chunks; chunk++)
+			count += chunkPhotons[chunk].size();
+		photons.reserve(count);
+		for (size_t chunk = 0; chunk < chunks; chunk++)
+			photons.insert(photons.end(), chunkPhotons[chunk].begin(), chunkPhotons[chunk].end());
+	}
+	causticMap.build(photons, renderThreads());
+
+	Vec3Df min(1.f, 1.f, 1.f), max(-1.f, -1.f, -1.f);
+	float diagonal = shapeArrays.bounds(min, max) ? (max - min).getLength() : 1.f;
+	causticRadius = CAUSTIC_RADIUS * diagonal;
+	causticBuildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Remove the photons, the map is built again when it is next used.
+ */
+void updateCausticMap()
+{
+	std::lock_guard<std::mutex> lock(causticMutex);
+	causticReady.store(false, std::memory_order_relaxed);
+	causticMap.clear();
+}
+
+size_t getCausticPhotons()
+{
+	return causticReady.load(std::memory_order_acquire) ? causticMap.size() : 0;
+}
+
+double getCausticBuildTime()
+{
+	return causticReady.load(std::memory_order_acquire) ? causticBuildTime : 0.0;
+}
+
+/**
+ * The light focused on a diffuse hit point by the shapes that reflect or refract it, from the
+ * nearest photons. The first thread that needs the map builds it, the others wait.
+ */
+Vec3Df computeCausticLight(const Vec3Df & origin, const Vec3Df & point, const Vec3Df & normal, Shape * shape)
+{
+	const MaterialRecord& material = *shape->_record;
+	if (causticPhotons == 0 || !(material.features & MATERIAL_KD))
+		return Vec3Df(0.f, 0.f, 0.f);
+
+	if (!causticReady.load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lock(causticMutex);
+		if (!causticReady.load(std::memory_order_relaxed)) {
+			buildCausticMap();
+			causticReady.store(true, std::memory_order_release);
+		}
+	}
+
+	// The side of the surface the ray came from.
+	Vec3Df facing = Vec3Df::dotProduct(normal, origin - point) < 0.f ? -normal : normal;
+	Vec3Df irradiance = causticMap.irradiance(point, facing, causticGather, causticRadius);
+
+	// Averaged over the lights like the direct light.
+	return material.Kd * irradiance / float(MyLightPositions.size() + areaLights.size());
+}
+
+/**
+ * Ray Tracing
+ *
+ * The implementation of performRayTracing. When hits is set, every hit is recorded with
+ * the weight of its direct light in the final color, so it can be relit later.
+ * When distance is set it gets the distance to the hit, FLT_MAX for a miss.
+ */
+static Vec3Df traceRay(const Vec3Df & origin, const Vec3Df & direction, unsigned char level, unsigned char max, const Vec3Df & weight, std::vector<HitRecord> * hits, float * distance)
+{
+	if (distance != nullptr)
+		*distance = FLT_MAX;
+
+	// If we are out of bounces, return black.
+	if (level == max)
+		return Vec3Df(0, 0, 0);
+
+	localRayCount++;
+
+	// The new origin at the intersected point, the normal there, and the object which is intersected.
+	ShapeHit hit;
+	bool hasIntersected = findHit(origin, direction, hit);
+	Vec3Df new_origin = hit.point;
+	Vec3Df new_direction = hit.normal;
+	Shape* intersectedShape = hit.shape;
 
 	// If no intersection happend, return black. (Color at infinity)
 	if (!hasIntersected)
 		return Vec3Df(0.f, 0.f, 0.f);
+	if (distance != nullptr)
+		*distance = (new_origin - origin).getLength();
 
 	// Dot product of the direction and new direction
 	float dotProduct = Vec3Df::dotProduct(direction, new_direction);
@@ -193,9 +822,13 @@ Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & direction, unsign
 	float transmission = 1.0f;
 
 	// If it has a material we can do reflections and refractions.
+	// The features of the material record tell at once which of them it needs.
 	if (intersectedShape->hasMaterial()) {
+		const MaterialRecord& material = *intersectedShape->_record;
+		unsigned int features = material.features;
+
 		// Refraction
-		if (intersectedShape->getMaterial().has_Ni()) {
+		if (features & MATERIAL_NI) {
 			float niAir = 1.0f;
 			float fresnel = 0.f;
 
@@ -205,62 +838,34 @@ Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & direction, unsign
 			transmission = 1 - fresnel;
 
 			float translucency = 0.f;
-			if (intersectedShape->getMaterial().has_Tr()) {
-				translucency = 1 - intersectedShape->getMaterial().Tr();
+			if (features & MATERIAL_TR) {
+				translucency = 1 - material.Tr;
 				if (translucency > 0) {
-					refractedColor = translucency * performRayTracing(new_origin + refract * EPSILON, refract, level + 1, max);
-
-					if (intersectedShape->getMaterial().has_Tf())
-						refractedColor *= intersectedShape->getMaterial().Tf();
+					Vec3Df filter = (features & MATERIAL_TF) ? material.Tf : Vec3Df(1.f, 1.f, 1.f);
+					refractedColor = translucency * traceRay(new_origin + refract * EPSILON, refract, level + 1, max, transmission * translucency * filter * weight, hits);
+					refractedColor *= filter;
 				}
 			}
 		}
 
 		// Reflection
-		if (intersectedShape->getMaterial().has_Ks()) {
+		if (features & MATERIAL_KS) {
 			Vec3Df reflect = direction - 2.f * dotProduct * new_direction;
 			if (reflection > 0)
-				reflectedColor = performRayTracing(new_origin, reflect, level + 1, max) * intersectedShape->getMaterial().Ks();
+				reflectedColor = traceRay(new_origin, reflect, level + 1, max, reflection * material.Ks * weight, hits) * material.Ks;
 		}
 	}
 
 	// The color of the intersected object for all lightsources.
-	Vec3Df directColor = Vec3Df(0.f, 0.f, 0.f);
-	Shape* shadowInt = nullptr;
-
-	// Calculate shadows. Multiple light sources. Transparant shadows.
-	for (unsigned int j = 0; j < MyLightPositions.size(); j++) {
-		Vec3Df lightDir = MyLightPositions[j] - new_origin;
-		float lightDist = lightDir.getLength();
-		bool intersection = false;
-
-		for (unsigned int i = 0; i < shapes.size(); i++) {
-			Vec3Df hit, stub2;
-			// Check whether there's an intersection between the hit point and the light source
-			if (shapes[i]->intersection(new_origin, lightDir, hit, stub2) && (hit - new_origin).getLength() < lightDist) {
-				intersection = true;
-				shadowInt = shapes[i]->getIntersectedShape();
-
-				if (!shadowInt->_material.has_Tr() || shadowInt->_material.Tr() == 1.0) {
-					// Intersected with an opaque object.
-					break;
-				}
-				else {
-					// Material is transparent
-					directColor += (1 - shapes[i]->getMaterial().Tr()) * intersectedShape->shade(origin, new_origin, MyLightPositions[j], new_direction);
-					// If it has an ambient color, it should let that color pass through.
-					if (shapes[i]->getMaterial().has_Ka() && shapes[i]->getMaterial().Ka() != Vec3Df(0.f, 0.f, 0.f)) {
-						directColor *= shapes[i]->getMaterial().Ka();
-					}
-				}
-			}
-		}
-		if (!intersection) {
-			// There was no intersection.
-			directColor += intersectedShape->shade(origin, new_origin, MyLightPositions[j], new_direction);
-		}
+	Vec3Df directColor = computeDirectLight(origin, new_origin, new_direction, intersectedShape, level);
+	directColor += computeIndirectLight(origin, new_origin, new_direction, intersectedShape, level);
+	directColor += computeCausticLight(origin, new_origin, new_direction, intersectedShape);
+
+	// Every hit that contributes is recorded, however little: the relit PFM keeps all of it.
+	if (hits && std::max(weight[0], std::max(weight[1], weight[2])) > 0.f) {
+		HitRecord hit = { origin, new_origin, new_direction, intersectedShape, weight };
+		hits->push_back(hit);
 	}
-	directColor /= float(MyLightPositions.size());
 
 	return directColor + reflection * reflectedColor + transmission * refractedColor;
 }
@@ -268,6 +873,33 @@ Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & direction, unsign
 
 
 
+/**
+ * Ray statistics
+ */
+unsigned long long getRayCount()
+{
+	return rayCount;
+}
+
+void resetRayCount()
+{
+	rayCount = 0;
+	shadowLookups = 0;
+	shadowHits = 0;
+	shadowTraversals = 0;
+	shadowNodes = 0;
+}
+
+ShadowCacheStats getShadowCacheStats()
+{
+	ShadowCacheStats stats;
+	stats.lookups = shadowLookups;
+	stats.hits = shadowHits;
+	stats.traversals = shadowTraversals;
+	stats.nodes = shadowNodes;
+	return stats;
+}
+
 /**
  * Debug function to draw things in real time
  */
@@ -277,7 +909,6 @@ void yourDebugDraw()
 	//this function is called every frame
 
 	//let's draw the mesh
-	//testMesh.draw();
 
 	// Draw all the shapes for the viewport window.
 	for (size_t i = 0; i < shapes.size(); i++) {
@@ -293,6 +924,25 @@ void yourDebugDraw()
 	for (unsigned int i=0;i<MyLightPositions.size();++i)
 		glVertex3fv(MyLightPositions[i].pointer());
 	glEnd();
+
+	// The outlines of the area lights.
+	for (size_t i = 0; i < areaLights.size(); i++) {
+		const AreaLight& light = areaLights[i];
+		if (light._type == AreaLight::RECT) {
+			Vec3Df corners[4] = { light._position, light._position + light._edgeU,
+				light._position + light._edgeU + light._edgeV, light._position + light._edgeV };
+			glBegin(GL_LINE_LOOP);
+			for (int c = 0; c < 4; c++)
+				glVertex3fv(corners[c].pointer());
+			glEnd();
+		}
+		else {
+			glPushMatrix();
+			glTranslatef(light._position[0], light._position[1], light._position[2]);
+			glutWireSphere(light._radius, 12, 8);
+			glPopMatrix();
+		}
+	}
 	glPopAttrib();//restore all GL attributes
 	//The Attrib commands maintain the state. 
 	//e.g., even though inside the two calls, we set
@@ -341,6 +991,19 @@ void yourDebugDraw()
 //    the target of the ray - see the code above), but once you replaced 
 //    this function and raytracing is in place, it might take a 
 //    while to complete...
+//    When the view didn't change since the last 'r', only the lights are recomputed
+//    from the cached hits, which is much faster.
+//'r' and 's' render in tiles on all cores, and keep the finished tiles in "result.checkpoint".
+//    When a render is interrupted, starting it again with the same scene, lights and view
+//    only renders the missing tiles, reading the finished ones back from the file one
+//    at a time. The file is removed when the render completes.
+//    's' writes the rows of "result.ppm" while it renders, so huge images fit in memory.
+//'r', 's' and 'p' also write "result.pfm", the linear colors without clamping, which can
+//    be tone mapped with other exposures later (RaytracerTonemap) without rendering again.
+//'p' starts a progressive render on background threads, shown in the window while it
+//    refines. Press 'p' again to stop early, the current image is stored in "result.ppm".
+//    Its samples are saved in "result.progressive" every 30 seconds and when it is stopped;
+//    'p' from the same view with the same scene continues from there.
 void yourKeyboardFunc(char t, int x, int y, const Vec3Df & rayOrigin, const Vec3Df & rayDestination)
 {
 
@@ -3,10 +3,14 @@
 #include <vector>
 #include "mesh.h"
 #include "Shapes\shape.h"
+#include "shapearrays.h"
+#include "arealight.h"
+#include "camera.h"
 
 
 // Variables
 extern std::vector<Shape*> shapes;
+extern std::vector<Material> materials;
 
 // Global variables to draw a debug ray trace.
 extern Vec3Df testRayOrigin;
@@ -18,20 +22,117 @@ extern unsigned int WindowSize_X;//window resolution width
 extern unsigned int WindowSize_Y;//window resolution height
 extern unsigned int RayTracingResolutionX;  // largeur fenetre
 extern unsigned int RayTracingResolutionY;  // largeur fenetre
+extern unsigned int maxRayDepth;  // Maximum number of reflections and refractions
 
 //use this function for any preprocessing of the mesh.
 void init();
 
+// Sort the shapes by type for ray queries, call it after changing the shapes.
+void updateShapeArrays();
+
+// Call it after adding, removing or replacing shapes; rays test the shape list itself until updateShapeArrays.
+void shapesChanged();
+
+// Refit the arrays to shapes moved with setOrigin, much faster than updateShapeArrays for animation.
+// API only for now: scene files have no shape keyframes, and the animation renders the tiles of
+// several frames at once, so only the microbench calls it.
+void refitShapeArrays();
+
+// Whether rays are traced through the sorted shapes (default) or the virtual methods of the shape list.
+extern bool useShapeArrays;
+
+// Build the light tree, call it after changing MyLightPositions.
+void updateLightTree();
+
+// Number of lights sampled per hit point from the light tree, 0 (default) traces a shadow ray to every light.
+extern unsigned int lightSamples;
+
+// Error allowed for interpolating indirect diffuse light from the irradiance cache, 0 (default) leaves
+// it out; 0.1 to 0.3 are useful. Call updateIrradianceCache after changing it.
+extern float irradianceAccuracy;
+
+// Number of rays traced for a new irradiance record.
+extern unsigned int irradianceRays;
+
+// Empty the irradiance cache, updateShapeArrays, refitShapeArrays and updateLightTree do it too.
+void updateIrradianceCache();
+
+// Number of records in the irradiance cache.
+size_t getIrradianceRecords();
+
+// Fill the irradiance cache from a coarse grid of camera rays on one thread, then freeze it, so the
+// indirect light of a pixel no longer depends on the order the tiles are rendered in: the tiles
+// of farm workers and of resumed renders match. Records gathered after that only serve their region.
+void prefillIrradianceCache(const Camera& camera);
+
+// Start a tile or row of pixels. While the irradiance cache is frozen, the records this thread
+// gathers are only used until the next call, so they depend on nothing but the pixels of the region.
+void beginIrradianceRegion();
+
+// Number of photons sent at the shapes that reflect and refract light for caustics, 0 (default) leaves
+// them out; 100000 to 1000000 are useful. Call updateCausticMap after changing it.
+extern unsigned int causticPhotons;
+
+// Number of photons the caustic light of a hit point is estimated from.
+extern unsigned int causticGather;
+
+// Remove the caustic photons, they are sent again when next needed. updateShapeArrays,
+// refitShapeArrays and updateLightTree do it too.
+void updateCausticMap();
+
+// Set maxRayDepth, lightSamples, the irradiance and caustic settings and sampleSequence back to their defaults.
+// Loading a scene file does it before applying the settings of the file.
+void resetRenderSettings();
+
+// Number of caustic photons, and the milliseconds it took to send them and build their map; 0 until they are used.
+size_t getCausticPhotons();
+double getCausticBuildTime();
+
+// Rectangle and sphere lights with soft shadows, next to the point lights of MyLightPositions.
+extern std::vector<AreaLight> areaLights;
+
+// Whether shadow rays first test the shape that blocked the last shadow ray to the same light (default).
+extern bool useShadowCache;
+
 //you can use this function to transform a click to an origin and destination
 //the last two values will be changed. There is no need to define this function.
 //it is defined elsewhere
 void produceRay(int x_I, int y_I, Vec3Df & origin, Vec3Df & dest);
 
 
+/**
+ * A hit of a camera ray, or of one of its reflected and refracted rays.
+ * Stores everything needed to compute its direct light again, when only the lights changed.
+ */
+struct HitRecord {
+	Vec3Df origin;		// Origin of the ray, the view position when shading.
+	Vec3Df point;		// Intersection point.
+	Vec3Df normal;		// Normal at the intersection point.
+	Shape* shape;		// The intersected shape.
+	Vec3Df weight;		// Factor of the direct light of this hit in the final color.
+};
+
 // The ray tracing functions
 Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & destination);
+Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & destination, std::vector<HitRecord> * hits);
 Vec3Df performRayTracing(const Vec3Df & origin, const Vec3Df & direction, unsigned char level, unsigned char max);
 
+// The light of all light sources arriving at a hit point, including shadows.
+Vec3Df computeDirectLight(const Vec3Df & origin, const Vec3Df & point, const Vec3Df & normal, Shape * shape, unsigned char level = 0);
+
+// The indirect diffuse light arriving at a hit point from the irradiance cache, for hits at a depth of the ray tree.
+Vec3Df computeIndirectLight(const Vec3Df & origin, const Vec3Df & point, const Vec3Df & normal, Shape * shape, unsigned char level = 0);
+
+// The light focused on a hit point by reflecting and refracting shapes, from the caustic photons.
+Vec3Df computeCausticLight(const Vec3Df & origin, const Vec3Df & point, const Vec3Df & normal, Shape * shape);
+
+// Ray statistics: number of camera, secondary and shadow rays traced since the last reset.
+unsigned long long getRayCount();
+void resetRayCount();
+
+// Use of the last occluders by the shadow rays since the last reset.
+ShadowCacheStats getShadowCacheStats();
+
 // a function to debug --- you can draw in OpenGL here
 void yourDebugDraw();
 
@@ -0,0 +1,113 @@
+#include "relight.h"
+#include "sampler.h"
+
+/**
+ * Constructor, an empty cache.
+ */
+RelightCache::RelightCache() {}
+
+/**
+ * Start recording a render, one slot of hits per tile.
+ */
+void RelightCache::begin(const Camera& camera) {
+	clear();
+	_camera = camera;
+	_tiles = makeTiles(camera._width, camera._height);
+	_tileHits.resize(_tiles.size());
+}
+
+/**
+ * Render a tile with one ray per pixel, and record all hits.
+ */
+void RelightCache::renderTile(const Tile& tile, std::vector<float>& pixels) {
+	TileHits& tileHits = _tileHits[tile.index];
+	tileHits._pixelStart.clear();
+	tileHits._hits.clear();
+	pixels.resize(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+	beginIrradianceRegion();
+
+	Vec3Df origin, dest;
+	float* pixel = &pixels[0];
+	for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+		for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+			tileHits._pixelStart.push_back((unsigned int)tileHits._hits.size());
+
+			setSamplePixel(x, y);
+			_camera.getRay(float(x), float(y), origin, dest);
+			Vec3Df rgb = performRayTracing(origin, dest, &tileHits._hits);
+			*pixel++ = rgb[0];
+			*pixel++ = rgb[1];
+			*pixel++ = rgb[2];
+		}
+	}
+	tileHits._pixelStart.push_back((unsigned int)tileHits._hits.size());
+}
+
+/**
+ * Compute a tile again from the recorded hits, only the direct light is traced,
+ * and the indirect light and caustics taken from the irradiance cache and photon map.
+ */
+void RelightCache::relightTile(const Tile& tile, std::vector<float>& pixels) const {
+	const TileHits& tileHits = _tileHits[tile.index];
+	pixels.resize(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+	beginIrradianceRegion();
+
+	const unsigned int width = tile.x1 - tile.x0;
+	for (unsigned int pixel = 0; pixel + 1 < tileHits._pixelStart.size(); pixel++) {
+		Vec3Df rgb(0.f, 0.f, 0.f);
+		setSamplePixel(tile.x0 + pixel % width, tile.y0 + pixel / width);
+		for (unsigned int i = tileHits._pixelStart[pixel]; i < tileHits._pixelStart[pixel + 1]; i++) {
+			const HitRecord& hit = tileHits._hits[i];
+			rgb += hit.weight * (computeDirectLight(hit.origin, hit.point, hit.normal, hit.shape)
+				+ computeIndirectLight(hit.origin, hit.point, hit.normal, hit.shape)
+				+ computeCausticLight(hit.origin, hit.point, hit.normal, hit.shape));
+		}
+		pixels[3 * pixel] = rgb[0];
+		pixels[3 * pixel + 1] = rgb[1];
+		pixels[3 * pixel + 2] = rgb[2];
+	}
+}
+
+/**
+ * Compute the image again from the recorded hits, on all cores.
+ */
+void RelightCache::relight(Image& result) {
+	renderTiles(_tiles, renderThreads(), [this](const Tile& tile, std::vector<float>& pixels) {
+		relightTile(tile, pixels);
+	}, [&result](const Tile& tile, std::vector<float>& pixels) {
+		storeTile(result, tile, pixels);
+	}, true);
+}
+
+/**
+ * Whether the cache holds every tile of a render made with this camera.
+ * Tiles restored from a checkpoint were not traced, so they have no hits.
+ */
+bool RelightCache::matches(const Camera& camera) const {
+	if (_tileHits.empty())
+		return false;
+	for (size_t i = 0; i < _tileHits.size(); i++)
+		if (_tileHits[i]._pixelStart.empty())
+			return false;
+
+	return camera._width == _camera._width && camera._height == _camera._height &&
+		camera._origin00 == _camera._origin00 && camera._dest00 == _camera._dest00 &&
+		camera._origin01 == _camera._origin01 && camera._dest01 == _camera._dest01 &&
+		camera._origin10 == _camera._origin10 && camera._dest10 == _camera._dest10 &&
+		camera._origin11 == _camera._origin11 && camera._dest11 == _camera._dest11;
+}
+
+/**
+ * Forget the cached hits.
+ */
+void RelightCache::clear() {
+	std::vector<Tile>().swap(_tiles);
+	std::vector<TileHits>().swap(_tileHits);
+}
+
+size_t RelightCache::size() const {
+	size_t hits = 0;
+	for (size_t i = 0; i < _tileHits.size(); i++)
+		hits += _tileHits[i]._hits.size();
+	return hits;
+}
@@ -0,0 +1,65 @@
+#ifndef RELIGHT_H_jfkdlsjfoiewjfklsdjfl
+#define RELIGHT_H_jfkdlsjfoiewjfklsdjfl
+
+#include <vector>
+#include "camera.h"
+#include "image.h"
+#include "raytracing.h"
+#include "render.h"
+
+/**
+ * RelightCache class
+ *
+ * Keeps the hits of every pixel of the last 'r' render: the first hit and the hits of all
+ * its reflected and refracted rays. These don't depend on the lights, so when only the
+ * lights changed the image is found again by recomputing just the shadow rays and shading.
+ * The hits are stored per tile, so the tiles can be recorded on several threads.
+ */
+class RelightCache {
+	public:
+		// Constructor
+		RelightCache();
+
+		// Start recording a render with this camera, the previous hits are forgotten.
+		void begin(const Camera& camera);
+
+		/**
+		 * Render a tile with one ray per pixel, like renderTile does, and record its hits.
+		 * Different tiles may be rendered at the same time.
+		 */
+		void renderTile(const Tile& tile, std::vector<float>& pixels);
+
+		/**
+		 * Compute the image again for the current lights, from the recorded hits.
+		 * The image must be as big as the camera the cache was rendered with.
+		 */
+		void relight(Image& result);
+
+		// Whether the cache holds all tiles of a render made with this camera.
+		bool matches(const Camera& camera) const;
+
+		// Forget the cached hits, call this whenever the shapes or materials change.
+		void clear();
+
+		// Number of recorded hits.
+		size_t size() const;
+
+	private:
+		// Compute a tile again from its recorded hits.
+		void relightTile(const Tile& tile, std::vector<float>& pixels) const;
+
+		// Camera of the cached render.
+		Camera _camera;
+
+		// The recorded hits of one tile. The hits of pixel i of the tile (row by row)
+		// are _hits[_pixelStart[i]] up to _hits[_pixelStart[i + 1]].
+		struct TileHits {
+			std::vector<unsigned int> _pixelStart;
+			std::vector<HitRecord> _hits;
+		};
+
+		std::vector<Tile> _tiles;
+		std::vector<TileHits> _tileHits;
+};
+
+#endif // RELIGHT_H
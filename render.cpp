@@ -0,0 +1,190 @@
+#include "render.h"
+#include "raytracing.h"
+#include "sampler.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+/**
+ * Trace the samples of a single pixel, and return the average color.
+ */
+Vec3Df renderPixel(const Camera& camera, unsigned int ns, unsigned int x, unsigned int y)
+{
+	Vec3Df origin, dest;
+	setSamplePixel(x, y);
+
+	if (ns <= 1) {
+		// One ray per pixel, through the pixel corner.
+		camera.getRay(float(x), float(y), origin, dest);
+		return performRayTracing(origin, dest);
+	}
+
+	// ns x ns samples within the pixel, from the sample sequence scrambled for the pixel.
+	Vec3Df rgb(0.f, 0.f, 0.f);
+	unsigned int scramble = pixelScramble(x, y);
+	for (unsigned int k = 0; k < ns * ns; k++) {
+		float u, v;
+		sample2D(sampleSequence, k, ns * ns, 0, scramble, u, v);
+		camera.getRay(x + u, y + v, origin, dest);
+		rgb += performRayTracing(origin, dest);
+	}
+	return rgb / float(ns*ns);
+}
+
+/**
+ * Render the rows [fromY, toY) of the image.
+ */
+void renderRows(const Camera& camera, Image& result, unsigned int ns, unsigned int fromY, unsigned int toY, bool showProgress)
+{
+	for (unsigned int y = fromY; y < toY; ++y) {
+		for (unsigned int x = 0; x < camera._width; ++x)
+		{
+			Vec3Df rgb = renderPixel(camera, ns, x, y);
+
+			// Store the result in an image
+			result.setPixelHDR(x, y, rgb[0], rgb[1], rgb[2]);
+		}
+
+		if (showProgress)
+			loadbar(y - fromY, toY - fromY, 50);
+	}
+
+	if (showProgress) {
+		loadbar(toY - fromY, toY - fromY, 50);
+		std::cout << std::endl << std::endl;
+	}
+}
+
+/**
+ * Split the image in tiles, in row-major order.
+ */
+std::vector<Tile> makeTiles(unsigned int width, unsigned int height)
+{
+	std::vector<Tile> tiles;
+	for (unsigned int y = 0; y < height; y += TILE_SIZE) {
+		for (unsigned int x = 0; x < width; x += TILE_SIZE) {
+			Tile tile = { (unsigned int)tiles.size(), x, y, std::min(x + TILE_SIZE, width), std::min(y + TILE_SIZE, height) };
+			tiles.push_back(tile);
+		}
+	}
+	return tiles;
+}
+
+/**
+ * Render a single tile.
+ */
+void renderTile(const Camera& camera, unsigned int ns, const Tile& tile, std::vector<float>& pixels)
+{
+	pixels.resize(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+	beginIrradianceRegion();
+
+	float* pixel = &pixels[0];
+	for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+		for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+			Vec3Df rgb = renderPixel(camera, ns, x, y);
+			*pixel++ = rgb[0];
+			*pixel++ = rgb[1];
+			*pixel++ = rgb[2];
+		}
+	}
+}
+
+/**
+ * Copy the pixels of a rendered tile into the image.
+ */
+void storeTile(Image& result, const Tile& tile, const std::vector<float>& pixels)
+{
+	const float* pixel = &pixels[0];
+	for (unsigned int y = tile.y0; y < tile.y1; ++y) {
+		for (unsigned int x = tile.x0; x < tile.x1; ++x) {
+			result.setPixelHDR(x, y, pixel[0], pixel[1], pixel[2]);
+			pixel += 3;
+		}
+	}
+}
+
+/**
+ * Render a list of tiles on a number of threads.
+ * The threads take the next tile from a shared counter, so slow tiles balance out.
+ */
+void renderTiles(const std::vector<Tile>& tiles, unsigned int threads, const TileFunction& render, const TileFunction& done, bool showProgress, unsigned int window)
+{
+	std::atomic<unsigned int> next(0);
+	std::mutex doneMutex;
+	std::condition_variable windowMoved;
+	std::vector<bool> finished(tiles.size(), false);
+	unsigned int oldest = 0;
+	unsigned int count = 0;
+
+	auto worker = [&]() {
+		std::vector<float> pixels;
+		for (unsigned int i = next++; i < tiles.size(); i = next++) {
+			// The first unfinished tile is always being rendered by a thread that isn't waiting.
+			if (window > 0) {
+				std::unique_lock<std::mutex> lock(doneMutex);
+				while (i >= oldest + window)
+					windowMoved.wait(lock);
+			}
+
+			render(tiles[i], pixels);
+
+			std::lock_guard<std::mutex> lock(doneMutex);
+			done(tiles[i], pixels);
+			finished[i] = true;
+			while (oldest < tiles.size() && finished[oldest])
+				oldest++;
+			windowMoved.notify_all();
+
+			count++;
+			if (showProgress)
+				loadbar(count, (unsigned int)tiles.size(), 50);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+
+	if (showProgress)
+		std::cout << std::endl << std::endl;
+}
+
+/**
+ * A window for renderTiles of two tile rows, but at least two tiles per thread.
+ */
+unsigned int streamingWindow(unsigned int width, unsigned int threads)
+{
+	unsigned int tilesPerRow = (width + TILE_SIZE - 1) / TILE_SIZE;
+	return std::max(2 * tilesPerRow, 2 * threads);
+}
+
+/**
+ * Number of render threads to use, one per core.
+ */
+unsigned int renderThreads()
+{
+	unsigned int threads = std::thread::hardware_concurrency();
+	return threads > 0 ? threads : 1;
+}
+
+/**
+ * Print a loadbar to the console, x out of n done, w characters wide.
+ */
+void loadbar(unsigned int x, unsigned int n, unsigned int w) {
+	if ((x != n) && (x % (n / 100 + 1) != 0)) return;
+
+	float ratio = x / (float)n;
+	unsigned int c = (unsigned int)(ratio * w);
+
+	std::cout << std::setw(3) << (int)(ratio * 100) << "% [";
+	for (unsigned int x = 0; x < c; x++) std::cout << "=";
+	for (unsigned int x = c; x < w; x++) std::cout << " ";
+	std::cout << "]\r" << std::flush;
+}
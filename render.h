@@ -0,0 +1,77 @@
+#ifndef RENDER_H_fjdklsjfoeiwjflskdjf
+#define RENDER_H_fjdklsjfoeiwjflskdjf
+
+#include <functional>
+#include <vector>
+#include "camera.h"
+#include "image.h"
+
+// Width and height of a tile in pixels.
+static const unsigned int TILE_SIZE = 32;
+
+/**
+ * A rectangle of the image, [x0, x1) x [y0, y1).
+ * Tiles are numbered in row-major order, index is the position in makeTiles().
+ */
+struct Tile {
+	unsigned int index;
+	unsigned int x0, y0;
+	unsigned int x1, y1;
+};
+
+/**
+ * Render tile callbacks. The pixels are 3 floats per pixel, row by row within the tile.
+ */
+typedef std::function<void(const Tile&, std::vector<float>&)> TileFunction;
+
+/**
+ * Trace the samples of a single pixel, and return the average color.
+ * With ns == 1 one ray is traced through the pixel corner, like the 'r' key did,
+ * otherwise ns x ns samples within the pixel from sampleSequence.
+ */
+Vec3Df renderPixel(const Camera& camera, unsigned int ns, unsigned int x, unsigned int y);
+
+/**
+ * Render the rows [fromY, toY) of the image.
+ * 1st param:	The camera to produce the rays with.
+ * 2nd param:	The image to store the result in, must be as big as the camera.
+ * 3rd param:	Number of samples per pixel in each direction (ns x ns samples).
+ *				With ns == 1 one ray per pixel is traced, like the 'r' key does.
+ * 4th param:	First row to render.
+ * 5th param:	Row after the last one to render.
+ * 6th param:	Whether to print the loadbar while rendering.
+ */
+void renderRows(const Camera& camera, Image& result, unsigned int ns, unsigned int fromY, unsigned int toY, bool showProgress);
+
+// Split the image in tiles of TILE_SIZE, in row-major order.
+std::vector<Tile> makeTiles(unsigned int width, unsigned int height);
+
+// Render a single tile with ns x ns samples per pixel.
+void renderTile(const Camera& camera, unsigned int ns, const Tile& tile, std::vector<float>& pixels);
+
+// Copy the pixels of a rendered tile into the image.
+void storeTile(Image& result, const Tile& tile, const std::vector<float>& pixels);
+
+/**
+ * Render a list of tiles on a number of threads.
+ * 1st param:	The tiles to render, they are started in this order.
+ * 2nd param:	Number of render threads.
+ * 3rd param:	Renders one tile, called from the render threads.
+ * 4th param:	Called for every finished tile. Calls are serialized, so it needs no locking.
+ * 5th param:	Whether to print the loadbar while rendering.
+ * 6th param:	When not 0, a tile is only started when it is less than this many tiles after
+ *				the first unfinished one. This bounds how far out of order tiles finish,
+ *				so a streaming ImageWriter keeps only a few rows in memory.
+ */
+void renderTiles(const std::vector<Tile>& tiles, unsigned int threads, const TileFunction& render, const TileFunction& done, bool showProgress, unsigned int window = 0);
+
+// A window for renderTiles that keeps all threads busy, and finishes tiles about two tile rows out of order.
+unsigned int streamingWindow(unsigned int width, unsigned int threads);
+
+// Number of render threads to use, one per core.
+unsigned int renderThreads();
+
+// Loadbar
+void loadbar(unsigned int x, unsigned int n, unsigned int w = 50);
+
+#endif // RENDER_H
@@ -0,0 +1,229 @@
+#include "sampler.h"
+#include <algorithm>
+#include <math.h>
+#include <mutex>
+#include <vector>
+
+SampleSequence sampleSequence = SAMPLES_GRID;
+
+// Width and height of the blue noise mask, it is tiled over the image.
+static const unsigned int MASK_SIZE = 64;
+
+// Spread of the Gaussian that void and cluster measures clusters with, in pixels.
+static const float MASK_SIGMA = 1.5f;
+
+// Where the shift of v is read in the mask from the shift of u, and the shifts of a dimension from
+// those of the one before; far apart, so the shifts aren't correlated.
+static const unsigned int MASK_OFFSET_X = 32, MASK_OFFSET_Y = 21;
+static const unsigned int MASK_STEP = 13;
+
+// The pixel the thread traces.
+static thread_local unsigned int pixelX = 0, pixelY = 0;
+
+static std::vector<float> blueNoise;
+static std::once_flag blueNoiseOnce;
+
+void setSamplePixel(unsigned int x, unsigned int y)
+{
+	pixelX = x;
+	pixelY = y;
+}
+
+static unsigned int hash(unsigned int value)
+{
+	value ^= value >> 16;
+	value *= 0x85ebca6bu;
+	value ^= value >> 13;
+	value *= 0xc2b2ae35u;
+	value ^= value >> 16;
+	return value;
+}
+
+unsigned int pixelScramble(unsigned int x, unsigned int y)
+{
+	return hash(x * 73856093u ^ hash(y * 19349663u + 1));
+}
+
+// The high 24 bits of a number as a float in [0, 1).
+static float toFloat(unsigned int bits)
+{
+	return (bits >> 8) * (1.f / 16777216.f);
+}
+
+// The first dimension of Sobol, the van der Corput sequence: the bits of the index mirrored.
+static unsigned int sobol0(unsigned int index)
+{
+	index = (index << 16) | (index >> 16);
+	index = ((index & 0x00ff00ffu) << 8) | ((index & 0xff00ff00u) >> 8);
+	index = ((index & 0x0f0f0f0fu) << 4) | ((index & 0xf0f0f0f0u) >> 4);
+	index = ((index & 0x33333333u) << 2) | ((index & 0xccccccccu) >> 2);
+	index = ((index & 0x55555555u) << 1) | ((index & 0xaaaaaaaau) >> 1);
+	return index;
+}
+
+// The second dimension of Sobol, from the direction numbers of the polynomial x + 1.
+// Together with the first a (0, 2)-sequence: every aligned run of 2^k points has one point in
+// each box of area 2^-k with power of two sides.
+static unsigned int sobol1(unsigned int index)
+{
+	unsigned int result = 0;
+	for (unsigned int direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1)
+		if (index & 1)
+			result ^= direction;
+	return result;
+}
+
+static float radicalInverse(unsigned int index, unsigned int base)
+{
+	double inverse = 1.0 / base, factor = inverse, result = 0.0;
+	while (index > 0) {
+		result += (index % base) * factor;
+		index /= base;
+		factor *= inverse;
+	}
+	return std::min(float(result), 0.99999994f);
+}
+
+/**
+ * A blue noise mask by void and cluster, after Ulichney: a pattern of a tenth of the pixels is
+ * made as even as possible, then pixels are taken from its tightest clusters and put in its
+ * largest voids one by one, and ranked in that order. Any threshold of the ranks is an even
+ * pattern, so the mask has no low frequencies. Clusters and voids are where the pattern,
+ * blurred by a Gaussian that wraps around the edges, is brightest and darkest.
+ */
+static void makeBlueNoise()
+{
+	const unsigned int size = MASK_SIZE, count = size * size;
+	std::vector<float> kernel(count);
+	for (unsigned int y = 0; y < size; y++) {
+		for (unsigned int x = 0; x < size; x++) {
+			float dx = float(std::min(x, size - x)), dy = float(std::min(y, size - y));
+			kernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2.f * MASK_SIGMA * MASK_SIGMA));
+		}
+	}
+
+	std::vector<unsigned char> pattern(count, 0);
+	std::vector<float> energy(count, 0.f);
+	auto set = [&](unsigned int pixel, bool on) {
+		pattern[pixel] = on ? 1 : 0;
+		float sign = on ? 1.f : -1.f;
+		unsigned int px = pixel % size, py = pixel / size;
+		for (unsigned int y = 0; y < size; y++) {
+			const float* row = &kernel[((y + size - py) % size) * size];
+			float* target = &energy[y * size];
+			for (unsigned int x = 0; x < size; x++)
+				target[x] += sign * row[(x + size - px) % size];
+		}
+	};
+	auto tightestCluster = [&]() {
+		unsigned int best = 0;
+		float most = -1.f;
+		for (unsigned int i = 0; i < count; i++)
+			if (pattern[i] && energy[i] > most)
+				most = energy[best = i];
+		return best;
+	};
+	auto largestVoid = [&]() {
+		unsigned int best = 0;
+		float least = 1e30f;
+		for (unsigned int i = 0; i < count; i++)
+			if (!pattern[i] && energy[i] < least)
+				least = energy[best = i];
+		return best;
+	};
+
+	const unsigned int ones = count / 10;
+	unsigned int state = 1;
+	for (unsigned int i = 0; i < ones;) {
+		unsigned int pixel = hash(state++) % count;
+		if (!pattern[pixel]) {
+			set(pixel, true);
+			i++;
+		}
+	}
+
+	// Move the tightest cluster to the largest void, until it would move back to where it was.
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int cluster = tightestCluster();
+		set(cluster, false);
+		unsigned int hole = largestVoid();
+		set(hole, true);
+		if (hole == cluster)
+			break;
+	}
+
+	std::vector<unsigned int> rank(count);
+	std::vector<unsigned char> prototype = pattern;
+	std::vector<float> prototypeEnergy = energy;
+	for (unsigned int r = ones; r-- > 0;) {
+		unsigned int cluster = tightestCluster();
+		set(cluster, false);
+		rank[cluster] = r;
+	}
+	pattern = prototype;
+	energy = prototypeEnergy;
+	for (unsigned int r = ones; r < count; r++) {
+		unsigned int hole = largestVoid();
+		set(hole, true);
+		rank[hole] = r;
+	}
+
+	blueNoise.resize(count);
+	for (unsigned int i = 0; i < count; i++)
+		blueNoise[i] = (rank[i] + 0.5f) / count;
+}
+
+static float maskValue(unsigned int x, unsigned int y)
+{
+	return blueNoise[(y % MASK_SIZE) * MASK_SIZE + x % MASK_SIZE];
+}
+
+void sample2D(SampleSequence sequence, unsigned int index, unsigned int count, unsigned int dimension, unsigned int scramble, float& u, float& v)
+{
+	switch (sequence) {
+		case SAMPLES_HALTON: {
+			// Bases 2 and 3 in every dimension: the first points of higher bases all lie in a corner.
+			// Shifted around the unit square the points stay as even, each dimension by its own shift.
+			unsigned int shift = hash(scramble ^ hash(dimension + 1));
+			u = radicalInverse(index, 2) + toFloat(shift);
+			v = radicalInverse(index, 3) + toFloat(hash(shift));
+			break;
+		}
+		case SAMPLES_SOBOL: {
+			// Flipping the same bits of every point keeps its place in the grids of the boxes.
+			unsigned int flipU = hash(scramble ^ hash(dimension + 1));
+			unsigned int flipV = hash(flipU);
+			u = toFloat(sobol0(index) ^ flipU);
+			v = toFloat(sobol1(index) ^ flipV);
+			return;
+		}
+		case SAMPLES_BLUE_NOISE: {
+			std::call_once(blueNoiseOnce, makeBlueNoise);
+
+			// The scramble picks a block of the sequence as long as a power of two of at least count samples.
+			unsigned int bits = 0;
+			while ((1u << bits) < count && bits < 16)
+				bits++;
+			index += (scramble & 0xffu) << bits;
+
+			unsigned int x = pixelX + dimension * MASK_STEP, y = pixelY + dimension * MASK_STEP;
+			u = toFloat(sobol0(index)) + maskValue(x, y);
+			v = toFloat(sobol1(index)) + maskValue(x + MASK_OFFSET_X, y + MASK_OFFSET_Y);
+			break;
+		}
+		default: {
+			unsigned int n = std::max(1u, (unsigned int)(sqrtf(float(count)) + 0.5f));
+			u = (index / n % n + 0.5f) / n;
+			v = (index % n + 0.5f) / n;
+			return;
+		}
+	}
+
+	// Back into [0, 1) after a shift.
+	if (u >= 1.f)
+		u -= 1.f;
+	if (v >= 1.f)
+		v -= 1.f;
+	u = std::min(u, 0.99999994f);
+	v = std::min(v, 0.99999994f);
+}
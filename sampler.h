@@ -0,0 +1,56 @@
+#ifndef SAMPLER_H_woeiruqpalskdjfhzmxnc
+#define SAMPLER_H_woeiruqpalskdjfhzmxnc
+
+/**
+ * Sequences of sample points in the unit square.
+ */
+enum SampleSequence {
+	SAMPLES_GRID,		// A regular grid, the pixel samples of 's' and the cells of AreaLight.
+	SAMPLES_HALTON,		// Halton points, shifted by a random offset per pixel or hit point.
+	SAMPLES_SOBOL,		// Sobol points, their bits flipped by a random mask per pixel or hit point.
+	SAMPLES_BLUE_NOISE	// Sobol points, shifted per pixel by a tiled blue noise mask.
+};
+
+// Sequence of the pixel and area light samples, set by the scene file or the benchmark. SAMPLES_GRID by default.
+extern SampleSequence sampleSequence;
+
+/**
+ * Samplers
+ *
+ * The samples of a pixel, or of the area lights at a hit point, are the first points of a
+ * sequence. Low discrepancy sequences spread any number of first points evenly, so they need
+ * fewer samples than a grid for the same noise and don't alias on regular patterns; a grid only
+ * spreads its points evenly when all of them are taken.
+ *
+ * Every pixel or hit point gets its own scrambled copy of the sequence, so neighbouring pixels
+ * don't repeat the same error. With blue noise the scrambles of neighbouring pixels are as
+ * different as possible, which leaves the noise at high frequencies where it is least visible.
+ * The blue noise mask is made by void and cluster the first time it is used.
+ *
+ * A sample has a dimension, the pair of coordinates it is for: the pixel samples are dimension
+ * 0 and every area light has its own, so their samples aren't correlated. Each dimension is
+ * scrambled independently.
+ */
+
+/**
+ * Set the pixel the calling thread traces, which picks the blue noise scrambles of its samples.
+ * The renderers set it before the rays of every pixel.
+ */
+void setSamplePixel(unsigned int x, unsigned int y);
+
+// A scramble for the samples of a pixel.
+unsigned int pixelScramble(unsigned int x, unsigned int y);
+
+/**
+ * A sample of a sequence.
+ * 1st param:	The sequence.
+ * 2nd param:	The index of the sample.
+ * 3rd param:	Number of samples that will be taken; a grid has sqrt(count) rows and columns,
+ *				and its samples are the cell centers, column by column.
+ * 4th param:	The dimension of the sample.
+ * 5th param:	The scramble, a hash of the pixel or hit point. Blue noise uses the pixel instead.
+ * 6th-7th:		Get the sample, in [0, 1).
+ */
+void sample2D(SampleSequence sequence, unsigned int index, unsigned int count, unsigned int dimension, unsigned int scramble, float& u, float& v);
+
+#endif // SAMPLER_H
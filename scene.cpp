@@ -0,0 +1,382 @@
+#include "scene.h"
+#include "raytracing.h"
+#include "sampler.h"
+#include "texture.h"
+#include "Shapes/shape.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+SceneSettings::SceneSettings() : hasCamera(false), eye(0.f, 0.f, 4.f), target(0.f, 0.f, 0.f), up(0.f, 1.f, 0.f), fov(50.f),
+	width(0), height(0), ns(0), depth(0), lightSamples(0), irradiance(0.f), irradianceRays(0), caustics(0), causticGather(0), sampler(SAMPLES_GRID), frames(0) {}
+
+/**
+ * Textures by path. They are shared by every scene loaded, so a texture is loaded at most once.
+ */
+static std::map<std::string, Texture*> sceneTextures;
+
+static Texture* sceneTexture(const std::string& filename)
+{
+	Texture*& texture = sceneTextures[filename];
+	if (texture == nullptr)
+		texture = new Texture(filename);
+	return texture;
+}
+
+/**
+ * A parsed shape, created once all materials are known.
+ */
+struct SceneShape {
+	enum Type { SPHERE, PLANE, MESH } type;
+	int line;
+	std::string material;
+	std::string filename;
+	Vec3Df position;
+	Vec3Df normal;
+	float radius;
+	bool hasBounds;
+	Vec3Df boundsMin;
+	Vec3Df boundsMax;
+};
+
+/**
+ * Read a vector of three floats.
+ */
+static bool readVector(std::istringstream& in, Vec3Df& v)
+{
+	return bool(in >> v[0] >> v[1] >> v[2]);
+}
+
+/**
+ * The path of a file referenced by the scene file, relative to the scene file.
+ */
+static std::string scenePath(const std::string& directory, const std::string& path)
+{
+	if (path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'))
+		return path;
+	return directory + path;
+}
+
+bool isSceneFile(const char* filename)
+{
+	std::string name(filename);
+	return name.size() > 6 && name.compare(name.size() - 6, 6, ".scene") == 0;
+}
+
+bool loadSceneFile(const char* filename, SceneSettings& settings)
+{
+	std::ifstream file(filename);
+	if (!file) {
+		std::cout << "Scene " << filename << " not found" << std::endl;
+		return false;
+	}
+	if (!shapes.empty() || !materials.empty()) {
+		std::cout << "Scene " << filename << " can only be loaded into an empty scene" << std::endl;
+		return false;
+	}
+
+	std::string directory(filename);
+	size_t slash = directory.find_last_of("/\\");
+	directory = slash == std::string::npos ? std::string() : directory.substr(0, slash + 1);
+
+	settings = SceneSettings();
+	std::vector<Material> sceneMaterials;
+	std::map<std::string, size_t> materialIndex;
+	std::vector<std::string> materialTextures;
+	std::vector<SceneShape> sceneShapes;
+	std::vector<Vec3Df> lights;
+	std::vector<bool> cameraLights;
+	std::vector<AreaLight> sceneAreaLights;
+
+	// The mesh statements only apply to the meshes of this file.
+	MeshOptions sceneMeshOptions = meshOptions;
+
+	std::string line;
+	int number = 0;
+	while (std::getline(file, line)) {
+		number++;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream in(line);
+		std::string keyword;
+		if (!(in >> keyword))
+			continue;
+
+		bool ok = true;
+		Material* material = sceneMaterials.empty() ? nullptr : &sceneMaterials.back();
+		float r, g, b;
+
+		if (keyword == "resolution") {
+			ok = bool(in >> settings.width >> settings.height) && settings.width > 0 && settings.height > 0;
+		}
+		else if (keyword == "samples") {
+			ok = bool(in >> settings.ns) && settings.ns > 0;
+		}
+		else if (keyword == "depth") {
+			ok = bool(in >> settings.depth) && settings.depth > 0 && settings.depth < 256;
+		}
+		else if (keyword == "lightsamples") {
+			ok = bool(in >> settings.lightSamples) && settings.lightSamples > 0;
+		}
+		else if (keyword == "irradiance") {
+			ok = bool(in >> settings.irradiance) && settings.irradiance > 0.f;
+			std::string option;
+			if (ok && in >> option)
+				ok = option == "rays" && bool(in >> settings.irradianceRays) && settings.irradianceRays > 0;
+		}
+		else if (keyword == "caustics") {
+			ok = bool(in >> settings.caustics) && settings.caustics > 0;
+			std::string option;
+			if (ok && in >> option)
+				ok = option == "gather" && bool(in >> settings.causticGather) && settings.causticGather > 0;
+		}
+		else if (keyword == "sampler") {
+			std::string sequence;
+			ok = bool(in >> sequence);
+			if (sequence == "grid") settings.sampler = SAMPLES_GRID;
+			else if (sequence == "halton") settings.sampler = SAMPLES_HALTON;
+			else if (sequence == "sobol") settings.sampler = SAMPLES_SOBOL;
+			else if (sequence == "bluenoise") settings.sampler = SAMPLES_BLUE_NOISE;
+			else ok = false;
+		}
+		else if (keyword == "meshstorage") {
+			std::string storage;
+			ok = bool(in >> storage);
+			if (storage == "full") sceneMeshOptions.storage = MESH_STORAGE_FULL;
+			else if (storage == "compact") sceneMeshOptions.storage = MESH_STORAGE_COMPACT;
+			else if (storage == "quantized") sceneMeshOptions.storage = MESH_STORAGE_QUANTIZED;
+			else ok = false;
+		}
+		else if (keyword == "meshleaves") {
+			std::string leaves;
+			ok = bool(in >> leaves);
+			if (leaves == "scalar") sceneMeshOptions.leaves = MESH_LEAVES_SCALAR;
+			else if (leaves == "soa") sceneMeshOptions.leaves = MESH_LEAVES_SOA;
+			else ok = false;
+		}
+		else if (keyword == "meshbvh") {
+			std::string bvh;
+			ok = bool(in >> bvh);
+			if (bvh == "binary") sceneMeshOptions.wide = false;
+			else if (bvh == "wide") sceneMeshOptions.wide = true;
+			else ok = false;
+		}
+		else if (keyword == "meshbuilder") {
+			std::string builder;
+			ok = bool(in >> builder);
+			if (builder == "sah") sceneMeshOptions.builder = BVH_BUILDER_SAH;
+			else if (builder == "sbvh") sceneMeshOptions.builder = BVH_BUILDER_SBVH;
+			else if (builder == "lbvh") sceneMeshOptions.builder = BVH_BUILDER_LBVH;
+			else ok = false;
+		}
+		else if (keyword == "camera") {
+			settings.hasCamera = true;
+			std::string key;
+			while (ok && in >> key) {
+				if (key == "eye") ok = readVector(in, settings.eye);
+				else if (key == "target") ok = readVector(in, settings.target);
+				else if (key == "up") ok = readVector(in, settings.up);
+				else if (key == "fov") ok = bool(in >> settings.fov) && settings.fov > 0.f && settings.fov < 180.f;
+				else ok = false;
+			}
+		}
+		else if (keyword == "keyframe") {
+			CameraKeyframe keyframe;
+			if (settings.keyframes.empty()) {
+				keyframe.eye = settings.eye;
+				keyframe.target = settings.target;
+				keyframe.up = settings.up;
+				keyframe.fov = settings.fov;
+			}
+			else {
+				keyframe = settings.keyframes.back();
+			}
+			ok = bool(in >> keyframe.time) && (settings.keyframes.empty() || keyframe.time >= settings.keyframes.back().time);
+			std::string key;
+			while (ok && in >> key) {
+				if (key == "eye") ok = readVector(in, keyframe.eye);
+				else if (key == "target") ok = readVector(in, keyframe.target);
+				else if (key == "up") ok = readVector(in, keyframe.up);
+				else if (key == "fov") ok = bool(in >> keyframe.fov) && keyframe.fov > 0.f && keyframe.fov < 180.f;
+				else ok = false;
+			}
+			settings.keyframes.push_back(keyframe);
+		}
+		else if (keyword == "frames") {
+			ok = bool(in >> settings.frames) && settings.frames > 0;
+		}
+		else if (keyword == "light") {
+			std::string position;
+			Vec3Df light;
+			ok = bool(in >> position);
+			if (ok && position != "camera") {
+				std::istringstream first(position);
+				ok = bool(first >> light[0]) && bool(in >> light[1] >> light[2]);
+			}
+			lights.push_back(light);
+			cameraLights.push_back(position == "camera");
+		}
+		else if (keyword == "arealight") {
+			std::string type;
+			Vec3Df position, edgeU, edgeV;
+			float radius = 0.f;
+			ok = bool(in >> type);
+			if (type == "rect")
+				ok = bool(in >> position[0] >> position[1] >> position[2] >> edgeU[0] >> edgeU[1] >> edgeU[2] >> edgeV[0] >> edgeV[1] >> edgeV[2]);
+			else if (type == "sphere")
+				ok = bool(in >> position[0] >> position[1] >> position[2] >> radius) && radius > 0.f;
+			else
+				ok = false;
+
+			unsigned int samples = 4;
+			std::string option;
+			if (ok && in >> option)
+				ok = option == "samples" && bool(in >> samples) && samples > 0 && samples <= 64;
+			if (ok)
+				sceneAreaLights.push_back(type == "rect" ? AreaLight(position, edgeU, edgeV, samples) : AreaLight(position, radius, samples));
+		}
+		else if (keyword == "material") {
+			std::string name;
+			ok = bool(in >> name) && materialIndex.count(name) == 0;
+			if (ok) {
+				materialIndex[name] = sceneMaterials.size();
+				sceneMaterials.push_back(Material());
+				sceneMaterials.back().set_name(name);
+				materialTextures.push_back(std::string());
+			}
+		}
+		else if (keyword == "Kd" || keyword == "Ka" || keyword == "Ks" || keyword == "Tf") {
+			ok = material != nullptr && bool(in >> r >> g >> b);
+			if (ok) {
+				if (keyword == "Kd") material->set_Kd(r, g, b);
+				else if (keyword == "Ka") material->set_Ka(r, g, b);
+				else if (keyword == "Ks") material->set_Ks(r, g, b);
+				else material->set_Tf(r, g, b);
+			}
+		}
+		else if (keyword == "Ns" || keyword == "Ni" || keyword == "Tr") {
+			ok = material != nullptr && bool(in >> r);
+			if (ok) {
+				if (keyword == "Ns") material->set_Ns(r);
+				else if (keyword == "Ni") material->set_Ni(r);
+				else material->set_Tr(r);
+			}
+		}
+		else if (keyword == "illum") {
+			int illum;
+			ok = material != nullptr && bool(in >> illum);
+			if (ok)
+				material->set_illum(illum);
+		}
+		else if (keyword == "texture") {
+			std::string path;
+			ok = material != nullptr && bool(in >> path);
+			if (ok) {
+				material->set_textureName(scenePath(directory, path));
+				materialTextures.back() = material->textureName();
+			}
+		}
+		else if (keyword == "sphere" || keyword == "plane") {
+			SceneShape shape;
+			shape.type = keyword == "sphere" ? SceneShape::SPHERE : SceneShape::PLANE;
+			shape.line = number;
+			ok = bool(in >> shape.material) && readVector(in, shape.position);
+			if (ok && shape.type == SceneShape::SPHERE)
+				ok = bool(in >> shape.radius) && shape.radius > 0.f;
+			else if (ok)
+				ok = readVector(in, shape.normal);
+			sceneShapes.push_back(shape);
+		}
+		else if (keyword == "mesh") {
+			SceneShape shape;
+			shape.type = SceneShape::MESH;
+			shape.line = number;
+			shape.hasBounds = false;
+			std::string path;
+			ok = bool(in >> path) && readVector(in, shape.position);
+			shape.filename = scenePath(directory, path);
+			std::string key;
+			if (ok && in >> key) {
+				shape.hasBounds = true;
+				ok = key == "bounds" && readVector(in, shape.boundsMin) && readVector(in, shape.boundsMax);
+			}
+			sceneShapes.push_back(shape);
+		}
+		else {
+			ok = false;
+		}
+
+		// Anything left on the line is an error as well.
+		std::string rest;
+		if (!ok || in >> rest) {
+			std::cout << filename << ":" << number << ": cannot parse \"" << line << "\"" << std::endl;
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < sceneShapes.size(); i++) {
+		if (sceneShapes[i].type != SceneShape::MESH && materialIndex.count(sceneShapes[i].material) == 0) {
+			std::cout << filename << ":" << sceneShapes[i].line << ": unknown material " << sceneShapes[i].material << std::endl;
+			return false;
+		}
+	}
+
+	// Shapes keep a reference to their material, so the vector can't grow after this.
+	materials = sceneMaterials;
+
+	for (size_t i = 0; i < sceneShapes.size(); i++) {
+		const SceneShape& scene = sceneShapes[i];
+		if (scene.type == SceneShape::MESH) {
+			LazyMesh* mesh = scene.hasBounds ? new LazyMesh(scene.filename, scene.position, scene.boundsMin, scene.boundsMax, sceneMeshOptions)
+				: new LazyMesh(scene.filename, scene.position, sceneMeshOptions);
+			shapes.push_back(mesh);
+			continue;
+		}
+
+		size_t index = materialIndex[scene.material];
+		Shape* shape;
+		if (scene.type == SceneShape::SPHERE)
+			shape = new Sphere(materials[index], scene.position, scene.radius);
+		else
+			shape = new Plane(materials[index], scene.position, scene.normal);
+		if (!materialTextures[index].empty())
+			shape->setTexture(sceneTexture(materialTextures[index]));
+		shapes.push_back(shape);
+	}
+	shapesChanged();
+
+	// Meshes without bounds are needed by nearly every ray, start loading them all at once.
+	for (size_t i = 0; i < shapes.size(); i++) {
+		LazyMesh* mesh = dynamic_cast<LazyMesh*>(shapes[i]);
+		if (mesh != nullptr && !mesh->_hasBounds)
+			mesh->prefetch();
+	}
+
+	MyLightPositions.clear();
+	for (size_t i = 0; i < lights.size(); i++)
+		MyLightPositions.push_back(cameraLights[i] ? settings.eye : lights[i]);
+	areaLights = sceneAreaLights;
+
+	// What the file doesn't give is the default, not what the scene before had.
+	resetRenderSettings();
+	if (settings.depth > 0)
+		maxRayDepth = settings.depth;
+	if (settings.lightSamples > 0)
+		lightSamples = settings.lightSamples;
+	if (settings.irradiance > 0.f)
+		irradianceAccuracy = settings.irradiance;
+	if (settings.irradianceRays > 0)
+		irradianceRays = settings.irradianceRays;
+	if (settings.caustics > 0)
+		causticPhotons = settings.caustics;
+	if (settings.causticGather > 0)
+		causticGather = settings.causticGather;
+	sampleSequence = settings.sampler;
+	updateShapeArrays();
+	updateLightTree();
+	return true;
+}
@@ -0,0 +1,101 @@
+#ifndef SCENE_H_zmxncbvlaksjdhfgqpwo
+#define SCENE_H_zmxncbvlaksjdhfgqpwo
+
+#include <vector>
+#include "animation.h"
+#include "sampler.h"
+#include "Vec3D.h"
+
+/**
+ * Scene files
+ *
+ * A scene file describes the shapes, materials, textures, lights, camera and render
+ * settings, one statement per line; # starts a comment. Paths are relative to the scene file.
+ *
+ *   resolution 800 600           Image size in pixels.
+ *   samples 4                    4 x 4 samples per pixel for 's'.
+ *   depth 10                     Maximum number of reflections and refractions.
+ *   sampler sobol                Sequence of the pixel and area light samples: grid (default), halton,
+ *                                sobol or bluenoise; see sampler.h.
+ *   lightsamples 8               Shadow rays to 8 lights per hit point picked from a light tree,
+ *                                instead of one to every light; for scenes with many lights.
+ *   irradiance 0.2 [rays 128]    Indirect diffuse light from an irradiance cache with this accuracy,
+ *                                gathering 128 rays for each record; see IrradianceCache.
+ *   caustics 200000 [gather 64]  Caustics of reflecting and refracting shapes from 200000 photons,
+ *                                estimated from the nearest 64 at each point; see PhotonMap.
+ *   meshstorage compact          How meshes store their geometry: full, compact or quantized.
+ *   meshleaves soa               How the BVH leaves of meshes store triangles: scalar or soa.
+ *   meshbvh wide                 Trace meshes through a binary or a 4-wide BVH.
+ *   meshbuilder sbvh             Build mesh BVHs with object splits (sah), spatial splits too (sbvh),
+ *                                or along a Morton curve for previews (lbvh).
+ *   camera eye 0 0 4 target 0 0 0 [up 0 1 0] [fov 50]
+ *   keyframe 2.5 eye 1 0 4 [target 0 0 0] [up 0 1 0] [fov 50]
+ *                                The camera at a time in seconds, for rendering an animation.
+ *                                What it doesn't give is kept from the keyframe or camera before.
+ *   frames 48                    Number of frames of the animation.
+ *   light 0 0.9 0.9              A point light, "light camera" puts it at the camera eye.
+ *   arealight rect -0.2 0.95 0.3 0.4 0 0 0 0 0.4 [samples 4]
+ *                                A rectangle light: a corner and the two edges from it, with soft
+ *                                shadows from up to 4 x 4 shadow rays per point, see AreaLight.
+ *   arealight sphere 0 0.8 0.5 0.1 [samples 4]
+ *                                A sphere light: center and radius.
+ *
+ *   material mirror              Starts a material, the lines below set its parameters
+ *   Kd 0 0 0                     like in an MTL file: Kd, Ka, Ks, Tf (colors),
+ *   Ks 1 1 1                     Ns, Ni, Tr (numbers), illum, and texture (a PPM file).
+ *
+ *   sphere mirror -0.3 0.45 0.7 0.25        Material, center and radius.
+ *   plane mirror 0 -0.5 0 0 1 0             Material, point and normal.
+ *   mesh box.obj 0 -1 1 [bounds x0 y0 z0 x1 y1 z1]
+ *
+ * Meshes use the materials of their MTL file. Meshes and textures are loaded when they are
+ * first needed: a mesh with bounds when a ray enters them, a mesh without bounds right away
+ * in the background, and a texture when a ray hits a shape that uses it.
+ */
+
+/**
+ * The camera and render settings of a scene file. Without a camera line the camera looks
+ * from 0 0 4 to the origin, other settings the file doesn't give are 0.
+ */
+struct SceneSettings {
+	SceneSettings();
+
+	bool hasCamera;
+	Vec3Df eye;
+	Vec3Df target;
+	Vec3Df up;
+	float fov;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int ns;
+	unsigned int depth;
+	unsigned int lightSamples;
+	float irradiance;
+	unsigned int irradianceRays;
+	unsigned int caustics;
+	unsigned int causticGather;
+	SampleSequence sampler;		// SAMPLES_GRID when the file doesn't give one.
+
+	// The camera path of an animation, in the order of the file.
+	std::vector<CameraKeyframe> keyframes;
+	unsigned int frames;
+};
+
+/**
+ * Load a scene file into the global shapes, materials, MyLightPositions and areaLights, which must be empty.
+ * The depth is applied to maxRayDepth, the light samples to lightSamples, the irradiance settings to
+ * irradianceAccuracy and irradianceRays, the caustic settings to causticPhotons and causticGather and
+ * the sampler to sampleSequence; those the file doesn't give are reset to their defaults, see resetRenderSettings.
+ * The mesh settings start from meshOptions and only apply to the meshes of the file;
+ * the other settings are up to the caller.
+ * 1st param:	Path of the scene file.
+ * 2nd param:	Gets the camera and render settings of the file.
+ * Return:		Whether the file was loaded, errors are printed with their line number.
+ */
+bool loadSceneFile(const char* filename, SceneSettings& settings);
+
+// Whether a file name ends in .scene.
+bool isSceneFile(const char* filename);
+
+#endif // SCENE_H
@@ -0,0 +1,603 @@
+#include "shapearrays.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+// Number of spheres tested at once, their distances fit in a small array on the stack.
+static const size_t SPHERE_BLOCK = 64;
+
+// Leaves of the BVH have at most this many spheres and meshes.
+static const unsigned int LEAF_SIZE = 4;
+
+const float ShapeArrays::REBUILD_DRIFT = 1.3f;
+
+// Generations of all arrays, so an occluder is never used with other arrays either.
+static std::atomic<unsigned int> generations(0);
+
+/**
+ * Whether a material lets light through, see the shadows of computeDirectLight.
+ */
+static bool isTransparent(const MaterialRecord& material)
+{
+	return (material.features & MATERIAL_TR) && material.Tr != 1.0;
+}
+
+ShapeArrays::ShapeArrays() : _size(0), _transparent(false), _generation(++generations), _lazyState(LAZY_UNKNOWN),
+	_builtCost(0.f), _rebuilds(0) {}
+
+/**
+ * Sort the shapes by their exact class.
+ */
+void ShapeArrays::build(const std::vector<Shape*>& shapes)
+{
+	clear();
+	_size = shapes.size();
+
+	for (size_t i = 0; i < shapes.size(); i++) {
+		Shape* shape = shapes[i];
+		if (Sphere* sphere = dynamic_cast<Sphere*>(shape)) {
+			_sphereX.push_back(sphere->_origin[0]);
+			_sphereY.push_back(sphere->_origin[1]);
+			_sphereZ.push_back(sphere->_origin[2]);
+			_sphereRadius2.push_back(sphere->_radius * sphere->_radius);
+			_spheres.push_back(sphere);
+			_sphereOrder.push_back((unsigned int)i);
+			_transparent |= isTransparent(*sphere->_record);
+		}
+		else if (Plane* plane = dynamic_cast<Plane*>(shape)) {
+			Vec3Df normal = plane->_coefficient;
+			normal.normalize();
+			_planeOrigin.push_back(plane->_origin);
+			_planeNormal.push_back(normal);
+			_planes.push_back(plane);
+			_transparent |= isTransparent(*plane->_record);
+		}
+		else if (MyMesh* mesh = dynamic_cast<MyMesh*>(shape)) {
+			// A mesh without triangles is never hit.
+			if (!mesh->_bvh.empty()) {
+				_meshes.push_back(mesh);
+				_meshOrder.push_back((unsigned int)i);
+			}
+			for (size_t j = 0; j < mesh->_triangleShapes.size(); j++)
+				_transparent |= isTransparent(*mesh->_triangleShapes[j]._record);
+		}
+		else if (LazyMesh* lazy = dynamic_cast<LazyMesh*>(shape)) {
+			// Its materials are only known once it is loaded, see shadow().
+			_lazyMeshes.push_back(lazy);
+		}
+		else {
+			_others.push_back(shape);
+			_transparent = true;
+		}
+	}
+
+	buildBVH();
+}
+
+/**
+ * Boxes of the spheres and of the meshes, padded so rounding never makes a ray miss the box of a shape it hits.
+ */
+void ShapeArrays::primitiveBounds(std::vector<Vec3Df>& boundsMin, std::vector<Vec3Df>& boundsMax) const
+{
+	size_t count = _spheres.size() + _meshes.size();
+	boundsMin.resize(count);
+	boundsMax.resize(count);
+	for (size_t i = 0; i < _spheres.size(); i++) {
+		Vec3Df center(_sphereX[i], _sphereY[i], _sphereZ[i]);
+		Vec3Df radius(_spheres[i]->_radius, _spheres[i]->_radius, _spheres[i]->_radius);
+		boundsMin[i] = center - radius;
+		boundsMax[i] = center + radius;
+	}
+	for (size_t i = 0; i < _meshes.size(); i++) {
+		const BVHNode& root = _meshes[i]->_bvh._nodes[0];
+		const Vec3Df& origin = _meshes[i]->_origin;
+		size_t j = _spheres.size() + i;
+		boundsMin[j] = Vec3Df(root.boundsMin[0], root.boundsMin[1], root.boundsMin[2]) + origin;
+		boundsMax[j] = Vec3Df(root.boundsMax[0], root.boundsMax[1], root.boundsMax[2]) + origin;
+	}
+	for (size_t i = 0; i < count; i++) {
+		float largest = 0.f;
+		for (int axis = 0; axis < 3; axis++)
+			largest = std::max(largest, std::max(fabsf(boundsMin[i][axis]), fabsf(boundsMax[i][axis])));
+		Vec3Df padding(1.f, 1.f, 1.f);
+		padding *= 1e-5f * (1.f + largest);
+		boundsMin[i] -= padding;
+		boundsMax[i] += padding;
+	}
+}
+
+/**
+ * Build the BVH, and sort the arrays so each leaf has a range of spheres and a range of meshes.
+ * The primitives of the BVH are renumbered to match, so refit() finds their new boxes.
+ */
+void ShapeArrays::buildBVH()
+{
+	std::vector<Vec3Df> boundsMin, boundsMax;
+	primitiveBounds(boundsMin, boundsMax);
+	_bvh.build(boundsMin, boundsMax, LEAF_SIZE);
+
+	const unsigned int spheres = (unsigned int)_spheres.size();
+	std::vector<float> sphereX, sphereY, sphereZ, sphereRadius2;
+	std::vector<Sphere*> sphereShapes;
+	std::vector<unsigned int> sphereOrder, meshOrder;
+	std::vector<MyMesh*> meshes;
+	std::vector<unsigned int> indices;
+
+	_leafRanges.assign(_bvh._nodes.size(), LeafRange());
+	for (size_t n = 0; n < _bvh._nodes.size(); n++) {
+		const BVHNode& node = _bvh._nodes[n];
+		if (!node.isLeaf())
+			continue;
+
+		LeafRange& range = _leafRanges[n];
+		range.firstSphere = (unsigned int)sphereShapes.size();
+		range.firstMesh = (unsigned int)meshes.size();
+		for (unsigned int i = 0; i < node.count; i++) {
+			unsigned int primitive = _bvh._indices[node.first + i];
+			if (primitive >= spheres)
+				continue;
+			sphereX.push_back(_sphereX[primitive]);
+			sphereY.push_back(_sphereY[primitive]);
+			sphereZ.push_back(_sphereZ[primitive]);
+			sphereRadius2.push_back(_sphereRadius2[primitive]);
+			sphereShapes.push_back(_spheres[primitive]);
+			sphereOrder.push_back(_sphereOrder[primitive]);
+		}
+		for (unsigned int i = 0; i < node.count; i++) {
+			unsigned int primitive = _bvh._indices[node.first + i];
+			if (primitive < spheres)
+				continue;
+			meshes.push_back(_meshes[primitive - spheres]);
+			meshOrder.push_back(_meshOrder[primitive - spheres]);
+		}
+		range.endSphere = (unsigned int)sphereShapes.size();
+		range.endMesh = (unsigned int)meshes.size();
+
+		// The leaf now refers to the new positions, spheres first.
+		unsigned int i = node.first;
+		for (unsigned int s = range.firstSphere; s < range.endSphere; s++)
+			_bvh._indices[i++] = s;
+		for (unsigned int m = range.firstMesh; m < range.endMesh; m++)
+			_bvh._indices[i++] = spheres + m;
+	}
+
+	_sphereX.swap(sphereX);
+	_sphereY.swap(sphereY);
+	_sphereZ.swap(sphereZ);
+	_sphereRadius2.swap(sphereRadius2);
+	_spheres.swap(sphereShapes);
+	_sphereOrder.swap(sphereOrder);
+	_meshes.swap(meshes);
+	_meshOrder.swap(meshOrder);
+	_builtCost = _bvh.sahCost();
+	_generation = ++generations;
+}
+
+/**
+ * Read the positions of the moved shapes, refit the BVH to them, and build it again when
+ * it has become too slow.
+ */
+void ShapeArrays::refit()
+{
+	for (size_t i = 0; i < _spheres.size(); i++) {
+		_sphereX[i] = _spheres[i]->_origin[0];
+		_sphereY[i] = _spheres[i]->_origin[1];
+		_sphereZ[i] = _spheres[i]->_origin[2];
+	}
+	for (size_t i = 0; i < _planes.size(); i++)
+		_planeOrigin[i] = _planes[i]->_origin;
+
+	// Meshes that moved far may have built their BVHs again, the leaves of older occluders are gone.
+	_generation = ++generations;
+
+	std::vector<Vec3Df> boundsMin, boundsMax;
+	primitiveBounds(boundsMin, boundsMax);
+	_bvh.refit(boundsMin, boundsMax);
+
+	if (drift() > REBUILD_DRIFT) {
+		buildBVH();
+		_rebuilds++;
+	}
+}
+
+float ShapeArrays::drift() const
+{
+	return _builtCost > 0.f ? _bvh.sahCost() / _builtCost : 1.f;
+}
+
+void ShapeArrays::clear()
+{
+	_size = 0;
+	_transparent = false;
+	_generation = ++generations;
+	_lazyState = LAZY_UNKNOWN;
+	_sphereX.clear();
+	_sphereY.clear();
+	_sphereZ.clear();
+	_sphereRadius2.clear();
+	_spheres.clear();
+	_sphereOrder.clear();
+	_planeOrigin.clear();
+	_planeNormal.clear();
+	_planes.clear();
+	_meshes.clear();
+	_meshOrder.clear();
+	_lazyMeshes.clear();
+	_others.clear();
+	_bvh.clear();
+	_leafRanges.clear();
+	_builtCost = 0.f;
+}
+
+/**
+ * The sphere intersection of Sphere::intersection, without branches so the loop is vectorized.
+ * It does the same floating point operations, so it finds exactly the same distances.
+ */
+void ShapeArrays::sphereDistances(const Vec3Df& origin, const Vec3Df& direction, size_t start, size_t count, float* t) const
+{
+	const float* x = &_sphereX[start];
+	const float* y = &_sphereY[start];
+	const float* z = &_sphereZ[start];
+	const float* radius2 = &_sphereRadius2[start];
+
+	const float ox = origin[0], oy = origin[1], oz = origin[2];
+	const float dx = direction[0], dy = direction[1], dz = direction[2];
+	const float a = dx * dx + dy * dy + dz * dz;
+
+	for (size_t i = 0; i < count; i++) {
+		float tx = ox - x[i], ty = oy - y[i], tz = oz - z[i];
+		float b = 2 * (tx * dx + ty * dy + tz * dz);
+		float c = (tx * tx + ty * ty + tz * tz) - radius2[i];
+
+		// Both sides of every choice are computed, so the choices become selects.
+		float disc = b * b - 4 * a * c;
+		float root = sqrtf(std::max(disc, 0.f));
+		float qPositive = -0.5f * (b + root);
+		float qNegative = -0.5f * (b - root);
+		float q = (b > 0.f) ? qPositive : qNegative;
+		float t0 = q / a;
+		float t1 = c / q;
+
+		// t0 becomes the far and t1 the near intersection.
+		float tFar = t0 < t1 ? t1 : t0;
+		float tNear = t0 < t1 ? t0 : t1;
+		float hit = tNear < 0 ? tFar : tNear;
+		t[i] = (disc < 0 || tFar < EPSILON) ? FLT_MAX : hit;
+	}
+}
+
+/**
+ * Closest hit. Every type finds its closest hit, and the closest of those wins. The spheres
+ * and meshes are found through the BVH, nodes beyond the closest hit so far are skipped.
+ */
+bool ShapeArrays::closestHit(const Vec3Df& origin, const Vec3Df& direction, ShapeHit& hit) const
+{
+	float closest = FLT_MAX;
+	bool found = false;
+
+	// The closest sphere by distance along the ray, and the closest mesh by distance.
+	size_t bestSphere = 0;
+	float bestT = FLT_MAX;
+	float bestMeshDepth = FLT_MAX;
+	unsigned int bestMeshOrder = 0;
+	ShapeHit meshHit;
+	meshHit.shape = nullptr;
+
+	// Mesh distances in units of the direction, for the box tests.
+	const float inverseLength = 1.f / direction.getLength();
+	const BVHRay ray(origin, direction);
+	unsigned int stack[BVH::MAX_DEPTH + 1];
+	unsigned int size = 0;
+	float tNear, tFar;
+	if (!_bvh.empty() && intersectBox(_bvh._nodes[0], ray, FLT_MAX, tNear))
+		stack[size++] = 0;
+
+	float t[SPHERE_BLOCK];
+	Vec3Df point, normal;
+	while (size > 0) {
+		const unsigned int index = stack[--size];
+		const BVHNode& node = _bvh._nodes[index];
+		if (node.isLeaf()) {
+			// Of equally close spheres or meshes the first of the shape list, as when testing them in order.
+			const LeafRange& range = _leafRanges[index];
+			for (size_t start = range.firstSphere; start < range.endSphere; start += SPHERE_BLOCK) {
+				size_t count = std::min(SPHERE_BLOCK, range.endSphere - start);
+				sphereDistances(origin, direction, start, count, t);
+				for (size_t i = 0; i < count; i++) {
+					if (t[i] < bestT || (t[i] == bestT && t[i] < FLT_MAX && _sphereOrder[start + i] < _sphereOrder[bestSphere])) {
+						bestT = t[i];
+						bestSphere = start + i;
+					}
+				}
+			}
+
+			// The intersected triangle is only valid right after the call.
+			for (unsigned int i = range.firstMesh; i < range.endMesh; i++) {
+				if (_meshes[i]->MyMesh::intersection(origin, direction, point, normal)) {
+					float depth = (point - origin).getLength();
+					if (depth < bestMeshDepth || (depth == bestMeshDepth && _meshOrder[i] < bestMeshOrder)) {
+						bestMeshDepth = depth;
+						bestMeshOrder = _meshOrder[i];
+						meshHit.point = point;
+						meshHit.normal = normal;
+						meshHit.shape = MyMesh::_lastIntersectedTriangle;
+					}
+				}
+			}
+			continue;
+		}
+
+		// A little beyond the closest hit, the boxes and the shapes round differently.
+		float tClosest = std::min(bestT, bestMeshDepth < FLT_MAX ? bestMeshDepth * inverseLength : FLT_MAX);
+		float tLimit = tClosest < FLT_MAX ? tClosest * 1.0001f + EPSILON : FLT_MAX;
+		bool hitNear = intersectBox(_bvh._nodes[node.first], ray, tLimit, tNear);
+		bool hitFar = intersectBox(_bvh._nodes[node.first + 1], ray, tLimit, tFar);
+		unsigned int nearChild = node.first, farChild = node.first + 1;
+		if (hitNear && hitFar && tFar < tNear) {
+			std::swap(nearChild, farChild);
+		}
+		else if (!hitNear) {
+			nearChild = farChild;
+			hitNear = hitFar;
+			hitFar = false;
+		}
+		if (hitFar)
+			stack[size++] = farChild;
+		if (hitNear)
+			stack[size++] = nearChild;
+	}
+
+	if (bestT < FLT_MAX) {
+		Vec3Df center(_sphereX[bestSphere], _sphereY[bestSphere], _sphereZ[bestSphere]);
+		hit.point = origin + bestT * direction;
+		hit.normal = (origin - center) + bestT * direction;
+		hit.normal.normalize();
+		hit.shape = _spheres[bestSphere];
+		closest = (hit.point - origin).getLength();
+		found = true;
+	}
+
+	// Planes.
+	for (size_t i = 0; i < _planes.size(); i++) {
+		const Vec3Df& normal = _planeNormal[i];
+		float denom = Vec3Df::dotProduct(direction, normal);
+		if (denom > -EPSILON && denom < EPSILON)
+			continue;
+
+		float tPlane = Vec3Df::dotProduct(_planeOrigin[i] - origin, normal) / denom;
+		if (tPlane < EPSILON)
+			continue;
+
+		Vec3Df point = origin + tPlane * direction;
+		float depth = (point - origin).getLength();
+		if (depth < closest) {
+			closest = depth;
+			hit.point = point;
+			hit.normal = normal;
+			hit.shape = _planes[i];
+			found = true;
+		}
+	}
+
+	// Meshes.
+	if (bestMeshDepth < closest) {
+		closest = bestMeshDepth;
+		hit = meshHit;
+		found = true;
+	}
+	for (size_t i = 0; i < _lazyMeshes.size(); i++) {
+		if (_lazyMeshes[i]->LazyMesh::intersection(origin, direction, point, normal)) {
+			float depth = (point - origin).getLength();
+			if (depth < closest) {
+				closest = depth;
+				hit.point = point;
+				hit.normal = normal;
+				hit.shape = MyMesh::_lastIntersectedTriangle;
+				found = true;
+			}
+		}
+	}
+
+	// Other shapes.
+	for (size_t i = 0; i < _others.size(); i++) {
+		if (_others[i]->intersection(origin, direction, point, normal)) {
+			float depth = (point - origin).getLength();
+			if (depth < closest) {
+				closest = depth;
+				hit.point = point;
+				hit.normal = normal;
+				hit.shape = _others[i]->getIntersectedShape();
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+bool ShapeArrays::bounds(Vec3Df& min, Vec3Df& max) const
+{
+	if (_bvh.empty())
+		return false;
+	const BVHNode& root = _bvh._nodes[0];
+	min = Vec3Df(root.boundsMin[0], root.boundsMin[1], root.boundsMin[2]);
+	max = Vec3Df(root.boundsMax[0], root.boundsMax[1], root.boundsMax[2]);
+	return true;
+}
+
+bool ShapeArrays::lazyMeshesOpaque() const
+{
+	int state = _lazyState.load(std::memory_order_relaxed);
+	if (state != LAZY_UNKNOWN)
+		return state == LAZY_OPAQUE;
+
+	for (size_t i = 0; i < _lazyMeshes.size(); i++)
+		if (!_lazyMeshes[i]->isLoaded())
+			return false;
+
+	// Threads that get here at once all find the same.
+	state = LAZY_OPAQUE;
+	for (size_t i = 0; i < _lazyMeshes.size() && state == LAZY_OPAQUE; i++) {
+		const MyMesh* mesh = _lazyMeshes[i]->mesh();
+		for (size_t j = 0; j < mesh->_triangleShapes.size(); j++) {
+			if (isTransparent(*mesh->_triangleShapes[j]._record)) {
+				state = LAZY_TRANSPARENT;
+				break;
+			}
+		}
+	}
+	_lazyState.store(state, std::memory_order_relaxed);
+	return state == LAZY_OPAQUE;
+}
+
+bool ShapeArrays::blocks(const ShadowOccluder& occluder, const Vec3Df& origin, const Vec3Df& direction, float distance) const
+{
+	switch (occluder.type) {
+		case ShadowOccluder::SPHERE: {
+			float t;
+			sphereDistances(origin, direction, occluder.index, 1, &t);
+			return t < FLT_MAX && ((origin + t * direction) - origin).getLength() < distance;
+		}
+		case ShadowOccluder::PLANE: {
+			const Vec3Df& normal = _planeNormal[occluder.index];
+			float denom = Vec3Df::dotProduct(direction, normal);
+			if (denom > -EPSILON && denom < EPSILON)
+				return false;
+			float tPlane = Vec3Df::dotProduct(_planeOrigin[occluder.index] - origin, normal) / denom;
+			return tPlane >= EPSILON && ((origin + tPlane * direction) - origin).getLength() < distance;
+		}
+		case ShadowOccluder::MESH:
+			return _meshes[occluder.index]->occludedBy(occluder.leaf, origin, direction, distance);
+		case ShadowOccluder::LAZY_MESH:
+			// Only found once the lazy meshes are loaded and opaque, see shadow().
+			return _lazyMeshes[occluder.index]->mesh()->occludedBy(occluder.leaf, origin, direction, distance);
+		default:
+			return false;
+	}
+}
+
+/**
+ * Shadow rays stop at the first opaque shape before the light. That shape is remembered in the
+ * occluder, and tested before anything else by the next shadow ray to the same light.
+ */
+ShapeArrays::Shadow ShapeArrays::shadow(const Vec3Df& origin, const Vec3Df& direction, float distance,
+	ShadowOccluder* occluder, ShadowCacheStats* stats) const
+{
+	if (_transparent)
+		return SHADOW_TRANSPARENT;
+
+	// Lazy meshes can only be skipped for the occluder when none of them lets light through.
+	const bool lazyOpaque = _lazyMeshes.empty() || lazyMeshesOpaque();
+	if (occluder != nullptr && occluder->type != ShadowOccluder::NONE && occluder->generation == _generation && lazyOpaque) {
+		if (stats != nullptr)
+			stats->lookups++;
+		if (blocks(*occluder, origin, direction, distance)) {
+			if (stats != nullptr)
+				stats->hits++;
+			return SHADOW_BLOCKED;
+		}
+	}
+
+	ShadowOccluder found;
+	found.generation = _generation;
+	unsigned int nodes = 0;
+	Shadow result = traceShadow(origin, direction, distance, lazyOpaque, found, nodes);
+	if (stats != nullptr) {
+		stats->traversals++;
+		stats->nodes += nodes;
+	}
+	if (occluder != nullptr && result == SHADOW_BLOCKED && found.type != ShadowOccluder::NONE)
+		*occluder = found;
+	return result;
+}
+
+/**
+ * The shadow ray without an occluder, which gets the shape that blocks it, if that can be tested on its own.
+ * Lazy meshes are tested first, since only their hits tell whether they are transparent; after them
+ * every shape is opaque, so the first hit blocks the light.
+ */
+ShapeArrays::Shadow ShapeArrays::traceShadow(const Vec3Df& origin, const Vec3Df& direction, float distance, bool lazyOpaque,
+	ShadowOccluder& occluder, unsigned int& nodes) const
+{
+	Vec3Df point, normal;
+	if (lazyOpaque) {
+		for (size_t i = 0; i < _lazyMeshes.size(); i++) {
+			MyMesh* mesh = _lazyMeshes[i]->mesh();
+			if (mesh != nullptr && mesh->occluded(origin, direction, distance, occluder.leaf, nodes)) {
+				occluder.type = ShadowOccluder::LAZY_MESH;
+				occluder.index = (unsigned int)i;
+				return SHADOW_BLOCKED;
+			}
+		}
+	}
+	else {
+		bool blocked = false;
+		for (size_t i = 0; i < _lazyMeshes.size(); i++) {
+			if (_lazyMeshes[i]->LazyMesh::intersection(origin, direction, point, normal) && (point - origin).getLength() < distance) {
+				if (isTransparent(*MyMesh::_lastIntersectedTriangle->_record))
+					return SHADOW_TRANSPARENT;
+				blocked = true;
+			}
+		}
+		if (blocked)
+			return SHADOW_BLOCKED;
+	}
+
+	// Any sphere or mesh before the light blocks it, the order of the nodes does not matter.
+	const BVHRay ray(origin, direction);
+	const float tMax = distance / direction.getLength() * 1.0001f + EPSILON;
+	unsigned int stack[BVH::MAX_DEPTH + 1];
+	unsigned int size = 0;
+	float tNear;
+	if (!_bvh.empty() && intersectBox(_bvh._nodes[0], ray, tMax, tNear))
+		stack[size++] = 0;
+
+	float t[SPHERE_BLOCK];
+	while (size > 0) {
+		const unsigned int index = stack[--size];
+		const BVHNode& node = _bvh._nodes[index];
+		nodes++;
+		if (!node.isLeaf()) {
+			for (unsigned int child = node.first; child < node.first + 2; child++)
+				if (intersectBox(_bvh._nodes[child], ray, tMax, tNear))
+					stack[size++] = child;
+			continue;
+		}
+
+		const LeafRange& range = _leafRanges[index];
+		for (size_t start = range.firstSphere; start < range.endSphere; start += SPHERE_BLOCK) {
+			size_t count = std::min(SPHERE_BLOCK, range.endSphere - start);
+			sphereDistances(origin, direction, start, count, t);
+			for (size_t i = 0; i < count; i++) {
+				if (t[i] < FLT_MAX && ((origin + t[i] * direction) - origin).getLength() < distance) {
+					occluder.type = ShadowOccluder::SPHERE;
+					occluder.index = (unsigned int)(start + i);
+					return SHADOW_BLOCKED;
+				}
+			}
+		}
+		for (unsigned int i = range.firstMesh; i < range.endMesh; i++) {
+			if (_meshes[i]->occluded(origin, direction, distance, occluder.leaf, nodes)) {
+				occluder.type = ShadowOccluder::MESH;
+				occluder.index = i;
+				return SHADOW_BLOCKED;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < _planes.size(); i++) {
+		const Vec3Df& normal = _planeNormal[i];
+		float denom = Vec3Df::dotProduct(direction, normal);
+		if (denom > -EPSILON && denom < EPSILON)
+			continue;
+
+		float tPlane = Vec3Df::dotProduct(_planeOrigin[i] - origin, normal) / denom;
+		if (tPlane >= EPSILON && ((origin + tPlane * direction) - origin).getLength() < distance) {
+			occluder.type = ShadowOccluder::PLANE;
+			occluder.index = (unsigned int)i;
+			return SHADOW_BLOCKED;
+		}
+	}
+
+	return SHADOW_CLEAR;
+}
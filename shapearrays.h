@@ -0,0 +1,193 @@
+#ifndef SHAPEARRAYS_H_peowiruqlaksjdmznxbv
+#define SHAPEARRAYS_H_peowiruqlaksjdmznxbv
+
+#include <atomic>
+#include <vector>
+#include "bvh.h"
+#include "Vec3D.h"
+#include "Shapes/shape.h"
+
+/**
+ * The closest hit of a ray, found by ShapeArrays.
+ */
+struct ShapeHit {
+	Vec3Df point;		// Intersection point.
+	Vec3Df normal;		// Normal at the intersection point.
+	Shape* shape;		// The intersected shape, the triangle for meshes.
+};
+
+/**
+ * The shape that blocked the last shadow ray to a light, which the next shadow ray to that light
+ * tests first: neighbouring pixels are mostly shadowed by the same shape. Callers keep one per
+ * thread and light, it is only used with the arrays it was found in.
+ */
+struct ShadowOccluder {
+	ShadowOccluder() : type(NONE), index(0), leaf(0), generation(0) {}
+
+	enum Type { NONE, SPHERE, PLANE, MESH, LAZY_MESH } type;
+	unsigned int index;			// Index in the array of its type.
+	unsigned int leaf;			// The BVH leaf of a mesh, neighbouring triangles are likely to block too.
+	unsigned int generation;	// Of the arrays, which change it whenever they are sorted or refit.
+};
+
+/**
+ * Counts of the shadow rays that used a ShadowOccluder.
+ */
+struct ShadowCacheStats {
+	ShadowCacheStats() : lookups(0), hits(0), traversals(0), nodes(0) {}
+
+	unsigned long long lookups;		// Shadow rays with a known occluder.
+	unsigned long long hits;		// Of those, blocked by it.
+	unsigned long long traversals;	// Shadow rays that traversed the BVHs.
+	unsigned long long nodes;		// BVH nodes they visited, of the arrays and of the meshes.
+};
+
+/**
+ * ShapeArrays class
+ *
+ * A copy of the scene for ray queries, with the shapes sorted by type into contiguous arrays:
+ * the spheres and planes as structures of arrays of their parameters, and the meshes as arrays
+ * of pointers to their exact class. Every type has its own loop without virtual calls, and the
+ * sphere loop tests blocks of spheres in a form the compiler can vectorize.
+ *
+ * The spheres and meshes are found through a BVH over their bounds, the arrays are stored in the
+ * order of its leaves so a leaf is a range of spheres and a range of meshes. Of equally close
+ * spheres or meshes the first of the shape list wins, as when testing them in order.
+ *
+ * The arrays point to the shapes, so they must be built again when shapes are added or removed.
+ * When shapes only move, refit() updates the arrays and the boxes of the BVH, and builds the BVH
+ * again once its SAH cost has grown by REBUILD_DRIFT since it was built.
+ * Shapes of other classes are kept in a list that is tested through their virtual methods.
+ */
+class ShapeArrays {
+	public:
+		// The result of a shadow query.
+		enum Shadow {
+			SHADOW_CLEAR,		// Nothing between the point and the light.
+			SHADOW_BLOCKED,		// An opaque shape blocks the light.
+			SHADOW_TRANSPARENT	// A transparent shape was hit, trace the shadow ray through the shape list.
+		};
+
+		// Constructor
+		ShapeArrays();
+
+		/**
+		 * Sort a list of shapes into the arrays.
+		 * 1st param:	The shapes, usually the global shapes.
+		 */
+		void build(const std::vector<Shape*>& shapes);
+
+		// Remove all shapes.
+		void clear();
+
+		// Read the positions of the shapes again after they moved, see the class comment.
+		void refit();
+
+		// SAH cost of the BVH relative to the cost when it was built, 1 right after a build.
+		float drift() const;
+
+		// Number of times refit() built the BVH again.
+		unsigned int rebuilds() const { return _rebuilds; }
+
+		// Relative growth of the SAH cost at which refit() builds the BVH again.
+		static const float REBUILD_DRIFT;
+
+		// Number of shapes the arrays were built from.
+		size_t size() const { return _size; }
+
+		// The box around the spheres and meshes, false when there are none.
+		bool bounds(Vec3Df& min, Vec3Df& max) const;
+
+		/**
+		 * Find the closest intersection of a ray, like testing every shape of the list.
+		 * 1st param:	Origin of the ray.
+		 * 2nd param:	Direction of the ray.
+		 * 3rd param:	Gets the closest hit.
+		 * Return:		Whether the ray hit a shape.
+		 */
+		bool closestHit(const Vec3Df& origin, const Vec3Df& direction, ShapeHit& hit) const;
+
+		/**
+		 * Check whether a shadow ray reaches its light.
+		 * 1st param:	The point to light.
+		 * 2nd param:	The vector from the point to the light.
+		 * 3rd param:	Distance to the light.
+		 * 4th param:	The last occluder of this light, tested first and replaced by the new one. Can be null.
+		 * 5th param:	Counts the use of the occluder and the traversals. Can be null.
+		 * Return:		Whether the light is blocked. Transparent shapes filter the light in the order
+		 *				of the shape list, so when one is hit the caller must trace the list instead.
+		 */
+		Shadow shadow(const Vec3Df& origin, const Vec3Df& direction, float distance,
+			ShadowOccluder* occluder = nullptr, ShadowCacheStats* stats = nullptr) const;
+
+	private:
+		// Distances to a block of spheres along a ray, FLT_MAX for the ones it misses.
+		void sphereDistances(const Vec3Df& origin, const Vec3Df& direction, size_t start, size_t count, float* t) const;
+
+		// Bounds of the spheres and then the meshes, as primitives of _bvh.
+		void primitiveBounds(std::vector<Vec3Df>& boundsMin, std::vector<Vec3Df>& boundsMax) const;
+
+		// Build _bvh, and sort the sphere and mesh arrays into the order of its leaves.
+		void buildBVH();
+
+		// shadow() without the known occluder, fills in the one it finds and counts the BVH nodes it visits.
+		Shadow traceShadow(const Vec3Df& origin, const Vec3Df& direction, float distance, bool lazyOpaque,
+			ShadowOccluder& occluder, unsigned int& nodes) const;
+
+		// Whether an occluder still blocks a shadow ray.
+		bool blocks(const ShadowOccluder& occluder, const Vec3Df& origin, const Vec3Df& direction, float distance) const;
+
+		// Whether the lazy meshes are all loaded and none lets light through, found once they are.
+		bool lazyMeshesOpaque() const;
+
+		// A range of spheres and a range of meshes.
+		struct LeafRange {
+			unsigned int firstSphere, endSphere;
+			unsigned int firstMesh, endMesh;
+		};
+
+		size_t _size;
+
+		// Whether a sphere, plane, mesh or other shape can let light through.
+		bool _transparent;
+
+		// Changes whenever the arrays are sorted or refit, so occluders of older arrays aren't used.
+		unsigned int _generation;
+
+		// LAZY_UNKNOWN until the lazy meshes are loaded, then whether they can let light through.
+		enum LazyState { LAZY_UNKNOWN, LAZY_OPAQUE, LAZY_TRANSPARENT };
+		mutable std::atomic<int> _lazyState;
+
+		// Spheres: center and squared radius.
+		std::vector<float> _sphereX;
+		std::vector<float> _sphereY;
+		std::vector<float> _sphereZ;
+		std::vector<float> _sphereRadius2;
+		std::vector<Sphere*> _spheres;
+		std::vector<unsigned int> _sphereOrder;	// Position in the shape list.
+
+		// Planes: a point and the normalized normal.
+		std::vector<Vec3Df> _planeOrigin;
+		std::vector<Vec3Df> _planeNormal;
+		std::vector<Plane*> _planes;
+
+		// Meshes, by their exact class.
+		std::vector<MyMesh*> _meshes;
+		std::vector<unsigned int> _meshOrder;	// Position in the shape list.
+		std::vector<LazyMesh*> _lazyMeshes;
+
+		// BVH over the spheres and meshes, the spheres are its primitives 0 to n - 1 and the meshes follow.
+		// Leaf nodes refer to their spheres and meshes by _leafRanges.
+		// It stays binary, unlike the BVHs of meshes: it only has a node per few shapes, its leaves
+		// already test blocks of spheres at once, and refit() would have to collapse a wide tree
+		// again after every move, where the binary boxes are updated in place.
+		BVH _bvh;
+		std::vector<LeafRange> _leafRanges;
+		float _builtCost;
+		unsigned int _rebuilds;
+
+		// Shapes of other classes.
+		std::vector<Shape*> _others;
+};
+
+#endif // SHAPEARRAYS_H
@@ -2,6 +2,16 @@
 
 Texture::Texture(Image img) : _image_data(img) {}
 
+Texture::Texture(const std::string& filename) : _image_data(0, 0), _filename(filename) {}
+
+/**
+ * Load the file on first use.
+ */
+void Texture::load() {
+	if (!_filename.empty())
+		_image_data = Image(_filename.c_str());
+}
+
 void Texture::convertBarycentricToTexCoord(float a, float b, Vec3Df* texcoords, float& tex_u, float& tex_v) {
 	// Calculate third barycentric coordinate
 	float c = 1 - a - b;
@@ -11,7 +21,12 @@ void Texture::convertBarycentricToTexCoord(float a, float b, Vec3Df* texcoords,
 }
 
 Vec3Df Texture::getColor(float tex_u, float tex_v) {
+	std::call_once(_loaded, &Texture::load, this);
+
 	Vec3Df rgb(0.f, 0.f, 0.f);
+	if (_image_data._image.empty())
+		return rgb;
+
 	int u = int(_image_data._width * tex_u) - 1;
 	int v = int(_image_data._height * tex_v) - 1;
 
@@ -1,23 +1,35 @@
 #ifndef TEXTURE_JFDJKDFSLJFDFKSDFDJFDFJSDKSFJSDLF
 #define TEXTURE_JFDJKDFSLJFDFKSDFDJFDFJSDKSFJSDLF
 
+#include <mutex>
+#include <string>
 #include "image.h"
 #include "Vec3D.h"
 
 /**
  * Texture class.
+ *
+ * A texture made from a file name is loaded on its first getColor, so textures
+ * of shapes no ray hits are never loaded. Render threads that need it at the
+ * same time wait for the one load.
  */
 class Texture {
 	public:
-		// Constructor
+		// Constructors
 		Texture(Image img);
+		explicit Texture(const std::string& filename);
 
 		// Methods
 		void convertBarycentricToTexCoord(float a, float b, Vec3Df* texcoords, float& tex_u, float& tex_v);
 		Vec3Df getColor(float u, float v);
 
 	private:
+		// Load the file, if this texture was made from one.
+		void load();
+
 		Image _image_data;
+		std::string _filename;
+		std::once_flag _loaded;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "triangleblock.h"
+#include "Shapes/shape.h"
+#include <float.h>
+#include <math.h>
+
+// With RAYTRACER_AVX the AVX kernel is compiled for this function only, and used when the CPU has AVX.
+#if defined(RAYTRACER_AVX) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define TRIANGLE_BLOCK_AVX
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX_FUNCTION
+#else
+#define AVX_FUNCTION __attribute__((target("avx")))
+#endif
+#endif
+
+TriangleBlock::TriangleBlock()
+{
+	for (int axis = 0; axis < 3; axis++) {
+		for (unsigned int lane = 0; lane < TRIANGLE_BLOCK_SIZE; lane++) {
+			v0[axis][lane] = 0.f;
+			e1[axis][lane] = 0.f;
+			e2[axis][lane] = 0.f;
+		}
+	}
+	for (unsigned int lane = 0; lane < TRIANGLE_BLOCK_SIZE; lane++)
+		triangle[lane] = 0;
+}
+
+void TriangleBlock::set(unsigned int lane, const Vec3Df& p0, const Vec3Df& p1, const Vec3Df& p2, unsigned int index)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		v0[axis][lane] = p0[axis];
+		e1[axis][lane] = p1[axis] - p0[axis];
+		e2[axis][lane] = p2[axis] - p0[axis];
+	}
+	triangle[lane] = index;
+}
+
+#ifdef TRIANGLE_BLOCK_AVX
+
+/**
+ * Whether the CPU and the operating system support AVX.
+ */
+static bool cpuHasAvx()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	// AVX, and XSAVE enabled by the operating system, which must save the upper halves of the registers.
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+		return false;
+	return (_xgetbv(0) & 6) == 6;
+#else
+	return __builtin_cpu_supports("avx") != 0;
+#endif
+}
+
+static const bool hasAvx = cpuHasAvx();
+
+/**
+ * All 8 lanes at once.
+ */
+AVX_FUNCTION static int intersectTriangleBlockAvx(const TriangleBlock& block, const Vec3Df& origin, const Vec3Df& direction, float& t, float& a, float& b)
+{
+	const __m256 dx = _mm256_set1_ps(direction[0]), dy = _mm256_set1_ps(direction[1]), dz = _mm256_set1_ps(direction[2]);
+	const __m256 e1x = _mm256_loadu_ps(block.e1[0]), e1y = _mm256_loadu_ps(block.e1[1]), e1z = _mm256_loadu_ps(block.e1[2]);
+	const __m256 e2x = _mm256_loadu_ps(block.e2[0]), e2y = _mm256_loadu_ps(block.e2[1]), e2z = _mm256_loadu_ps(block.e2[2]);
+
+	// p = d x e2, det = e1 . p
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+	__m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+
+	// s = o - v0, u = (s . p) / det
+	__m256 sx = _mm256_sub_ps(_mm256_set1_ps(origin[0]), _mm256_loadu_ps(block.v0[0]));
+	__m256 sy = _mm256_sub_ps(_mm256_set1_ps(origin[1]), _mm256_loadu_ps(block.v0[1]));
+	__m256 sz = _mm256_sub_ps(_mm256_set1_ps(origin[2]), _mm256_loadu_ps(block.v0[2]));
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverse);
+
+	// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverse);
+	__m256 distance = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverse);
+
+	const __m256 epsilon = _mm256_set1_ps(EPSILON);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 hit = _mm256_cmp_ps(_mm256_and_ps(det, absMask), epsilon, _CMP_GE_OQ);
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, _mm256_sub_ps(_mm256_setzero_ps(), epsilon), _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, _mm256_sub_ps(_mm256_setzero_ps(), epsilon), _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.f), _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(distance, epsilon, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(distance, _mm256_set1_ps(t), _CMP_LE_OQ));
+	if (_mm256_testz_ps(hit, hit))
+		return -1;
+
+	// The closest hit: the minimum over the lanes, then the first lane that has it.
+	__m256 candidates = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), distance, hit);
+	__m256 minimum = _mm256_min_ps(candidates, _mm256_permute_ps(candidates, _MM_SHUFFLE(2, 3, 0, 1)));
+	minimum = _mm256_min_ps(minimum, _mm256_permute_ps(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+	minimum = _mm256_min_ps(minimum, _mm256_permute2f128_ps(minimum, minimum, 1));
+	int lanes = _mm256_movemask_ps(_mm256_and_ps(hit, _mm256_cmp_ps(candidates, minimum, _CMP_EQ_OQ)));
+	int lane = 0;
+	while (!(lanes & (1 << lane)))
+		lane++;
+
+	alignas(32) float values[TRIANGLE_BLOCK_SIZE];
+	_mm256_store_ps(values, distance);
+	t = values[lane];
+	_mm256_store_ps(values, u);
+	a = values[lane];
+	_mm256_store_ps(values, v);
+	b = values[lane];
+	return lane;
+}
+
+#endif
+
+/**
+ * The same test without AVX, one lane after the other.
+ */
+static int intersectTriangleBlockScalar(const TriangleBlock& block, const Vec3Df& origin, const Vec3Df& direction, float& t, float& a, float& b)
+{
+	int closest = -1;
+	for (unsigned int lane = 0; lane < TRIANGLE_BLOCK_SIZE; lane++) {
+		float e1x = block.e1[0][lane], e1y = block.e1[1][lane], e1z = block.e1[2][lane];
+		float e2x = block.e2[0][lane], e2y = block.e2[1][lane], e2z = block.e2[2][lane];
+
+		float px = direction[1] * e2z - direction[2] * e2y;
+		float py = direction[2] * e2x - direction[0] * e2z;
+		float pz = direction[0] * e2y - direction[1] * e2x;
+		float det = e1x * px + e1y * py + e1z * pz;
+		if (fabsf(det) < EPSILON)
+			continue;
+		float inverse = 1.f / det;
+
+		float sx = origin[0] - block.v0[0][lane], sy = origin[1] - block.v0[1][lane], sz = origin[2] - block.v0[2][lane];
+		float u = (sx * px + sy * py + sz * pz) * inverse;
+
+		float qx = sy * e1z - sz * e1y;
+		float qy = sz * e1x - sx * e1z;
+		float qz = sx * e1y - sy * e1x;
+		float v = (direction[0] * qx + direction[1] * qy + direction[2] * qz) * inverse;
+		float distance = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+
+		if (u >= -EPSILON && v >= -EPSILON && u + v <= 1.f && distance >= EPSILON && distance <= t && (closest < 0 || distance < t)) {
+			t = distance;
+			a = u;
+			b = v;
+			closest = int(lane);
+		}
+	}
+	return closest;
+}
+
+int intersectTriangleBlock(const TriangleBlock& block, const Vec3Df& origin, const Vec3Df& direction, float& t, float& a, float& b)
+{
+#ifdef TRIANGLE_BLOCK_AVX
+	if (hasAvx)
+		return intersectTriangleBlockAvx(block, origin, direction, t, a, b);
+#endif
+	return intersectTriangleBlockScalar(block, origin, direction, t, a, b);
+}
@@ -0,0 +1,57 @@
+#ifndef TRIANGLEBLOCK_H_xncmvbalskdjfhgqpwoe
+#define TRIANGLEBLOCK_H_xncmvbalskdjfhgqpwoe
+
+#include <vector>
+#include "Vec3D.h"
+
+/**
+ * How the leaves of a mesh BVH store their triangles.
+ */
+enum MeshLeaves {
+	MESH_LEAVES_SCALAR,	// Triangle indices, tested one by one as the mesh stores them.
+	MESH_LEAVES_SOA		// Blocks of TRIANGLE_BLOCK_SIZE triangles, tested at once by a SIMD kernel.
+};
+
+// Number of triangles in a block, the width of an AVX register.
+static const unsigned int TRIANGLE_BLOCK_SIZE = 8;
+
+/**
+ * TriangleBlock struct
+ *
+ * Triangles as a structure of arrays: a vertex and the two edges from it, one lane per triangle,
+ * so every coordinate of all triangles loads as one register. Unused lanes have zero edges,
+ * which no ray hits. The block isn't declared 32-byte aligned, std::vector only aligns it
+ * from C++17 on, so the kernel uses unaligned loads.
+ */
+struct TriangleBlock {
+	// Constructor, all lanes unused.
+	TriangleBlock();
+
+	/**
+	 * Put a triangle in a lane.
+	 * 1st param:	The lane.
+	 * 2nd-4th:		Vertex positions.
+	 * 5th param:	Index of the triangle in its mesh.
+	 */
+	void set(unsigned int lane, const Vec3Df& v0, const Vec3Df& v1, const Vec3Df& v2, unsigned int triangle);
+
+	float v0[3][TRIANGLE_BLOCK_SIZE];
+	float e1[3][TRIANGLE_BLOCK_SIZE];
+	float e2[3][TRIANGLE_BLOCK_SIZE];
+	unsigned int triangle[TRIANGLE_BLOCK_SIZE];
+};
+
+/**
+ * Moller-Trumbore intersection of a ray with all triangles of a block, with the bounds of
+ * MyMesh::intersection: barycentric coordinates down to -EPSILON and distances from EPSILON.
+ * 1st param:	The block.
+ * 2nd param:	Origin of the ray, in the space of the block.
+ * 3rd param:	Direction of the ray.
+ * 4th param:	Only hits up to this distance count, gets the distance of the closest hit.
+ * 5th param:	Gets the barycentric coordinate of the second vertex.
+ * 6th param:	Gets the barycentric coordinate of the third vertex.
+ * Return:		The lane of the closest hit, or -1.
+ */
+int intersectTriangleBlock(const TriangleBlock& block, const Vec3Df& origin, const Vec3Df& direction, float& t, float& a, float& b);
+
+#endif // TRIANGLEBLOCK_H
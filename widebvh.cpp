@@ -0,0 +1,91 @@
+#include "widebvh.h"
+
+/**
+ * Surface area of the box of a binary node.
+ */
+static float nodeArea(const BVHNode& node)
+{
+	float x = node.boundsMax[0] - node.boundsMin[0];
+	float y = node.boundsMax[1] - node.boundsMin[1];
+	float z = node.boundsMax[2] - node.boundsMin[2];
+	return 2.f * (x * y + y * z + z * x);
+}
+
+WideBVH::WideBVH() {}
+
+void WideBVH::build(const BVH& bvh)
+{
+	clear();
+	if (bvh.empty())
+		return;
+
+	_nodes.push_back(WideBVHNode());
+	buildNode(bvh, 0, 0);
+}
+
+void WideBVH::buildNode(const BVH& bvh, unsigned int binaryNode, unsigned int node)
+{
+	// Open the inner child with the largest area until the node is full.
+	unsigned int children[WIDE_BVH_WIDTH];
+	unsigned int count = 0;
+	if (bvh._nodes[binaryNode].isLeaf()) {
+		children[count++] = binaryNode;
+	}
+	else {
+		children[count++] = bvh._nodes[binaryNode].first;
+		children[count++] = bvh._nodes[binaryNode].first + 1;
+	}
+	while (count < WIDE_BVH_WIDTH) {
+		int largest = -1;
+		float largestArea = -1.f;
+		for (unsigned int i = 0; i < count; i++) {
+			const BVHNode& child = bvh._nodes[children[i]];
+			if (!child.isLeaf() && nodeArea(child) > largestArea) {
+				largestArea = nodeArea(child);
+				largest = int(i);
+			}
+		}
+		if (largest < 0)
+			break;
+
+		unsigned int opened = children[largest];
+		children[largest] = bvh._nodes[opened].first;
+		children[count++] = bvh._nodes[opened].first + 1;
+	}
+
+	WideBVHNode wide;
+	wide.childCount = count;
+	for (unsigned int i = 0; i < WIDE_BVH_WIDTH; i++) {
+		// Unused slots get an empty box, intersectChildren masks them anyway.
+		const BVHNode* child = i < count ? &bvh._nodes[children[i]] : nullptr;
+		for (int axis = 0; axis < 3; axis++) {
+			wide.boundsMin[axis][i] = child ? child->boundsMin[axis] : 0.f;
+			wide.boundsMax[axis][i] = child ? child->boundsMax[axis] : 0.f;
+		}
+		wide.child[i] = 0;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (bvh._nodes[children[i]].isLeaf()) {
+			wide.child[i] = children[i] | WIDE_BVH_LEAF;
+			continue;
+		}
+		wide.child[i] = (unsigned int)_nodes.size();
+		_nodes.push_back(WideBVHNode());
+	}
+	_nodes[node] = wide;
+
+	for (unsigned int i = 0; i < count; i++)
+		if (!(wide.child[i] & WIDE_BVH_LEAF))
+			buildNode(bvh, children[i], wide.child[i]);
+}
+
+void WideBVH::clear()
+{
+	std::vector<WideBVHNode>().swap(_nodes);
+}
+
+size_t WideBVH::memoryUsage() const
+{
+	return _nodes.capacity() * sizeof(WideBVHNode);
+}
@@ -0,0 +1,107 @@
+#ifndef WIDEBVH_H_pqlaowkdjeiruthgbnvm
+#define WIDEBVH_H_pqlaowkdjeiruthgbnvm
+
+#include <vector>
+#include "bvh.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WIDEBVH_SSE
+#include <xmmintrin.h>
+#endif
+
+// Number of children of a wide node, the width of an SSE register.
+static const unsigned int WIDE_BVH_WIDTH = 4;
+
+/**
+ * A node of a WideBVH: the boxes of up to four children as a structure of arrays,
+ * so one SIMD slab test checks all of them.
+ */
+struct WideBVHNode {
+	float boundsMin[3][WIDE_BVH_WIDTH];
+	float boundsMax[3][WIDE_BVH_WIDTH];
+
+	// Inner child: index of a wide node. Leaf: index of the leaf in the binary BVH, with WIDE_BVH_LEAF set.
+	unsigned int child[WIDE_BVH_WIDTH];
+	unsigned int childCount;
+};
+
+// Marks a child of a wide node that is a leaf.
+static const unsigned int WIDE_BVH_LEAF = 0x80000000u;
+
+/**
+ * WideBVH class
+ *
+ * A 4-ary BVH collapsed from a binary BVH: every wide node takes the place of a binary node
+ * and up to two levels below it, always opening the child with the largest surface area.
+ * The leaves stay those of the binary tree, so the leaf data built for it is used as is.
+ */
+class WideBVH {
+	public:
+		// Constructor
+		WideBVH();
+
+		/**
+		 * Collapse a binary BVH.
+		 * 1st param:	The binary BVH, it must be kept for its leaves.
+		 */
+		void build(const BVH& bvh);
+
+		// Remove the tree.
+		void clear();
+
+		// Whether the tree has no nodes.
+		bool empty() const { return _nodes.empty(); }
+
+		// Number of bytes used by the nodes.
+		size_t memoryUsage() const;
+
+		// Variables
+		std::vector<WideBVHNode> _nodes;
+
+	private:
+		// Collapse the subtree of a binary inner node into the wide node.
+		void buildNode(const BVH& bvh, unsigned int binaryNode, unsigned int node);
+};
+
+/**
+ * Slab test of a ray against all children of a wide node.
+ * 1st param:	The node.
+ * 2nd param:	The ray.
+ * 3rd param:	Only hits before this distance count.
+ * 4th param:	Gets the distance where the ray enters each child, 0 when it starts inside.
+ * Return:		Bit i is set when the ray hits child i.
+ */
+inline unsigned int intersectChildren(const WideBVHNode& node, const BVHRay& ray, float tMax, float tNear[WIDE_BVH_WIDTH])
+{
+#ifdef WIDEBVH_SSE
+	__m128 t0 = _mm_setzero_ps(), t1 = _mm_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis++) {
+		__m128 origin = _mm_set1_ps(ray.origin[axis]);
+		__m128 inverse = _mm_set1_ps(ray.inverse[axis]);
+		__m128 tA = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMin[axis]), origin), inverse);
+		__m128 tB = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMax[axis]), origin), inverse);
+		t0 = _mm_max_ps(t0, _mm_min_ps(tA, tB));
+		t1 = _mm_min_ps(t1, _mm_max_ps(tA, tB));
+	}
+	_mm_storeu_ps(tNear, t0);
+	unsigned int hits = (unsigned int)_mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+	unsigned int hits = 0;
+	for (unsigned int i = 0; i < WIDE_BVH_WIDTH; i++) {
+		float t0 = 0.f, t1 = tMax;
+		for (int axis = 0; axis < 3; axis++) {
+			float tA = (node.boundsMin[axis][i] - ray.origin[axis]) * ray.inverse[axis];
+			float tB = (node.boundsMax[axis][i] - ray.origin[axis]) * ray.inverse[axis];
+			t0 = tA < tB ? (tA > t0 ? tA : t0) : (tB > t0 ? tB : t0);
+			t1 = tA < tB ? (tB < t1 ? tB : t1) : (tA < t1 ? tA : t1);
+		}
+		tNear[i] = t0;
+		if (t0 <= t1)
+			hits |= 1u << i;
+	}
+#endif
+	// Unused child slots never count.
+	return hits & ((1u << node.childCount) - 1);
+}
+
+#endif // WIDEBVH_H